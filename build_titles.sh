@@ -0,0 +1,377 @@
+#!/bin/bash
+#
+# build_titles.sh - Batch build driver for many .dcmv titles
+# -------------------------------------------------------------
+# Converts every title in a manifest with the same steps as
+# convert_to_pvr_fmv.sh, but all titles share one pool of worker slots and
+# their stages overlap: while one title's frames go through pvrtex, the next
+# one is being extracted and another packed.
+#
+# Each title is cut into tasks:
+#   extract    ffmpeg -> PNG frames (rgb565) or raw YUV split per frame (yuv420p)
+#   convert    a batch of BATCH frames through pvrtex (plus the fallback
+#              codebook) or yuv420converter; one task per batch, so a long
+#              title spreads over every slot
+#   audio      ffmpeg -> 16-bit PCM for the packer's ADPCM encoder (or a
+#              WAV through dcaconv with USE_DCACONV=1)
+#   pack       pack_dcmv, once the title's conversions and audio are done
+#
+# A free slot takes, in order: a pack that is ready, an extraction (while
+# fewer than MAX_INFLIGHT titles are between extraction and pack, which
+# also bounds the temp space), an audio task, a convert batch. So packs
+# finish titles early and extractions keep the converters fed.
+#
+# Manifest: one title per line, '#' comments, fields shell-quoted:
+#   <name> <input> [KEY=VALUE ...]
+# KEYs override the settings below for that title: WIDTH HEIGHT FPS
+# FORMAT AUDIO_RATE CHANNELS AUDIO_BLOCK USE_DCACONV RATE_TARGET RATE_PEAK
+# RATE_WINDOW FALLBACK_CODEBOOK SCENE_CUT VF (ffmpeg video filter after the
+# fps and scale) PACK_OPTS (extra pack_dcmv options, e.g. "--loop 48").
+# The title is written to $OUT_DIR/<name>.dcmv; logs and intermediate
+# files go to $WORK_DIR/<name>/.
+#
+# Usage:
+#   ./build_titles.sh [-j <slots>] [-k] <manifest>
+#     -j  worker slots (default: one per CPU)
+#     -k  keep each title's frames and audio after packing
+#
+# At the end it prints, per title and per stage, the tasks run, the time
+# they kept slots busy and the wall time from the first one starting to
+# the last one ending, then the totals and the pool's utilization. Exits
+# with status 1 if any title failed (its log is shown, the others carry on).
+#
+# Author: Troy E. Davis (GPF) — https://github.com/GPF
+
+# Defaults - per-title overrides in the manifest
+WIDTH=256
+HEIGHT=256
+FPS=24
+FORMAT="rgb565"         # yuv420p or rgb565
+AUDIO_RATE=32000
+CHANNELS=1
+AUDIO_BLOCK=4096
+USE_DCACONV=0
+RATE_TARGET=""
+RATE_PEAK=""
+RATE_WINDOW=1.0
+FALLBACK_CODEBOOK=""
+SCENE_CUT=""
+VF="hqdn3d=1.0:1.0:6.0:6.0,smartblur=1.0:0.0"
+PACK_OPTS=""
+
+# Build
+OUT_DIR="output/titles"
+WORK_DIR="temp_titles"
+BATCH=64                # frames per convert task
+MAX_INFLIGHT=2          # titles extracted and not yet packed
+ADPCM_THREADS=1         # the pool already keeps every core busy
+
+# Tool Paths (adjust as needed)
+PVRTX="/opt/toolchains/dc/kos/utils/pvrtex/pvrtex"
+DCACONV="./dcaconv"
+PACKER="./pack_dcmv"
+YUVCONVERTER="./yuv420converter"
+FFMPEG="ffmpeg"
+FFMPEG_LOGLEVEL="warning"
+
+TITLE_KEYS=" WIDTH HEIGHT FPS FORMAT AUDIO_RATE CHANNELS AUDIO_BLOCK USE_DCACONV RATE_TARGET RATE_PEAK RATE_WINDOW FALLBACK_CODEBOOK SCENE_CUT VF PACK_OPTS "
+
+JOBS=$(nproc)
+KEEP=0
+while getopts "j:k" opt; do
+    case "$opt" in
+        j) JOBS="$OPTARG" ;;
+        k) KEEP=1 ;;
+        *) sed -n '/^# Usage:/,/^#     -k/p' "$0" | sed 's/^# \{0,1\}//'; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+MANIFEST="$1"
+if [ -z "$MANIFEST" ] || [ ! -f "$MANIFEST" ] || ! [ "$JOBS" -ge 1 ] 2>/dev/null; then
+    echo "Usage: $0 [-j <slots>] [-k] <manifest>"
+    exit 1
+fi
+
+now() {
+    echo "${EPOCHREALTIME:-$(date +%s.%N)}"
+}
+
+# Read the manifest
+NAMES=()
+INPUTS=()
+SETTINGS=()
+lineno=0
+while IFS= read -r line || [ -n "$line" ]; do
+    ((lineno++))
+    line="${line%%#*}"
+    [ -z "${line//[[:space:]]/}" ] && continue
+    eval "fields=($line)" || { echo "❌ $MANIFEST:$lineno: can't parse"; exit 1; }
+    if [ "${#fields[@]}" -lt 2 ]; then
+        echo "❌ $MANIFEST:$lineno: needs a name and an input"
+        exit 1
+    fi
+    for kv in "${fields[@]:2}"; do
+        if [[ "$kv" != *=* || "$TITLE_KEYS" != *" ${kv%%=*} "* ]]; then
+            echo "❌ $MANIFEST:$lineno: unknown setting '$kv'"
+            exit 1
+        fi
+    done
+    if [[ ! "${fields[0]}" =~ ^[A-Za-z0-9._-]+$ ]]; then
+        echo "❌ $MANIFEST:$lineno: title name '${fields[0]}' isn't a plain file name"
+        exit 1
+    fi
+    for n in "${NAMES[@]}"; do
+        [ "$n" = "${fields[0]}" ] && { echo "❌ $MANIFEST:$lineno: title '$n' twice"; exit 1; }
+    done
+    NAMES+=("${fields[0]}")
+    INPUTS+=("${fields[1]}")
+    SETTINGS+=("$(printf '%q ' "${fields[@]:2}")")
+done < "$MANIFEST"
+NUM_TITLES=${#NAMES[@]}
+if [ "$NUM_TITLES" -eq 0 ]; then
+    echo "❌ No titles in $MANIFEST"
+    exit 1
+fi
+
+mkdir -p "$OUT_DIR" "$WORK_DIR"
+TIMINGS="$WORK_DIR/timings.txt"
+: > "$TIMINGS"
+
+# Title t's settings into this shell (tasks run in their own subshell)
+load_title() {
+    local t=$1 kv
+    NAME="${NAMES[$t]}"
+    INPUT="${INPUTS[$t]}"
+    W="$WORK_DIR/$NAME"
+    eval "local kvs=(${SETTINGS[$t]})"
+    for kv in "${kvs[@]}"; do
+        [ -n "$kv" ] || continue
+        printf -v "${kv%%=*}" '%s' "${kv#*=}"
+    done
+    case "$FORMAT" in
+        rgb565) EXT="dt"; FRAME_TYPE=0 ;;
+        yuv420p) EXT="bin"; FRAME_TYPE=1 ;;
+        *) echo "❌ Unknown format: $FORMAT"; return 1 ;;
+    esac
+}
+
+stage_extract() {
+    rm -rf "$W/src" "$W/frames" "$W/fallback"
+    mkdir -p "$W/src" "$W/frames"
+    local vf="fps=$FPS,scale=$WIDTH:$HEIGHT:flags=lanczos${VF:+,$VF}"
+    local opts=(-nostdin -hide_banner -loglevel "$FFMPEG_LOGLEVEL" -y -i "$INPUT" -vf "$vf"
+                -sws_flags "+accurate_rnd+full_chroma_int+full_chroma_inp" -an)
+    if [ "$FORMAT" = "rgb565" ]; then
+        "$FFMPEG" "${opts[@]}" -pix_fmt rgb24 -start_number 0 "$W/src/frame%05d.png" || return 1
+    else
+        "$FFMPEG" "${opts[@]}" -pix_fmt yuv420p -f rawvideo "$W/src/full.yuv" || return 1
+        split -b $((WIDTH * HEIGHT * 3 / 2)) -d -a 5 "$W/src/full.yuv" "$W/src/frame" --additional-suffix=".yuv" || return 1
+        rm -f "$W/src/full.yuv"
+    fi
+    local count
+    count=$(find "$W/src" -name 'frame*' | wc -l)
+    [ "$count" -gt 0 ] || { echo "❌ No frames extracted"; return 1; }
+    echo "$count" > "$W/frame_count"
+}
+
+stage_convert() {
+    local first=$(($1 * BATCH)) count i base
+    count=$(cat "$W/frame_count")
+    [ -n "$FALLBACK_CODEBOOK" ] && mkdir -p "$W/fallback"
+    for ((i = first; i < first + BATCH && i < count; ++i)); do
+        base=$(printf "frame%05d" "$i")
+        if [ "$FORMAT" = "rgb565" ]; then
+            "$PVRTX" -i "$W/src/$base.png" -o "$W/frames/$base.$EXT" -f RGB565 -c 256 --dither 0 || return 1
+            if [ -n "$FALLBACK_CODEBOOK" ]; then
+                "$PVRTX" -i "$W/src/$base.png" -o "$W/fallback/$base.$EXT" -f RGB565 -c "$FALLBACK_CODEBOOK" --dither 0 || return 1
+            fi
+        else
+            "$YUVCONVERTER" "$W/src/$base.yuv" "$W/frames/$base.$EXT" "$WIDTH" "$HEIGHT" -q || return 1
+        fi
+    done
+}
+
+stage_audio() {
+    if [ "$USE_DCACONV" = "1" ]; then
+        "$FFMPEG" -nostdin -hide_banner -loglevel error -y -i "$INPUT" -ac "$CHANNELS" -ar "$AUDIO_RATE" -c:a pcm_s16le "$W/audio.wav" || return 1
+        "$DCACONV" --long --rate "$AUDIO_RATE" -c "$CHANNELS" -f ADPCM -i "$W/audio.wav" -o "$W/audio.dca" || return 1
+    else
+        "$FFMPEG" -nostdin -hide_banner -loglevel error -y -i "$INPUT" -ac "$CHANNELS" -ar "$AUDIO_RATE" -f s16le -c:a pcm_s16le "$W/audio.pcm" || return 1
+    fi
+}
+
+stage_pack() {
+    local opts=()
+    [ -n "$RATE_TARGET" ] && opts+=(--target-bps "$RATE_TARGET")
+    [ -n "$RATE_PEAK" ] && opts+=(--peak-bps "$RATE_PEAK")
+    [ -n "$RATE_TARGET$RATE_PEAK" ] && opts+=(--window "$RATE_WINDOW")
+    [ -n "$FALLBACK_CODEBOOK" ] && opts+=(--fallback "$W/fallback/frame%05d.$EXT")
+    [ -n "$SCENE_CUT" ] && opts+=(--scene-cut "$SCENE_CUT")
+    eval "opts+=($PACK_OPTS)"
+    if [ "$USE_DCACONV" = "1" ]; then
+        "$PACKER" "${opts[@]}" "$OUT_DIR/$NAME.dcmv" "$FRAME_TYPE" "$WIDTH" "$HEIGHT" "$FPS" "$AUDIO_RATE" "$CHANNELS" \
+            "$W/frames/frame%05d.$EXT" "$W/audio.dca" || return 1
+    else
+        "$PACKER" "${opts[@]}" --audio-block "$AUDIO_BLOCK" --adpcm-threads "$ADPCM_THREADS" \
+            "$OUT_DIR/$NAME.dcmv" "$FRAME_TYPE" "$WIDTH" "$HEIGHT" "$FPS" "$AUDIO_RATE" "$CHANNELS" \
+            "$W/frames/frame%05d.$EXT" - < "$W/audio.pcm" || return 1
+    fi
+    [ "$KEEP" = "1" ] || rm -rf "$W/src" "$W/frames" "$W/fallback" "$W/audio.pcm" "$W/audio.wav" "$W/audio.dca"
+}
+
+# Tasks report "<title> <stage> <batch> <status> <start> <end>" on this FIFO when they finish
+FIFO="$WORK_DIR/.done"
+rm -f "$FIFO"
+mkfifo "$FIFO" || exit 1
+exec 3<>"$FIFO"
+
+start_task() {
+    local t=$1 stage=$2 k=$3
+    (
+        mkdir -p "$WORK_DIR/${NAMES[$t]}/logs"
+        log="$WORK_DIR/${NAMES[$t]}/logs/$stage${k:+-$k}.log"
+        t0=$(now)
+        if load_title "$t" > "$log" 2>&1; then
+            "stage_$stage" "$k" >> "$log" 2>&1
+            rc=$?
+        else
+            rc=1
+        fi
+        echo "$t $stage ${k:--} $rc $t0 $(now)" >&3
+    ) < /dev/null &
+    RUNNING=$((RUNNING + 1))
+}
+
+# Per-title progress: 0 = waiting, 1 = extracting, 2 = converting, 3 = packing, 4 = done, 5 = failed
+STATE=()
+BATCHES=()          # convert batches, known once extracted
+NEXT_BATCH=()       # next one to start
+BATCHES_DONE=()
+AUDIO=()            # 0 = not started, 1 = running, 2 = done
+for ((t = 0; t < NUM_TITLES; ++t)); do
+    STATE[t]=0; BATCHES[t]=0; NEXT_BATCH[t]=0; BATCHES_DONE[t]=0; AUDIO[t]=0
+done
+RUNNING=0
+FAILED=0
+
+# Start the best ready task; 1 if nothing is ready
+schedule_one() {
+    local t inflight=0
+    for ((t = 0; t < NUM_TITLES; ++t)); do
+        if [ "${STATE[t]}" = 2 ] && [ "${BATCHES_DONE[t]}" = "${BATCHES[t]}" ] && [ "${AUDIO[t]}" = 2 ]; then
+            STATE[t]=3
+            start_task "$t" pack
+            return 0
+        fi
+        [ "${STATE[t]}" -ge 1 ] && [ "${STATE[t]}" -le 3 ] && inflight=$((inflight + 1))
+    done
+    if [ "$inflight" -lt "$MAX_INFLIGHT" ]; then
+        for ((t = 0; t < NUM_TITLES; ++t)); do
+            if [ "${STATE[t]}" = 0 ]; then
+                STATE[t]=1
+                echo "🖼️ ${NAMES[t]}: extracting frames"
+                start_task "$t" extract
+                return 0
+            fi
+        done
+    fi
+    for ((t = 0; t < NUM_TITLES; ++t)); do
+        if [ "${STATE[t]}" -ge 1 ] && [ "${STATE[t]}" -le 2 ] && [ "${AUDIO[t]}" = 0 ]; then
+            AUDIO[t]=1
+            start_task "$t" audio
+            return 0
+        fi
+    done
+    for ((t = 0; t < NUM_TITLES; ++t)); do
+        if [ "${STATE[t]}" = 2 ] && [ "${NEXT_BATCH[t]}" -lt "${BATCHES[t]}" ]; then
+            start_task "$t" convert "${NEXT_BATCH[t]}"
+            NEXT_BATCH[t]=$((NEXT_BATCH[t] + 1))
+            return 0
+        fi
+    done
+    return 1
+}
+
+fail_title() {
+    local t=$1 log=$2
+    [ "${STATE[t]}" = 5 ] && return
+    STATE[t]=5
+    FAILED=$((FAILED + 1))
+    echo "❌ ${NAMES[t]}: failed, last lines of $log:"
+    tail -n 5 "$log" | sed 's/^/   /'
+}
+
+BUILD_START=$(now)
+echo "🏗️ Building $NUM_TITLES title(s) from $MANIFEST on $JOBS slot(s)"
+while :; do
+    while [ "$RUNNING" -lt "$JOBS" ] && schedule_one; do :; done
+    [ "$RUNNING" -eq 0 ] && break
+
+    read -r t stage k rc t0 t1 <&3
+    RUNNING=$((RUNNING - 1))
+    echo "$t $stage $k $rc $t0 $t1" >> "$TIMINGS"
+    log="$WORK_DIR/${NAMES[t]}/logs/$stage$([ "$k" != - ] && echo "-$k").log"
+    if [ "$rc" != 0 ]; then
+        fail_title "$t" "$log"
+        continue
+    fi
+    [ "${STATE[t]}" = 5 ] && continue
+    case "$stage" in
+        extract)
+            count=$(cat "$WORK_DIR/${NAMES[t]}/frame_count")
+            BATCHES[t]=$(((count + BATCH - 1) / BATCH))
+            STATE[t]=2
+            echo "🎞️ ${NAMES[t]}: $count frames, converting in ${BATCHES[t]} batch(es)"
+            ;;
+        convert) BATCHES_DONE[t]=$((BATCHES_DONE[t] + 1)) ;;
+        audio) AUDIO[t]=2 ;;
+        pack)
+            STATE[t]=4
+            echo "✅ ${NAMES[t]}: $OUT_DIR/${NAMES[t]}.dcmv ($(du -h "$OUT_DIR/${NAMES[t]}.dcmv" | cut -f1))"
+            ;;
+    esac
+done
+BUILD_END=$(now)
+exec 3<&-
+rm -f "$FIFO"
+
+# Per-stage timing: busy = summed task time, span = first start to last end
+echo "⏱️ Stage timing (busy = time the tasks held slots, span = first start to last end):"
+awk -v jobs="$JOBS" -v t0="$BUILD_START" -v t1="$BUILD_END" -v names="${NAMES[*]}" '
+    BEGIN { split(names, name, " "); nst = split("extract convert audio pack", st, " ") }
+    {
+        key = $1 SUBSEP $2
+        n[key]++; busy[key] += $6 - $5
+        if (!(key in first) || $5 < first[key]) first[key] = $5
+        if (!(key in last) || $6 > last[key]) last[key] = $6
+        sn[$2]++; sbusy[$2] += $6 - $5
+        if (!($2 in sfirst) || $5 < sfirst[$2]) sfirst[$2] = $5
+        if (!($2 in slast) || $6 > slast[$2]) slast[$2] = $6
+        if (!($1 in tfirst) || $5 < tfirst[$1]) tfirst[$1] = $5
+        if (!($1 in tlast) || $6 > tlast[$1]) tlast[$1] = $6
+        total += $6 - $5
+    }
+    END {
+        printf "   %-20s %-8s %6s %10s %10s\n", "title", "stage", "tasks", "busy s", "span s"
+        for (t = 0; t < length(name); ++t) {
+            if (!(t in tfirst)) continue
+            for (s = 1; s <= nst; ++s) {
+                key = t SUBSEP st[s]
+                if (key in n)
+                    printf "   %-20s %-8s %6d %10.1f %10.1f\n", name[t + 1], st[s], n[key], busy[key], last[key] - first[key]
+            }
+            printf "   %-20s %-8s %6s %10s %10.1f\n", name[t + 1], "total", "", "", tlast[t] - tfirst[t]
+        }
+        for (s = 1; s <= nst; ++s)
+            if (st[s] in sn)
+                printf "   %-20s %-8s %6d %10.1f %10.1f\n", "(all)", st[s], sn[st[s]], sbusy[st[s]], slast[st[s]] - sfirst[st[s]]
+        wall = t1 - t0
+        printf "🕒 Total wall time %.1f s, %.1f s of tasks on %d slot(s): %.0f%% utilization\n",
+               wall, total, jobs, (wall > 0 ? 100 * total / (wall * jobs) : 0)
+    }' "$TIMINGS"
+
+if [ "$FAILED" -gt 0 ]; then
+    echo "❌ $FAILED of $NUM_TITLES title(s) failed"
+    exit 1
+fi
+echo "✅ All $NUM_TITLES title(s) built in $OUT_DIR"
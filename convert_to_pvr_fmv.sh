@@ -8,12 +8,13 @@
 # Steps performed:
 # 1. Extract RGB frames from input video using `ffmpeg`
 # 2. Convert each frame to RGB565 and encode into VQ-compressed PVR textures using `pvrtex`
-# 3. Extract and encode audio to Dreamcast ADPCM format using `dcaconv`
-# 4. Package the VQ textures and audio into a `.dcmv` container using `pack_dcmv`
+# 3. Package the VQ textures into a `.dcmv` container using `pack_dcmv`, with
+#    ffmpeg piping PCM straight into the packer's built-in ADPCM encoder
+#    (set USE_DCACONV=1 to encode with `dcaconv` via a temp WAV instead)
 #
 # Requirements:
 # - ffmpeg (for video and audio extraction)
-# - dcaconv (TapamN’s Dreamcast ADPCM encoder: https://github.com/TapamN/dcaconv)
+# - dcaconv (optional, TapamN’s Dreamcast ADPCM encoder: https://github.com/TapamN/dcaconv)
 # - pvrtex (KOS utility for RGB565 VQ texture generation)
 # - pack_dcmv (custom LZ4-based video+audio packer)
 #
@@ -29,12 +30,21 @@
 INPUT="/home/gpf/code/dreamcast/DirkSimple/lair.ogv"
 OUTPUT_DIR="output"
 TEMP_DIR="temp_frames"
-FPS=24
+FPS=24           # 30000/1001 or 29.97 for NTSC material, stored exactly
 WIDTH=256
 HEIGHT=256
 AUDIO_RATE=32000
 CHANNELS=1
 FORMAT="rgb565"  # yuv420p or rgb565
+AUDIO_BLOCK=4096 # ADPCM bytes per channel per stream block (stereo layout)
+USE_DCACONV=0    # 1 = legacy dcaconv + temp WAV path
+
+# Rate control (bytes/sec for video + audio, empty = unlimited)
+RATE_TARGET=""          # e.g. 600000
+RATE_PEAK=""            # e.g. 1000000 (keep under the drive's sustained rate)
+RATE_WINDOW=1.0         # sliding window in seconds
+FALLBACK_CODEBOOK=""    # e.g. 64: extra rgb565 encode used when a frame blows the budget
+SCENE_CUT=""            # e.g. 0.3: scene cut threshold for chapter seeking (0 = off, empty = packer default)
 
 # Tool Paths (adjust as needed)
 PVRTX="/opt/toolchains/dc/kos/utils/pvrtex/pvrtex"
@@ -44,6 +54,7 @@ YUVCONVERTER="./yuv420converter"
 
 # Performance Optimization
 THREADS=$(nproc)                # Auto-detect CPU cores
+ADPCM_THREADS=$THREADS          # Built-in ADPCM encoder threads
 FFMPEG_LOGLEVEL="warning"       # error/warning/info
 PVRTX_QUIET=">/dev/null 2>&1"   # Suppress pvrtex output
 
@@ -70,6 +81,12 @@ PVRTX_OPTS=(
   -c 256
   --dither 0
 )
+
+PACKER_OPTS=()
+[ -n "$RATE_TARGET" ] && PACKER_OPTS+=(--target-bps "$RATE_TARGET")
+[ -n "$RATE_PEAK" ] && PACKER_OPTS+=(--peak-bps "$RATE_PEAK")
+[ -n "$RATE_TARGET$RATE_PEAK" ] && PACKER_OPTS+=(--window "$RATE_WINDOW")
+[ -n "$SCENE_CUT" ] && PACKER_OPTS+=(--scene-cut "$SCENE_CUT")
 # Setup directories
 mkdir -p "$OUTPUT_DIR" "$TEMP_DIR"
 echo "📂 Created directories: $OUTPUT_DIR, $TEMP_DIR"
@@ -80,6 +97,9 @@ process_rgb565() {
     
     if compgen -G "$OUTPUT_DIR/frame*.${EXT}" >/dev/null; then
         echo "✅ Found preconverted .${EXT} frames, skipping frame extraction and conversion."
+        if [ -n "$FALLBACK_CODEBOOK" ] && compgen -G "$OUTPUT_DIR/cb${FALLBACK_CODEBOOK}/frame*.${EXT}" >/dev/null; then
+            PACKER_OPTS+=(--fallback "$OUTPUT_DIR/cb${FALLBACK_CODEBOOK}/frame%05d.${EXT}")
+        fi
         return 0
     fi
 
@@ -104,6 +124,24 @@ process_rgb565() {
             ((frame_idx++))
         done
     fi
+
+    # Cheaper encode of the same frames for the packer's rate controller
+    if [ -n "$FALLBACK_CODEBOOK" ]; then
+        local FB_DIR="$OUTPUT_DIR/cb${FALLBACK_CODEBOOK}"
+        mkdir -p "$FB_DIR"
+        echo "🎞️ Converting fallback frames with a ${FALLBACK_CODEBOOK}-entry codebook..."
+        local FB_OPTS=(-f RGB565 -c "$FALLBACK_CODEBOOK" --dither 0)
+        if command -v parallel >/dev/null; then
+            find "$TEMP_DIR" -name 'frame*.png' -print0 | \
+                parallel -0 -j "$THREADS" --bar \
+                "$PVRTX -i {} -o $FB_DIR/{/.}.$EXT ${FB_OPTS[*]} $PVRTX_QUIET"
+        else
+            for png in "$TEMP_DIR"/frame*.png; do
+                $PVRTX -i "$png" -o "$FB_DIR/$(basename "${png%.png}").${EXT}" "${FB_OPTS[@]}" $PVRTX_QUIET || exit 1
+            done
+        fi
+        PACKER_OPTS+=(--fallback "$FB_DIR/frame%05d.${EXT}")
+    fi
 }
 
 process_yuv420p() {
@@ -144,22 +182,29 @@ esac
 TOTAL_FRAMES=$frame_idx
 echo "✅ Converted $TOTAL_FRAMES frames."
 
-# Extract and convert audio
-echo "🔊 Extracting and converting audio to ADPCM (channels=${CHANNELS}, rate=${AUDIO_RATE})..."
-ffmpeg -hide_banner -loglevel error -i "$INPUT" -ac "$CHANNELS" -ar "$AUDIO_RATE" -c:a pcm_s16le -y "$TEMP_DIR/temp.wav"
-"$DCACONV" --long --rate "$AUDIO_RATE" -c "$CHANNELS" -f ADPCM \
-  -i "$TEMP_DIR/temp.wav" -o "$TEMP_DIR/audio.dca" || exit 1
-
 # Pack video frames + audio into compressed .dcmv format
-echo "📦 Packing into compressed .dcmv format..."
-"$PACKER" "./playdcmv/movie.dcmv" "$FRAME_TYPE" "$WIDTH" "$HEIGHT" "$FPS" "$AUDIO_RATE" "$CHANNELS" \
-  "$OUTPUT_DIR/frame%05d.${EXT}" "$TEMP_DIR/audio.dca" || exit 1
+if [ "$USE_DCACONV" = "1" ]; then
+    echo "🔊 Extracting and converting audio to ADPCM with dcaconv (channels=${CHANNELS}, rate=${AUDIO_RATE})..."
+    ffmpeg -hide_banner -loglevel error -i "$INPUT" -ac "$CHANNELS" -ar "$AUDIO_RATE" -c:a pcm_s16le -y "$TEMP_DIR/temp.wav"
+    "$DCACONV" --long --rate "$AUDIO_RATE" -c "$CHANNELS" -f ADPCM \
+      -i "$TEMP_DIR/temp.wav" -o "$TEMP_DIR/audio.dca" || exit 1
+
+    echo "📦 Packing into compressed .dcmv format..."
+    "$PACKER" "${PACKER_OPTS[@]}" "./playdcmv/movie.dcmv" "$FRAME_TYPE" "$WIDTH" "$HEIGHT" "$FPS" "$AUDIO_RATE" "$CHANNELS" \
+      "$OUTPUT_DIR/frame%05d.${EXT}" "$TEMP_DIR/audio.dca" || exit 1
+else
+    echo "📦 Packing into compressed .dcmv format, encoding ADPCM from PCM (channels=${CHANNELS}, rate=${AUDIO_RATE})..."
+    ffmpeg -hide_banner -loglevel error -i "$INPUT" -ac "$CHANNELS" -ar "$AUDIO_RATE" -f s16le -c:a pcm_s16le - | \
+    "$PACKER" "${PACKER_OPTS[@]}" --audio-block "$AUDIO_BLOCK" --adpcm-threads "$ADPCM_THREADS" \
+      "./playdcmv/movie.dcmv" "$FRAME_TYPE" "$WIDTH" "$HEIGHT" "$FPS" "$AUDIO_RATE" "$CHANNELS" \
+      "$OUTPUT_DIR/frame%05d.${EXT}" - || exit 1
+fi
 
 # Clean up intermediate files
 # echo "🧹 Cleaning up temporary files..."
 # rm -rf "$OUTPUT_DIR"
 # rm -rf "$TEMP_DIR"
 
-echo "✅ Final .dcmv + audio.dca created:"
+echo "✅ Final .dcmv created:"
 ls -lh ./playdcmv/movie.dcmv
 
@@ -0,0 +1,89 @@
+/*
+ * dcmv_adpcm.h
+ * ---------------------
+ * AICA (Yamaha) 4-bit ADPCM codec shared by pack_dcmv and the host tools.
+ *
+ * Each nibble is a sign bit plus a 3-bit magnitude. The decoder keeps a
+ * running signal and an adaptive step size, exactly like the AICA does when
+ * a channel plays ADPCM:
+ *
+ *   signal += step * diff[n] / 8          (clamped to int16)
+ *   step    = step * scale[n & 7] >> 8    (clamped to 127..24576)
+ *
+ * The AICA starts every channel at signal 0, step 127. Two samples per byte,
+ * low nibble first.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DCMV_ADPCM_STEP_MIN  127
+#define DCMV_ADPCM_STEP_MAX  24576
+
+typedef struct {
+    int32_t signal;
+    int32_t step;
+} dcmv_adpcm_state_t;
+
+static const int32_t dcmv_adpcm_diff[16] = {
+    1, 3, 5, 7, 9, 11, 13, 15,
+    -1, -3, -5, -7, -9, -11, -13, -15,
+};
+
+static const int32_t dcmv_adpcm_scale[8] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+};
+
+static inline void dcmv_adpcm_init(dcmv_adpcm_state_t *s) {
+    s->signal = 0;
+    s->step = DCMV_ADPCM_STEP_MIN;
+}
+
+static inline int16_t dcmv_adpcm_decode_nibble(dcmv_adpcm_state_t *s, int nibble) {
+    int32_t signal = s->signal + s->step * dcmv_adpcm_diff[nibble] / 8;
+    if (signal > 32767) signal = 32767;
+    else if (signal < -32768) signal = -32768;
+
+    int32_t step = (s->step * dcmv_adpcm_scale[nibble & 7]) >> 8;
+    if (step < DCMV_ADPCM_STEP_MIN) step = DCMV_ADPCM_STEP_MIN;
+    else if (step > DCMV_ADPCM_STEP_MAX) step = DCMV_ADPCM_STEP_MAX;
+
+    s->signal = signal;
+    s->step = step;
+    return (int16_t)signal;
+}
+
+static inline int dcmv_adpcm_encode_sample(dcmv_adpcm_state_t *s, int16_t sample) {
+    int32_t delta = sample - s->signal;
+    int nibble = 0;
+    if (delta < 0) {
+        nibble = 8;
+        delta = -delta;
+    }
+    int32_t q = (delta << 2) / s->step;
+    nibble |= q > 7 ? 7 : q;
+
+    // Track exactly what the decoder will reconstruct
+    dcmv_adpcm_decode_nibble(s, nibble);
+    return nibble;
+}
+
+/* Encode n samples (n even) read every `stride` int16s into n / 2 bytes */
+static inline void dcmv_adpcm_encode(dcmv_adpcm_state_t *s, const int16_t *pcm, size_t n,
+                                     size_t stride, uint8_t *out) {
+    for (size_t i = 0; i < n; i += 2) {
+        int lo = dcmv_adpcm_encode_sample(s, pcm[i * stride]);
+        int hi = dcmv_adpcm_encode_sample(s, pcm[(i + 1) * stride]);
+        out[i / 2] = (uint8_t)(lo | (hi << 4));
+    }
+}
+
+/* Decode n / 2 bytes into n samples */
+static inline void dcmv_adpcm_decode(dcmv_adpcm_state_t *s, const uint8_t *in, size_t n, int16_t *out) {
+    for (size_t i = 0; i < n; i += 2) {
+        out[i] = dcmv_adpcm_decode_nibble(s, in[i / 2] & 0x0F);
+        out[i + 1] = dcmv_adpcm_decode_nibble(s, in[i / 2] >> 4);
+    }
+}
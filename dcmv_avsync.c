@@ -0,0 +1,470 @@
+/*
+ * dcmv_avsync.c
+ * ---------------------
+ * A/V sync simulator for fmv_play.
+ *
+ * Runs the player's timing logic (playdcmv/av_sync.h, the same code the
+ * player calls) against simulated clocks for hours of virtual playback, and
+ * checks the result against fixed bounds, so drift that only shows up late
+ * in a long title can be caught on the host in a second.
+ *
+ * Model:
+ *   - AICA: the timer ticks 4410 times a second and audio plays at the rate
+ *     the AICA pitch registers can actually represent. Both run off the same
+ *     crystal, which is the time base of the simulation.
+ *   - SH-4: sleeps and decode times run on a clock that is off by --sh4-ppm
+ *     (199.5 vs 200 MHz by default), sleeps round up to --sleep-quantum-ms.
+ *   - Audio: snd_stream_start prefills the buffer, then the poll thread tops
+ *     it up every --poll-ms (same refill model as dcmv_gdsim). Returned ADPCM
+ *     bytes go through the player's sample accounting.
+ *   - Video: the main loop asks av_sync_next() what to do (av_sync_next_at
+ *     with --pts, from 90 kHz timestamps as pack_dcmv --pts stores them,
+ *     av_sync_next at the header's rounded rate with --rounded-fps, as
+ *     players before v6 headers did). It wakes on every vblank, skips drops
+ *     without waiting and decodes the next frame while it waits, so a frame
+ *     decoded ahead only costs --upload-ms; one that isn't costs
+ *     --decode-ms +/- --jitter-ms (deterministic, --seed), which includes the
+ *     upload. With --pacing sleep it sleeps the time av_sync asks for instead
+ *     and decodes nothing ahead, as players before vblank pacing did. Then
+ *     the PVR: the scene can't begin until the previous one has flipped, and
+ *     a scene becomes visible on the first vblank after it has rendered.
+ *
+ * Measured per run:
+ *   - Drift: audio position when a frame becomes visible minus the frame's
+ *     timestamp in the source, frame * fps_den / fps_num (positive = video
+ *     late)
+ *   - Trend: least-squares slope of the drift over the run, times its length
+ *   - Dropped frames and audio underruns
+ *   - Jitter: each interval between two frames becoming visible minus the
+ *     interval between their due times (av_jitter_t, as the player reports
+ *     it), rms and largest
+ *   - With --loop-start/--loop-end, how far apart the audio and video are
+ *     within the clip (the player's wrap points, av_loop_*) over all passes
+ *
+ * Dropped frames are allowed only where the display can't keep up, i.e.
+ * (fps - vblank rate) * duration when the video is faster than the display.
+ * A looping clip's audio may be off its video by the rounding of the wrap
+ * points to even samples (AV_LOOP_MAX_OFFSET), never more.
+ *
+ * By default every combination of 15/23.976/24/25/29.97/30/59.94/60 fps,
+ * 22050/32000/44100 Hz and mono/stereo is run for two virtual hours. Exits with status 2 if any
+ * run is outside the bounds.
+ *
+ * Usage:
+ *   dcmv_avsync [options]
+ *
+ * Build:
+ *   gcc -O2 dcmv_avsync.c -o dcmv_avsync -lm
+ *
+ * Author: Troy Davis (gpf)
+ * GitHub: https://github.com/GPF
+ * License: Public Domain / MIT-style — use freely with attribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "dcmv_format.h"
+#include "playdcmv/av_sync.h"
+
+#define MAX_MATRIX 8
+#define PTS_TIMESCALE 90000     // as pack_dcmv --pts
+#define AV_LOOP_MAX_OFFSET 2    // samples: both loop ends round down to an even sample
+
+typedef struct {
+    double hours;
+    double decode;          // per-frame decode + upload, sec
+    double upload;          // upload alone, for a frame decoded ahead, sec
+    double jitter;          // +/- uniform on top of decode, sec
+    double render;          // PVR render time, sec
+    double vblank_hz;
+    double sh4_ppm;         // SH-4 clock error relative to the AICA
+    double sleep_quantum;   // scheduler wakeup granularity, sec
+    double poll;            // audio poll period, sec
+    uint32_t audio_buf;     // stream buffer per channel, bytes
+    uint32_t start_frame;
+    uint32_t seed;
+    uint32_t lead_ms;
+    av_loop_t loop;         // end = 0: play straight through
+    int nominal_clock;      // take the AICA rate at face value (the old assumption)
+    int rounded_fps;        // play at the whole-number rate a v5 header holds
+    int pts;                // schedule from per-frame timestamps
+    int sleep_paced;        // sleep between frames instead of waking on vblanks
+} sim_model_t;
+
+typedef struct {
+    uint32_t num, den;
+} fps_t;
+
+typedef struct {
+    double max_drift;       // largest |drift|, sec
+    double mean_drift;
+    double trend;           // fitted drift change over the run, sec
+    uint32_t presented;
+    uint32_t dropped;
+    uint32_t underruns;
+    double jitter_rms;      // sec
+    double jitter_max;
+    uint32_t loop_passes;
+    int32_t loop_offset;    // largest |audio - video| position within the clip, samples
+} sim_result_t;
+
+static uint32_t rng_next(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+/* SH-4 duration -> AICA time */
+static double sh4_time(const sim_model_t *m, double d) {
+    return d / (1.0 + m->sh4_ppm / 1e6);
+}
+
+static double sleep_until(const sim_model_t *m, double t, uint32_t ms) {
+    double wake = t + sh4_time(m, ms / 1000.0);
+    if (m->sleep_quantum > 0)
+        wake = ceil(wake / m->sleep_quantum) * m->sleep_quantum;
+    return wake;
+}
+
+/* Decode time of one frame, with the upload or without it (decoding ahead) */
+static double frame_cost(const sim_model_t *m, uint32_t *seed, int with_upload) {
+    double cost = m->decode + m->jitter * ((rng_next(seed) & 0xFFFF) / 32768.0 - 1.0);
+    if (!with_upload)
+        cost -= m->upload;
+    return cost > 0 ? cost : 0;
+}
+
+/* Timestamp of frame i in PTS_TIMESCALE ticks */
+static uint32_t frame_pts(fps_t fps, uint32_t i) {
+    return (uint32_t)(((uint64_t)i * PTS_TIMESCALE * fps.den + fps.num / 2) / fps.num);
+}
+
+static void simulate(const sim_model_t *m, fps_t fps, uint32_t rate, int channels, sim_result_t *r) {
+    memset(r, 0, sizeof(*r));
+    double source_fps = (double)fps.num / fps.den;
+    uint32_t num_frames = (uint32_t)(m->hours * 3600.0 * source_fps);
+    uint64_t total_samples = av_frame_sample(&(av_sync_t){ .fps_num = fps.num, .fps_den = fps.den, .sample_rate = rate },
+                                             num_frames);
+
+    // What the player times frames by
+    fps_t play = fps;
+    if (m->rounded_fps)
+        play = (fps_t){ (fps.num + fps.den / 2) / fps.den, 1 };
+
+    // What the AICA really plays
+    uint32_t base, lo;
+    av_aica_pitch(rate, &base, &lo);
+    double play_rate = (double)base * lo / 1024.0;
+
+    // Start as fmv_play does: seek the audio, start the stream, then sample the timer
+    uint32_t frame = m->start_frame;
+    uint32_t start_sample = m->pts ? (uint32_t)((uint64_t)frame_pts(fps, frame) * rate / PTS_TIMESCALE) & ~1u :
+        (uint32_t)av_frame_sample(&(av_sync_t){ .fps_num = play.num, .fps_den = play.den, .sample_rate = rate }, frame) & ~1u;
+    const uint32_t jiffies0 = 0x12345678;   // the timer has been running since boot
+    double t0 = 0.0;
+
+    uint32_t buf_samples = m->audio_buf * 2;
+    uint32_t samples_fed = buf_samples;
+    double next_poll = t0 + sh4_time(m, m->poll);
+
+    av_sync_t av;
+    av_sync_init(&av, play.num, play.den, rate, start_sample, jiffies0, m->lead_ms);
+    if (m->pts)
+        av_sync_use_pts(&av, PTS_TIMESCALE);
+    if (!m->sleep_paced)
+        av_sync_set_slack(&av, AV_SYNC_VBLANK_SLACK_MS);
+    if (m->nominal_clock) {
+        av.pitch_base = rate;
+        av.pitch_lo = 1024;
+    }
+
+    uint32_t seed = m->seed ? m->seed : 1;
+    double t = t0;
+    double last_flip = t0;
+    double vblank = 1.0 / m->vblank_hz;
+    uint32_t refresh_us = (uint32_t)(vblank * 1e6 + 0.5);
+    uint64_t vb_next = 0;       // vblank pacing: index of the vblank the loop waits for
+    uint32_t ahead = 0;         // frame decoded ahead, 0 = none (frame 0 is never presented)
+    int action = AV_WAIT;
+    av_jitter_t jit;
+    av_jitter_reset(&jit);
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    double run_len = (num_frames - frame) / source_fps;
+    uint32_t loop_pass = 0;
+
+    frame++;    // fmv_play starts on the frame after the seek target
+    while (frame < num_frames) {
+        // wait_vblank: returns at once if one went by while the last frame was presented
+        if (!m->sleep_paced && action != AV_DROP) {
+            double at = t0 + vb_next * vblank;
+            if (t < at) t = at;
+            vb_next = (uint64_t)floor((t - t0) / vblank + 1e-9) + 1;
+        }
+
+        // The poll thread runs whenever it's due
+        while (next_poll <= t) {
+            double played = (next_poll - t0) * play_rate;
+            if (played > samples_fed) r->underruns++;
+            double level = samples_fed - played;
+            if (level < 0) level = 0;
+            uint32_t free_bytes = ((uint32_t)(buf_samples - level) / 2) & ~31u;
+            uint64_t left = total_samples - start_sample - samples_fed;
+            if (free_bytes * 2ull > left) free_bytes = (uint32_t)(left / 2);
+            samples_fed += av_adpcm_samples(free_bytes * channels, channels);
+            next_poll += sh4_time(m, m->poll);
+        }
+
+        uint32_t jiffies = jiffies0 + (uint32_t)((t - t0) * AV_AICA_JIFFIES_PER_SEC);
+        uint64_t clock = av_sync_clock(&av, jiffies, samples_fed);
+        uint32_t sleep_ms = 0;
+        uint64_t due = m->pts ? av_pts_due(&av, frame_pts(fps, frame)) : av_frame_due(&av, frame);
+        uint64_t due_next = m->pts ? av_pts_due(&av, frame_pts(fps, frame + 1)) : av_frame_due(&av, frame + 1);
+        action = av_sync_next_at(&av, clock, due, due_next, &sleep_ms);
+
+        if (action == AV_WAIT) {
+            if (m->sleep_paced) {
+                t = sleep_until(m, t, sleep_ms);
+            } else if (ahead != frame) {
+                t += sh4_time(m, frame_cost(m, &seed, 0));     // decode_ahead
+                ahead = frame;
+            }
+            continue;
+        }
+        if (action == AV_DROP) {
+            r->dropped++;
+            frame++;
+            continue;
+        }
+
+        // present_frame: decode (unless decoded ahead) and upload
+        t += sh4_time(m, !m->sleep_paced && ahead == frame ? m->upload : frame_cost(m, &seed, 1));
+        if (t < last_flip) t = last_flip;           // pvr_scene_begin waits for the flip
+        double ready = t + m->render;
+        double visible = ceil((ready - t0) / vblank) * vblank + t0;
+        last_flip = visible;
+        if (!m->sleep_paced && frame + 1 < num_frames) {
+            t += sh4_time(m, frame_cost(m, &seed, 0));         // decode_ahead while the PVR renders
+            ahead = frame + 1;
+        }
+        av_jitter_add(&jit, (uint64_t)((visible - t0) * 1e6 + 0.5), av_due_us(&av, due), refresh_us);
+
+        double heard = start_sample + (visible - t0) * play_rate;
+        double drift = heard / rate - frame / source_fps;
+        double elapsed = visible - t0;
+        if (fabs(drift) > r->max_drift) r->max_drift = fabs(drift);
+        sx += elapsed;
+        sy += drift;
+        sxx += elapsed * elapsed;
+        sxy += elapsed * drift;
+        r->presented++;
+
+        // Track position the audio is at when this frame is due vs the frame's own
+        if (m->loop.end) {
+            uint64_t due = av_frame_sample(&av, frame);
+            while (due >= av_loop_wrap(&av, &m->loop, loop_pass))
+                loop_pass++;
+            int64_t off = (int64_t)av_loop_sample(&av, &m->loop, loop_pass, due) -
+                          (int64_t)av_frame_sample(&av, av_loop_frame(&m->loop, frame));
+            if (off < 0) off = -off;
+            if (off > r->loop_offset) r->loop_offset = (int32_t)off;
+            r->loop_passes = loop_pass;
+        }
+        frame++;
+    }
+
+    r->jitter_rms = sqrt((double)av_jitter_mean_sq(&jit)) / 1e6;
+    r->jitter_max = jit.max / 1e6;
+
+    double n = r->presented;
+    if (n > 1) {
+        r->mean_drift = sy / n;
+        double den = n * sxx - sx * sx;
+        if (den > 0) r->trend = (n * sxy - sx * sy) / den * run_len;
+    }
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("Matrix (repeat to pick several, default all):\n");
+    printf("  --fps <n>             Video frame rate (15 23.976 24 25 29.97 30 59.94 60, or 30000/1001)\n");
+    printf("  --rate <hz>           Audio sample rate (22050 32000 44100)\n");
+    printf("  --channels <n>        1 or 2\n");
+    printf("  --hours <h>           Virtual run length (default 2)\n");
+    printf("  --start-frame <n>     Start mid-stream like a seek (default 0)\n");
+    printf("  --loop-start <n>      Loop the clip from this frame (with --loop-end)\n");
+    printf("  --loop-end <n>        Frame after the last one of the loop\n");
+    printf("Player model:\n");
+    printf("  --decode-ms <ms>      Decode + upload time per frame (default 8)\n");
+    printf("  --jitter-ms <ms>      +/- variation on the decode time (default 4)\n");
+    printf("  --upload-ms <ms>      Upload alone, part of --decode-ms (default 2)\n");
+    printf("  --pacing <vblank|sleep>  Wake on every vblank (default), or sleep as older players did\n");
+    printf("  --render-ms <ms>      PVR render time (default 3)\n");
+    printf("  --vblank-hz <hz>      Display refresh (default 59.94, exactly 60000/1001)\n");
+    printf("  --sh4-ppm <ppm>       SH-4 clock error vs the AICA (default -2500)\n");
+    printf("  --sleep-quantum-ms <ms>  Sleep wakeup granularity (default 1)\n");
+    printf("  --poll-ms <ms>        Audio poll period (default 20)\n");
+    printf("  --audio-buf <bytes>   Stream buffer per channel (default 8192)\n");
+    printf("  --seed <n>            Decode jitter seed (default 1)\n");
+    printf("  --lead-ms <ms>        Presentation lead (default %d, as fmv_play.c)\n", AV_SYNC_LEAD_MS);
+    printf("  --nominal-clock       Assume the AICA plays the nominal rate\n");
+    printf("  --rounded-fps         Time frames by the whole-number fps of a v5 header\n");
+    printf("  --pts                 Time frames by 90 kHz per-frame timestamps (PTS chunk)\n");
+    printf("Bounds:\n");
+    printf("  --max-drift-ms <ms>   Largest |drift| (default one frame + one vblank + 5)\n");
+    printf("  --max-trend-ms <ms>   Drift change over the run (default 2)\n");
+    printf("  --max-drops <n>       Drops allowed beyond what the display forces (default 0)\n");
+    printf("Output:\n");
+    printf("  --csv <file>          One line per run\n");
+}
+
+int main(int argc, char **argv) {
+    static const fps_t all_fps[] = {
+        { 15, 1 }, { 24000, 1001 }, { 24, 1 }, { 25, 1 }, { 30000, 1001 }, { 30, 1 }, { 60000, 1001 }, { 60, 1 },
+    };
+    static const uint32_t all_rates[] = { 22050, 32000, 44100 };
+    static const uint32_t all_channels[] = { 1, 2 };
+
+    sim_model_t m = {
+        .hours = 2.0, .decode = 0.008, .upload = 0.002, .jitter = 0.004, .render = 0.003, .vblank_hz = 60000.0 / 1001,
+        .sh4_ppm = -2500, .sleep_quantum = 0.001, .poll = 0.020, .audio_buf = 8192, .seed = 1,
+        .lead_ms = AV_SYNC_LEAD_MS,
+    };
+    fps_t fps_list[MAX_MATRIX];
+    uint32_t rate_list[MAX_MATRIX], ch_list[MAX_MATRIX];
+    int n_fps = 0, n_rates = 0, n_ch = 0;
+    double max_drift_ms = -1, max_trend_ms = 2.0;
+    uint32_t max_drops = 0;
+    const char *csv_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *opt = argv[i];
+        if (!strcmp(opt, "--nominal-clock")) {
+            m.nominal_clock = 1;
+            continue;
+        }
+        if (!strcmp(opt, "--rounded-fps")) {
+            m.rounded_fps = 1;
+            continue;
+        }
+        if (!strcmp(opt, "--pts")) {
+            m.pts = 1;
+            continue;
+        }
+        if (strncmp(opt, "--", 2) != 0 || i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        double v = atof(argv[++i]);
+        if (!strcmp(opt, "--fps") && n_fps < MAX_MATRIX) {
+            if (dcmv_parse_fps(argv[i], &fps_list[n_fps].num, &fps_list[n_fps].den) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            n_fps++;
+        } else if (!strcmp(opt, "--rate") && n_rates < MAX_MATRIX) rate_list[n_rates++] = (uint32_t)v;
+        else if (!strcmp(opt, "--channels") && n_ch < MAX_MATRIX) ch_list[n_ch++] = (uint32_t)v;
+        else if (!strcmp(opt, "--hours")) m.hours = v;
+        else if (!strcmp(opt, "--start-frame")) m.start_frame = (uint32_t)v;
+        else if (!strcmp(opt, "--loop-start")) m.loop.start = (uint32_t)v;
+        else if (!strcmp(opt, "--loop-end")) m.loop.end = (uint32_t)v;
+        else if (!strcmp(opt, "--decode-ms")) m.decode = v / 1000.0;
+        else if (!strcmp(opt, "--jitter-ms")) m.jitter = v / 1000.0;
+        else if (!strcmp(opt, "--upload-ms")) m.upload = v / 1000.0;
+        else if (!strcmp(opt, "--pacing") && (!strcmp(argv[i], "vblank") || !strcmp(argv[i], "sleep")))
+            m.sleep_paced = !strcmp(argv[i], "sleep");
+        else if (!strcmp(opt, "--render-ms")) m.render = v / 1000.0;
+        else if (!strcmp(opt, "--vblank-hz")) m.vblank_hz = v;
+        else if (!strcmp(opt, "--sh4-ppm")) m.sh4_ppm = v;
+        else if (!strcmp(opt, "--sleep-quantum-ms")) m.sleep_quantum = v / 1000.0;
+        else if (!strcmp(opt, "--poll-ms")) m.poll = v / 1000.0;
+        else if (!strcmp(opt, "--audio-buf")) m.audio_buf = (uint32_t)v;
+        else if (!strcmp(opt, "--seed")) m.seed = (uint32_t)v;
+        else if (!strcmp(opt, "--lead-ms")) m.lead_ms = (uint32_t)v;
+        else if (!strcmp(opt, "--max-drift-ms")) max_drift_ms = v;
+        else if (!strcmp(opt, "--max-trend-ms")) max_trend_ms = v;
+        else if (!strcmp(opt, "--max-drops")) max_drops = (uint32_t)v;
+        else if (!strcmp(opt, "--csv")) csv_path = argv[i];
+        else {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (m.hours <= 0 || m.vblank_hz <= 0 || m.upload < 0 || m.upload > m.decode || m.poll <= 0 || m.audio_buf < 64 ||
+        (m.loop.end && m.loop.start >= m.loop.end) || (m.pts && (m.rounded_fps || m.loop.end))) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!n_fps) { memcpy(fps_list, all_fps, sizeof(all_fps)); n_fps = 8; }
+    if (!n_rates) { memcpy(rate_list, all_rates, sizeof(all_rates)); n_rates = 3; }
+    if (!n_ch) { memcpy(ch_list, all_channels, sizeof(all_channels)); n_ch = 2; }
+
+    FILE *csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) { perror("CSV open failed"); return 1; }
+        fprintf(csv, "fps,rate,channels,presented,dropped,allowed_drops,underruns,max_drift_ms,"
+                     "mean_drift_ms,trend_ms,jitter_rms_ms,jitter_max_ms,pass\n");
+    }
+
+    printf("⏱ %.1f h virtual runs, decode %.1f±%.1f ms (upload %.1f), render %.1f ms, %.2f Hz display, %s paced, "
+           "SH-4 %+.0f ppm%s%s%s\n",
+           m.hours, m.decode * 1000, m.jitter * 1000, m.upload * 1000, m.render * 1000, m.vblank_hz,
+           m.sleep_paced ? "sleep" : "vblank", m.sh4_ppm,
+           m.nominal_clock ? ", nominal AICA rate" : "", m.rounded_fps ? ", rounded fps" : "",
+           m.pts ? ", 90 kHz timestamps" : "");
+    if (m.loop.end)
+        printf("🔁 Looping frames %u-%u\n", m.loop.start, m.loop.end - 1);
+    printf("     fps   rate ch  presented  dropped  underruns  max drift  mean drift   trend  jitter rms/max%s\n",
+           m.loop.end ? "   passes  loop offset" : "");
+
+    int failures = 0;
+    for (int a = 0; a < n_fps; ++a) {
+        for (int b = 0; b < n_rates; ++b) {
+            for (int c = 0; c < n_ch; ++c) {
+                fps_t fps = fps_list[a];
+                uint32_t rate = rate_list[b];
+                double fps_f = (double)fps.num / fps.den;
+                int channels = (int)ch_list[c];
+                if (!rate || channels < 1 || channels > 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+
+                sim_result_t r;
+                simulate(&m, fps, rate, channels, &r);
+
+                double bound = max_drift_ms >= 0 ? max_drift_ms : 1000.0 / fps_f + 1000.0 / m.vblank_hz + 5.0;
+                double excess = fps_f - m.vblank_hz;
+                uint32_t allowed = max_drops + (excess > 0 ? (uint32_t)ceil(excess * m.hours * 3600.0) : 0);
+                int pass = r.max_drift * 1000 <= bound && fabs(r.trend) * 1000 <= max_trend_ms &&
+                           r.dropped <= allowed && r.underruns == 0 && r.loop_offset <= AV_LOOP_MAX_OFFSET;
+                if (!pass) failures++;
+
+                printf("  %6.3f  %5u %2d  %9u  %7u  %9u  %6.1f ms  %7.1f ms  %+5.1f ms  %5.1f/%4.1f ms", fps_f,
+                       rate, channels, r.presented, r.dropped, r.underruns, r.max_drift * 1000,
+                       r.mean_drift * 1000, r.trend * 1000, r.jitter_rms * 1000, r.jitter_max * 1000);
+                if (m.loop.end)
+                    printf("  %7u  %5d smp", r.loop_passes, r.loop_offset);
+                printf("  %s\n", pass ? "✅" : "❌");
+                if (csv)
+                    fprintf(csv, "%.3f,%u,%d,%u,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n", fps_f, rate, channels,
+                            r.presented, r.dropped, allowed, r.underruns, r.max_drift * 1000, r.mean_drift * 1000,
+                            r.trend * 1000, r.jitter_rms * 1000, r.jitter_max * 1000, pass);
+            }
+        }
+    }
+    if (csv) fclose(csv);
+
+    if (failures) {
+        printf("❌ %d run(s) outside the bounds\n", failures);
+        return 2;
+    }
+    printf("✅ All runs within bounds\n");
+    return 0;
+}
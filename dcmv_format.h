@@ -0,0 +1,560 @@
+/*
+ * dcmv_format.h
+ * ---------------------
+ * Shared definitions for the .dcmv container, used by pack_dcmv and the host
+ * tools so the header layout only lives in one place.
+ *
+ * Header format (51 bytes, version 6):
+ *   4 bytes  - Magic "DCMV"
+ *   4 bytes  - Version
+ *   1 byte   - Frame type (0 = RGB565 VQ, 1 = YUV420P macroblocks)
+ *   2 bytes  - Video width
+ *   2 bytes  - Video height
+ *   2 bytes  - Frame rate (fps), rounded to a whole number in v6+
+ *   2 bytes  - Audio sample rate
+ *   2 bytes  - Audio channel count
+ *   4 bytes  - Number of video frames
+ *   4 bytes  - Uncompressed frame size
+ *   4 bytes  - Maximum compressed frame size (LZ4)
+ *   4 bytes  - Audio stream offset (absolute file position)
+ *   4 bytes  - Audio block size (v4+): ADPCM bytes per channel per block.
+ *              Stereo audio is stored as [L block][R block] pairs so one
+ *              stream request maps to one contiguous read. 0 = legacy layout
+ *              as written by dcaconv.
+ *   4 bytes  - Extension offset (v5+): absolute position of the chunk list,
+ *              0 if there is none. Audio runs up to this offset.
+ *   4 bytes  - Frame rate numerator (v6+)
+ *   4 bytes  - Frame rate denominator (v6+): fps_num / fps_den frames per
+ *              second exactly, 30000/1001 for NTSC 29.97.
+ *
+ * Version 3 files end the header after the audio offset (35 bytes), version 4
+ * after the audio block size (39 bytes), version 5 after the extension offset
+ * (43 bytes). Before version 6 the frame rate is fps / 1.
+ *
+ * Extension chunks sit after the audio and run to end of file:
+ *   4 bytes  - Tag
+ *   4 bytes  - Payload size
+ *   N bytes  - Payload
+ * Readers skip tags they don't know.
+ *
+ * "SEEK" - ADPCM decoder state at regular sample positions, so audio can
+ *          resume anywhere without decoding from the start:
+ *   4 bytes  - Interval (samples per channel between entries)
+ *   4 bytes  - Entry count
+ *   Entries (16 bytes each), entry k is at sample k * interval:
+ *     4 bytes  - Sample position (per channel)
+ *     4 bytes  - Byte offset from the audio offset (start of the L block)
+ *     2 bytes  - Signal, L     2 bytes - Signal, R (0 for mono)
+ *     2 bytes  - Step, L       2 bytes - Step, R (127 for mono)
+ *
+ * "CRCS" - Per-frame checksums, so a burn can be checked (dcmv_verify) before
+ *          trusting the player's unchecked LZ4 decoder with it:
+ *   4 bytes  - Frame count
+ *   Entries (8 bytes each), one per frame:
+ *     4 bytes  - CRC-32 of the compressed frame as stored
+ *     4 bytes  - CRC-32 of the decompressed frame
+ *   CRC-32 is the zlib / PNG one, see dcmv_crc32().
+ *
+ * "LOOP" - Loop points for menu backgrounds and attract loops. The player
+ *          plays up to the end frame, then [start, end) over and over, audio
+ *          included (cut at frame * sample_rate / fps, rounded down to an
+ *          even sample):
+ *   4 bytes  - First frame of the loop
+ *   4 bytes  - Frame after the last one (num_frames to loop to the end)
+ *
+ * "PTS " - Presentation timestamps, for variable frame rate sources. Frame i
+ *          is shown from pts[i] to pts[i + 1] instead of at i * fps_den /
+ *          fps_num seconds, and the audio is cut at pts[num_frames]:
+ *   4 bytes  - Timescale (ticks per second)
+ *   4 bytes  - Entry count (num_frames + 1)
+ *   Entries (4 bytes each): start of each frame in ticks, non-decreasing,
+ *   the last one the end of the last frame. Frame 0 starts at pts[0].
+ *
+ * "COST" - Estimated time for the SH-4 to decode each frame (the model in
+ *          dcmv_lz4cost.h), so a reader can tell the frames that risk
+ *          missing their refresh from the cheap ones:
+ *   4 bytes  - Frame count
+ *   Entries (2 bytes each), one per frame: microseconds, saturated at 65535,
+ *   0 for repeats.
+ *
+ * "CUTS" - Scene cuts found by pack_dcmv in the frames, for chapter seeking:
+ *   4 bytes  - Cut count
+ *   Entries (4 bytes each): first frame of every scene after the first,
+ *   increasing, each a stored frame (never a repeat).
+ *
+ * The offset table ((num_frames + 1) uint32_t) follows the header; the last
+ * entry equals the audio offset. A frame whose entry equals the next one is
+ * zero-length and repeats the last stored frame before it (frame 0 never is).
+ * All values are little-endian.
+ *
+ * The player doesn't hold the whole table (690 KB for two hours at 24 fps,
+ * all of it read before the first frame), it pages it in with dcmv_index_t.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DCMV_MAGIC          "DCMV"
+#define DCMV_VERSION        6
+#define DCMV_HEADER_SIZE_V3 35
+#define DCMV_HEADER_SIZE_V4 39
+#define DCMV_HEADER_SIZE_V5 43
+#define DCMV_HEADER_SIZE_V6 51
+#define DCMV_HEADER_SIZE    DCMV_HEADER_SIZE_V6    // what dcmv_write_header emits
+
+#define DCMV_CHUNK_SEEK     "SEEK"
+#define DCMV_CHUNK_CRCS     "CRCS"
+#define DCMV_CHUNK_LOOP     "LOOP"
+#define DCMV_CHUNK_PTS      "PTS "
+#define DCMV_CHUNK_COST     "COST"
+#define DCMV_CHUNK_CUTS     "CUTS"
+
+#define DCMV_DEFAULT_AUDIO_BLOCK 4096
+
+#define DCMV_FRAME_RGB565   0
+#define DCMV_FRAME_YUV420P  1
+
+typedef struct {
+    uint32_t version;
+    uint8_t  frame_type;
+    uint16_t width;
+    uint16_t height;
+    uint16_t fps;
+    uint16_t sample_rate;
+    uint16_t channels;
+    uint32_t num_frames;
+    uint32_t frame_size;
+    uint32_t max_compressed_size;
+    uint32_t audio_offset;
+    uint32_t audio_block_size;
+    uint32_t ext_offset;
+    uint32_t fps_num, fps_den;  // fps / 1 before v6
+
+    uint32_t header_size;       // bytes before the offset table
+} dcmv_header_t;
+
+typedef struct {
+    uint32_t sample;
+    uint32_t byte_offset;
+    int16_t  signal[2];
+    uint16_t step[2];
+} dcmv_seek_entry_t;
+
+static inline int dcmv_read_header(FILE *fp, dcmv_header_t *h) {
+    char magic[4];
+    memset(h, 0, sizeof(*h));
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, DCMV_MAGIC, 4))
+        return -1;
+    fread(&h->version, 4, 1, fp);
+    fread(&h->frame_type, 1, 1, fp);
+    fread(&h->width, 2, 1, fp);
+    fread(&h->height, 2, 1, fp);
+    fread(&h->fps, 2, 1, fp);
+    fread(&h->sample_rate, 2, 1, fp);
+    fread(&h->channels, 2, 1, fp);
+    fread(&h->num_frames, 4, 1, fp);
+    fread(&h->frame_size, 4, 1, fp);
+    fread(&h->max_compressed_size, 4, 1, fp);
+    if (fread(&h->audio_offset, 4, 1, fp) != 1)
+        return -1;
+    h->header_size = DCMV_HEADER_SIZE_V3;
+
+    if (h->version >= 4) {
+        if (fread(&h->audio_block_size, 4, 1, fp) != 1)
+            return -1;
+        h->header_size = DCMV_HEADER_SIZE_V4;
+    }
+    if (h->version >= 5) {
+        if (fread(&h->ext_offset, 4, 1, fp) != 1)
+            return -1;
+        h->header_size = DCMV_HEADER_SIZE_V5;
+    }
+    h->fps_num = h->fps;
+    h->fps_den = 1;
+    if (h->version >= 6) {
+        if (fread(&h->fps_num, 4, 1, fp) != 1 || fread(&h->fps_den, 4, 1, fp) != 1)
+            return -1;
+        h->header_size = DCMV_HEADER_SIZE_V6;
+    }
+    return h->fps_num && h->fps_den ? 0 : -1;
+}
+
+static inline void dcmv_write_header(FILE *out, const dcmv_header_t *h) {
+    uint32_t version = DCMV_VERSION;
+    fwrite(DCMV_MAGIC, 1, 4, out);
+    fwrite(&version, 4, 1, out);
+    fwrite(&h->frame_type, 1, 1, out);
+    fwrite(&h->width, 2, 1, out);
+    fwrite(&h->height, 2, 1, out);
+    fwrite(&h->fps, 2, 1, out);
+    fwrite(&h->sample_rate, 2, 1, out);
+    fwrite(&h->channels, 2, 1, out);
+    fwrite(&h->num_frames, 4, 1, out);
+    fwrite(&h->frame_size, 4, 1, out);
+    fwrite(&h->max_compressed_size, 4, 1, out);
+    fwrite(&h->audio_offset, 4, 1, out);
+    fwrite(&h->audio_block_size, 4, 1, out);
+    fwrite(&h->ext_offset, 4, 1, out);
+    fwrite(&h->fps_num, 4, 1, out);
+    fwrite(&h->fps_den, 4, 1, out);
+}
+
+static inline void dcmv_write_chunk(FILE *out, const char tag[4], const void *payload, uint32_t size) {
+    fwrite(tag, 1, 4, out);
+    fwrite(&size, 4, 1, out);
+    fwrite(payload, 1, size, out);
+}
+
+/*
+ * Find a chunk by tag. On success fp is left at the start of the payload,
+ * its size is stored in *size and the payload's file position is returned.
+ * A chunk running past the end of the file ends the search, so a corrupt
+ * size can't send the walk around (long is 32 bits on the SH-4).
+ */
+static inline long dcmv_find_chunk(FILE *fp, const dcmv_header_t *h, const char tag[4], uint32_t *size) {
+    if (!h->ext_offset || fseek(fp, 0, SEEK_END) != 0)
+        return -1;
+    long file_size = ftell(fp);
+    long pos = h->ext_offset;
+    while (file_size - pos >= 8) {
+        char t[4];
+        uint32_t len;
+        if (fseek(fp, pos, SEEK_SET) != 0 || fread(t, 1, 4, fp) != 4 || fread(&len, 4, 1, fp) != 1)
+            return -1;
+        if (len > (unsigned long)(file_size - pos - 8))
+            return -1;
+        if (memcmp(t, tag, 4) == 0) {
+            *size = len;
+            return pos + 8;
+        }
+        pos += 8 + len;
+    }
+    return -1;
+}
+
+/*
+ * Seek index from a SEEK chunk: the payload position is returned and the
+ * interval and entry count stored, -1 if there is no usable chunk
+ */
+static inline long dcmv_find_seek(FILE *fp, const dcmv_header_t *h, uint32_t *interval, uint32_t *count) {
+    uint32_t size;
+    long pos = dcmv_find_chunk(fp, h, DCMV_CHUNK_SEEK, &size);
+    if (pos < 0 || size < 8 || fread(interval, 4, 1, fp) != 1 || fread(count, 4, 1, fp) != 1)
+        return -1;
+    if (!*interval || !*count || size < 8 + (uint64_t)*count * 16)
+        return -1;
+    return pos;
+}
+
+/* Read seek entry k from a SEEK chunk whose payload starts at payload_pos */
+static inline int dcmv_read_seek_entry(FILE *fp, long payload_pos, uint32_t k, dcmv_seek_entry_t *e) {
+    if (fseek(fp, payload_pos + 8 + (long)k * 16, SEEK_SET) != 0)
+        return -1;
+    if (fread(&e->sample, 4, 1, fp) != 1 || fread(&e->byte_offset, 4, 1, fp) != 1 ||
+        fread(e->signal, 2, 2, fp) != 2 || fread(e->step, 2, 2, fp) != 2)
+        return -1;
+    return 0;
+}
+
+/* Loop points from a LOOP chunk, 0 if there is one and they fit the file */
+static inline int dcmv_read_loop(FILE *fp, const dcmv_header_t *h, uint32_t *start, uint32_t *end) {
+    uint32_t size;
+    if (dcmv_find_chunk(fp, h, DCMV_CHUNK_LOOP, &size) < 0 || size < 8)
+        return -1;
+    if (fread(start, 4, 1, fp) != 1 || fread(end, 4, 1, fp) != 1)
+        return -1;
+    return *start < *end && *end <= h->num_frames ? 0 : -1;
+}
+
+/*
+ * Timestamps from a PTS chunk: the position of pts[0] is returned and the
+ * timescale stored in *timescale, -1 if there is no usable chunk
+ */
+static inline long dcmv_find_pts(FILE *fp, const dcmv_header_t *h, uint32_t *timescale) {
+    uint32_t size, count;
+    long pos = dcmv_find_chunk(fp, h, DCMV_CHUNK_PTS, &size);
+    if (pos < 0 || size < 8 || fread(timescale, 4, 1, fp) != 1 || fread(&count, 4, 1, fp) != 1)
+        return -1;
+    if (!*timescale || count != h->num_frames + 1 || size < 8 + (uint64_t)count * 4)
+        return -1;
+    return pos + 8;
+}
+
+/* Position of the first COST entry, -1 if there is no usable chunk */
+static inline long dcmv_find_cost(FILE *fp, const dcmv_header_t *h) {
+    uint32_t size, count;
+    long pos = dcmv_find_chunk(fp, h, DCMV_CHUNK_COST, &size);
+    if (pos < 0 || size < 4 || fread(&count, 4, 1, fp) != 1)
+        return -1;
+    if (count != h->num_frames || size < 4 + (uint64_t)count * 2)
+        return -1;
+    return pos + 4;
+}
+
+/*
+ * Scene cuts from a CUTS chunk: the position of the first entry is returned
+ * and the count stored in *count, -1 if there is no usable chunk
+ */
+static inline long dcmv_find_cuts(FILE *fp, const dcmv_header_t *h, uint32_t *count) {
+    uint32_t size;
+    long pos = dcmv_find_chunk(fp, h, DCMV_CHUNK_CUTS, &size);
+    if (pos < 0 || size < 4 || fread(count, 4, 1, fp) != 1)
+        return -1;
+    if (*count >= h->num_frames || size < 4 + (uint64_t)*count * 4)
+        return -1;
+    return pos + 4;
+}
+
+/* The stored frame that frame i shows: itself, or the one a zero-length entry repeats */
+static inline uint32_t dcmv_source_frame(const uint32_t *offsets, uint32_t i) {
+    while (i > 0 && offsets[i + 1] == offsets[i])
+        --i;
+    return i;
+}
+
+/*
+ * Paged offset table: DCMV_INDEX_PAGES pages of DCMV_INDEX_PAGE_FRAMES
+ * entries (plus the next one, so every frame in a page has its size) read
+ * from the file on demand, least recently used page replaced. A page also
+ * records which stored frame each entry shows; when a page starts inside a
+ * run of repeats, the earlier pages are scanned once to find its source.
+ * With dcmv_index_use_pts the page's timestamps are read along with it, and
+ * with dcmv_index_use_cost its decode time estimates.
+ */
+#ifndef DCMV_INDEX_PAGE_FRAMES
+#define DCMV_INDEX_PAGE_FRAMES  1024
+#endif
+#define DCMV_INDEX_PAGES        2
+#define DCMV_INDEX_NO_SOURCE    0xFFFF      // shows the page's first_source
+
+typedef struct {
+    uint32_t first;                                 // first frame, UINT32_MAX = empty
+    uint32_t used;                                  // LRU tick
+    uint32_t first_source;                          // stored frame entry 0 repeats, if it does
+    uint32_t first_offset, first_size;              // and where that frame is
+    uint32_t offsets[DCMV_INDEX_PAGE_FRAMES + 1];
+    uint16_t source[DCMV_INDEX_PAGE_FRAMES];        // in-page stored frame each entry shows
+    uint32_t pts[DCMV_INDEX_PAGE_FRAMES + 1];       // with a PTS table
+    uint16_t cost[DCMV_INDEX_PAGE_FRAMES];          // with a COST table
+} dcmv_index_page_t;
+
+typedef struct {
+    FILE *fp;
+    long table_pos;
+    long pts_pos;                                   // pts[0], 0 = no PTS table
+    long cost_pos;                                  // cost[0], 0 = no COST table
+    uint32_t num_frames;
+    uint32_t tick;
+    uint32_t loads;                                 // pages read so far
+    dcmv_index_page_t pages[DCMV_INDEX_PAGES];
+} dcmv_index_t;
+
+/* Where a frame's pixels come from: the stored frame it shows, and its place in the file */
+typedef struct {
+    uint32_t source;
+    uint32_t offset;
+    uint32_t size;
+} dcmv_frame_ref_t;
+
+/* No reads yet; the first lookup loads its page. fp's position is moved by lookups. */
+static inline void dcmv_index_open(dcmv_index_t *idx, FILE *fp, const dcmv_header_t *h) {
+    memset(idx, 0, sizeof(*idx));
+    idx->fp = fp;
+    idx->table_pos = h->header_size;
+    idx->num_frames = h->num_frames;
+    for (int i = 0; i < DCMV_INDEX_PAGES; ++i)
+        idx->pages[i].first = UINT32_MAX;
+}
+
+/* Page timestamps in too, from the table at pts_pos (dcmv_find_pts); before the first lookup */
+static inline void dcmv_index_use_pts(dcmv_index_t *idx, long pts_pos) {
+    idx->pts_pos = pts_pos;
+}
+
+/* Page decode time estimates in too, from the table at cost_pos (dcmv_find_cost); before the first lookup */
+static inline void dcmv_index_use_cost(dcmv_index_t *idx, long cost_pos) {
+    idx->cost_pos = cost_pos;
+}
+
+static inline int dcmv_index_read_at(dcmv_index_t *idx, long pos, uint32_t first, uint32_t count, uint32_t *out) {
+    if (fseek(idx->fp, pos + (long)first * 4, SEEK_SET) != 0)
+        return -1;
+    return fread(out, 4, count, idx->fp) == count ? 0 : -1;
+}
+
+/* Read table entries [first, first + count) */
+static inline int dcmv_index_read(dcmv_index_t *idx, uint32_t first, uint32_t count, uint32_t *out) {
+    return dcmv_index_read_at(idx, idx->table_pos, first, count, out);
+}
+
+/* Last stored frame before `frame` (a page boundary), scanning back a page at a time */
+static inline int dcmv_index_scan_back(dcmv_index_t *idx, uint32_t frame, dcmv_frame_ref_t *ref) {
+    uint32_t chunk[65];
+    while (frame > 0) {
+        uint32_t start = frame > 64 ? frame - 64 : 0;
+        if (dcmv_index_read(idx, start, frame - start + 1, chunk) < 0)
+            return -1;
+        for (uint32_t i = frame; i-- > start;) {
+            uint32_t size = chunk[i - start + 1] - chunk[i - start];
+            if (size) {
+                *ref = (dcmv_frame_ref_t){ i, chunk[i - start], size };
+                return 0;
+            }
+        }
+        frame = start;
+    }
+    return -1;  // frame 0 is never a repeat
+}
+
+static inline dcmv_index_page_t *dcmv_index_load(dcmv_index_t *idx, uint32_t frame) {
+    uint32_t first = frame / DCMV_INDEX_PAGE_FRAMES * DCMV_INDEX_PAGE_FRAMES;
+    dcmv_index_page_t *pg = &idx->pages[0];
+    for (int i = 0; i < DCMV_INDEX_PAGES; ++i) {
+        if (idx->pages[i].first == first) {
+            idx->pages[i].used = ++idx->tick;
+            return &idx->pages[i];
+        }
+        if (idx->pages[i].used < pg->used)
+            pg = &idx->pages[i];
+    }
+
+    uint32_t count = idx->num_frames - first;
+    if (count > DCMV_INDEX_PAGE_FRAMES) count = DCMV_INDEX_PAGE_FRAMES;
+    pg->first = UINT32_MAX;
+    if (dcmv_index_read(idx, first, count + 1, pg->offsets) < 0)
+        return NULL;
+    uint16_t src = DCMV_INDEX_NO_SOURCE;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (pg->offsets[i + 1] < pg->offsets[i])
+            return NULL;    // corrupt table
+        if (pg->offsets[i + 1] != pg->offsets[i] || (first == 0 && i == 0))
+            src = (uint16_t)i;
+        pg->source[i] = src;
+    }
+    if (pg->source[0] == DCMV_INDEX_NO_SOURCE) {
+        dcmv_frame_ref_t ref;
+        if (dcmv_index_scan_back(idx, first, &ref) < 0)
+            return NULL;
+        pg->first_source = ref.source;
+        pg->first_offset = ref.offset;
+        pg->first_size = ref.size;
+    }
+    if (idx->pts_pos) {
+        if (dcmv_index_read_at(idx, idx->pts_pos, first, count + 1, pg->pts) < 0)
+            return NULL;
+        for (uint32_t i = 0; i < count; ++i)
+            if (pg->pts[i + 1] < pg->pts[i])
+                return NULL;    // timestamps going backwards
+    }
+    if (idx->cost_pos && (fseek(idx->fp, idx->cost_pos + (long)first * 2, SEEK_SET) != 0 ||
+                          fread(pg->cost, 2, count, idx->fp) != count))
+        return NULL;
+    pg->first = first;
+    pg->used = ++idx->tick;
+    idx->loads++;
+    return pg;
+}
+
+/* Look up frame i, reading its page if needed; -1 on a read error or a corrupt table */
+static inline int dcmv_index_lookup(dcmv_index_t *idx, uint32_t i, dcmv_frame_ref_t *ref) {
+    if (i >= idx->num_frames)
+        return -1;
+    dcmv_index_page_t *pg = dcmv_index_load(idx, i);
+    if (!pg)
+        return -1;
+    uint16_t k = pg->source[i - pg->first];
+    if (k == DCMV_INDEX_NO_SOURCE) {
+        *ref = (dcmv_frame_ref_t){ pg->first_source, pg->first_offset, pg->first_size };
+    } else {
+        *ref = (dcmv_frame_ref_t){ pg->first + k, pg->offsets[k], pg->offsets[k + 1] - pg->offsets[k] };
+    }
+    return 0;
+}
+
+/* Start and end of frame i (pts[i], pts[i + 1]) with a PTS table, reading its page if needed */
+static inline int dcmv_index_pts(dcmv_index_t *idx, uint32_t i, uint32_t pts[2]) {
+    if (!idx->pts_pos || i >= idx->num_frames)
+        return -1;
+    dcmv_index_page_t *pg = dcmv_index_load(idx, i);
+    if (!pg)
+        return -1;
+    pts[0] = pg->pts[i - pg->first];
+    pts[1] = pg->pts[i - pg->first + 1];
+    return 0;
+}
+
+/* Estimated decode time of frame i in microseconds with a COST table (0 for a repeat), -1 without */
+static inline int32_t dcmv_index_cost(dcmv_index_t *idx, uint32_t i) {
+    if (!idx->cost_pos || i >= idx->num_frames)
+        return -1;
+    dcmv_index_page_t *pg = dcmv_index_load(idx, i);
+    return pg ? pg->cost[i - pg->first] : -1;
+}
+
+/*
+ * A frame rate as written on the command line: "30000/1001", "24" or a
+ * decimal. 23.976, 29.97 and 59.94 are read as the NTSC rates (n * 1000 /
+ * 1001), anything else to a thousandth. Reduced; -1 if it isn't a rate.
+ */
+static inline int dcmv_parse_fps(const char *s, uint32_t *num, uint32_t *den) {
+    char *end;
+    if (strchr(s, '/')) {
+        *num = strtoul(s, &end, 10);
+        *den = *end == '/' ? strtoul(end + 1, &end, 10) : 0;
+    } else {
+        double fps = strtod(s, &end);
+        uint32_t ntsc = (uint32_t)(fps * 1.001 + 0.5);
+        if (fps <= 0 || fps > 1000) {
+            *num = 0;
+        } else if (fps == (uint32_t)fps) {
+            *num = (uint32_t)fps;
+            *den = 1;
+        } else if (fps - ntsc * 1000.0 / 1001 < 0.01 && ntsc * 1000.0 / 1001 - fps < 0.01) {
+            *num = ntsc * 1000;
+            *den = 1001;
+        } else {
+            *num = (uint32_t)(fps * 1000 + 0.5);
+            *den = 1000;
+        }
+    }
+    if (*end || !*num || !*den)
+        return -1;
+    uint32_t a = *num, b = *den;
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    *num /= a;
+    *den /= a;
+    return 0;
+}
+
+/* End of the audio stream, given the file size */
+static inline uint32_t dcmv_audio_end(const dcmv_header_t *h, uint32_t file_size) {
+    return h->ext_offset ? h->ext_offset : file_size;
+}
+
+/* CRC-32 (reflected, polynomial 0xEDB88320); call dcmv_crc32_init() once first */
+static uint32_t dcmv_crc_table[256];
+
+static inline void dcmv_crc32_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        dcmv_crc_table[i] = c;
+    }
+}
+
+static inline uint32_t dcmv_crc32(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--)
+        crc = dcmv_crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
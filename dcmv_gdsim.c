@@ -0,0 +1,769 @@
+/*
+ * dcmv_gdsim.c
+ * ---------------------
+ * GD-ROM read-pattern simulator for .dcmv files.
+ *
+ * Replays the exact I/O that fmv_play.elf issues for a given movie against a
+ * simple optical drive model, so stutter can be predicted without burning a
+ * disc:
+ *   - Startup: header + the first page of the offset table (dcmv_index_t),
+ *              or the whole table with --index-page 0 (players before paging)
+ *   - Video:   one fseek + fread per frame (offset table entry to next entry),
+ *              none for repeated (zero-length) frames, plus a page of the
+ *              table from the start of the file whenever playback enters a
+ *              new one (and the same page of the PTS table, if there is one)
+ *   - Timing:  frames are due at the header's exact frame rate (fps_num /
+ *              fps_den), or at their timestamps in a PTS chunk; a frame has
+ *              to arrive its decode + upload time before its slot ends,
+ *              --decode-ms, or its own estimate from a COST chunk plus
+ *              --upload-ms (its pages are read with the offset table's)
+ *   - Audio:   snd_stream refills from the second (audio) handle, issued by
+ *              the poll thread every --poll-ms, sized to the free buffer space
+ *
+ * Both handles share one drive, so every switch between the frame region and
+ * the audio region at the end of the file is a seek.
+ *
+ * Given several files, they are a playlist laid out back to back on the
+ * disc. While each clip plays, fmv_play.c preloads the next one on a third
+ * handle in PRELOAD_CHUNK reads: the header and first offset table page
+ * (with its PTS and COST pages), then the first PRELOAD_VIDEO bytes of frames
+ * and PRELOAD_AUDIO of audio (the whole file if it's small enough to play
+ * from RAM). The switch is compared with reopening the next file once the
+ * clip has ended.
+ *
+ * Drive model:
+ *   - Sustained transfer rate (bytes/sec) for reads off the disc
+ *   - Seek latency: min + (max - min) * sqrt(distance / disc size)
+ *   - Sector-aligned reads (default 2048 bytes)
+ *   - Single-segment read-ahead cache: after a read the drive keeps streaming
+ *     the following sectors into its buffer until it is full; hits inside the
+ *     buffer only pay the bus transfer
+ *   - The KOS iso9660 sector cache in front of it: partial-sector pieces of a
+ *     read go through a small LRU cache, whole sectors go straight to the drive
+ *
+ * Output:
+ *   - Time-to-first-frame and RAM held by the offset table
+ *   - Per-frame request/arrival/deadline times (--csv)
+ *   - Late frames (arrived after their display slot ended) and audio underruns
+ *   - With a COST chunk, the frames estimated to take longer than their slot
+ *     to decode and upload, which only read-ahead can keep on time
+ *   - Minimum video read-ahead (frames and bytes) and audio stream buffer size
+ *     that would have avoided them
+ *   - For a playlist: per clip the same counts, and per switch how long before
+ *     it the preload finished, how late the next clip's first frame is and
+ *     the audio gap, with and without preloading
+ *
+ * Usage:
+ *   dcmv_gdsim [options] <movie.dcmv> [<next.dcmv> ...]
+ *
+ * Build:
+ *   gcc -O2 dcmv_gdsim.c -o dcmv_gdsim -lm
+ *
+ * Author: Troy Davis (gpf)
+ * GitHub: https://github.com/GPF
+ * License: Public Domain / MIT-style — use freely with attribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "dcmv_format.h"
+
+#define MAX_READAHEAD_FRAMES 240
+#define MAX_FS_CACHE 64
+#define MAX_CLIPS 16
+#define PRELOAD_VIDEO (256 * 1024)      // as fmv_play.c
+#define PRELOAD_AUDIO (64 * 1024)
+#define PRELOAD_CHUNK (32 * 1024)
+
+typedef struct {
+    double rate;            // sustained disc transfer, bytes/sec
+    double bus_rate;        // drive buffer -> SH-4 transfer, bytes/sec
+    double seek_min;        // short seek, sec
+    double seek_max;        // full stroke seek, sec
+    double cmd_overhead;    // per-command overhead, sec
+    double disc_bytes;      // span used to scale seek distance
+    uint32_t sector;        // sector size in bytes
+    uint32_t cache;         // read-ahead buffer in bytes
+    int fs_cache;           // iso9660 cache blocks (sectors)
+} drive_model_t;
+
+typedef struct {
+    const drive_model_t *m;
+    double free_at;         // drive idle from this time
+    double idle_from;       // when read-ahead started streaming
+    uint64_t seg_lo;        // lowest byte held in the buffer segment
+    uint64_t head_end;      // bytes fetched up to here when read-ahead started
+    uint64_t consumed_end;  // end of the last host read
+    int seeks;
+    int hits;
+    double seek_time;
+    uint64_t fs_sector[MAX_FS_CACHE];
+    uint64_t fs_used[MAX_FS_CACHE];
+    uint64_t fs_tick;
+} drive_t;
+
+typedef struct {
+    double poll;            // poll thread period, sec
+    uint32_t buffer;        // stream buffer per channel, bytes
+} audio_model_t;
+
+typedef struct {
+    double request;
+    double arrival;
+    double deadline;
+    double decode;
+} frame_timing_t;
+
+// One file, placed at `base` on the disc
+typedef struct {
+    const char *path;
+    dcmv_header_t h;
+    uint32_t *offsets;
+    uint64_t audio_end;
+    uint64_t size;
+    uint64_t base;
+    double fd;              // frame duration at the header's rate, sec
+    double *start;          // PTS table: start of each frame and end of the last, sec; NULL = i * fd
+    long pts_pos;           // where the PTS table is in the file
+    uint16_t *cost;         // COST table: estimated decode per frame, us; NULL = --decode-ms
+    long cost_pos;
+    double upload;          // added to cost[], sec
+} clip_t;
+
+// When frame i starts, sec from playback start (i = num_frames: when the last one ends)
+static double frame_start(const clip_t *c, int i) {
+    return c->start && i >= 0 ? c->start[i] : i * c->fd;
+}
+
+// Decode + upload time of stored frame i, sec
+static double frame_decode(const clip_t *c, int i, double decode) {
+    return c->cost ? c->cost[i] / 1e6 + c->upload : decode;
+}
+
+// The clip after the one being played, and what the switch to it cost
+typedef struct {
+    const clip_t *clip;
+    int preload;            // read its start while this one plays (fmv_play.c), else reopen after
+    uint64_t ram_clip;      // files up to this size are preloaded whole
+    uint64_t preload_bytes;
+    int preload_reads;
+    double preload_lead;    // out: preload done this long before the switch, sec (negative = after)
+    double late;            // out: its first frame past its deadline, sec (0 = on time)
+    double silence;         // out: audio gap at the switch, sec
+} next_clip_t;
+
+typedef struct {
+    int late_frames;
+    int heavy_frames;       // estimated to decode + upload in more than their slot
+    int late_heavy;         // of which late
+    double worst_slack;     // most negative (deadline - arrival)
+    int audio_underruns;
+    double audio_gap;       // total silence, sec
+    double first_frame;     // time-to-first-frame
+    int index_reads;        // offset table pages read during playback
+    uint64_t max_buffered;  // peak bytes held by the video read-ahead queue
+    int seeks;
+    int hits;
+    double seek_time;
+} sim_result_t;
+
+static void drive_reset(drive_t *d, const drive_model_t *m) {
+    memset(d, 0, sizeof(*d));
+    d->m = m;
+    for (int i = 0; i < MAX_FS_CACHE; ++i)
+        d->fs_sector[i] = UINT64_MAX;
+}
+
+// Bytes the drive has streamed into its buffer by time t
+static uint64_t drive_head(const drive_t *d, double t) {
+    double streamed = (t - d->idle_from) * d->m->rate;
+    uint64_t limit = d->consumed_end + d->m->cache;
+    uint64_t head = d->head_end + (streamed > 0 ? (uint64_t)streamed : 0);
+    return head < limit ? head : limit;
+}
+
+// Service one host read of [off, off + len); returns completion time
+static double drive_read(drive_t *d, double t, uint64_t off, uint64_t len) {
+    const drive_model_t *m = d->m;
+    double start = t > d->free_at ? t : d->free_at;
+    uint64_t a = off / m->sector * m->sector;
+    uint64_t b = (off + len + m->sector - 1) / m->sector * m->sector;
+    uint64_t head = drive_head(d, start);
+    uint64_t lo = head > m->cache ? head - m->cache : 0;
+    if (lo < d->seg_lo) lo = d->seg_lo;
+
+    double dur = m->cmd_overhead;
+    if (a >= lo && a <= head) {
+        // Buffer hit, possibly finishing the tail off the disc
+        uint64_t cached_end = b < head ? b : head;
+        dur += (double)(cached_end - a) / m->bus_rate;
+        if (b > head)
+            dur += (double)(b - head) / m->rate;
+        d->hits++;
+    } else {
+        uint64_t dist = a > head ? a - head : head - a;
+        double seek = m->seek_min + (m->seek_max - m->seek_min) * sqrt((double)dist / m->disc_bytes);
+        if (seek > m->seek_max) seek = m->seek_max;
+        dur += seek + (double)(b - a) / m->rate;
+        d->seg_lo = a;
+        d->seeks++;
+        d->seek_time += seek;
+        head = a;
+    }
+
+    d->free_at = start + dur;
+    d->idle_from = d->free_at;
+    d->head_end = head > b ? head : b;
+    d->consumed_end = b;
+    return d->free_at;
+}
+
+// Look up (and on miss, claim the LRU slot for) a sector in the fs cache
+static int fs_cache_lookup(drive_t *d, uint64_t sector) {
+    int victim = 0;
+    for (int i = 0; i < d->m->fs_cache; ++i) {
+        if (d->fs_sector[i] == sector) {
+            d->fs_used[i] = ++d->fs_tick;
+            return 1;
+        }
+        if (d->fs_used[i] < d->fs_used[victim])
+            victim = i;
+    }
+    if (d->m->fs_cache > 0) {
+        d->fs_sector[victim] = sector;
+        d->fs_used[victim] = ++d->fs_tick;
+    }
+    return 0;
+}
+
+// An fread() through the filesystem: partial sectors may come from its cache
+static double host_read(drive_t *d, double t, uint64_t off, uint64_t len) {
+    uint32_t sec = d->m->sector;
+    uint64_t first = off / sec;
+    uint64_t last = (off + len - 1) / sec;
+    int head_partial = off % sec != 0 || len < sec;
+    int tail_partial = last != first && (off + len) % sec != 0;
+
+    if (head_partial && fs_cache_lookup(d, first))
+        first++;
+    if (tail_partial && last >= first && fs_cache_lookup(d, last))
+        last--;
+    if (last < first || len == 0)
+        return t;
+    return drive_read(d, t, first * sec, (last - first + 1) * sec);
+}
+
+// Read the PTS and COST pages that go with the offset table entries from frame i
+static double read_side_tables(drive_t *d, const clip_t *c, double t, uint32_t i, uint32_t entries) {
+    if (c->start)
+        t = host_read(d, t, c->base + c->pts_pos + (uint64_t)i * 4, (uint64_t)entries * 4);
+    if (c->cost)
+        t = host_read(d, t, c->base + c->cost_pos + (uint64_t)i * 2, (uint64_t)(entries - 1) * 2);
+    return t;
+}
+
+// Offset table entries in the first page read at startup
+static uint32_t first_page_entries(const dcmv_header_t *h, uint32_t index_page) {
+    return index_page && index_page < h->num_frames ? index_page + 1 : h->num_frames + 1;
+}
+
+// What the preload thread reads of clip n, in order; returns the number of spans
+static int preload_spans(const next_clip_t *n, uint32_t index_page, uint64_t span[5][2]) {
+    const clip_t *c = n->clip;
+    if (c->size <= n->ram_clip) {
+        span[0][0] = 0;
+        span[0][1] = c->size;
+        return 1;
+    }
+    uint64_t off0 = c->offsets[0], aoff = c->h.audio_offset;
+    span[0][0] = 0;
+    span[0][1] = c->h.header_size + (uint64_t)first_page_entries(&c->h, index_page) * 4;
+    span[1][0] = c->pts_pos;
+    span[1][1] = c->start ? (uint64_t)first_page_entries(&c->h, index_page) * 4 : 0;
+    span[2][0] = c->cost_pos;
+    span[2][1] = c->cost ? (uint64_t)(first_page_entries(&c->h, index_page) - 1) * 2 : 0;
+    span[3][0] = off0;
+    span[3][1] = off0 < aoff ? (aoff - off0 < PRELOAD_VIDEO ? aoff - off0 : PRELOAD_VIDEO) : 0;
+    span[4][0] = aoff;
+    span[4][1] = aoff < c->audio_end ? (c->audio_end - aoff < PRELOAD_AUDIO ? c->audio_end - aoff : PRELOAD_AUDIO) : 0;
+    return 5;
+}
+
+/*
+ * The switch to clip n at t_switch (when its frame 0 is due), from the drive
+ * state at the end of the clip before. Preloaded, its first frame is read
+ * (unless it's in RAM) when due and the audio carries on in the stream; the
+ * stream only runs short if the preload was still going when the callback
+ * reached the end of the clip, one PCM buffer ahead of playback. Reopened,
+ * the player reads the header and first table page, prefills the restarted
+ * stream and then reads the frame.
+ */
+static void simulate_switch(const drive_t *end_state, next_clip_t *n, double t_switch, double preload_done,
+                            const audio_model_t *am, uint32_t index_page, double decode) {
+    const clip_t *c = n->clip;
+    drive_t d = *end_state;
+    double deadline = t_switch + frame_start(c, 1) - frame_decode(c, 0, decode);
+    uint32_t size0 = c->offsets[1] - c->offsets[0];
+    double arrival;
+    if (n->preload) {
+        int in_ram = c->size <= n->ram_clip || (size0 <= PRELOAD_VIDEO && c->offsets[0] < c->h.audio_offset);
+        double start = t_switch > preload_done ? t_switch : preload_done;
+        arrival = in_ram ? start : host_read(&d, start, c->base + c->offsets[0], size0);
+        double pcm_lead = am->buffer / 2.0 / c->h.sample_rate;
+        double gap = preload_done - (t_switch - pcm_lead);
+        n->silence = gap > 0 ? gap : 0;
+        n->preload_lead = t_switch - preload_done;
+    } else {
+        int channels = c->h.channels ? c->h.channels : 1;
+        double t = host_read(&d, t_switch, c->base, c->h.header_size + (uint64_t)first_page_entries(&c->h, index_page) * 4);
+        t = read_side_tables(&d, c, t, 0, first_page_entries(&c->h, index_page));
+        t = host_read(&d, t, c->base + c->h.audio_offset, (uint64_t)am->buffer * channels);
+        n->silence = t - t_switch;
+        arrival = host_read(&d, t, c->base + c->offsets[0], size0);
+    }
+    n->late = arrival > deadline ? arrival - deadline : 0;
+}
+
+/*
+ * Run the playback once. readahead is how many frames ahead of display the
+ * reader may run (0 = fmv_play.c today: read when the frame is due).
+ * index_page is the offset table page in frames, 0 to read it all up front.
+ * With next set, the switch to the following clip is simulated as well.
+ */
+static void simulate(const clip_t *c, const drive_model_t *m, const audio_model_t *am, int readahead,
+                     uint32_t index_page, double decode, next_clip_t *next, frame_timing_t *timing, sim_result_t *r) {
+    const dcmv_header_t *h = &c->h;
+    const uint32_t *offsets = c->offsets;
+    uint64_t base = c->base;
+    drive_t drive;
+    drive_reset(&drive, m);
+    memset(r, 0, sizeof(*r));
+
+    double audio_bps = (double)h->sample_rate / 2.0;  // ADPCM per channel
+    int channels = h->channels ? h->channels : 1;
+    uint64_t audio_pos = h->audio_offset;
+
+    // Startup: header + offset table (or its first page) on the video handle
+    uint32_t first_entries = first_page_entries(h, index_page);
+    double t = host_read(&drive, 0, base, h->header_size + (uint64_t)first_entries * 4);
+    t = read_side_tables(&drive, c, t, 0, first_entries);
+
+    // snd_stream_start prefills the whole buffer before playback begins
+    uint64_t req = (uint64_t)am->buffer * channels;
+    t = host_read(&drive, t, base + audio_pos, req);
+    audio_pos += req;
+    double t0 = t;
+    double level = am->buffer;          // per channel
+    double level_at = t0;
+    double next_poll = t0 + am->poll;
+
+    // The next clip's preload starts with playback, one chunk after another
+    uint64_t span[5][2];
+    int spans = next && next->preload ? preload_spans(next, index_page, span) : 0;
+    int k = 0;
+    uint64_t span_pos = 0;
+    double pl_next = spans ? t0 : INFINITY, pl_done = t0;
+    while (k < spans && !span[k][1]) k++;
+    if (next) {
+        next->preload_bytes = 0;
+        next->preload_reads = 0;
+    }
+
+    double prev_done = t0;
+    int i = 0;
+    while (i < (int)h->num_frames || k < spans) {
+        double want = t0 + frame_start(c, i - readahead);
+        double vreq = i >= (int)h->num_frames ? INFINITY : want > prev_done ? want : prev_done;
+        double soonest = vreq < pl_next ? vreq : pl_next;
+
+        if (next_poll <= soonest) {
+            // Audio poll comes first
+            double now = next_poll;
+            double cur = level - (now - level_at) * audio_bps;
+            uint32_t free_bytes = (uint32_t)(am->buffer - (cur > 0 ? cur : 0)) & ~31u;
+            double done = now;
+            if (free_bytes && audio_pos < c->audio_end) {
+                done = host_read(&drive, now, base + audio_pos, (uint64_t)free_bytes * channels);
+                audio_pos += (uint64_t)free_bytes * channels;
+                double at_done = level - (done - level_at) * audio_bps;
+                if (at_done < 0) {
+                    r->audio_underruns++;
+                    r->audio_gap += -at_done / audio_bps;
+                    at_done = 0;
+                }
+                level = at_done + free_bytes;
+                level_at = done;
+            }
+            next_poll = done + am->poll;
+            continue;
+        }
+
+        if (pl_next < vreq) {
+            uint64_t len = span[k][1] - span_pos < PRELOAD_CHUNK ? span[k][1] - span_pos : PRELOAD_CHUNK;
+            pl_done = pl_next = host_read(&drive, pl_next, next->clip->base + span[k][0] + span_pos, len);
+            next->preload_bytes += len;
+            next->preload_reads++;
+            span_pos += len;
+            if (span_pos == span[k][1]) {
+                span_pos = 0;
+                while (++k < spans && !span[k][1]) {}
+                if (k == spans) pl_next = INFINITY;
+            }
+            continue;
+        }
+
+        // Entering a new page of the offset table reads it first
+        if (index_page && i > 0 && i % index_page == 0) {
+            uint32_t entries = h->num_frames - i < index_page ? h->num_frames - i + 1 : index_page + 1;
+            vreq = host_read(&drive, vreq, base + h->header_size + (uint64_t)i * 4, (uint64_t)entries * 4);
+            vreq = read_side_tables(&drive, c, vreq, i, entries);
+            r->index_reads++;
+        }
+
+        // Repeats (zero-length entries) aren't read or decoded
+        uint32_t size = offsets[i + 1] - offsets[i];
+        double done = size ? host_read(&drive, vreq, base + offsets[i], size) : vreq;
+        timing[i].request = vreq - t0;
+        timing[i].arrival = done - t0;
+        timing[i].decode = size ? frame_decode(c, i, decode) : 0;
+        timing[i].deadline = frame_start(c, i + 1) - timing[i].decode;
+        double slack = timing[i].deadline - timing[i].arrival;
+        int heavy = c->cost && timing[i].deadline < frame_start(c, i);
+        if (slack < 0) r->late_frames++;
+        r->heavy_frames += heavy;
+        r->late_heavy += heavy && slack < 0;
+        if (i == 0 || slack < r->worst_slack) r->worst_slack = slack;
+        if (i == 0) r->first_frame = done;
+
+        // Bytes sitting in the read-ahead queue when this frame lands
+        uint64_t buffered = 0;
+        for (int j = i; j >= 0 && t0 + frame_start(c, j) > done; --j)
+            buffered += offsets[j + 1] - offsets[j];
+        if (buffered > r->max_buffered) r->max_buffered = buffered;
+
+        prev_done = done;
+        i++;
+    }
+
+    r->seeks = drive.seeks;
+    r->hits = drive.hits;
+    r->seek_time = drive.seek_time;
+    if (next)
+        simulate_switch(&drive, next, t0 + frame_start(c, h->num_frames), pl_done, am, index_page, decode);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] <movie.dcmv> [<next.dcmv> ...]\n", prog);
+    printf("Drive model:\n");
+    printf("  --rate <bytes/s>      Sustained read rate (default 1200000)\n");
+    printf("  --bus-rate <bytes/s>  Drive buffer to RAM rate (default 10000000)\n");
+    printf("  --seek-min-ms <ms>    Short seek latency (default 20)\n");
+    printf("  --seek-ms <ms>        Full stroke seek latency (default 150)\n");
+    printf("  --cmd-ms <ms>         Per-read command overhead (default 1)\n");
+    printf("  --disc-mb <mb>        Disc span for seek scaling (default 1000)\n");
+    printf("  --sector <bytes>      Sector size (default 2048)\n");
+    printf("  --cache-kb <kb>       Drive read-ahead buffer (default 128)\n");
+    printf("  --fs-cache <n>        iso9660 cache sectors, max %d (default 16)\n", MAX_FS_CACHE);
+    printf("Player model:\n");
+    printf("  --poll-ms <ms>        Audio poll period (default 20)\n");
+    printf("  --audio-buf <bytes>   Stream buffer per channel (default 8192)\n");
+    printf("  --decode-ms <ms>      Decode + upload time per frame without a COST chunk (default 4)\n");
+    printf("  --upload-ms <ms>      Upload time added to COST decode estimates (default 2)\n");
+    printf("  --readahead <n>       Frames the reader runs ahead (default 0, as fmv_play.c)\n");
+    printf("  --index-page <n>      Offset table page in frames (default %d, as fmv_play.c;\n", DCMV_INDEX_PAGE_FRAMES);
+    printf("                        0 = whole table at startup)\n");
+    printf("  --ram-clip-kb <kb>    Playlist: next clips up to this size are preloaded whole\n");
+    printf("                        (default 4096, RAM_CLIP_MAX in fmv_play.c)\n");
+    printf("Output:\n");
+    printf("  --csv <file>          Per-frame request/arrival/deadline times (first file)\n");
+}
+
+// Read a file's header and offset table; it sits at `base` on the disc
+static int load_clip(clip_t *c, const char *path, uint64_t base) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror("Open failed"); return -1; }
+    c->path = path;
+    c->base = base;
+    if (dcmv_read_header(fp, &c->h) < 0 || c->h.num_frames == 0) {
+        fprintf(stderr, "%s is not a DCMV file\n", path);
+        fclose(fp);
+        return -1;
+    }
+    c->offsets = malloc((c->h.num_frames + 1) * sizeof(uint32_t));
+    if (!c->offsets) {
+        fprintf(stderr, "OOM\n");
+        fclose(fp);
+        return -1;
+    }
+    fseek(fp, c->h.header_size, SEEK_SET);
+    if (fread(c->offsets, sizeof(uint32_t), c->h.num_frames + 1, fp) != c->h.num_frames + 1) {
+        fprintf(stderr, "%s: truncated offset table\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    c->size = ftell(fp);
+    c->audio_end = dcmv_audio_end(&c->h, c->size);
+    c->fd = (double)c->h.fps_den / c->h.fps_num;
+    c->start = NULL;
+
+    // Variable frame rate: frame times from the PTS chunk, frame 0 at pts[0]
+    uint32_t timescale, count = c->h.num_frames + 1;
+    c->pts_pos = dcmv_find_pts(fp, &c->h, &timescale);
+    if (c->pts_pos >= 0) {
+        uint32_t *pts = malloc(count * sizeof(uint32_t));
+        c->start = malloc(count * sizeof(double));
+        if (!pts || !c->start || fseek(fp, c->pts_pos, SEEK_SET) != 0 || fread(pts, 4, count, fp) != count) {
+            fprintf(stderr, "%s: can't read the PTS table\n", path);
+            fclose(fp);
+            return -1;
+        }
+        for (uint32_t i = 0; i < count; ++i)
+            c->start[i] = (double)pts[i] / timescale;
+        free(pts);
+    }
+
+    // Per-frame decode estimates
+    c->cost = NULL;
+    c->cost_pos = dcmv_find_cost(fp, &c->h);
+    if (c->cost_pos >= 0) {
+        c->cost = malloc(c->h.num_frames * sizeof(uint16_t));
+        if (!c->cost || fseek(fp, c->cost_pos, SEEK_SET) != 0 ||
+            fread(c->cost, 2, c->h.num_frames, fp) != c->h.num_frames) {
+            fprintf(stderr, "%s: can't read the COST table\n", path);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Playlist: each clip plays with the next one preloading, and each switch is
+ * compared with reopening the next file after the clip ends. Late frames are
+ * counted per clip with the preload competing for the drive.
+ */
+static int simulate_playlist(clip_t *clips, int n, const drive_model_t *m, const audio_model_t *am,
+                             int readahead, uint32_t index_page, uint64_t ram_clip, double decode) {
+    int stutter = 0;
+    printf("\n▶️ Playlist of %d clips, read-ahead %d frame(s), audio buffer %u B/ch:\n", n, readahead, am->buffer);
+    for (int i = 0; i < n; ++i) {
+        frame_timing_t *timing = malloc(clips[i].h.num_frames * sizeof(frame_timing_t));
+        if (!timing) {
+            fprintf(stderr, "OOM\n");
+            return 1;
+        }
+        sim_result_t r, alone;
+        next_clip_t pre = { .clip = &clips[i + 1], .preload = 1, .ram_clip = ram_clip };
+        next_clip_t reopen = { .clip = &clips[i + 1] };
+        int last = i + 1 == n;
+        simulate(&clips[i], m, am, readahead, index_page, decode, last ? NULL : &pre, timing, &r);
+        simulate(&clips[i], m, am, readahead, index_page, decode, last ? NULL : &reopen, timing, &alone);
+        free(timing);
+
+        printf("  🎬 %s: %u frames, %d late (%d without preloading), %d audio underrun(s)\n",
+               clips[i].path, clips[i].h.num_frames, r.late_frames, alone.late_frames, r.audio_underruns);
+        if (r.late_frames || r.audio_underruns) stutter = 1;
+        if (last) break;
+
+        const dcmv_header_t *a = &clips[i].h, *b = &clips[i + 1].h;
+        printf("  ⏭ switch to %s:\n", clips[i + 1].path);
+        printf("      preload: %llu B in %d read(s), done %.1f ms %s the switch\n",
+               (unsigned long long)pre.preload_bytes, pre.preload_reads, fabs(pre.preload_lead) * 1000,
+               pre.preload_lead >= 0 ? "before" : "after");
+        printf("      first frame: %s (reopening: %.1f ms late)\n",
+               pre.late > 0 ? "late" : "on time", reopen.late * 1000);
+        if (pre.late > 0)
+            printf("        %.1f ms late with preloading\n", pre.late * 1000);
+        if (a->sample_rate != b->sample_rate || a->channels != b->channels ||
+            (b->channels == 2 && !b->audio_block_size) || (a->channels == 2 && !a->audio_block_size))
+            printf("      audio: the stream restarts (rate, channels or stereo layout differ); reopening: %.1f ms of silence\n",
+                   reopen.silence * 1000);
+        else
+            printf("      audio: %.1f ms of silence (reopening: %.1f ms)\n", pre.silence * 1000, reopen.silence * 1000);
+        if (pre.late > 0 || pre.silence > 0) stutter = 1;
+    }
+    return stutter ? 2 : 0;
+}
+
+int main(int argc, char **argv) {
+    drive_model_t m = {
+        .rate = 1200000, .bus_rate = 10000000, .seek_min = 0.020, .seek_max = 0.150,
+        .cmd_overhead = 0.001, .disc_bytes = 1000.0 * 1024 * 1024, .sector = 2048,
+        .cache = 128 * 1024, .fs_cache = 16,
+    };
+    audio_model_t am = { .poll = 0.020, .buffer = 8192 };
+    double decode = 0.004, upload = 0.002;
+    int readahead = 0;
+    uint32_t index_page = DCMV_INDEX_PAGE_FRAMES;
+    uint64_t ram_clip = 4096 * 1024;
+    const char *csv_path = NULL;
+    const char *paths[MAX_CLIPS];
+    int num_paths = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *opt = argv[i];
+        if (strncmp(opt, "--", 2) != 0) {
+            if (num_paths == MAX_CLIPS) {
+                fprintf(stderr, "At most %d files\n", MAX_CLIPS);
+                return 1;
+            }
+            paths[num_paths++] = opt;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        double v = atof(argv[++i]);
+        if (!strcmp(opt, "--rate")) m.rate = v;
+        else if (!strcmp(opt, "--bus-rate")) m.bus_rate = v;
+        else if (!strcmp(opt, "--seek-min-ms")) m.seek_min = v / 1000.0;
+        else if (!strcmp(opt, "--seek-ms")) m.seek_max = v / 1000.0;
+        else if (!strcmp(opt, "--cmd-ms")) m.cmd_overhead = v / 1000.0;
+        else if (!strcmp(opt, "--disc-mb")) m.disc_bytes = v * 1024 * 1024;
+        else if (!strcmp(opt, "--sector")) m.sector = (uint32_t)v;
+        else if (!strcmp(opt, "--cache-kb")) m.cache = (uint32_t)(v * 1024);
+        else if (!strcmp(opt, "--fs-cache")) m.fs_cache = (int)v;
+        else if (!strcmp(opt, "--poll-ms")) am.poll = v / 1000.0;
+        else if (!strcmp(opt, "--audio-buf")) am.buffer = (uint32_t)v;
+        else if (!strcmp(opt, "--decode-ms")) decode = v / 1000.0;
+        else if (!strcmp(opt, "--upload-ms")) upload = v / 1000.0;
+        else if (!strcmp(opt, "--readahead")) readahead = (int)v;
+        else if (!strcmp(opt, "--index-page")) index_page = (uint32_t)v;
+        else if (!strcmp(opt, "--ram-clip-kb")) ram_clip = (uint64_t)(v * 1024);
+        else if (!strcmp(opt, "--csv")) csv_path = argv[i];
+        else {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!num_paths || m.sector == 0 || m.rate <= 0 || m.fs_cache < 0 || m.fs_cache > MAX_FS_CACHE) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Back to back on the disc, each file starting on a sector
+    clip_t clips[MAX_CLIPS];
+    uint64_t base = 0;
+    for (int i = 0; i < num_paths; ++i) {
+        if (load_clip(&clips[i], paths[i], base) < 0)
+            return 1;
+        clips[i].upload = upload;
+        base += (clips[i].size + m.sector - 1) / m.sector * m.sector;
+    }
+    const dcmv_header_t h = clips[0].h;
+    const uint32_t *offsets = clips[0].offsets;
+    frame_timing_t *timing = malloc(h.num_frames * sizeof(frame_timing_t));
+    if (!timing) {
+        fprintf(stderr, "OOM\n");
+        return 1;
+    }
+
+    double duration = frame_start(&clips[0], h.num_frames);
+    uint64_t video_bytes = offsets[h.num_frames] - offsets[0];
+    for (int i = 0; i < num_paths; ++i)
+        printf("📦 %s: %ux%u @ %.6gfps%s, %u frames (%.1fs), %uHz %uch\n", clips[i].path, clips[i].h.width,
+               clips[i].h.height, (double)clips[i].h.fps_num / clips[i].h.fps_den, clips[i].start ? " (PTS)" : "",
+               clips[i].h.num_frames, frame_start(&clips[i], clips[i].h.num_frames),
+               clips[i].h.sample_rate, clips[i].h.channels);
+    printf("💿 Drive: %.0f B/s, seek %.0f-%.0f ms, %u B sectors, %u KB cache, %d fs cache sectors\n",
+           m.rate, m.seek_min * 1000, m.seek_max * 1000, m.sector, m.cache / 1024, m.fs_cache);
+    if (num_paths > 1) {
+        int rv = simulate_playlist(clips, num_paths, &m, &am, readahead, index_page, ram_clip, decode);
+        for (int i = 0; i < num_paths; ++i) {
+            free(clips[i].offsets);
+            free(clips[i].start);
+            free(clips[i].cost);
+        }
+        free(timing);
+        return rv;
+    }
+    printf("📊 Demand: video %.0f B/s avg, audio %.0f B/s\n", video_bytes / duration,
+           (double)h.sample_rate * (h.channels ? h.channels : 1) / 2.0);
+
+    sim_result_t r;
+    simulate(&clips[0], &m, &am, readahead, index_page, decode, NULL, timing, &r);
+    printf("\n▶️ Read-ahead %d frame(s), audio buffer %u B/ch:\n", readahead, am.buffer);
+    printf("    first frame ready at %.1f ms\n", r.first_frame * 1000);
+    if (index_page)
+        // dcmv_index_t, resized: an entry is an offset, source, timestamp and decode estimate
+        printf("    offset table: %u B resident (%d x %u-frame pages), %d page read(s) during playback\n",
+               (unsigned)(sizeof(dcmv_index_t) + DCMV_INDEX_PAGES * ((long)index_page - DCMV_INDEX_PAGE_FRAMES) * 12),
+               DCMV_INDEX_PAGES, index_page,
+               r.index_reads);
+    else
+        printf("    offset table: %u B resident (whole table)\n", (h.num_frames + 1) * 4);
+    printf("    %d seeks (%.1f s total), %d buffer hits\n", r.seeks, r.seek_time, r.hits);
+    printf("    %d late frame(s), worst slack %.1f ms\n", r.late_frames, r.worst_slack * 1000);
+    if (clips[0].cost)
+        printf("    %d frame(s) estimated to decode + upload in more than their slot, %d of them late\n",
+               r.heavy_frames, r.late_heavy);
+    printf("    %d audio underrun(s), %.1f ms of silence\n", r.audio_underruns, r.audio_gap * 1000);
+
+    if (csv_path) {
+        FILE *csv = fopen(csv_path, "w");
+        if (!csv) { perror("CSV open failed"); return 1; }
+        fprintf(csv, "frame,size,request_ms,arrival_ms,deadline_ms,slack_ms,decode_ms\n");
+        for (uint32_t i = 0; i < h.num_frames; ++i)
+            fprintf(csv, "%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f\n", i, offsets[i + 1] - offsets[i],
+                    timing[i].request * 1000, timing[i].arrival * 1000, timing[i].deadline * 1000,
+                    (timing[i].deadline - timing[i].arrival) * 1000, timing[i].decode * 1000);
+        fclose(csv);
+        printf("    per-frame timings written to %s\n", csv_path);
+    }
+
+    // Smallest video read-ahead with no late frames at this audio buffer.
+    // More read-ahead never makes a frame later, so bisect.
+    int min_ra = -1;
+    sim_result_t ra;
+    simulate(&clips[0], &m, &am, MAX_READAHEAD_FRAMES, index_page, decode, NULL, timing, &ra);
+    if (ra.late_frames == 0) {
+        int lo = 0, hi = MAX_READAHEAD_FRAMES;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            simulate(&clips[0], &m, &am, mid, index_page, decode, NULL, timing, &ra);
+            if (ra.late_frames == 0) hi = mid;
+            else lo = mid + 1;
+        }
+        min_ra = lo;
+        simulate(&clips[0], &m, &am, min_ra, index_page, decode, NULL, timing, &ra);
+    }
+
+    // Smallest audio stream buffer with no underruns at that read-ahead
+    uint32_t min_abuf = 0;
+    sim_result_t ab;
+    for (uint32_t buf = 2048; buf <= 1024 * 1024; buf *= 2) {
+        audio_model_t try_am = am;
+        try_am.buffer = buf;
+        simulate(&clips[0], &m, &try_am, min_ra < 0 ? readahead : min_ra, index_page,
+                 decode, NULL, timing, &ab);
+        if (ab.audio_underruns == 0) {
+            min_abuf = buf;
+            break;
+        }
+    }
+
+    printf("\n🧮 Minimum to play without stutter:\n");
+    if (min_ra >= 0)
+        printf("    video read-ahead: %d frame(s), %llu bytes peak queue\n", min_ra,
+               (unsigned long long)ra.max_buffered);
+    else
+        printf("    video read-ahead: ❌ none up to %d frames, the drive cannot sustain this file\n",
+               MAX_READAHEAD_FRAMES);
+    if (min_abuf)
+        printf("    audio buffer:     %u bytes per channel\n", min_abuf);
+    else
+        printf("    audio buffer:     ❌ none up to 1 MB per channel\n");
+
+    free(clips[0].offsets);
+    free(clips[0].start);
+    free(clips[0].cost);
+    free(timing);
+    return (r.late_frames || r.audio_underruns) ? 2 : 0;
+}
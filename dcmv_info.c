@@ -0,0 +1,663 @@
+/*
+ * dcmv_info.c
+ * ---------------------
+ * Shows what's inside a .dcmv file.
+ *
+ * The file is memory-mapped and only the header, the offset table and the
+ * extension chunks are read, never the frames themselves, so a multi-GB
+ * movie is summed up as fast as a short clip. It reports:
+ *   - Header: every field, the duration and the chunks present
+ *   - Layout: how the file splits into header and offset table, video,
+ *     audio and chunks, and the mean bytes/sec of video and audio
+ *   - Frames: stored and repeated frames, compressed size min / median /
+ *     95th percentile / max, compression ratio; every frame with --frames
+ *   - Bitrate: video + audio bytes/sec over a sliding window (--window,
+ *     the same measure as pack_dcmv's --peak-bps), its peak, and a timeline
+ *     of the mean and peak in --timeline rows
+ *   - Scenes: per scene from the CUTS chunk, its length, stored bytes,
+ *     compression ratio, bitrate and mean decode estimate
+ *   - Hot spots: the --top largest frames, and the slowest to decode from
+ *     the COST chunk. Files packed before COST can be estimated with
+ *     --estimate, which does read every frame (dcmv_lz4cost.h)
+ *
+ * Frame times come from the PTS chunk when there is one, the header's exact
+ * rate otherwise. Audio is constant-rate ADPCM, so its share of a window is
+ * its mean rate. --json prints all of it as one JSON object instead.
+ *
+ * Usage:
+ *   dcmv_info [options] <movie.dcmv>
+ *
+ * Build:
+ *   gcc -O2 dcmv_info.c -o dcmv_info
+ *
+ * Exits with status 2 when the offset table is broken (dcmv_verify says
+ * where), 1 if the file can't be read.
+ *
+ * Author: Troy Davis (gpf)
+ * GitHub: https://github.com/GPF
+ * License: Public Domain / MIT-style — use freely with attribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dcmv_format.h"
+#include "dcmv_lz4cost.h"
+
+#define MAX_TOP     100
+#define MAX_ROWS    1000
+#define BAR_WIDTH   30
+
+typedef struct {
+    uint32_t first, frames, stored;
+    uint64_t bytes;
+    double start, seconds;
+    double ratio;               // decompressed / stored bytes
+    double bps;                 // video + audio
+    double cost_ms;             // mean decode estimate of its stored frames, -1 without
+} scene_t;
+
+typedef struct {
+    double start;
+    double mean_bps, peak_bps;
+} row_t;
+
+typedef struct {
+    const char *path;
+    const uint8_t *file;
+    uint64_t file_size;
+    dcmv_header_t h;
+    uint32_t *offsets;          // copied out of the map, (num_frames + 1)
+    double *start;              // frame start times in seconds, (num_frames + 1), the last one the end
+    uint16_t *cost;             // decode estimates in us, NULL without
+    int cost_estimated;         // --estimate rather than the COST chunk
+    uint32_t *cuts;
+    uint32_t num_cuts;
+    int has_cuts;               // a usable CUTS chunk, even one with no cuts
+    uint32_t timescale;         // PTS chunk, 0 = header rate
+    uint32_t loop_start, loop_end;
+    int has_loop;
+
+    uint64_t table_bytes, video_bytes, audio_bytes, chunk_bytes;
+    double duration, video_bps, audio_bps;
+
+    uint32_t stored, repeats;
+    uint32_t size_min, size_median, size_p95, size_max;
+
+    double window;
+    double peak_bps, peak_start;
+    uint32_t peak_frame;
+    row_t rows[MAX_ROWS];
+    int num_rows;
+
+    scene_t *scenes;
+    uint32_t num_scenes;
+
+    uint32_t largest[MAX_TOP], slowest[MAX_TOP];
+    int num_largest, num_slowest;
+} info_t;
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t frame_bytes(const info_t *in, uint32_t i) {
+    return in->offsets[i + 1] - in->offsets[i];
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Keep the n frames with the highest key in top[], highest first, earliest on a tie */
+static void top_insert(uint32_t *top, int *len, int n, uint32_t frame, uint32_t key, uint32_t (*key_of)(const info_t *, uint32_t),
+                       const info_t *in) {
+    if (!n)
+        return;
+    int k = *len < n ? (*len)++ : n;
+    if (k == n && key <= key_of(in, top[n - 1]))
+        return;
+    if (k == n)
+        k = n - 1;
+    while (k > 0 && key > key_of(in, top[k - 1])) {
+        top[k] = top[k - 1];
+        k--;
+    }
+    top[k] = frame;
+}
+
+static uint32_t cost_of(const info_t *in, uint32_t i) {
+    return in->cost[i];
+}
+
+/* Offset table, chunks and frame times out of the map; -1 if they don't hold together */
+static int load(info_t *in) {
+    const dcmv_header_t *h = &in->h;
+    uint64_t table_end = h->header_size + (uint64_t)(h->num_frames + 1) * 4;
+    uint64_t audio_end = dcmv_audio_end(h, (uint32_t)in->file_size);
+    if (table_end > in->file_size || h->audio_offset > audio_end || audio_end > in->file_size) {
+        fprintf(stderr, "❌ Truncated: header wants %llu bytes of offset table and audio up to 0x%llX, file is %llu\n",
+                (unsigned long long)table_end, (unsigned long long)audio_end, (unsigned long long)in->file_size);
+        return -1;
+    }
+
+    in->offsets = malloc((h->num_frames + 1) * sizeof(uint32_t));
+    in->start = malloc((h->num_frames + 1) * sizeof(double));
+    if (!in->offsets || !in->start) {
+        fprintf(stderr, "OOM\n");
+        return -1;
+    }
+    memcpy(in->offsets, in->file + h->header_size, (h->num_frames + 1) * 4);
+    if (in->offsets[0] < table_end || in->offsets[h->num_frames] != h->audio_offset) {
+        fprintf(stderr, "❌ Offset table doesn't span the video region (0x%X-0x%X, audio at 0x%X)\n",
+                in->offsets[0], in->offsets[h->num_frames], h->audio_offset);
+        return -1;
+    }
+    for (uint32_t i = 0; i < h->num_frames; ++i) {
+        if (in->offsets[i + 1] < in->offsets[i]) {
+            fprintf(stderr, "❌ Offset table goes backwards at frame %u\n", i);
+            return -1;
+        }
+    }
+
+    in->table_bytes = in->offsets[0];
+    in->video_bytes = h->audio_offset - in->offsets[0];
+    in->audio_bytes = audio_end - h->audio_offset;
+    in->chunk_bytes = in->file_size - audio_end;
+
+    // The chunk list was walked by dcmv_verify; take what's usable, as the player does
+    const uint8_t *pts = NULL;
+    for (uint64_t pos = h->ext_offset; h->ext_offset && in->file_size - pos >= 8;) {
+        const uint8_t *c = in->file + pos;
+        uint32_t len = get_u32(c + 4);
+        if (len > in->file_size - pos - 8)
+            break;
+        if (!memcmp(c, DCMV_CHUNK_PTS, 4) && len >= 8 + (uint64_t)(h->num_frames + 1) * 4 &&
+            get_u32(c + 8) && get_u32(c + 12) == h->num_frames + 1) {
+            in->timescale = get_u32(c + 8);
+            pts = c + 16;
+        }
+        if (!memcmp(c, DCMV_CHUNK_COST, 4) && len >= 4 + (uint64_t)h->num_frames * 2 &&
+            get_u32(c + 8) == h->num_frames && (in->cost = malloc(h->num_frames * 2))) {
+            memcpy(in->cost, c + 12, h->num_frames * 2);
+        }
+        if (!memcmp(c, DCMV_CHUNK_CUTS, 4) && len >= 4) {
+            uint32_t count = get_u32(c + 8);
+            if (count < h->num_frames && len >= 4 + (uint64_t)count * 4 && (in->cuts = malloc(count * 4 + 4))) {
+                memcpy(in->cuts, c + 12, count * 4);
+                in->num_cuts = count;
+                in->has_cuts = 1;
+            }
+        }
+        if (!memcmp(c, DCMV_CHUNK_LOOP, 4) && len >= 8) {
+            in->loop_start = get_u32(c + 8);
+            in->loop_end = get_u32(c + 12);
+            in->has_loop = in->loop_start < in->loop_end && in->loop_end <= h->num_frames;
+        }
+        pos += 8 + (uint64_t)len;
+    }
+
+    for (uint32_t i = 0; i <= h->num_frames; ++i) {
+        if (pts)
+            in->start[i] = (double)(get_u32(pts + i * 4) - get_u32(pts)) / in->timescale;
+        else
+            in->start[i] = (double)i * h->fps_den / h->fps_num;
+    }
+    in->duration = in->start[h->num_frames];
+    if (in->duration <= 0)
+        in->duration = (double)h->num_frames * h->fps_den / h->fps_num;
+    for (uint32_t k = 0; k < in->num_cuts; ++k) {
+        if (in->cuts[k] <= (k ? in->cuts[k - 1] : 0) || in->cuts[k] >= h->num_frames) {
+            fprintf(stderr, "⚠️  CUTS chunk out of order at cut %u, ignored\n", k);
+            in->num_cuts = 0;
+            in->has_cuts = 0;
+        }
+    }
+    return 0;
+}
+
+/* Decode estimates for files packed before the COST chunk: reads every frame */
+static void estimate_cost(info_t *in) {
+    if (!(in->cost = calloc(in->h.num_frames, 2)))
+        return;
+    in->cost_estimated = 1;
+    madvise((void *)(in->file + in->offsets[0]), in->video_bytes, MADV_SEQUENTIAL);
+    for (uint32_t i = 0; i < in->h.num_frames; ++i) {
+        dcmv_lz4_cost_t c;
+        int64_t cycles = dcmv_lz4_cost(in->file + in->offsets[i], frame_bytes(in, i), &c);
+        in->cost[i] = frame_bytes(in, i) && cycles >= 0 ? dcmv_lz4_cost_us((uint64_t)cycles) : 0;
+    }
+}
+
+static void frame_stats(info_t *in, int top) {
+    const dcmv_header_t *h = &in->h;
+    uint32_t *sizes = malloc(h->num_frames * sizeof(uint32_t));
+    for (uint32_t i = 0; i < h->num_frames; ++i) {
+        uint32_t size = frame_bytes(in, i);
+        if (!size) {
+            in->repeats++;
+            continue;
+        }
+        if (sizes)
+            sizes[in->stored] = size;
+        in->stored++;
+        top_insert(in->largest, &in->num_largest, top, i, size, frame_bytes, in);
+        if (in->cost)
+            top_insert(in->slowest, &in->num_slowest, top, i, in->cost[i], cost_of, in);
+    }
+    if (sizes && in->stored) {
+        qsort(sizes, in->stored, sizeof(uint32_t), cmp_u32);
+        in->size_min = sizes[0];
+        in->size_median = sizes[in->stored / 2];
+        in->size_p95 = sizes[(uint32_t)(in->stored * 0.95)];
+        in->size_max = sizes[in->stored - 1];
+    }
+    free(sizes);
+    in->video_bps = in->video_bytes / in->duration;
+    in->audio_bps = in->audio_bytes / in->duration;
+}
+
+/*
+ * Video + audio bytes/sec over [start of frame j, + window) for every j,
+ * folded into the timeline rows. Windows that would run past the end are
+ * taken as the last whole one; a file shorter than the window is one window.
+ * Rows hold whole frames, so a row's mean is over exactly the frames in it,
+ * and a row shorter than the window counts as a window of its own: its
+ * peak is never below its mean.
+ */
+static void bitrate(info_t *in, int rows) {
+    const dcmv_header_t *h = &in->h;
+    double w = in->window < in->duration ? in->window : in->duration;
+    uint64_t bytes = 0, row_bytes = 0;
+    uint32_t end = 0;
+    double last = 0;
+    if ((uint32_t)rows > h->num_frames)
+        rows = (int)h->num_frames;
+    in->num_rows = rows;
+
+    int r = 0;
+    uint32_t row_first = 0, row_next = h->num_frames / rows;
+    for (uint32_t j = 0; j < h->num_frames; ++j) {
+        double bps = last;
+        if (in->start[j] + w <= in->duration + 1e-9) {
+            while (end < h->num_frames && in->start[end] < in->start[j] + w - 1e-9)
+                bytes += frame_bytes(in, end++);
+            bps = last = bytes / w + in->audio_bps;
+            if (bps > in->peak_bps) {
+                in->peak_bps = bps;
+                in->peak_frame = j;
+                in->peak_start = in->start[j];
+            }
+        }
+        if (j < end)
+            bytes -= frame_bytes(in, j);
+
+        if (j == row_first)
+            in->rows[r] = (row_t){ .start = in->start[j] };
+        if (bps > in->rows[r].peak_bps)
+            in->rows[r].peak_bps = bps;
+        row_bytes += frame_bytes(in, j);
+        if (j + 1 == row_next) {
+            row_t *row = &in->rows[r];
+            double secs = in->start[row_next] - row->start;
+            row->mean_bps = (secs > 0 ? row_bytes / secs : 0) + in->audio_bps;
+            if (secs < w && row->mean_bps > row->peak_bps)
+                row->peak_bps = row->mean_bps;
+            row_bytes = 0;
+            row_first = row_next;
+            row_next = (uint32_t)((uint64_t)h->num_frames * (++r + 1) / rows);
+        }
+    }
+}
+
+static void scene_stats(info_t *in) {
+    const dcmv_header_t *h = &in->h;
+    in->num_scenes = in->num_cuts + 1;
+    in->scenes = calloc(in->num_scenes, sizeof(scene_t));
+    if (!in->scenes) {
+        in->num_scenes = 0;
+        return;
+    }
+    for (uint32_t k = 0; k < in->num_scenes; ++k) {
+        scene_t *s = &in->scenes[k];
+        uint32_t first = k ? in->cuts[k - 1] : 0, next = k < in->num_cuts ? in->cuts[k] : h->num_frames;
+        uint64_t us = 0;
+        s->first = first;
+        s->frames = next - first;
+        s->bytes = in->offsets[next] - in->offsets[first];
+        s->start = in->start[first];
+        s->seconds = in->start[next] - in->start[first];
+        for (uint32_t i = first; i < next; ++i) {
+            if (!frame_bytes(in, i))
+                continue;
+            s->stored++;
+            if (in->cost)
+                us += in->cost[i];
+        }
+        s->ratio = s->bytes ? (double)s->frames * h->frame_size / s->bytes : 0;
+        s->bps = s->seconds > 0 ? s->bytes / s->seconds + in->audio_bps : 0;
+        s->cost_ms = in->cost && s->stored ? us / 1000.0 / s->stored : -1;
+    }
+}
+
+static const char *fmt_bytes(char *buf, double n) {
+    if (n >= 1e9) sprintf(buf, "%.2f GB", n / 1e9);
+    else if (n >= 1e6) sprintf(buf, "%.2f MB", n / 1e6);
+    else if (n >= 1e3) sprintf(buf, "%.1f kB", n / 1e3);
+    else sprintf(buf, "%.0f B", n);
+    return buf;
+}
+
+static const char *fmt_time(char *buf, double s) {
+    unsigned t = (unsigned)(s * 10 + 0.5);
+    sprintf(buf, "%u:%02u:%02u.%u", t / 36000, t / 600 % 60, t / 10 % 60, t % 10);
+    return buf;
+}
+
+static double pct(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+static void print_text(const info_t *in, int frames) {
+    const dcmv_header_t *h = &in->h;
+    char a[32], b[32], c[32], d[32], e[32];
+
+    printf("📦 %s: DCMV v%u, %s %ux%u @ %u/%u fps (%.3f), %u frames, %s\n", in->path, h->version,
+           h->frame_type == DCMV_FRAME_YUV420P ? "YUV420P" : "RGB565 VQ", h->width, h->height, h->fps_num,
+           h->fps_den, (double)h->fps_num / h->fps_den, h->num_frames, fmt_time(a, in->duration));
+    printf("   frame_size=%u max_compressed_size=%u audio_offset=0x%X audio_block_size=%u ext_offset=0x%X\n",
+           h->frame_size, h->max_compressed_size, h->audio_offset, h->audio_block_size, h->ext_offset);
+    printf("🔊 Audio: %u Hz, %u ch ADPCM%s\n", h->sample_rate, h->channels,
+           h->audio_block_size ? "" : " (legacy dcaconv layout)");
+    if (in->timescale)
+        printf("⏱️  Per-frame timestamps, %u ticks/s\n", in->timescale);
+    if (in->has_loop)
+        printf("🔁 Loops frames %u-%u\n", in->loop_start, in->loop_end - 1);
+    for (uint64_t pos = h->ext_offset; h->ext_offset && in->file_size - pos >= 8;) {
+        uint32_t len = get_u32(in->file + pos + 4);
+        printf("🧩 Chunk %.4s: %u bytes\n", (const char *)in->file + pos, len);
+        if (len > in->file_size - pos - 8)
+            break;
+        pos += 8 + (uint64_t)len;
+    }
+
+    printf("🧱 Layout: %s total, header + offset table %s (%.1f%%), video %s (%.1f%%), audio %s (%.1f%%), chunks %s (%.1f%%)\n",
+           fmt_bytes(a, in->file_size), fmt_bytes(b, in->table_bytes), pct(in->table_bytes, in->file_size),
+           fmt_bytes(c, in->video_bytes), pct(in->video_bytes, in->file_size), fmt_bytes(d, in->audio_bytes),
+           pct(in->audio_bytes, in->file_size), fmt_bytes(e, in->chunk_bytes), pct(in->chunk_bytes, in->file_size));
+    printf("   video %.1f kB/s, audio %.1f kB/s\n", in->video_bps / 1e3, in->audio_bps / 1e3);
+
+    printf("🎞️  %u stored frame(s), %u repeat(s); size min %s, median %s, 95%% %s, max %s; %.1f:1 overall\n",
+           in->stored, in->repeats, fmt_bytes(a, in->size_min), fmt_bytes(b, in->size_median),
+           fmt_bytes(c, in->size_p95), fmt_bytes(d, in->size_max),
+           in->video_bytes ? (double)h->num_frames * h->frame_size / in->video_bytes : 0.0);
+
+    printf("📈 Bitrate (video + audio) over %.2f s windows: mean %.1f kB/s, peak %.1f kB/s at %s (frame %u)\n",
+           in->window, (in->video_bps + in->audio_bps) / 1e3, in->peak_bps / 1e3, fmt_time(a, in->peak_start),
+           in->peak_frame);
+    double top = 0;
+    for (int r = 0; r < in->num_rows; ++r)
+        if (in->rows[r].peak_bps > top)
+            top = in->rows[r].peak_bps;
+    printf("   %-11s %10s %10s\n", "from", "mean kB/s", "peak kB/s");
+    for (int r = 0; r < in->num_rows; ++r) {
+        const row_t *row = &in->rows[r];
+        int mean = top > 0 ? (int)(row->mean_bps / top * BAR_WIDTH + 0.5) : 0;
+        int peak = top > 0 ? (int)(row->peak_bps / top * BAR_WIDTH + 0.5) : 0;
+        printf("   %-11s %10.1f %10.1f  ", fmt_time(a, row->start), row->mean_bps / 1e3, row->peak_bps / 1e3);
+        for (int x = 0; x < BAR_WIDTH; ++x)
+            fputs(x < mean ? "█" : x < peak ? "▒" : " ", stdout);
+        putchar('\n');
+    }
+
+    if (in->num_cuts)
+        printf("🎬 %u scene(s) from the CUTS chunk\n", in->num_scenes);
+    else if (in->has_cuts)
+        printf("🎬 CUTS chunk has no scene cuts: the whole file as one scene\n");
+    else
+        printf("🎬 No CUTS chunk: the whole file as one scene\n");
+    printf("   %5s %8s %-11s %8s %10s %8s %10s %10s\n", "scene", "frame", "start", "frames", "stored", "ratio",
+           "kB/s", "decode ms");
+    for (uint32_t k = 0; k < in->num_scenes; ++k) {
+        const scene_t *s = &in->scenes[k];
+        printf("   %5u %8u %-11s %8u %10s %7.1f:1 %10.1f ", k + 1, s->first, fmt_time(a, s->start), s->frames,
+               fmt_bytes(b, s->bytes), s->ratio, s->bps / 1e3);
+        if (s->cost_ms >= 0)
+            printf("%10.2f\n", s->cost_ms);
+        else
+            printf("%10s\n", "-");
+    }
+
+    printf("🏋️  Largest frames:\n");
+    for (int k = 0; k < in->num_largest; ++k) {
+        uint32_t i = in->largest[k];
+        printf("   frame %8u at %-11s %10s", i, fmt_time(a, in->start[i]), fmt_bytes(b, frame_bytes(in, i)));
+        if (in->cost)
+            printf("  %6.2f ms", in->cost[i] / 1000.0);
+        putchar('\n');
+    }
+    if (in->cost) {
+        printf("🐢 Slowest frames to decode (%s):\n", in->cost_estimated ? "estimated with --estimate" : "COST chunk");
+        for (int k = 0; k < in->num_slowest; ++k) {
+            uint32_t i = in->slowest[k];
+            printf("   frame %8u at %-11s %10s  %6.2f ms\n", i, fmt_time(a, in->start[i]),
+                   fmt_bytes(b, frame_bytes(in, i)), in->cost[i] / 1000.0);
+        }
+    } else {
+        printf("🐢 No COST chunk: --estimate reads every frame to rank them by decode time\n");
+    }
+
+    if (frames) {
+        printf("   %8s %-11s %10s %8s %10s\n", "frame", "start", "bytes", "ratio", "decode ms");
+        for (uint32_t i = 0; i < h->num_frames; ++i) {
+            uint32_t size = frame_bytes(in, i);
+            printf("   %8u %-11s %10u ", i, fmt_time(a, in->start[i]), size);
+            if (size)
+                printf("%7.1f:1", (double)h->frame_size / size);
+            else
+                printf("%8s", "repeat");
+            if (in->cost && size)
+                printf(" %10.2f", in->cost[i] / 1000.0);
+            putchar('\n');
+        }
+    }
+}
+
+static void json_str(const char *s) {
+    putchar('"');
+    for (; *s; ++s) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') printf("\\%c", ch);
+        else if (ch < 0x20) printf("\\u%04x", ch);
+        else putchar(ch);
+    }
+    putchar('"');
+}
+
+static void print_json(const info_t *in, int frames) {
+    const dcmv_header_t *h = &in->h;
+    printf("{\n  \"file\": ");
+    json_str(in->path);
+    printf(",\n  \"header\": {\"version\": %u, \"frame_type\": \"%s\", \"width\": %u, \"height\": %u, "
+           "\"fps_num\": %u, \"fps_den\": %u, \"sample_rate\": %u, \"channels\": %u, \"num_frames\": %u, "
+           "\"frame_size\": %u, \"max_compressed_size\": %u, \"audio_offset\": %u, \"audio_block_size\": %u, "
+           "\"ext_offset\": %u},\n",
+           h->version, h->frame_type == DCMV_FRAME_YUV420P ? "yuv420p" : "rgb565", h->width, h->height,
+           h->fps_num, h->fps_den, h->sample_rate, h->channels, h->num_frames, h->frame_size,
+           h->max_compressed_size, h->audio_offset, h->audio_block_size, h->ext_offset);
+    printf("  \"duration\": %.6f,\n", in->duration);
+    printf("  \"timescale\": %u,\n", in->timescale);
+    if (in->has_loop)
+        printf("  \"loop\": {\"start\": %u, \"end\": %u},\n", in->loop_start, in->loop_end);
+    printf("  \"chunks\": [");
+    int n = 0;
+    for (uint64_t pos = h->ext_offset; h->ext_offset && in->file_size - pos >= 8;) {
+        uint32_t len = get_u32(in->file + pos + 4);
+        printf("%s{\"tag\": \"%.4s\", \"size\": %u}", n++ ? ", " : "", (const char *)in->file + pos, len);
+        if (len > in->file_size - pos - 8)
+            break;
+        pos += 8 + (uint64_t)len;
+    }
+    printf("],\n");
+    printf("  \"layout\": {\"file\": %llu, \"header_and_table\": %llu, \"video\": %llu, \"audio\": %llu, "
+           "\"chunks\": %llu, \"video_bps\": %.1f, \"audio_bps\": %.1f},\n",
+           (unsigned long long)in->file_size, (unsigned long long)in->table_bytes,
+           (unsigned long long)in->video_bytes, (unsigned long long)in->audio_bytes,
+           (unsigned long long)in->chunk_bytes, in->video_bps, in->audio_bps);
+    printf("  \"frames\": {\"stored\": %u, \"repeats\": %u, \"min\": %u, \"median\": %u, \"p95\": %u, \"max\": %u, "
+           "\"ratio\": %.3f},\n",
+           in->stored, in->repeats, in->size_min, in->size_median, in->size_p95, in->size_max,
+           in->video_bytes ? (double)h->num_frames * h->frame_size / in->video_bytes : 0.0);
+    printf("  \"bitrate\": {\"window\": %.3f, \"mean_bps\": %.1f, \"peak_bps\": %.1f, \"peak_frame\": %u, "
+           "\"peak_start\": %.6f, \"timeline\": [",
+           in->window, in->video_bps + in->audio_bps, in->peak_bps, in->peak_frame, in->peak_start);
+    for (int r = 0; r < in->num_rows; ++r)
+        printf("%s\n    {\"start\": %.6f, \"mean_bps\": %.1f, \"peak_bps\": %.1f}", r ? "," : "", in->rows[r].start,
+               in->rows[r].mean_bps, in->rows[r].peak_bps);
+    printf("\n  ]},\n");
+    printf("  \"scenes\": [");
+    for (uint32_t k = 0; k < in->num_scenes; ++k) {
+        const scene_t *s = &in->scenes[k];
+        printf("%s\n    {\"first\": %u, \"frames\": %u, \"stored\": %u, \"start\": %.6f, \"seconds\": %.6f, "
+               "\"bytes\": %llu, \"ratio\": %.3f, \"bps\": %.1f",
+               k ? "," : "", s->first, s->frames, s->stored, s->start, s->seconds, (unsigned long long)s->bytes,
+               s->ratio, s->bps);
+        if (s->cost_ms >= 0)
+            printf(", \"decode_ms\": %.3f", s->cost_ms);
+        putchar('}');
+    }
+    printf("\n  ],\n");
+    printf("  \"largest\": [");
+    for (int k = 0; k < in->num_largest; ++k)
+        printf("%s{\"frame\": %u, \"bytes\": %u}", k ? ", " : "", in->largest[k], frame_bytes(in, in->largest[k]));
+    printf("],\n");
+    printf("  \"decode_estimates\": %s,\n", !in->cost ? "null" : in->cost_estimated ? "\"estimated\"" : "\"COST\"");
+    printf("  \"slowest\": [");
+    for (int k = 0; k < in->num_slowest; ++k)
+        printf("%s{\"frame\": %u, \"decode_us\": %u}", k ? ", " : "", in->slowest[k], in->cost[in->slowest[k]]);
+    printf("]");
+    if (frames) {
+        printf(",\n  \"frame_bytes\": [");
+        for (uint32_t i = 0; i < h->num_frames; ++i)
+            printf("%s%u", i ? (i % 16 ? "," : ",\n    ") : "\n    ", frame_bytes(in, i));
+        printf("\n  ]");
+        if (in->cost) {
+            printf(",\n  \"frame_decode_us\": [");
+            for (uint32_t i = 0; i < h->num_frames; ++i)
+                printf("%s%u", i ? (i % 16 ? "," : ",\n    ") : "\n    ", in->cost[i]);
+            printf("\n  ]");
+        }
+        if (in->timescale) {
+            printf(",\n  \"frame_start\": [");
+            for (uint32_t i = 0; i < h->num_frames; ++i)
+                printf("%s%.6f", i ? (i % 8 ? "," : ",\n    ") : "\n    ", in->start[i]);
+            printf("\n  ]");
+        }
+    }
+    printf("\n}\n");
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] <movie.dcmv>\n", prog);
+    printf("  --json                One JSON object on stdout instead of the report\n");
+    printf("  --window <sec>        Sliding bitrate window (default 1.0, as pack_dcmv)\n");
+    printf("  --timeline <n>        Bitrate timeline rows, max %d (default 20)\n", MAX_ROWS);
+    printf("  --top <n>             Largest and slowest frames listed, max %d (default 10)\n", MAX_TOP);
+    printf("  --frames              Every frame's size (and decode estimate) too\n");
+    printf("  --estimate            Without a COST chunk, estimate decode times from the frames (reads them all)\n");
+}
+
+int main(int argc, char **argv) {
+    int json = 0, frames = 0, estimate = 0, rows = 20, top = 10;
+    double window = 1.0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *opt = argv[i];
+        if (strncmp(opt, "--", 2) != 0) {
+            path = opt;
+            continue;
+        }
+        if (!strcmp(opt, "--json")) {
+            json = 1;
+            continue;
+        }
+        if (!strcmp(opt, "--frames")) {
+            frames = 1;
+            continue;
+        }
+        if (!strcmp(opt, "--estimate")) {
+            estimate = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        double v = atof(argv[++i]);
+        if (!strcmp(opt, "--window")) window = v;
+        else if (!strcmp(opt, "--timeline")) rows = (int)v;
+        else if (!strcmp(opt, "--top")) top = (int)v;
+        else {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path || window <= 0 || rows < 1 || rows > MAX_ROWS || top < 0 || top > MAX_TOP) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static info_t in;
+    in.path = path;
+    in.window = window;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror("Open failed"); return 1; }
+    if (dcmv_read_header(fp, &in.h) < 0 || in.h.num_frames == 0) {
+        fprintf(stderr, "%s is not a DCMV file\n", path);
+        return 1;
+    }
+    fclose(fp);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) { perror("Open failed"); return 1; }
+    in.file_size = st.st_size;
+    in.file = mmap(NULL, in.file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (in.file == MAP_FAILED) { perror("mmap failed"); return 1; }
+
+    if (load(&in) < 0)
+        return 2;
+    if (estimate && !in.cost)
+        estimate_cost(&in);
+    frame_stats(&in, top);
+    bitrate(&in, rows);
+    scene_stats(&in);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (json) {
+        print_json(&in, frames);
+    } else {
+        print_text(&in, frames);
+        printf("⏱️  Read in %.3f s\n", (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    }
+
+    munmap((void *)in.file, in.file_size);
+    close(fd);
+    free(in.offsets);
+    free(in.start);
+    free(in.cost);
+    free(in.cuts);
+    free(in.scenes);
+    return 0;
+}
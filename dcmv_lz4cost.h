@@ -0,0 +1,132 @@
+/*
+ * dcmv_lz4cost.h
+ * ---------------------
+ * Estimated SH-4 time to decode an LZ4 block with LZ4_decompress_fast, shared
+ * by pack_dcmv (which parses frames to keep it low and stores it in the COST
+ * chunk) and the host tools.
+ *
+ * Decoding a frame writes the same bytes whatever the parse, so what differs
+ * between two parses of one frame is per sequence, not per byte:
+ *
+ *   - every sequence decodes a token and branches twice (literals, match),
+ *     and each length byte past the token's 15 is another load and branch
+ *   - literals and matches are copied 8 bytes at a time, so a 4-byte match
+ *     costs as much as an 8-byte one
+ *   - a match closer than 8 bytes overlaps its own output and takes the
+ *     byte-at-a-time fixup path before the wide copy
+ *   - a match further back than the 16 KB operand cache misses once per
+ *     32-byte line it reads
+ *   - the compressed bytes themselves stream through the cache once
+ *
+ * The cycle counts are rough figures for the generic C decoder at 200 MHz;
+ * the "lz4" region of the profiler (readmeprofile.txt) is what to calibrate
+ * them against. They rank parses and frames, they don't predict to the
+ * microsecond.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DCMV_SH4_MHZ                200
+#define DCMV_LZ4_SEQ_CYCLES         40      // token, two length branches, offset
+#define DCMV_LZ4_LEN_BYTE_CYCLES    6       // each extra length byte
+#define DCMV_LZ4_COPY8_CYCLES       8       // one 8-byte step of a literal or match copy
+#define DCMV_LZ4_OVERLAP_CYCLES     30      // offset < 8
+#define DCMV_LZ4_FAR_OFFSET         16384   // SH-4 operand cache
+#define DCMV_LZ4_MISS_CYCLES        24      // per 32-byte line of a far match
+#define DCMV_LZ4_INPUT_CYCLES_X4    3       // per 4 compressed bytes streamed in
+
+#define DCMV_LZ4_MINMATCH           4
+
+typedef struct {
+    uint32_t sequences;
+    uint32_t literals;          // bytes
+    uint32_t matched;           // bytes
+    uint32_t short_matches;     // matches of at most 8 bytes
+    uint32_t overlaps;          // matches closer than 8 bytes
+    uint32_t far_matches;       // further back than DCMV_LZ4_FAR_OFFSET
+    uint64_t cycles;
+} dcmv_lz4_cost_t;
+
+/* Extra length bytes for a literal run or a match length past the token's 15 */
+static inline uint32_t dcmv_lz4_len_bytes(uint32_t len) {
+    return len < 15 ? 0 : 1 + (len - 15) / 255;
+}
+
+/* Cycles for a literal run of n bytes, excluding the sequence it belongs to */
+static inline uint32_t dcmv_lz4_literal_cycles(uint32_t n) {
+    return (n + 7) / 8 * DCMV_LZ4_COPY8_CYCLES + dcmv_lz4_len_bytes(n) * DCMV_LZ4_LEN_BYTE_CYCLES;
+}
+
+/* Cycles for a sequence's match of len bytes at offset, including the sequence overhead */
+static inline uint32_t dcmv_lz4_match_cycles(uint32_t len, uint32_t offset) {
+    uint32_t c = DCMV_LZ4_SEQ_CYCLES + (len + 7) / 8 * DCMV_LZ4_COPY8_CYCLES +
+                 dcmv_lz4_len_bytes(len - DCMV_LZ4_MINMATCH) * DCMV_LZ4_LEN_BYTE_CYCLES;
+    if (offset < 8)
+        c += DCMV_LZ4_OVERLAP_CYCLES;
+    if (offset > DCMV_LZ4_FAR_OFFSET)
+        c += (len + 31) / 32 * DCMV_LZ4_MISS_CYCLES;
+    return c;
+}
+
+/*
+ * Walk the sequences of an LZ4 block of len bytes and add up the model.
+ * Returns the cycles, or -1 if the block is malformed (dcmv_verify checks
+ * that properly, this only stops at the end of the input).
+ */
+static inline int64_t dcmv_lz4_cost(const uint8_t *src, size_t len, dcmv_lz4_cost_t *c) {
+    const uint8_t *p = src, *end = src + len;
+    uint64_t out = 0;
+    *c = (dcmv_lz4_cost_t){ 0 };
+    c->cycles = (uint64_t)len * DCMV_LZ4_INPUT_CYCLES_X4 / 4;
+    while (p < end) {
+        uint32_t token = *p++;
+        uint32_t lit = token >> 4;
+        if (lit == 15) {
+            uint32_t b;
+            do {
+                if (p >= end) return -1;
+                lit += b = *p++;
+            } while (b == 255);
+        }
+        if ((size_t)(end - p) < lit) return -1;
+        p += lit;
+        out += lit;
+        c->literals += lit;
+        c->cycles += dcmv_lz4_literal_cycles(lit);
+        c->sequences++;
+        if (p == end) {
+            c->cycles += DCMV_LZ4_SEQ_CYCLES;   // last sequence: literals only
+            break;
+        }
+
+        if (end - p < 2) return -1;
+        uint32_t offset = p[0] | p[1] << 8;
+        p += 2;
+        uint32_t ml = token & 15;
+        if (ml == 15) {
+            uint32_t b;
+            do {
+                if (p >= end) return -1;
+                ml += b = *p++;
+            } while (b == 255);
+        }
+        ml += DCMV_LZ4_MINMATCH;
+        if (!offset || offset > out) return -1;
+        out += ml;
+        c->matched += ml;
+        if (ml <= 8) c->short_matches++;
+        if (offset < 8) c->overlaps++;
+        if (offset > DCMV_LZ4_FAR_OFFSET) c->far_matches++;
+        c->cycles += dcmv_lz4_match_cycles(ml, offset);
+    }
+    return (int64_t)c->cycles;
+}
+
+/* Cycles as the COST chunk stores them: microseconds at DCMV_SH4_MHZ, saturated */
+static inline uint16_t dcmv_lz4_cost_us(uint64_t cycles) {
+    uint64_t us = (cycles + DCMV_SH4_MHZ / 2) / DCMV_SH4_MHZ;
+    return us > UINT16_MAX ? UINT16_MAX : (uint16_t)us;
+}
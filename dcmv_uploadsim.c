@@ -0,0 +1,343 @@
+/*
+ * dcmv_uploadsim.c
+ * ---------------------
+ * Texture upload simulator for fmv_play.
+ *
+ * Runs the player's double-buffered upload logic (playdcmv/tex_slots.h, the
+ * same code the player calls) against a model of the SH-4, the texture DMA
+ * and the PVR, next to the old single-texture path that decoded and then
+ * copied the frame with the CPU, so the overlap can be checked on the host.
+ *
+ * Model:
+ *   - Decode: --decode-ms +/- --jitter-ms per stored frame (deterministic,
+ *     --seed), scaled by the frame's compressed size when a .dcmv is given.
+ *     Repeated (zero-length) frames cost nothing.
+ *   - Old path: the CPU copies the frame into VRAM at --sq-mbps.
+ *   - DMA path: flushing the frame out of the dcache and starting the DMA
+ *     (--dma-setup-ms) is CPU time; the transfer then runs at --dma-mbps
+ *     while the CPU decodes the next frame.
+ *   - PVR: a scene can't begin until the previous one has flipped, renders
+ *     for --render-ms and becomes visible on the next vblank.
+ *   - Timing: av_sync.h against an ideal audio clock, so a path that can't
+ *     keep up drops frames the way the player would.
+ *
+ * Checked for the DMA path:
+ *   - Tearing: the DMA writing a texture while a scene that draws it is
+ *     still rendering
+ *   - Refusals: tex_slots_* calls that refused (a decode into a buffer the
+ *     DMA is reading, an upload into the texture on screen, a flip to an
+ *     incomplete texture)
+ *
+ * Exits with status 2 if either happens.
+ *
+ * Usage:
+ *   dcmv_uploadsim [options] [movie.dcmv]
+ *
+ * Build:
+ *   gcc -O2 dcmv_uploadsim.c -o dcmv_uploadsim -lm
+ *
+ * Author: Troy Davis (gpf)
+ * GitHub: https://github.com/GPF
+ * License: Public Domain / MIT-style — use freely with attribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "dcmv_format.h"
+#include "playdcmv/av_sync.h"
+#include "playdcmv/tex_slots.h"
+
+#define SIM_RATE 44100      // audio rate for the sync clock; 44100 plays exactly
+
+typedef struct {
+    double decode;          // per stored frame, sec
+    double jitter;          // +/- uniform on top of decode, sec
+    double sq_rate;         // old path CPU copy, bytes/sec
+    double dma_rate;        // texture DMA, bytes/sec
+    double dma_setup;       // dcache flush + DMA start, sec
+    double render;          // PVR render time, sec
+    double vblank_hz;
+    uint32_t seed;
+} sim_model_t;
+
+typedef struct {
+    const uint32_t *offsets;
+    uint32_t num_frames;
+    uint32_t frame_size;
+    uint32_t fps_num, fps_den;
+    double mean_size;       // mean compressed size of stored frames
+} sim_movie_t;
+
+typedef struct {
+    uint32_t presented;
+    uint32_t dropped;
+    uint32_t repeats;
+    uint32_t decodes;
+    uint32_t wasted;        // frames decoded ahead, then dropped
+    uint32_t tears;
+    uint32_t refused;
+    double busy;            // present start -> scene submitted, sec
+    double max_busy;
+    double dma_wait;        // CPU blocked on the DMA, sec
+} sim_result_t;
+
+static uint32_t rng_next(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static double decode_cost(const sim_model_t *m, const sim_movie_t *mv, uint32_t frame, uint32_t *seed) {
+    double cost = m->decode;
+    if (mv->offsets && mv->mean_size > 0)
+        cost *= (mv->offsets[frame + 1] - mv->offsets[frame]) / mv->mean_size;
+    cost += m->jitter * ((rng_next(seed) & 0xFFFF) / 32768.0 - 1.0);
+    return cost > 0 ? cost : 0;
+}
+
+static uint32_t source_frame(const sim_movie_t *mv, uint32_t frame) {
+    return mv->offsets ? dcmv_source_frame(mv->offsets, frame) : frame;
+}
+
+typedef struct {
+    double t;               // SH-4 time
+    double last_flip;
+    double render_end;      // latest scene
+    double dma_end;         // texture DMA in flight
+    double vblank;
+} sim_pvr_t;
+
+/* Submit a scene, return when it's done rendering */
+static double draw(sim_pvr_t *p, double render) {
+    if (p->t < p->last_flip) p->t = p->last_flip;       // pvr_scene_begin waits for the flip
+    p->render_end = p->t + render;
+    p->last_flip = ceil(p->render_end / p->vblank) * p->vblank;
+    return p->render_end;
+}
+
+static void decode_into(const sim_model_t *m, const sim_movie_t *mv, tex_slots_t *ts, int slot, int frame,
+                        sim_pvr_t *p, uint32_t *seed, sim_result_t *r) {
+    if (tex_slots_fill(ts, slot, -1) < 0) r->refused++;
+    p->t += decode_cost(m, mv, frame, seed);
+    tex_slots_fill(ts, slot, frame);
+    r->decodes++;
+}
+
+static void start_dma(const sim_model_t *m, const sim_movie_t *mv, tex_slots_t *ts, int slot, sim_pvr_t *p,
+                      const double *in_use, sim_result_t *r) {
+    if (p->t < in_use[slot]) r->tears++;
+    if (tex_slots_dma_start(ts, slot) < 0) r->refused++;
+    p->t += m->dma_setup;
+    p->dma_end = p->t + mv->frame_size / m->dma_rate;
+}
+
+static void wait_dma(tex_slots_t *ts, sim_pvr_t *p, sim_result_t *r) {
+    if (ts->dma_slot < 0) return;
+    if (p->t < p->dma_end) {
+        r->dma_wait += p->dma_end - p->t;
+        p->t = p->dma_end;
+    }
+    tex_slots_dma_done(ts);
+}
+
+static void simulate(const sim_model_t *m, const sim_movie_t *mv, int use_dma, sim_result_t *r) {
+    memset(r, 0, sizeof(*r));
+    sim_pvr_t p = { .vblank = 1.0 / m->vblank_hz };
+    uint32_t seed = m->seed ? m->seed : 1;
+
+    av_sync_t av;
+    av_sync_init(&av, mv->fps_num, mv->fps_den, SIM_RATE, 0, 0, AV_SYNC_LEAD_MS);
+
+    tex_slots_t ts;
+    tex_slots_init(&ts);
+    double in_use[TEX_SLOTS] = { 0 };           // render end of the last scene drawing each texture
+    int ahead_of[TEX_SLOTS] = { 0 };            // buffer was decoded ahead, not shown yet
+    int shown = -1;                             // old path: frame in the one texture
+
+    uint32_t frame = 0;
+    while (frame < mv->num_frames) {
+        uint32_t jiffies = (uint32_t)(p.t * AV_AICA_JIFFIES_PER_SEC);
+        uint64_t clock = av_sync_clock(&av, jiffies, UINT32_MAX);
+        uint32_t sleep_ms = 0;
+        int action = av_sync_next(&av, clock, frame, &sleep_ms);
+        if (action == AV_WAIT) {
+            p.t += sleep_ms / 1000.0;
+            continue;
+        }
+        if (action == AV_DROP) {
+            r->dropped++;
+            frame++;
+            continue;
+        }
+
+        double start = p.t;
+        int source = (int)source_frame(mv, frame);
+
+        if (!use_dma) {
+            if (source == shown) {
+                r->repeats++;
+            } else {
+                p.t += decode_cost(m, mv, source, &seed);
+                r->decodes++;
+                if (p.t < p.render_end) r->tears++;
+                p.t += mv->frame_size / m->sq_rate;
+                shown = source;
+            }
+        } else {
+            int slot;
+            int step = tex_slots_present(&ts, source, &slot);
+            if (step == TS_REDRAW) r->repeats++;
+            if (step == TS_DECODE) {
+                if (ahead_of[slot]) r->wasted++;
+                decode_into(m, mv, &ts, slot, source, &p, &seed, r);
+            }
+            ahead_of[slot] = 0;
+            if (step != TS_REDRAW) start_dma(m, mv, &ts, slot, &p, in_use, r);
+
+            // Decode the next frame while the DMA runs, only while on time
+            uint64_t now = av_sync_clock(&av, (uint32_t)(p.t * AV_AICA_JIFFIES_PER_SEC), UINT32_MAX);
+            if (frame + 1 < mv->num_frames && av_sync_next(&av, now, frame + 1, &sleep_ms) == AV_WAIT) {
+                int ahead = (int)source_frame(mv, frame + 1);
+                int target = tex_slots_ahead(&ts, slot, ahead);
+                if (target >= 0) {
+                    if (ahead_of[target]) r->wasted++;
+                    decode_into(m, mv, &ts, target, ahead, &p, &seed, r);
+                    ahead_of[target] = 1;
+                }
+            }
+
+            wait_dma(&ts, &p, r);
+            if (tex_slots_flip(&ts, slot) < 0) r->refused++;
+        }
+
+        double busy = p.t - start;
+        r->busy += busy;
+        if (busy > r->max_busy) r->max_busy = busy;
+        double rendered = draw(&p, m->render);
+        if (use_dma) in_use[ts.front] = rendered;
+        r->presented++;
+        frame++;
+    }
+}
+
+static void report(const char *name, const sim_result_t *r) {
+    double n = r->presented ? r->presented : 1;
+    printf("  %-8s %9u  %7u  %7u  %7u  %6u  %7.2f ms  %7.2f ms  %7.2f ms  %5u  %7u\n", name, r->presented,
+           r->dropped, r->repeats, r->decodes, r->wasted, r->busy / n * 1000, r->max_busy * 1000,
+           r->dma_wait / n * 1000, r->tears, r->refused);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] [movie.dcmv]\n", prog);
+    printf("Without a movie (frame count, size and rate of a synthetic one):\n");
+    printf("  --frames <n>          Frames (default 18000)\n");
+    printf("  --frame-size <bytes>  Decoded frame size (default 614400, 640x480 RGB565)\n");
+    printf("  --fps <n>             Frame rate, e.g. 24, 29.97 or 30000/1001 (default 30)\n");
+    printf("Player model:\n");
+    printf("  --decode-ms <ms>      Read + LZ4 per stored frame (default 24)\n");
+    printf("  --jitter-ms <ms>      +/- variation on the decode time (default 6)\n");
+    printf("  --sq-mbps <MB/s>      Old path CPU copy to VRAM (default 100)\n");
+    printf("  --dma-mbps <MB/s>     Texture DMA (default 100)\n");
+    printf("  --dma-setup-ms <ms>   dcache flush + DMA start (default 0.3)\n");
+    printf("  --render-ms <ms>      PVR render time (default 3)\n");
+    printf("  --vblank-hz <hz>      Display refresh (default 59.94)\n");
+    printf("  --seed <n>            Decode jitter seed (default 1)\n");
+}
+
+int main(int argc, char **argv) {
+    sim_model_t m = {
+        .decode = 0.024, .jitter = 0.006, .sq_rate = 100e6, .dma_rate = 100e6, .dma_setup = 0.0003,
+        .render = 0.003, .vblank_hz = 59.94, .seed = 1,
+    };
+    sim_movie_t mv = { .num_frames = 18000, .frame_size = 640 * 480 * 2, .fps_num = 30, .fps_den = 1 };
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *opt = argv[i];
+        if (strncmp(opt, "--", 2) != 0) {
+            path = opt;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        double v = atof(argv[++i]);
+        if (!strcmp(opt, "--frames")) mv.num_frames = (uint32_t)v;
+        else if (!strcmp(opt, "--frame-size")) mv.frame_size = (uint32_t)v;
+        else if (!strcmp(opt, "--fps")) {
+            if (dcmv_parse_fps(argv[i], &mv.fps_num, &mv.fps_den) < 0) mv.fps_num = 0;
+        }
+        else if (!strcmp(opt, "--decode-ms")) m.decode = v / 1000.0;
+        else if (!strcmp(opt, "--jitter-ms")) m.jitter = v / 1000.0;
+        else if (!strcmp(opt, "--sq-mbps")) m.sq_rate = v * 1e6;
+        else if (!strcmp(opt, "--dma-mbps")) m.dma_rate = v * 1e6;
+        else if (!strcmp(opt, "--dma-setup-ms")) m.dma_setup = v / 1000.0;
+        else if (!strcmp(opt, "--render-ms")) m.render = v / 1000.0;
+        else if (!strcmp(opt, "--vblank-hz")) m.vblank_hz = v;
+        else if (!strcmp(opt, "--seed")) m.seed = (uint32_t)v;
+        else {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    uint32_t *offsets = NULL;
+    if (path) {
+        FILE *fp = fopen(path, "rb");
+        if (!fp) { perror("Open failed"); return 1; }
+        dcmv_header_t h;
+        if (dcmv_read_header(fp, &h) < 0 || h.num_frames == 0) {
+            fprintf(stderr, "%s is not a DCMV file\n", path);
+            return 1;
+        }
+        offsets = malloc((h.num_frames + 1) * sizeof(uint32_t));
+        if (!offsets) {
+            fprintf(stderr, "OOM\n");
+            return 1;
+        }
+        fseek(fp, h.header_size, SEEK_SET);
+        if (fread(offsets, sizeof(uint32_t), h.num_frames + 1, fp) != h.num_frames + 1) {
+            fprintf(stderr, "Truncated offset table\n");
+            return 1;
+        }
+        fclose(fp);
+        uint32_t stored = 0;
+        for (uint32_t i = 0; i < h.num_frames; ++i)
+            if (offsets[i + 1] != offsets[i]) stored++;
+        mv = (sim_movie_t){ .offsets = offsets, .num_frames = h.num_frames, .frame_size = h.frame_size,
+                            .fps_num = h.fps_num, .fps_den = h.fps_den, .mean_size = stored ? (double)(offsets[h.num_frames] - offsets[0]) / stored : 0 };
+        printf("📦 %s: %ux%u @ %.6gfps, %u frames (%u stored), frame_size=%u\n", path, h.width, h.height,
+               (double)h.fps_num / h.fps_den,
+               h.num_frames, stored, h.frame_size);
+    }
+    if (!mv.fps_num || !mv.num_frames || !mv.frame_size || m.sq_rate <= 0 || m.dma_rate <= 0 || m.vblank_hz <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("⏱ %u frames @ %.6gfps, decode %.1f±%.1f ms, copy %.0f MB/s, DMA %.0f MB/s + %.2f ms, render %.1f ms\n",
+           mv.num_frames, (double)mv.fps_num / mv.fps_den, m.decode * 1000, m.jitter * 1000, m.sq_rate / 1e6, m.dma_rate / 1e6,
+           m.dma_setup * 1000, m.render * 1000);
+    printf("  path     presented  dropped  repeats  decodes  wasted   cpu/frame   max frame    dma wait  tears  refused\n");
+
+    sim_result_t old, dma;
+    simulate(&m, &mv, 0, &old);
+    simulate(&m, &mv, 1, &dma);
+    report("copy", &old);
+    report("dma", &dma);
+    free(offsets);
+
+    if (dma.tears || dma.refused) {
+        printf("❌ DMA path tore %u frame(s), %u refused slot operation(s)\n", dma.tears, dma.refused);
+        return 2;
+    }
+    printf("✅ DMA path: no tearing, %u dropped (copy path %u)\n", dma.dropped, old.dropped);
+    return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * dcmv_verify.c
+ * ---------------------
+ * Checks a .dcmv file on the host before it is burned.
+ *
+ * fmv_play.elf decodes with LZ4_decompress_fast, which trusts its input: a
+ * truncated or corrupted file shows up on hardware as garbage or a crash. This
+ * tool decodes every frame with the bounds-checked decoder instead, spread over
+ * all cores, and checks:
+ *   - Header and offset table: offsets increasing, inside the video region,
+ *     no frame bigger than max_compressed_size (the player's read buffer)
+ *   - LZ4_decompress_safe on exactly the stored bytes gives exactly frame_size
+ *     bytes; a frame that passes decodes the same under LZ4_decompress_fast
+ *   - CRC-32 of the stored and of the decompressed frame against the CRCS
+ *     chunk written by pack_dcmv (older files without one only get the
+ *     decode check)
+ *   - Repeated frames (zero-length entries): never frame 0, and their CRC is
+ *     the one of the frame they repeat
+ *   - Extension chunks: the list runs exactly to the end of the file, loop
+ *     points (LOOP) inside the movie, one timestamp per frame plus the end
+ *     (PTS), never going backwards, one decode estimate per frame and none
+ *     for a repeat (COST), scene cuts increasing and on stored frames (CUTS)
+ *
+ * Usage:
+ *   dcmv_verify [--threads <n>] [--max-errors <n>] <movie.dcmv>
+ *
+ * Build:
+ *   gcc -O2 dcmv_verify.c -o dcmv_verify -llz4 -pthread
+ *
+ * Exits with status 2 when any frame fails, 1 if the file can't be read.
+ *
+ * Author: Troy Davis (gpf)
+ * GitHub: https://github.com/GPF
+ * License: Public Domain / MIT-style — use freely with attribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lz4.h>
+#include "dcmv_format.h"
+
+#define MAX_THREADS 64
+#define FRAME_BATCH 16          // frames a worker takes at a time
+
+enum {
+    FRAME_OK,
+    FRAME_BAD_OFFSET,           // outside the video region or past max_compressed_size
+    FRAME_BAD_STORED_CRC,       // the compressed bytes changed
+    FRAME_BAD_LZ4,              // doesn't decode to exactly frame_size from exactly its bytes
+    FRAME_BAD_CRC,              // decodes, but not to what was packed
+};
+
+static const char *frame_errors[] = {
+    "ok", "bad offset table entry", "compressed CRC mismatch", "LZ4 stream invalid", "decompressed CRC mismatch",
+};
+
+typedef struct {
+    const uint8_t *file;
+    const dcmv_header_t *h;
+    const uint32_t *offsets;
+    const uint8_t *crcs;        // CRCS entries, NULL if the file has none
+    uint8_t *status;            // one FRAME_* per frame
+    uint32_t next;              // next frame batch to hand out
+} verify_job_t;
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int check_frame(const verify_job_t *job, uint32_t i, uint8_t *out) {
+    const dcmv_header_t *h = job->h;
+    uint32_t start = job->offsets[i], end = job->offsets[i + 1];
+    if (start < job->offsets[0] || end < start || end > h->audio_offset || end - start > h->max_compressed_size)
+        return FRAME_BAD_OFFSET;
+
+    const uint8_t *src = job->file + start;
+    uint32_t size = end - start;
+    if (size == 0) {
+        // Repeat: shows the previous frame, so it carries that frame's CRC
+        if (i == 0)
+            return FRAME_BAD_OFFSET;
+        if (job->crcs && get_u32(job->crcs + i * 8 + 4) != get_u32(job->crcs + (i - 1) * 8 + 4))
+            return FRAME_BAD_CRC;
+        return FRAME_OK;
+    }
+    if (job->crcs && dcmv_crc32(0, src, size) != get_u32(job->crcs + i * 8))
+        return FRAME_BAD_STORED_CRC;
+    if (LZ4_decompress_safe((const char *)src, (char *)out, size, h->frame_size) != (int)h->frame_size)
+        return FRAME_BAD_LZ4;
+    if (job->crcs && dcmv_crc32(0, out, h->frame_size) != get_u32(job->crcs + i * 8 + 4))
+        return FRAME_BAD_CRC;
+    return FRAME_OK;
+}
+
+static void *verify_worker(void *arg) {
+    verify_job_t *job = arg;
+    uint8_t *out = malloc(job->h->frame_size);
+    if (!out)
+        return (void *)1;
+    for (;;) {
+        uint32_t first = __atomic_fetch_add(&job->next, FRAME_BATCH, __ATOMIC_RELAXED);
+        if (first >= job->h->num_frames)
+            break;
+        uint32_t last = first + FRAME_BATCH < job->h->num_frames ? first + FRAME_BATCH : job->h->num_frames;
+        for (uint32_t i = first; i < last; ++i)
+            job->status[i] = check_frame(job, i, out);
+    }
+    free(out);
+    return NULL;
+}
+
+/* Decode estimates from the COST chunk: summary, and -1 if a repeat has one */
+static int check_cost(const uint8_t *cost, const dcmv_header_t *h, const uint32_t *offsets) {
+    uint64_t sum = 0;
+    uint32_t worst = 0, worst_at = 0, over = 0, stored = 0, bad = 0;
+    double frame_us = 1e6 * h->fps_den / h->fps_num;
+    for (uint32_t i = 0; i < h->num_frames; ++i) {
+        uint32_t us = cost[i * 2] | cost[i * 2 + 1] << 8;
+        if (offsets[i + 1] == offsets[i]) {
+            if (us && !bad++)
+                fprintf(stderr, "❌ COST chunk: repeated frame %u has a decode estimate\n", i);
+            continue;
+        }
+        stored++;
+        sum += us;
+        over += us > frame_us;
+        if (us > worst) {
+            worst = us;
+            worst_at = i;
+        }
+    }
+    printf("⚙️  Estimated SH-4 decode: %.2f ms mean, slowest frame %u at %.2f ms, %u over one frame period\n",
+           stored ? sum / 1000.0 / stored : 0.0, worst_at, worst / 1000.0, over);
+    return bad ? -1 : 0;
+}
+
+/* Walk the chunk list; returns the CRCS payload (or NULL) and -1 in *bad if the list is broken */
+static const uint8_t *check_chunks(const uint8_t *file, uint64_t file_size, const dcmv_header_t *h,
+                                   const uint32_t *offsets, int *bad) {
+    const uint8_t *crcs = NULL;
+    *bad = 0;
+    if (!h->ext_offset)
+        return NULL;
+    uint64_t pos = h->ext_offset;
+    while (pos < file_size) {
+        if (file_size - pos < 8) {
+            fprintf(stderr, "❌ Truncated chunk header at 0x%llX\n", (unsigned long long)pos);
+            *bad = -1;
+            return crcs;
+        }
+        uint32_t len = get_u32(file + pos + 4);
+        if (len > file_size - pos - 8) {
+            fprintf(stderr, "❌ Chunk %.4s at 0x%llX runs past the end of the file (%u bytes)\n",
+                    (const char *)file + pos, (unsigned long long)pos, len);
+            *bad = -1;
+            return crcs;
+        }
+        if (!memcmp(file + pos, DCMV_CHUNK_CRCS, 4)) {
+            if (len != 4 + (uint64_t)h->num_frames * 8 || get_u32(file + pos + 8) != h->num_frames) {
+                fprintf(stderr, "❌ CRCS chunk doesn't cover the %u frames\n", h->num_frames);
+                *bad = -1;
+            } else {
+                crcs = file + pos + 12;
+            }
+        }
+        if (!memcmp(file + pos, DCMV_CHUNK_LOOP, 4)) {
+            uint32_t start = len >= 8 ? get_u32(file + pos + 8) : 0, end = len >= 8 ? get_u32(file + pos + 12) : 0;
+            if (start >= end || end > h->num_frames) {
+                fprintf(stderr, "❌ LOOP chunk: frames %u-%u aren't inside the %u frames\n", start, end, h->num_frames);
+                *bad = -1;
+            }
+        }
+        if (!memcmp(file + pos, DCMV_CHUNK_PTS, 4)) {
+            uint32_t count = h->num_frames + 1, back = 0;
+            if (len != 8 + (uint64_t)count * 4 || get_u32(file + pos + 12) != count || !get_u32(file + pos + 8)) {
+                fprintf(stderr, "❌ PTS chunk doesn't cover the %u frames\n", h->num_frames);
+                *bad = -1;
+            } else {
+                for (uint32_t i = 1; i < count; ++i) {
+                    if (get_u32(file + pos + 16 + i * 4) < get_u32(file + pos + 12 + i * 4) && !back++)
+                        fprintf(stderr, "❌ PTS chunk: frame %u starts before frame %u\n", i, i - 1);
+                }
+                if (back)
+                    *bad = -1;
+            }
+        }
+        if (!memcmp(file + pos, DCMV_CHUNK_COST, 4)) {
+            if (len != 4 + (uint64_t)h->num_frames * 2 || get_u32(file + pos + 8) != h->num_frames) {
+                fprintf(stderr, "❌ COST chunk doesn't cover the %u frames\n", h->num_frames);
+                *bad = -1;
+            } else {
+                if (check_cost(file + pos + 12, h, offsets) < 0)
+                    *bad = -1;
+            }
+        }
+        if (!memcmp(file + pos, DCMV_CHUNK_CUTS, 4)) {
+            uint32_t count = len >= 4 ? get_u32(file + pos + 8) : 0, prev = 0, wrong = 0;
+            if (len != 4 + (uint64_t)count * 4) {
+                fprintf(stderr, "❌ CUTS chunk: %u bytes for %u cuts\n", len, count);
+                *bad = -1;
+            } else {
+                for (uint32_t k = 0; k < count; ++k) {
+                    uint32_t f = get_u32(file + pos + 12 + k * 4);
+                    if ((f <= prev || f >= h->num_frames || offsets[f + 1] == offsets[f]) && !wrong++)
+                        fprintf(stderr, "❌ CUTS chunk: cut %u at frame %u isn't a stored frame after the last cut\n", k, f);
+                    prev = f;
+                }
+                if (wrong)
+                    *bad = -1;
+                else
+                    printf("🎬 %u scene cut(s)\n", count);
+            }
+        }
+        printf("🧩 Chunk %.4s: %u bytes\n", (const char *)file + pos, len);
+        pos += 8 + (uint64_t)len;
+    }
+    return crcs;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] <movie.dcmv>\n", prog);
+    printf("  --threads <n>         Worker threads (default: one per CPU)\n");
+    printf("  --max-errors <n>      Bad frames to list individually (default 20)\n");
+}
+
+int main(int argc, char **argv) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int max_errors = 20;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *opt = argv[i];
+        if (strncmp(opt, "--", 2) != 0) {
+            path = opt;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        int v = atoi(argv[++i]);
+        if (!strcmp(opt, "--threads")) threads = v;
+        else if (!strcmp(opt, "--max-errors")) max_errors = v;
+        else {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror("Open failed"); return 1; }
+    dcmv_header_t h;
+    if (dcmv_read_header(fp, &h) < 0 || h.num_frames == 0 || h.frame_size == 0) {
+        fprintf(stderr, "%s is not a DCMV file\n", path);
+        return 1;
+    }
+    fclose(fp);
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) { perror("Open failed"); return 1; }
+    uint64_t file_size = st.st_size;
+    const uint8_t *file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) { perror("mmap failed"); return 1; }
+    madvise((void *)file, file_size, MADV_SEQUENTIAL);
+
+    printf("📦 %s: %ux%u @ %u/%u fps, %u frames of %u bytes, max compressed %u\n", path, h.width, h.height,
+           h.fps_num, h.fps_den, h.num_frames, h.frame_size, h.max_compressed_size);
+
+    int failed = 0;
+    uint64_t table_end = h.header_size + (uint64_t)(h.num_frames + 1) * 4;
+    uint64_t audio_end = dcmv_audio_end(&h, (uint32_t)file_size);
+    if (table_end > file_size || h.audio_offset > audio_end || audio_end > file_size) {
+        fprintf(stderr, "❌ Truncated: header wants %llu bytes of offset table and audio up to 0x%llX, file is %llu\n",
+                (unsigned long long)table_end, (unsigned long long)audio_end, (unsigned long long)file_size);
+        return 2;
+    }
+    const uint32_t *offsets = (const uint32_t *)(file + h.header_size);
+    if (offsets[0] < table_end || offsets[h.num_frames] != h.audio_offset) {
+        fprintf(stderr, "❌ Offset table doesn't span the video region (0x%X-0x%X, audio at 0x%X)\n",
+                offsets[0], offsets[h.num_frames], h.audio_offset);
+        failed = 1;
+    }
+
+    int chunks_bad;
+    dcmv_crc32_init();
+    const uint8_t *crcs = check_chunks(file, file_size, &h, offsets, &chunks_bad);
+    if (chunks_bad)
+        failed = 1;
+    if (!crcs)
+        printf("⚠️  No CRCS chunk (packed by an older pack_dcmv): checking that frames decode, not their content\n");
+
+    verify_job_t job = {
+        .file = file, .h = &h, .offsets = offsets, .crcs = crcs,
+        .status = calloc(h.num_frames, 1),
+    };
+    if (!job.status) {
+        fprintf(stderr, "OOM\n");
+        return 1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t tid[MAX_THREADS];
+    int started = 0;
+    for (; started < threads; ++started)
+        if (pthread_create(&tid[started], NULL, verify_worker, &job) != 0)
+            break;
+    if (!started)
+        verify_worker(&job);
+    for (int j = 0; j < started; ++j) {
+        void *ret;
+        pthread_join(tid[j], &ret);
+        if (ret) {
+            fprintf(stderr, "OOM\n");
+            return 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    uint32_t bad = 0, repeats = 0;
+    for (uint32_t i = 0; i < h.num_frames; ++i)
+        repeats += offsets[i + 1] == offsets[i];
+    if (repeats)
+        printf("🔁 %u repeated frame(s) (zero-length entries)\n", repeats);
+    uint32_t by_error[sizeof(frame_errors) / sizeof(frame_errors[0])] = {0};
+    for (uint32_t i = 0; i < h.num_frames; ++i) {
+        if (job.status[i] == FRAME_OK)
+            continue;
+        by_error[job.status[i]]++;
+        if ((int)bad++ < max_errors)
+            printf("❌ Frame %u (0x%X, %u bytes): %s\n", i, offsets[i], offsets[i + 1] - offsets[i],
+                   frame_errors[job.status[i]]);
+    }
+    if ((int)bad > max_errors)
+        printf("   ... and %u more\n", bad - max_errors);
+
+    double mb = (double)h.num_frames * h.frame_size / 1e6;
+    printf("⏱️  %u frames (%.0f MB decompressed) in %.2f s on %d thread(s), %.0f MB/s\n", h.num_frames, mb, secs,
+           started ? started : 1, mb / (secs > 0 ? secs : 1e-9));
+    if (bad) {
+        for (size_t e = 1; e < sizeof(frame_errors) / sizeof(frame_errors[0]); ++e)
+            if (by_error[e])
+                printf("   %u x %s\n", by_error[e], frame_errors[e]);
+        failed = 1;
+    }
+
+    munmap((void *)file, file_size);
+    close(fd);
+    free(job.status);
+
+    if (failed) {
+        printf("❌ %s failed verification (%u bad frames)\n", path, bad);
+        return 2;
+    }
+    printf("✅ All %u frames verified%s\n", h.num_frames, crcs ? " against their CRCs" : " (decode only)");
+    return 0;
+}
@@ -7,22 +7,18 @@
  *   - LZ4 HC-compressed RGB565 VQ PVR texture frames (.dt)
  *   - Optional ADPCM-encoded audio track
  *   - Frame offset table for decompression and sync
- *   - Extended header (version 3) with metadata + audio offset
+ *   - Per-frame CRC-32s of the compressed and decompressed data (CRCS chunk),
+ *     checked by dcmv_verify
+ *   - Repeated frames (telecine, low frame rate sources) stored as zero-length
+ *     offset table entries, which the player doesn't read, decode or upload
+ *   - Optional loop points (LOOP chunk) for clips the player loops from RAM
+ *   - Each frame's estimated SH-4 decode time (COST chunk, dcmv_lz4cost.h)
+ *   - Scene cuts found in the frames (CUTS chunk), for chapter seeking
+ *   - Version DCMV_VERSION header with metadata, the exact frame rate, audio
+ *     offset and block size and the chunk list offset
  *
- * Header format (35 bytes total):
- *   4 bytes  - Magic "DCMV"
- *   4 bytes  - Version (3)
- *   2 bytes  - Video width
- *   2 bytes  - Video height
- *   2 bytes  - Frame rate (fps)
- *   2 bytes  - Audio sample rate
- *   2 bytes  - Audio channel count
- *   4 bytes  - Number of video frames
- *   4 bytes  - Uncompressed frame size
- *   4 bytes  - Maximum compressed frame size (LZ4)
- *   4 bytes  - Audio stream offset (absolute file position)
- *   Offset Table:
- *   - Immediately follows the 35-byte header
+ * The header layout lives in dcmv_format.h. Offset Table:
+ *   - Immediately follows the header
  *   - Contains (num_frames + 1) uint32_t values
  *   - Each entry is a byte offset to the start of a frame
  *   - The final offset points to the start of the audio stream
@@ -31,14 +27,71 @@
  *   "output/frame%04d.dt"
  * All frames must be of the same size and format (e.g., RGB565 VQ).
  *
- * Audio input should be ADPCM (.dca) with optional 64-byte "DcAF" header.
+ * Audio input is 16-bit PCM — a .wav file, or raw s16le on stdin as "-" — which
+ * is encoded to AICA ADPCM by the built-in encoder and stored in
+ * [L block][R block] pairs (see --audio-block). Pre-encoded ADPCM (.dca, with
+ * optional 64-byte "DcAF" header) is still accepted and copied as-is.
  * The audio is appended at the end of the compressed video + offset table.
  *
  * Usage:
- *   pack_dcmv_lz4_fixed <output.dcmv> <width> <height> <fps> <sample_rate> <channels> <frame_pattern> <audio_file>
+ *   pack_dcmv [options] <output.dcmv> <frame_type> <width> <height> <fps> <sample_rate> <channels> <frame_pattern> <audio_file>
  *
  * Example:
- *   ./pack_dcmv_lz4_fixed movie.dcmv 512 512 24 32000 1 output/frame%04d.dt audio.dca
+ *   ./pack_dcmv movie.dcmv 0 512 512 24 32000 1 output/frame%04d.dt audio.wav
+ *   ffmpeg -i in.mp4 -ac 2 -ar 44100 -f s16le - | ./pack_dcmv --adpcm-threads 8 movie.dcmv 0 512 512 24 44100 2 output/frame%04d.dt -
+ *
+ * Audio (optional):
+ *   --audio-block <bytes> ADPCM bytes per channel per stream block (default 4096)
+ *   --adpcm-threads <n>   Encode long tracks on n threads (bit-exact with 1 thread)
+ *   --check-seek          Decode the packed track and confirm every SEEK entry and a
+ *                         set of unaligned seeks reproduce a full decode exactly
+ *
+ * Duplicate frames:
+ *   --near-dup <bytes>    Also treat a frame as a repeat when at most this many bytes
+ *                         of its texture differ from the last stored frame (default 0,
+ *                         exact repeats only)
+ *   --no-dedup            Store every frame, even exact repeats
+ *
+ * Looping (optional):
+ *   --loop <start>[:<end>] Loop frames start..end-1 (end defaults to the last frame + 1).
+ *                         fmv_play loops clips it holds in RAM, audio included.
+ *
+ * Frame timing:
+ *   <fps> is a whole number, a fraction ("30000/1001") or a decimal; 23.976,
+ *   29.97 and 59.94 are taken as the NTSC rates (24000/1001 ...), so the
+ *   player doesn't drift against the audio as it would at a rounded rate.
+ *   --pts <file>          Variable frame rate: start of every frame in seconds, one
+ *                         per line (e.g. ffprobe -show_entries frame=pts_time), and
+ *                         optionally the end of the last one; stored as a PTS chunk
+ *
+ * PCM input also gets a SEEK chunk (see dcmv_format.h): the ADPCM decoder
+ * state at the start of every audio block, so the player can resume anywhere.
+ *
+ * Rate control (optional):
+ *   --target-bps <n>      Average bytes/sec budget for the whole stream (video + ADPCM)
+ *   --peak-bps <n>        Hard bytes/sec cap over any sliding window
+ *   --window <sec>        Sliding window length in seconds (default 1.0)
+ *   --fallback <pattern>  Alternate, cheaper encode of the same frames (e.g. pvrtex -c 64).
+ *                         May be given several times, ordered from best to smallest.
+ *
+ *   With a budget set, each frame walks a ladder of (source, LZ4 mode) pairs —
+ *   primary frames first, then each fallback — trying LZ4 fast, HC and HC max
+ *   and keeping the first that fits both the leaky-bucket target and the
+ *   window peak. Windows that still exceed the peak are reported at the end.
+ *
+ * Decode speed (optional):
+ *   --fast-decode <n>     Parse every frame for SH-4 decode time (lz4_parse_cost):
+ *                         fewer sequences, few short or overlapping matches, at
+ *                         the price of one stored byte per n cycles saved (e.g.
+ *                         8). Under rate control the ladder is this parse, then
+ *                         HC max, for each source.
+ *
+ * Scene cuts:
+ *   --scene-cut <t>       How different (0-1) a frame has to be from the last one to
+ *                         start a scene (default 0.3, 0 = don't detect). Under rate
+ *                         control a scene's first frame stays on the best source that
+ *                         fits the peak (at its smallest LZ4 mode) instead of
+ *                         dropping to a fallback codebook to meet the target.
  *
  * Dependencies:
  *   - LZ4 (lz4.h, lz4hc.h)
@@ -56,55 +109,1099 @@
 #include <errno.h>
 #include <lz4.h>
 #include <lz4hc.h>
+#include <pthread.h>
+#include "dcmv_format.h"
+#include "dcmv_adpcm.h"
+#include "dcmv_lz4cost.h"
 
 
 #define MAX_FRAMES 99999
 #define FRAME_FILENAME_MAX 256
+#define MAX_FALLBACKS 4
+
+// LZ4 modes the rate controller may pick from, cheapest to pack first
+enum {
+    PACK_MODE_FAST,     // LZ4_compress_fast, acceleration 12 (historic default)
+    PACK_MODE_HC,       // LZ4_compress_HC, default level
+    PACK_MODE_HC_MAX,   // LZ4_compress_HC, max level
+    PACK_MODE_COST,     // lz4_parse_cost, bytes traded for SH-4 decode time (--fast-decode)
+    PACK_MODE_COUNT
+};
+
+static const char *pack_mode_names[PACK_MODE_COUNT] = { "fast", "hc", "hcmax", "cost" };
+
+typedef struct {
+    const char *pattern;
+    uint32_t skip;          // texture header bytes stripped from each frame
+    uint8_t *raw_buf;
+    size_t raw_cap;
+} frame_source_t;
+
+typedef struct {
+    double target_bps;      // 0 = no rate control
+    double peak_bps;
+    double window_sec;
+    int window_frames;
+    double frame_budget;    // target video bytes per frame
+    double window_cap;      // peak video bytes per window
+    double credit;          // leaky bucket: unspent target bytes
+    uint32_t *sizes;        // chosen compressed size per frame
+    uint32_t window_sum;    // sum of the last (window_frames - 1) sizes
+    int level_hist[(MAX_FALLBACKS + 1) * PACK_MODE_COUNT];
+} rate_ctl_t;
+
+// Detect the texture header on a frame and return the bytes to skip
+static int detect_skip(const uint8_t *raw, uint8_t frame_type, uint32_t *skip) {
+    if (frame_type != 0) {
+        *skip = 0;
+        return 0;
+    }
+    if (memcmp(raw, "DcTx", 4) == 0) {
+        uint8_t header_size = raw[9];
+        *skip = (header_size + 1) * 32;
+    } else if (memcmp(raw, "DTEX", 4) == 0 || memcmp(raw, "PVRT", 4) == 0) {
+        *skip = 0x10;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Read frame i of a source into its raw buffer; returns total file size or 0
+static size_t read_frame_file(frame_source_t *src, int i) {
+    char filename[FRAME_FILENAME_MAX];
+    snprintf(filename, sizeof(filename), src->pattern, i);
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open frame %s\n", filename);
+        return 0;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size_t original_size = ftell(fp);
+    rewind(fp);
+
+    if (original_size > src->raw_cap) {
+        src->raw_buf = realloc(src->raw_buf, original_size);
+        if (!src->raw_buf) {
+            perror("Failed to realloc raw_buf");
+            fclose(fp);
+            return 0;
+        }
+        src->raw_cap = original_size;
+    }
+
+    size_t got = fread(src->raw_buf, 1, original_size, fp);
+    fclose(fp);
+    return got == original_size ? original_size : 0;
+}
+
+// True if a frame can be shown as a repeat of the last stored one
+static int is_repeat(const uint8_t *a, const uint8_t *b, size_t n, uint32_t max_diff) {
+    if (max_diff == 0)
+        return memcmp(a, b, n) == 0;
+    uint32_t diff = 0;
+    for (size_t k = 0; k < n; ++k)
+        if (a[k] != b[k] && ++diff > max_diff)
+            return 0;
+    return 1;
+}
+
+/*
+ * Scene cuts
+ *
+ * Each stored frame is reduced to a signature read straight from the
+ * converter's output: a 32-bin luma histogram and the mean luma of 256 runs
+ * of the frame in storage order (macroblocks for YUV, twiddled VQ indices
+ * looked up in the frame's codebook, texels for plain RGB565). The order is
+ * the same in every frame, so the runs compare like a thumbnail. A frame
+ * is a cut when it differs from the last stored one by at least the
+ * threshold, and by SCENE_RATIO times the recent average, so a fast pan
+ * doesn't cut on every frame. A one-frame flash (the frame after it is
+ * much closer to the one before it than the cut was) is taken back, and a
+ * scene is at least SCENE_MIN_SEC long.
+ */
+#define SCENE_CELLS     256
+#define SCENE_BINS      32
+#define SCENE_HISTORY   8       // frames the recent average is taken over
+#define SCENE_RATIO     2.5
+#define SCENE_MIN_SEC   0.5
+
+typedef struct {
+    uint32_t hist[SCENE_BINS];
+    uint32_t count;             // luma samples in hist
+    uint8_t cell[SCENE_CELLS];
+} scene_sig_t;
 
-void write_header(FILE *out, uint8_t frame_type, uint16_t width, uint16_t height, uint16_t fps, uint16_t sample_rate,
-                  uint16_t channels, uint32_t num_frames, uint32_t frame_size, uint32_t max_compressed_size, uint32_t audio_offset) {
-    fwrite("DCMV", 1, 4, out);
-    uint32_t version = 3;
-    fwrite(&version, 4, 1, out);
-    fwrite(&frame_type, 1, 1, out);
-    fwrite(&width, 2, 1, out);
-    fwrite(&height, 2, 1, out);
-    fwrite(&fps, 2, 1, out);
-    fwrite(&sample_rate, 2, 1, out);
-    fwrite(&channels, 2, 1, out);
-    fwrite(&num_frames, 4, 1, out);
-    fwrite(&frame_size, 4, 1, out);
-    fwrite(&max_compressed_size, 4, 1, out); // to be overwritten
-    fwrite(&audio_offset, 4, 1, out);       // 34 (new!)
+typedef struct {
+    double threshold;           // 0 = no detection
+    int min_frames;
+    scene_sig_t prev, before;   // last stored frame, and the one before it
+    int have_prev, have_before;
+    int prev_frame;
+    double cut_distance;        // of the last cut from the frame before it
+    double history[SCENE_HISTORY];
+    int history_len;
+    uint32_t *cuts;             // first frame of every scene but the first
+    uint32_t num_cuts;
+} scene_det_t;
+
+static uint8_t rgb565_luma(uint16_t p) {
+    uint32_t r = (p >> 11) * 255 / 31, g = ((p >> 5) & 63) * 255 / 63, b = (p & 31) * 255 / 31;
+    return (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+}
+
+static void scene_add(scene_sig_t *sig, uint32_t *sums, uint32_t *counts, uint32_t k, uint32_t n, uint8_t luma) {
+    uint32_t cell = (uint32_t)((uint64_t)k * SCENE_CELLS / n);
+    sig->hist[luma >> 3]++;
+    sums[cell] += luma;
+    counts[cell]++;
+}
+
+static void scene_signature(const uint8_t *tex, size_t size, int frame_type, int width, int height, scene_sig_t *sig) {
+    uint32_t sums[SCENE_CELLS] = {0}, counts[SCENE_CELLS] = {0};
+    size_t texels = (size_t)width * height;
+    memset(sig, 0, sizeof(*sig));
+    if (frame_type == 1 && size % 384 == 0) {
+        // YUV420 macroblocks: 128 bytes of chroma, then four 8x8 luma tiles
+        uint32_t blocks = size / 384;
+        for (uint32_t b = 0; b < blocks; ++b)
+            for (int k = 0; k < 256; ++k)
+                scene_add(sig, sums, counts, b, blocks, tex[b * 384 + 128 + k]);
+    } else if (frame_type == 0 && size == texels * 2) {
+        for (size_t k = 0; k < texels; ++k)
+            scene_add(sig, sums, counts, k, texels, rgb565_luma(tex[k * 2] | tex[k * 2 + 1] << 8));
+    } else if (frame_type == 0 && size > texels / 4 && (size - texels / 4) % 8 == 0 && size - texels / 4 <= 2048) {
+        // VQ: codebook of 2x2 RGB565 entries, then one index per 2x2 block
+        uint8_t luma[256];
+        uint32_t entries = (size - texels / 4) / 8;
+        for (uint32_t e = 0; e < entries; ++e) {
+            uint32_t sum = 0;
+            for (int t = 0; t < 4; ++t)
+                sum += rgb565_luma(tex[e * 8 + t * 2] | tex[e * 8 + t * 2 + 1] << 8);
+            luma[e] = sum / 4;
+        }
+        const uint8_t *idx = tex + entries * 8;
+        for (size_t k = 0; k < texels / 4; ++k)
+            scene_add(sig, sums, counts, k, texels / 4, idx[k] < entries ? luma[idx[k]] : 0);
+    } else {
+        for (size_t k = 0; k < size; ++k)
+            scene_add(sig, sums, counts, k, size, tex[k]);
+    }
+    for (int c = 0; c < SCENE_CELLS; ++c)
+        sig->cell[c] = counts[c] ? sums[c] / counts[c] : 0;
+    for (int b = 0; b < SCENE_BINS; ++b)
+        sig->count += sig->hist[b];
+}
+
+// 0 (same picture) to 1: histogram distance and thumbnail difference, equally weighted
+static double scene_distance(const scene_sig_t *a, const scene_sig_t *b) {
+    double hist = 0, cells = 0;
+    for (int k = 0; k < SCENE_BINS; ++k) {
+        double d = (double)a->hist[k] / a->count - (double)b->hist[k] / b->count;
+        hist += d < 0 ? -d : d;
+    }
+    for (int k = 0; k < SCENE_CELLS; ++k)
+        cells += abs(a->cell[k] - b->cell[k]);
+    cells = 4 * cells / (SCENE_CELLS * 255.0);
+    return 0.5 * hist / 2 + 0.5 * (cells < 1 ? cells : 1);
+}
+
+// Frame i is about to be stored: returns 1 if it starts a new scene
+static int scene_check(scene_det_t *sd, int i, const uint8_t *tex, size_t size, int frame_type, int width, int height) {
+    if (sd->threshold <= 0)
+        return 0;
+    scene_sig_t sig;
+    scene_signature(tex, size, frame_type, width, height, &sig);
+    int cut = 0;
+    if (sd->have_prev && sd->num_cuts && sd->cuts[sd->num_cuts - 1] == (uint32_t)sd->prev_frame &&
+        sd->have_before && SCENE_RATIO * scene_distance(&sig, &sd->before) < sd->cut_distance) {
+        // The last cut was a flash: this frame is back to the one before it
+        sd->num_cuts--;
+    } else if (sd->have_prev) {
+        double d = scene_distance(&sig, &sd->prev), avg = 0;
+        for (int k = 0; k < sd->history_len; ++k)
+            avg += sd->history[k] / sd->history_len;
+        uint32_t last = sd->num_cuts ? sd->cuts[sd->num_cuts - 1] : 0;
+        cut = d >= sd->threshold && d >= SCENE_RATIO * avg && i - (int)last >= sd->min_frames;
+        if (cut) {
+            sd->cuts[sd->num_cuts++] = i;
+            sd->cut_distance = d;
+            sd->history_len = 0;    // the average starts over in the new scene
+        } else if (sd->history_len < SCENE_HISTORY) {
+            sd->history[sd->history_len++] = d;
+        } else {
+            memmove(sd->history, sd->history + 1, (SCENE_HISTORY - 1) * sizeof(double));
+            sd->history[SCENE_HISTORY - 1] = d;
+        }
+    }
+    sd->before = sd->prev;
+    sd->have_before = sd->have_prev;
+    sd->prev = sig;
+    sd->have_prev = 1;
+    sd->prev_frame = i;
+    return cut;
+}
+
+/*
+ * Decode-cost-aware LZ4 parse
+ *
+ * An optimal parse like LZ4HC's, but priced in SH-4 decode cycles
+ * (dcmv_lz4cost.h) plus `weight` cycles per stored byte, so a sequence is
+ * only worth splitting off when the bytes it saves outweigh the time it
+ * takes to decode. weight 0 minimises decode time alone; a large weight
+ * approaches a plain smallest-size parse.
+ *
+ * Matches come from a hash chain over the 64 KB window (LZ4_PARSE_DEPTH
+ * candidates per position). Every length of every candidate that beats the
+ * ones before it is priced, up to LZ4_PARSE_SUFFICIENT bytes; a longer match
+ * is taken as it is and the positions it covers are only hashed.
+ */
+#define LZ4_PARSE_HASH_LOG      17
+#define LZ4_PARSE_DEPTH         64
+#define LZ4_PARSE_SUFFICIENT    128
+#define LZ4_PARSE_MAX_OFFSET    65535
+#define LZ4_PARSE_MFLIMIT       12      // last match starts at least this far from the end
+#define LZ4_PARSE_LASTLITERALS  5       // and ends at least this far from it
+
+typedef struct {
+    uint64_t price;         // quarter cycles, cheapest way to reach this position
+    uint32_t len;           // match ending here, 0 = literal
+    uint32_t offset;
+    uint32_t litlen;        // literals right before this position
+} lz4_node_t;
+
+typedef struct {
+    uint32_t weight;        // cycles charged per stored byte
+    int32_t *head;
+    int32_t *chain;
+    lz4_node_t *opt;
+    uint8_t *check;         // the block decoded again
+    size_t cap;
+} lz4_parser_t;
+
+static lz4_parser_t cost_parser;
+
+static uint32_t lz4_parse_hash(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ4_PARSE_HASH_LOG);
+}
+
+static uint32_t lz4_parse_count(const uint8_t *a, const uint8_t *b, uint32_t max) {
+    uint32_t n = 0;
+    while (n + 8 <= max) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y)
+            return n + (uint32_t)(__builtin_ctzll(x ^ y) >> 3);
+        n += 8;
+    }
+    while (n < max && a[n] == b[n])
+        n++;
+    return n;
+}
+
+// Price of one more literal after a run of litlen - 1, in quarter cycles
+static uint64_t lz4_parse_literal_price(const lz4_parser_t *lp, uint32_t litlen) {
+    uint32_t cycles = dcmv_lz4_literal_cycles(litlen) - dcmv_lz4_literal_cycles(litlen - 1);
+    uint32_t bytes = 1 + dcmv_lz4_len_bytes(litlen) - dcmv_lz4_len_bytes(litlen - 1);
+    return 4ull * cycles + (4ull * lp->weight + DCMV_LZ4_INPUT_CYCLES_X4) * bytes;
+}
+
+// Price of a match with its token and offset, in quarter cycles
+static uint64_t lz4_parse_match_price(const lz4_parser_t *lp, uint32_t len, uint32_t offset) {
+    uint32_t bytes = 3 + dcmv_lz4_len_bytes(len - DCMV_LZ4_MINMATCH);
+    return 4ull * dcmv_lz4_match_cycles(len, offset) + (4ull * lp->weight + DCMV_LZ4_INPUT_CYCLES_X4) * bytes;
+}
+
+static void lz4_parse_insert(lz4_parser_t *lp, const uint8_t *src, uint32_t i) {
+    uint32_t h = lz4_parse_hash(src + i);
+    lp->chain[i] = lp->head[h];
+    lp->head[h] = (int32_t)i;
+}
+
+static void lz4_parse_relax(lz4_parser_t *lp, uint32_t to, uint64_t price, uint32_t len, uint32_t offset,
+                            uint32_t litlen) {
+    if (price < lp->opt[to].price)
+        lp->opt[to] = (lz4_node_t){ price, len, offset, litlen };
+}
+
+// Write sequences for the parse ending at src_len; returns the block size or 0 if it doesn't fit
+static int lz4_parse_emit(lz4_parser_t *lp, const uint8_t *src, uint32_t src_len, uint8_t *dst, int bound) {
+    // Walk back from the end collecting where each match ends (chain[] is free by now)
+    int32_t *ends = lp->chain;
+    uint32_t matches = 0;
+    for (uint32_t pos = src_len; pos > 0;) {
+        if (lp->opt[pos].len) {
+            ends[matches++] = (int32_t)pos;
+            pos -= lp->opt[pos].len;
+        } else {
+            pos--;
+        }
+    }
+
+    uint8_t *o = dst, *end = dst + bound;
+    uint32_t anchor = 0;
+    for (int64_t k = (int64_t)matches - 1; k >= -1; --k) {
+        const lz4_node_t *m = k >= 0 ? &lp->opt[ends[k]] : NULL;
+        uint32_t start = m ? (uint32_t)ends[k] - m->len : src_len;
+        uint32_t lit = start - anchor;
+        uint32_t ml = m ? m->len - DCMV_LZ4_MINMATCH : 0;
+        if (end - o < (long)(1 + dcmv_lz4_len_bytes(lit) + lit + 2 + dcmv_lz4_len_bytes(ml)))
+            return 0;
+        uint8_t *token = o++;
+        *token = (uint8_t)((lit < 15 ? lit : 15) << 4);
+        if (lit >= 15) {
+            uint32_t r = lit - 15;
+            for (; r >= 255; r -= 255) *o++ = 255;
+            *o++ = (uint8_t)r;
+        }
+        memcpy(o, src + anchor, lit);
+        o += lit;
+        if (!m)
+            break;
+        *o++ = (uint8_t)m->offset;
+        *o++ = (uint8_t)(m->offset >> 8);
+        *token |= (uint8_t)(ml < 15 ? ml : 15);
+        if (ml >= 15) {
+            uint32_t r = ml - 15;
+            for (; r >= 255; r -= 255) *o++ = 255;
+            *o++ = (uint8_t)r;
+        }
+        anchor = start + m->len;
+    }
+    return (int)(o - dst);
+}
+
+static int lz4_parse_cost(lz4_parser_t *lp, const uint8_t *src, size_t src_len, uint8_t *dst, int bound) {
+    uint32_t n = (uint32_t)src_len;
+    if (n + 1 > lp->cap) {
+        free(lp->chain);
+        free(lp->opt);
+        free(lp->check);
+        lp->chain = malloc((n + 1) * sizeof(*lp->chain));
+        lp->opt = malloc((n + 1) * sizeof(*lp->opt));
+        lp->check = malloc(n + 1);
+        lp->cap = n + 1;
+    }
+    if (!lp->head)
+        lp->head = malloc(sizeof(*lp->head) << LZ4_PARSE_HASH_LOG);
+    if (!lp->head || !lp->chain || !lp->opt || !lp->check)
+        return 0;
+    for (uint32_t k = 0; k < 1u << LZ4_PARSE_HASH_LOG; ++k)
+        lp->head[k] = -1;
+    for (uint32_t k = 0; k <= n; ++k)
+        lp->opt[k].price = UINT64_MAX;
+    lp->opt[0] = (lz4_node_t){ 0 };
+
+    uint32_t match_limit = n >= LZ4_PARSE_MFLIMIT ? n - LZ4_PARSE_MFLIMIT : 0;
+    for (uint32_t i = 0; i < n;) {
+        const lz4_node_t *at = &lp->opt[i];
+        uint32_t litlen = at->len ? 1 : at->litlen + 1;
+        lz4_parse_relax(lp, i + 1, at->price + lz4_parse_literal_price(lp, litlen), 0, 0, litlen);
+        if (i > match_limit || n < LZ4_PARSE_MFLIMIT + 1) {
+            i++;
+            continue;
+        }
+
+        uint32_t max_len = n - LZ4_PARSE_LASTLITERALS - i;
+        uint32_t best = DCMV_LZ4_MINMATCH - 1, best_offset = 0;
+        int32_t cand = lp->head[lz4_parse_hash(src + i)];
+        for (int d = 0; d < LZ4_PARSE_DEPTH && cand >= 0 && i - (uint32_t)cand <= LZ4_PARSE_MAX_OFFSET; ++d) {
+            uint32_t len = lz4_parse_count(src + cand, src + i, max_len);
+            if (len > best) {
+                uint32_t offset = i - (uint32_t)cand;
+                if (len < LZ4_PARSE_SUFFICIENT)
+                    for (uint32_t l = best + 1 > DCMV_LZ4_MINMATCH ? best + 1 : DCMV_LZ4_MINMATCH; l <= len; ++l)
+                        lz4_parse_relax(lp, i + l, at->price + lz4_parse_match_price(lp, l, offset), l, offset, 0);
+                best = len;
+                best_offset = offset;
+                if (len == max_len)
+                    break;
+            }
+            cand = lp->chain[cand];
+        }
+        lz4_parse_insert(lp, src, i);
+
+        if (best >= LZ4_PARSE_SUFFICIENT) {
+            // Long match: take it whole, only hash the positions it covers
+            lz4_parse_relax(lp, i + best, at->price + lz4_parse_match_price(lp, best, best_offset), best, best_offset, 0);
+            uint32_t stop = i + best;
+            for (uint32_t k = i + 1; k < stop && k <= match_limit; ++k)
+                lz4_parse_insert(lp, src, k);
+            i = stop;
+            continue;
+        }
+        i++;
+    }
+
+    // Not liblz4's encoder, so make sure liblz4 decodes it back before it ships
+    int size = lz4_parse_emit(lp, src, n, dst, bound);
+    if (size <= 0 || LZ4_decompress_safe((const char *)dst, (char *)lp->check, size, n) != (int)n ||
+        memcmp(lp->check, src, n) != 0)
+        return 0;
+    return size;
+}
+
+static int compress_frame(const uint8_t *src, size_t src_len, int mode, uint8_t *dst, int bound) {
+    switch (mode) {
+    case PACK_MODE_COST:
+        return lz4_parse_cost(&cost_parser, src, src_len, dst, bound);
+    case PACK_MODE_HC:
+        return LZ4_compress_HC((const char *)src, (char *)dst, src_len, bound, LZ4HC_CLEVEL_DEFAULT);
+    case PACK_MODE_HC_MAX:
+        return LZ4_compress_HC((const char *)src, (char *)dst, src_len, bound, LZ4HC_CLEVEL_MAX);
+    default:
+        return LZ4_compress_fast((const char *)src, (char *)dst, src_len, bound, 12);
+    }
+}
+
+static void rate_ctl_init(rate_ctl_t *rc, double fps, int sample_rate, int channels, int frame_count) {
+    // ADPCM is 4 bits per sample and streams off the same disc, so it comes
+    // out of the budget before video gets its share
+    double audio_bps = (double)sample_rate * channels / 2.0;
+    double target = rc->target_bps > 0 ? rc->target_bps : rc->peak_bps;
+    double peak = rc->peak_bps > 0 ? rc->peak_bps : rc->target_bps;
+
+    rc->window_frames = (int)(rc->window_sec * fps + 0.5);
+    if (rc->window_frames < 1) rc->window_frames = 1;
+    rc->frame_budget = (target - audio_bps) / fps;
+    rc->window_cap = (peak - audio_bps) * rc->window_frames / fps;
+    rc->credit = 0;
+    rc->window_sum = 0;
+    rc->sizes = calloc(frame_count, sizeof(uint32_t));
+
+    printf("🎚️ Rate control: target %.0f B/s, peak %.0f B/s over %d frames (audio %.0f B/s)\n",
+           target, peak, rc->window_frames, audio_bps);
+    if (rc->frame_budget <= 0 || rc->window_cap <= 0)
+        fprintf(stderr, "⚠️ Audio alone exceeds the budget, every frame will use the smallest level\n");
+}
+
+// Does a frame of this size fit both the leaky-bucket target and the window peak?
+// peak_only: just the peak (a scene's first frame, see --scene-cut)
+static int rate_ctl_fits(const rate_ctl_t *rc, uint32_t size, int peak_only) {
+    if (rc->window_sum + size > rc->window_cap)
+        return 0;
+    if (peak_only)
+        return 1;
+    // Bank at most one window's worth of target so a long static scene
+    // can't buy an unbounded burst later
+    return size <= rc->frame_budget + (rc->credit > 0 ? rc->credit : 0);
+}
+
+static void rate_ctl_commit(rate_ctl_t *rc, int i, uint32_t size) {
+    rc->sizes[i] = size;
+    rc->credit += rc->frame_budget - size;
+    double max_credit = rc->frame_budget * rc->window_frames;
+    if (rc->credit > max_credit) rc->credit = max_credit;
+
+    // Keep the sum of the last (window_frames - 1) sizes for the next fit test
+    rc->window_sum += size;
+    int drop = i - (rc->window_frames - 1);
+    if (drop >= 0)
+        rc->window_sum -= rc->sizes[drop];
+}
+
+// Walk every window once more and list the ones still over the cap
+static void rate_ctl_report(const rate_ctl_t *rc, int frame_count, double fps, int num_sources, frame_source_t *sources) {
+    printf("🎚️ Level usage:\n");
+    for (int l = 0; l < num_sources * PACK_MODE_COUNT; ++l) {
+        if (!rc->level_hist[l]) continue;
+        printf("    %-40s %-6s %d frames\n", sources[l / PACK_MODE_COUNT].pattern,
+               pack_mode_names[l % PACK_MODE_COUNT], rc->level_hist[l]);
+    }
+
+    int w = rc->window_frames < frame_count ? rc->window_frames : frame_count;
+    uint64_t sum = 0;
+    int over = 0;
+    for (int i = 0; i < frame_count; ++i) {
+        sum += rc->sizes[i];
+        if (i >= w) sum -= rc->sizes[i - w];
+        if (i < w - 1) continue;
+        if (sum > rc->window_cap) {
+            int start = i - w + 1;
+            printf("❌ Window frames %d-%d (%.2fs): %.0f B/s video exceeds cap by %.0f B/s\n",
+                   start, i, (double)start / fps, (double)sum * fps / w,
+                   ((double)sum - rc->window_cap) * fps / w);
+            over++;
+        }
+    }
+    if (over)
+        printf("❌ %d window(s) exceed the peak budget even at the smallest level\n", over);
+    else
+        printf("✅ All windows within the peak budget\n");
+}
+
+/*
+ * Built-in AICA ADPCM encoder
+ *
+ * PCM (WAV file or raw s16le on stdin) is encoded per channel, then written as
+ * [L block][R block] pairs of block_size bytes each, so the player's stream
+ * callback can serve a request with one contiguous read. The tail is padded
+ * with encoded silence to a whole block.
+ *
+ * Threaded mode splits each segment into parts. Parts after the first start
+ * from a guessed state: the encoder run from reset over the ADPCM_PREROLL
+ * samples before the part, which on most audio meets the true state before
+ * the part begins. A serial fixup pass then re-encodes each part from the true
+ * state until both encoders land on the same (signal, step) — from there on
+ * the output is identical, so the result is bit-exact with a single-threaded
+ * encode. The fixup gives up after ADPCM_PREROLL samples (a steady tone may
+ * never meet): the rest of the segment is split across the threads again.
+ */
+#define ADPCM_SEGMENT_BLOCKS 256    // blocks per channel encoded per pass, at least
+#define ADPCM_PREROLL        (1 << 18)  // samples run to guess a part's start state; fixup cap
+#define ADPCM_PART           (8 * ADPCM_PREROLL)   // samples per thread in a threaded segment
+#define ADPCM_MAX_THREADS    64
+
+typedef struct {
+    const int16_t *pcm;
+    size_t stride;
+    size_t preroll;                 // samples before start run from reset to guess the state, 0 = given
+    size_t start, end;              // sample range within the segment
+    dcmv_adpcm_state_t state;       // start state in, end state out
+    dcmv_adpcm_state_t guess;       // start state the preroll landed on
+    uint8_t *out;
+    dcmv_adpcm_state_t *hist;       // state after each of the first ADPCM_PREROLL samples (threaded parts only)
+} adpcm_part_t;
+
+typedef struct {
+    int channels;
+    uint32_t block_size;
+    int threads;
+    dcmv_adpcm_state_t state[2];
+    uint64_t samples;               // per channel, excluding padding
+    uint64_t resync_samples;        // re-encoded by the threaded fixup pass
+    uint32_t rounds;                // extra splits after a fixup gave up
+    dcmv_seek_entry_t *seek;        // decoder state at the start of every block
+    uint32_t seek_count;
+    uint32_t seek_cap;
+} adpcm_enc_t;
+
+static void *adpcm_part_worker(void *arg) {
+    adpcm_part_t *p = arg;
+    if (p->preroll) {
+        dcmv_adpcm_init(&p->state);
+        for (size_t k = p->start - p->preroll; k < p->start; ++k)
+            dcmv_adpcm_encode_sample(&p->state, p->pcm[k * p->stride]);
+        p->guess = p->state;
+    }
+    dcmv_adpcm_state_t s = p->state;
+    for (size_t k = p->start; k < p->end; k += 2) {
+        int keep = p->hist && k - p->start < ADPCM_PREROLL;
+        int lo = dcmv_adpcm_encode_sample(&s, p->pcm[k * p->stride]);
+        if (keep) p->hist[k - p->start] = s;
+        int hi = dcmv_adpcm_encode_sample(&s, p->pcm[(k + 1) * p->stride]);
+        if (keep) p->hist[k + 1 - p->start] = s;
+        p->out[k / 2] = (uint8_t)(lo | (hi << 4));
+    }
+    p->state = s;
+    return NULL;
+}
+
+static int adpcm_same(const dcmv_adpcm_state_t *a, const dcmv_adpcm_state_t *b) {
+    return a->signal == b->signal && a->step == b->step;
+}
+
+// Encode n samples (even) of one channel, carrying enc->state[ch] across calls.
+// hist holds ADPCM_PREROLL states for each thread but one.
+static int adpcm_encode_channel(adpcm_enc_t *enc, int ch, const int16_t *pcm, size_t n,
+                                uint8_t *out, dcmv_adpcm_state_t *hist) {
+    dcmv_adpcm_state_t s = enc->state[ch];
+    size_t done = 0;
+
+    // Every round keeps at least its first part, which starts from the true state
+    for (int round = 0; done < n; ++round) {
+        int parts = enc->threads;
+        if ((size_t)parts > (n - done) / ADPCM_PREROLL) parts = (n - done) / ADPCM_PREROLL;
+        if (parts < 1) parts = 1;
+        if (round) enc->rounds++;
+
+        adpcm_part_t part[ADPCM_MAX_THREADS];
+        pthread_t tid[ADPCM_MAX_THREADS];
+        size_t chunk = ((n - done) / parts) & ~(size_t)1;
+
+        for (int j = 0; j < parts; ++j) {
+            part[j] = (adpcm_part_t){
+                .pcm = pcm + ch, .stride = enc->channels, .out = out, .state = s,
+                .start = done + j * chunk, .end = j == parts - 1 ? n : done + (j + 1) * chunk,
+                .preroll = j ? ADPCM_PREROLL : 0, .hist = j ? hist + (size_t)(j - 1) * ADPCM_PREROLL : NULL,
+            };
+            if (j && pthread_create(&tid[j], NULL, adpcm_part_worker, &part[j]) != 0) {
+                fprintf(stderr, "Failed to start ADPCM worker\n");
+                return -1;
+            }
+        }
+        adpcm_part_worker(&part[0]);
+        for (int j = 1; j < parts; ++j)
+            pthread_join(tid[j], NULL);
+
+        // Serial fixup: re-encode from the true state until it meets the guess
+        s = part[0].state;
+        done = part[0].end;
+        for (int j = 1; j < parts; ++j) {
+            size_t k = part[j].start;
+            size_t cap = part[j].end - k < ADPCM_PREROLL ? part[j].end : k + ADPCM_PREROLL;
+            int met;
+            for (;; ++k) {
+                const dcmv_adpcm_state_t *before = k == part[j].start ? &part[j].guess : &part[j].hist[k - 1 - part[j].start];
+                if ((met = adpcm_same(&s, before)) || k == cap)
+                    break;
+                int nib = dcmv_adpcm_encode_sample(&s, pcm[k * enc->channels + ch]);
+                if (k & 1) out[k / 2] = (out[k / 2] & 0x0F) | (nib << 4);
+                else       out[k / 2] = (out[k / 2] & 0xF0) | nib;
+            }
+            enc->resync_samples += k - part[j].start;
+            done = met ? part[j].end : k;
+            if (met)
+                s = part[j].state;
+            else if (k < part[j].end)
+                break;      // split what's left again from here
+        }
+    }
+    enc->state[ch] = s;
+    return 0;
+}
+
+// Parse a RIFF/WAVE header and leave fp at the start of the PCM data
+static int wav_open(FILE *fp, int *channels, int *rate) {
+    uint8_t hdr[12];
+    if (fread(hdr, 1, 12, fp) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4))
+        return -1;
+
+    int got_fmt = 0;
+    for (;;) {
+        uint8_t ck[8];
+        if (fread(ck, 1, 8, fp) != 8)
+            return -1;
+        uint32_t len = ck[4] | (ck[5] << 8) | (ck[6] << 16) | ((uint32_t)ck[7] << 24);
+        if (!memcmp(ck, "data", 4))
+            return got_fmt ? 0 : -1;
+
+        uint8_t fmt[16];
+        uint32_t skip = len + (len & 1);
+        if (!memcmp(ck, "fmt ", 4) && len >= 16) {
+            if (fread(fmt, 1, 16, fp) != 16)
+                return -1;
+            uint16_t tag = fmt[0] | (fmt[1] << 8);
+            uint16_t bits = fmt[14] | (fmt[15] << 8);
+            if ((tag != 1 && tag != 0xFFFE) || bits != 16) {
+                fprintf(stderr, "Only 16-bit PCM WAV input is supported\n");
+                return -1;
+            }
+            *channels = fmt[2] | (fmt[3] << 8);
+            *rate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t)fmt[7] << 24);
+            got_fmt = 1;
+            skip -= 16;
+        }
+        while (skip--)
+            if (fgetc(fp) == EOF)
+                return -1;
+    }
+}
+
+// Stream PCM from `in` to ADPCM blocks in `out`; returns bytes written or -1
+static long adpcm_encode_stream(adpcm_enc_t *enc, FILE *in, FILE *out) {
+    // Samples per channel; threaded, enough for ADPCM_PART per thread
+    size_t per_block = enc->block_size * 2;
+    size_t seg = (size_t)ADPCM_SEGMENT_BLOCKS * per_block;
+    if (enc->threads > 1 && seg < (size_t)enc->threads * ADPCM_PART)
+        seg = ((size_t)enc->threads * ADPCM_PART + per_block - 1) / per_block * per_block;
+    int16_t *pcm = malloc(seg * enc->channels * sizeof(int16_t));
+    uint8_t *adpcm[2] = { malloc(seg / 2), enc->channels == 2 ? malloc(seg / 2) : NULL };
+    dcmv_adpcm_state_t *hist = enc->threads > 1 ? malloc((size_t)(enc->threads - 1) * ADPCM_PREROLL * sizeof(*hist)) : NULL;
+    if (!pcm || !adpcm[0] || (enc->channels == 2 && !adpcm[1]) || (enc->threads > 1 && !hist)) {
+        fprintf(stderr, "OOM\n");
+        return -1;
+    }
+
+    dcmv_adpcm_init(&enc->state[0]);
+    dcmv_adpcm_init(&enc->state[1]);
+    long written = 0;
+    size_t n;
+    do {
+        n = fread(pcm, sizeof(int16_t) * enc->channels, seg, in);
+        if (n == 0)
+            break;
+        enc->samples += n;
+
+        // Pad the tail with silence up to a whole block
+        size_t padded = (n + per_block - 1) / per_block * per_block;
+        memset(pcm + n * enc->channels, 0, (padded - n) * enc->channels * sizeof(int16_t));
+
+        // Seek index: replay the decoder over each block to capture its entry state
+        size_t blocks = padded / per_block;
+        if (enc->seek_count + blocks > enc->seek_cap) {
+            enc->seek_cap = (enc->seek_count + blocks) * 2;
+            enc->seek = realloc(enc->seek, enc->seek_cap * sizeof(dcmv_seek_entry_t));
+            if (!enc->seek) {
+                fprintf(stderr, "OOM\n");
+                return -1;
+            }
+        }
+        dcmv_adpcm_state_t start[2] = { enc->state[0], enc->state[1] };
+
+        for (int ch = 0; ch < enc->channels; ++ch)
+            if (adpcm_encode_channel(enc, ch, pcm, padded, adpcm[ch], hist) < 0)
+                return -1;
+
+        for (size_t b = 0; b < blocks; ++b) {
+            dcmv_seek_entry_t *e = &enc->seek[enc->seek_count++];
+            e->sample = (uint32_t)((enc->seek_count - 1) * per_block);
+            e->byte_offset = (uint32_t)((enc->seek_count - 1) * enc->block_size * enc->channels);
+            for (int ch = 0; ch < 2; ++ch) {
+                e->signal[ch] = (int16_t)start[ch].signal;
+                e->step[ch] = (uint16_t)start[ch].step;
+                if (ch < enc->channels) {
+                    for (size_t k = 0; k < per_block; ++k) {
+                        uint8_t byte = adpcm[ch][b * enc->block_size + k / 2];
+                        dcmv_adpcm_decode_nibble(&start[ch], (k & 1) ? byte >> 4 : byte & 0x0F);
+                    }
+                }
+            }
+        }
+
+        for (size_t b = 0; b < padded / per_block; ++b)
+            for (int ch = 0; ch < enc->channels; ++ch)
+                written += fwrite(adpcm[ch] + b * enc->block_size, 1, enc->block_size, out);
+    } while (n == seg);
+
+    free(pcm);
+    free(adpcm[0]);
+    free(adpcm[1]);
+    free(hist);
+    return written;
+}
+
+/*
+ * --check-seek: reopen the packed file, decode the whole track once and
+ * confirm that resuming from the SEEK index reproduces it exactly — both the
+ * stored state at every entry and the samples after a handful of odd seek
+ * targets, located the same way the player does it.
+ */
+#define SEEK_CHECK_TARGETS 64
+#define SEEK_CHECK_WINDOW  4096
+
+// Decode `count` samples per channel starting `skip` samples into block `blk`
+static int decode_from_block(FILE *fp, const dcmv_header_t *h, dcmv_adpcm_state_t st[2], uint32_t blk,
+                             uint32_t skip, uint32_t count, int16_t *out[2], uint32_t audio_end) {
+    uint32_t bs = h->audio_block_size;
+    uint8_t *pair = malloc(bs * 2);
+    int ch_count = h->channels;
+    uint32_t done = 0;
+    for (; done < count; ++blk) {
+        uint32_t pos = h->audio_offset + blk * bs * ch_count;
+        if (pos + bs * ch_count > audio_end)
+            break;
+        fseek(fp, pos, SEEK_SET);
+        if (fread(pair, 1, bs * ch_count, fp) != bs * ch_count)
+            break;
+        // Samples before `skip` still run through the decoder to advance its state
+        for (uint32_t k = 0; k < bs * 2 && done < count; ++k) {
+            for (int ch = 0; ch < ch_count; ++ch) {
+                uint8_t byte = pair[ch * bs + k / 2];
+                int16_t v = dcmv_adpcm_decode_nibble(&st[ch], (k & 1) ? byte >> 4 : byte & 0x0F);
+                if (k >= skip && out) out[ch][done] = v;
+            }
+            if (k >= skip) done++;
+        }
+        skip = 0;
+    }
+    free(pair);
+    return done == count ? 0 : -1;
+}
+
+static int check_seek_index(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    dcmv_header_t h;
+    if (!fp || dcmv_read_header(fp, &h) < 0) {
+        fprintf(stderr, "check-seek: cannot read %s\n", path);
+        return -1;
+    }
+    uint32_t interval, count;
+    long payload = dcmv_find_seek(fp, &h, &interval, &count);
+    if (payload < 0 || !h.audio_block_size) {
+        fprintf(stderr, "check-seek: no SEEK chunk in %s\n", path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    uint32_t audio_end = dcmv_audio_end(&h, ftell(fp));
+    uint32_t per_block = h.audio_block_size * 2;
+    uint64_t total = (uint64_t)count * per_block;
+
+    // Odd, unaligned targets spread over the track
+    uint32_t targets[SEEK_CHECK_TARGETS];
+    int ntargets = 0;
+    for (int i = 0; i < SEEK_CHECK_TARGETS && total > SEEK_CHECK_WINDOW * 2; ++i) {
+        uint64_t t = (total - SEEK_CHECK_WINDOW) * (2 * i + 1) / (2 * SEEK_CHECK_TARGETS) + 2 * i + 3;
+        targets[ntargets++] = (uint32_t)(t & ~1ULL);
+    }
+
+    // Full decode from the start, checking every entry and capturing windows
+    int16_t *ref[SEEK_CHECK_TARGETS][2] = {{0}};
+    dcmv_adpcm_state_t st[2];
+    dcmv_adpcm_init(&st[0]);
+    dcmv_adpcm_init(&st[1]);
+    int bad_entries = 0;
+    int16_t *scratch[2] = { malloc(per_block * 2), malloc(per_block * 2) };
+    for (uint32_t k = 0; k < count; ++k) {
+        dcmv_seek_entry_t e;
+        dcmv_read_seek_entry(fp, payload, k, &e);
+        for (int ch = 0; ch < h.channels; ++ch)
+            if (e.signal[ch] != st[ch].signal || e.step[ch] != st[ch].step || e.sample != k * per_block)
+                bad_entries++;
+        if (decode_from_block(fp, &h, st, k, 0, per_block, scratch, audio_end) < 0)
+            break;
+        uint64_t blk_lo = (uint64_t)k * per_block, blk_hi = blk_lo + per_block;
+        for (int i = 0; i < ntargets; ++i) {
+            uint64_t lo = targets[i] > blk_lo ? targets[i] : blk_lo;
+            uint64_t hi = (uint64_t)targets[i] + SEEK_CHECK_WINDOW;
+            if (hi > blk_hi) hi = blk_hi;
+            for (int ch = 0; ch < h.channels && lo < hi; ++ch) {
+                if (!ref[i][ch]) ref[i][ch] = malloc(SEEK_CHECK_WINDOW * 2);
+                memcpy(ref[i][ch] + (lo - targets[i]), scratch[ch] + (lo - blk_lo), (hi - lo) * 2);
+            }
+        }
+    }
+
+    // Seek like the player: nearest entry at or before the target, then discard
+    int bad_seeks = 0;
+    int16_t *got[2] = { malloc(SEEK_CHECK_WINDOW * 2), malloc(SEEK_CHECK_WINDOW * 2) };
+    for (int i = 0; i < ntargets; ++i) {
+        dcmv_seek_entry_t e;
+        dcmv_read_seek_entry(fp, payload, targets[i] / interval, &e);
+        dcmv_adpcm_state_t s2[2] = { { e.signal[0], e.step[0] }, { e.signal[1], e.step[1] } };
+        if (decode_from_block(fp, &h, s2, e.byte_offset / (h.audio_block_size * h.channels),
+                              targets[i] - e.sample, SEEK_CHECK_WINDOW, got, audio_end) < 0 ||
+            memcmp(got[0], ref[i][0], SEEK_CHECK_WINDOW * 2) ||
+            (h.channels == 2 && memcmp(got[1], ref[i][1], SEEK_CHECK_WINDOW * 2)))
+            bad_seeks++;
+        free(ref[i][0]);
+        free(ref[i][1]);
+    }
+
+    free(scratch[0]); free(scratch[1]);
+    free(got[0]); free(got[1]);
+    fclose(fp);
+    printf("%s Seek index: %u entries every %u samples, %d bad entries, %d/%d seeks differ from a full decode\n",
+           bad_entries || bad_seeks ? "❌" : "✅", count, interval, bad_entries, bad_seeks, ntargets);
+    return bad_entries || bad_seeks ? -1 : 0;
+}
+
+/*
+ * Frame start times in seconds, one per line, as PTS ticks (PTS_TIMESCALE
+ * a second, as in MPEG). The end of the last frame may be given as an extra
+ * line; otherwise it lasts as long as the frame before it (or one frame at
+ * the nominal rate). NULL on a short or backwards list.
+ */
+#define PTS_TIMESCALE 90000
+
+static uint32_t *read_pts(const char *path, int frame_count, double fps) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return NULL;
+    }
+    uint32_t *pts = calloc(frame_count + 1, sizeof(uint32_t));
+    int n = 0;
+    char line[128];
+    while (n <= frame_count && fgets(line, sizeof(line), fp)) {
+        char *end;
+        double t = strtod(line, &end);
+        if (end == line)
+            continue;   // blank line or comment
+        if (t < 0 || t * PTS_TIMESCALE > UINT32_MAX) {
+            fprintf(stderr, "%s: %s is out of range\n", path, line);
+            break;
+        }
+        pts[n] = (uint32_t)(t * PTS_TIMESCALE + 0.5);
+        if (n > 0 && pts[n] < pts[n - 1]) {
+            fprintf(stderr, "%s: frame %d starts before frame %d\n", path, n, n - 1);
+            break;
+        }
+        n++;
+    }
+    fclose(fp);
+    if (n == frame_count && n > 0) {
+        uint32_t last = n > 1 ? pts[n - 1] - pts[n - 2] : (uint32_t)(PTS_TIMESCALE / fps + 0.5);
+        pts[n++] = pts[frame_count - 1] + last;
+    }
+    if (n != frame_count + 1) {
+        fprintf(stderr, "%s: %d timestamps for %d frames\n", path, n, frame_count);
+        free(pts);
+        return NULL;
+    }
+    return pts;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] <output.dcmv> <frame_type 0=RGB565, 1=YUV420P> <width> <height> <fps> <sample_rate> <channels> <frame_pattern> <audio_file>\n", prog);
+    printf("Options:\n");
+    printf("  --target-bps <n>      Average bytes/sec budget (video + audio)\n");
+    printf("  --peak-bps <n>        Peak bytes/sec cap over the sliding window\n");
+    printf("  --window <sec>        Sliding window length (default 1.0)\n");
+    printf("  --fallback <pattern>  Cheaper encode of the same frames, best first (repeatable)\n");
+    printf("  --audio-block <bytes> ADPCM bytes per channel per stream block (default %d)\n", DCMV_DEFAULT_AUDIO_BLOCK);
+    printf("  --adpcm-threads <n>   Threads for the built-in ADPCM encoder (default 1)\n");
+    printf("  --check-seek          After packing, verify seeks via the SEEK index match a full decode\n");
+    printf("  --near-dup <bytes>    Store frames differing from the last stored one in at most this\n");
+    printf("                        many bytes as repeats (default 0: exact repeats only)\n");
+    printf("  --no-dedup            Store repeated frames instead of zero-length repeat entries\n");
+    printf("  --loop <start>[:<end>] Loop points for the player (end defaults to the frame count)\n");
+    printf("  --pts <file>          Per-frame start times in seconds, one per line (variable frame rate)\n");
+    printf("  --fast-decode <n>     Parse for SH-4 decode time: spend a stored byte per n decode cycles saved\n");
+    printf("  --scene-cut <t>       Scene cut threshold, 0-1 (default 0.3, 0 = no CUTS chunk)\n");
+    printf("<fps> may be a fraction (30000/1001) or a decimal (29.97 = 30000/1001)\n");
+    printf("<audio_file> is a 16-bit PCM .wav, '-' for raw s16le PCM on stdin, or pre-encoded .dca\n");
 }
 
 int main(int argc, char **argv) {
-    if (argc != 10) {
-        printf("Usage: %s <output.dcmv> <frame_type 0=RGB565, 1=YUV420P> <width> <height> <fps> <sample_rate> <channels> <frame_pattern> <audio_file>\n", argv[0]);
+    rate_ctl_t rc = { .window_sec = 1.0 };
+    frame_source_t sources[MAX_FALLBACKS + 1] = {0};
+    int num_sources = 1;
+    uint32_t audio_block_size = DCMV_DEFAULT_AUDIO_BLOCK;
+    int adpcm_threads = 1;
+    int check_seek = 0;
+    int dedup = 1;
+    uint32_t near_dup = 0;
+    int loop = 0;
+    uint32_t loop_start = 0, loop_end = 0;
+    const char *pts_path = NULL;
+    int fast_decode = 0;
+    scene_det_t scenes = { .threshold = 0.3 };
+
+    int argi = 1;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        const char *opt = argv[argi];
+        if (strcmp(opt, "--check-seek") == 0) {
+            check_seek = 1;
+            argi++;
+            continue;
+        }
+        if (strcmp(opt, "--no-dedup") == 0) {
+            dedup = 0;
+            argi++;
+            continue;
+        }
+        if (argi + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *val = argv[argi + 1];
+        if (strcmp(opt, "--target-bps") == 0) {
+            rc.target_bps = atof(val);
+        } else if (strcmp(opt, "--peak-bps") == 0) {
+            rc.peak_bps = atof(val);
+        } else if (strcmp(opt, "--window") == 0) {
+            rc.window_sec = atof(val);
+        } else if (strcmp(opt, "--near-dup") == 0) {
+            near_dup = strtoul(val, NULL, 0);
+        } else if (strcmp(opt, "--loop") == 0) {
+            char *colon;
+            loop = 1;
+            loop_start = strtoul(val, &colon, 0);
+            loop_end = *colon == ':' ? strtoul(colon + 1, NULL, 0) : 0;
+        } else if (strcmp(opt, "--pts") == 0) {
+            pts_path = val;
+        } else if (strcmp(opt, "--scene-cut") == 0) {
+            scenes.threshold = atof(val);
+        } else if (strcmp(opt, "--fast-decode") == 0) {
+            fast_decode = 1;
+            cost_parser.weight = strtoul(val, NULL, 0);
+        } else if (strcmp(opt, "--audio-block") == 0) {
+            audio_block_size = atoi(val);
+        } else if (strcmp(opt, "--adpcm-threads") == 0) {
+            adpcm_threads = atoi(val);
+            if (adpcm_threads < 1) adpcm_threads = 1;
+            if (adpcm_threads > ADPCM_MAX_THREADS) adpcm_threads = ADPCM_MAX_THREADS;
+        } else if (strcmp(opt, "--fallback") == 0) {
+            if (num_sources > MAX_FALLBACKS) {
+                fprintf(stderr, "At most %d fallback patterns\n", MAX_FALLBACKS);
+                return 1;
+            }
+            sources[num_sources++].pattern = val;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+        argi += 2;
+    }
+
+    if (argc - argi != 9) {
+        usage(argv[0]);
         return 1;
     }
+    argv += argi - 1;
 
     const char *output_path = argv[1];
     uint16_t frame_type = atoi(argv[2]);
     uint16_t width = atoi(argv[3]);
     uint16_t height = atoi(argv[4]);
-    uint16_t fps = atoi(argv[5]);
+    uint32_t fps_num, fps_den;
     uint16_t sample_rate = atoi(argv[6]);
     uint16_t channels = atoi(argv[7]);
     const char *frame_pattern = argv[8];
     const char *audio_path = argv[9];
+    int rate_control = rc.target_bps > 0 || rc.peak_bps > 0;
+    sources[0].pattern = frame_pattern;
+
+    if (channels < 1 || channels > 2) {
+        fprintf(stderr, "Only mono or stereo audio is supported\n");
+        return 1;
+    }
+    if (dcmv_parse_fps(argv[5], &fps_num, &fps_den) < 0 || (fps_num + fps_den / 2) / fps_den > UINT16_MAX) {
+        fprintf(stderr, "Bad frame rate %s\n", argv[5]);
+        return 1;
+    }
+    double fps = (double)fps_num / fps_den;
+    if (fps_den > 1)
+        printf("🎞️ Frame rate %u/%u (%.3f fps)\n", fps_num, fps_den, fps);
+    if (loop && pts_path) {
+        fprintf(stderr, "--loop and --pts can't be combined: loops play at the fixed frame rate\n");
+        return 1;
+    }
+
+    // Audio is either PCM we encode ourselves (WAV, or raw s16le on stdin
+    // as "-") or pre-encoded ADPCM from dcaconv, copied through as-is
     printf("audio path = %s\n", audio_path);
-    FILE *audio_fp = fopen(audio_path, "rb");
-    if (!audio_fp) { perror("Audio open failed"); return 1; }
-
-    // Check for and skip DcAF header if present
-    char head[4];
-    size_t read_bytes = fread(head, 1, 4, audio_fp);
-    if (memcmp(head, "DcAF", 4) == 0) {
-        fseek(audio_fp, 0x40, SEEK_SET);
-        printf("🔊 Skipping 64-byte DcAF header from %s\n", audio_path);
+    int pcm_input = 0;
+    FILE *audio_fp;
+    if (strcmp(audio_path, "-") == 0) {
+        audio_fp = stdin;
+        pcm_input = 1;
+        printf("🔊 Reading raw s16le PCM (%uch @ %uHz) from stdin\n", channels, sample_rate);
     } else {
+        audio_fp = fopen(audio_path, "rb");
+        if (!audio_fp) { perror("Audio open failed"); return 1; }
+
+        char head[4];
+        size_t read_bytes = fread(head, 1, 4, audio_fp);
         rewind(audio_fp);
+        if (read_bytes == 4 && memcmp(head, "RIFF", 4) == 0) {
+            int wav_channels = 0, wav_rate = 0;
+            if (wav_open(audio_fp, &wav_channels, &wav_rate) < 0) {
+                fprintf(stderr, "Unsupported WAV file %s\n", audio_path);
+                return 1;
+            }
+            if (wav_channels != channels) {
+                fprintf(stderr, "WAV has %d channel(s), expected %u\n", wav_channels, channels);
+                return 1;
+            }
+            if (wav_rate != sample_rate)
+                fprintf(stderr, "⚠️ WAV is %dHz but header will say %uHz\n", wav_rate, sample_rate);
+            pcm_input = 1;
+        } else if (read_bytes == 4 && memcmp(head, "DcAF", 4) == 0) {
+            // Check for and skip DcAF header if present
+            fseek(audio_fp, 0x40, SEEK_SET);
+            printf("🔊 Skipping 64-byte DcAF header from %s\n", audio_path);
+        }
+    }
+    if (pcm_input && (audio_block_size == 0 || audio_block_size % 32)) {
+        fprintf(stderr, "Audio block size must be a non-zero multiple of 32\n");
+        return 1;
     }
 
     char filename[FRAME_FILENAME_MAX];
@@ -121,16 +1218,27 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    snprintf(filename, sizeof(filename), frame_pattern, 0);
-
-    FILE *first_fp = fopen(filename, "rb");
-    if (!first_fp) {
-        fprintf(stderr, "Failed to open first frame\n");
-        return 1;
-    }
-    uint32_t skip = 0;
+    // Every source must decode to the same texture layout as the primary
     size_t frame_size = 0;
-    uint8_t *raw_buf = NULL;
+    for (int s = 0; s < num_sources; ++s) {
+        size_t original_size = read_frame_file(&sources[s], 0);
+        if (!original_size) {
+            fprintf(stderr, "Failed to open first frame of %s\n", sources[s].pattern);
+            return 1;
+        }
+        if (detect_skip(sources[s].raw_buf, frame_type, &sources[s].skip) < 0) {
+            fprintf(stderr, "Unknown texture format in frame 0 of %s (expected RGB565+header)\n", sources[s].pattern);
+            return 1;
+        }
+        size_t usable = original_size - sources[s].skip;
+        if (s == 0) {
+            frame_size = usable;  // store first frame's usable size
+        } else if (usable != frame_size) {
+            fprintf(stderr, "Fallback %s frame size %zu does not match primary %zu\n",
+                    sources[s].pattern, usable, frame_size);
+            return 1;
+        }
+    }
 
     FILE *out = fopen(output_path, "wb+");
     if (!out) { perror("Output open failed"); return 1; }
@@ -140,97 +1248,166 @@ int main(int argc, char **argv) {
         fprintf(stderr, "OOM\n");
         return 1;
     }    
-    fseek(out, 35, SEEK_SET);   // size of DCMV header
+    fseek(out, DCMV_HEADER_SIZE, SEEK_SET);   // size of DCMV header
     long offset_table_pos = ftell(out);  // where offset table starts
 
     fseek(out, (frame_count + 1) * sizeof(uint32_t), SEEK_CUR);
     offsets[0] = ftell(out);
 
-
     uint32_t max_compressed_size = 0;
+    uint32_t *crcs = malloc(frame_count * 2 * sizeof(uint32_t));   // compressed, decompressed
+    if (!crcs) {
+        fprintf(stderr, "OOM\n");
+        return 1;
+    }
+    dcmv_crc32_init();
 
-// Initialize offset[0] before writing frames
-    // offsets[0] = ftell(out);
+    int bound = LZ4_compressBound(frame_size);
+    int ladder[PACK_MODE_COUNT], ladder_len = 0;    // modes each source is tried in
+    if (fast_decode) {
+        ladder[ladder_len++] = PACK_MODE_COST;
+        if (rate_control)
+            ladder[ladder_len++] = PACK_MODE_HC_MAX;
+    } else if (rate_control) {
+        for (int m = PACK_MODE_FAST; m <= PACK_MODE_HC_MAX; ++m)
+            ladder[ladder_len++] = m;
+    } else {
+        ladder[ladder_len++] = PACK_MODE_FAST;
+    }
+    int num_levels = rate_control ? num_sources * ladder_len : ladder_len;
+    uint16_t *costs = calloc(frame_count, sizeof(uint16_t));   // COST chunk
+    dcmv_lz4_cost_t cost_sum = { 0 };
+    int cost_max_frame = 0;
+    uint8_t *comp = malloc(bound);
+    uint8_t *best = malloc(bound);
+    uint8_t *last_stored = malloc(frame_size);     // primary texture of the last frame written
+    uint32_t last_size = 0;
+    int dup_frames = 0;
+    uint64_t dup_bytes = 0;
+    scenes.cuts = malloc(frame_count * sizeof(uint32_t));
+    scenes.min_frames = (int)(SCENE_MIN_SEC * fps + 0.5);
+    if (!comp || !best || !last_stored || !costs || !scenes.cuts) {
+        perror("Failed to malloc comp");
+        return 1;
+    }
+    if (rate_control)
+        rate_ctl_init(&rc, fps, sample_rate, channels, frame_count);
 
     for (int i = 0; i < frame_count; ++i) {
-        snprintf(filename, sizeof(filename), frame_pattern, i);
-        FILE *fp = fopen(filename, "rb");
-        if (!fp) {
-            fprintf(stderr, "Failed to open frame %d\n", i);
+        int best_size = 0;
+        int chosen = 0;
+        int loaded = 0;
+        size_t original_size = read_frame_file(&sources[0], i);
+        if (!original_size || original_size - sources[0].skip != frame_size) {
+            fprintf(stderr, "Frame %d of %s is missing or has the wrong size\n", i, sources[0].pattern);
             return 1;
         }
 
-        fseek(fp, 0, SEEK_END);
-        size_t original_size = ftell(fp);
-        rewind(fp);
-
-        if (!raw_buf || original_size > 0x100000) {
-            raw_buf = realloc(raw_buf, original_size);
-            if (!raw_buf) {
-                perror("Failed to realloc raw_buf");
-                return 1;
+        // A repeat gets a zero-length entry: the player keeps showing the last
+        // stored frame and its decoded CRC carries over
+        if (dedup) {
+            if (i > 0 && is_repeat(sources[0].raw_buf + sources[0].skip, last_stored, frame_size, near_dup)) {
+                offsets[i + 1] = offsets[i];
+                crcs[2 * i] = 0;
+                crcs[2 * i + 1] = crcs[2 * i - 1];
+                if (rate_control)
+                    rate_ctl_commit(&rc, i, 0);
+                dup_frames++;
+                dup_bytes += last_size;
+                continue;
             }
+            memcpy(last_stored, sources[0].raw_buf + sources[0].skip, frame_size);
         }
+        int cut = scene_check(&scenes, i, sources[0].raw_buf + sources[0].skip, frame_size, frame_type, width, height);
 
-        fread(raw_buf, 1, original_size, fp);
-        fclose(fp);
-
-        // Handle skip logic on frame 0 only (only relevant for RGB565)
-        if (i == 0) {
-            if (frame_type == 0) {
-                if (memcmp(raw_buf, "DcTx", 4) == 0) {
-                    uint8_t header_size = raw_buf[9];
-                    skip = (header_size + 1) * 32;
-                } else if (memcmp(raw_buf, "DTEX", 4) == 0 || memcmp(raw_buf, "PVRT", 4) == 0) {
-                    skip = 0x10;
-                } else {
-                    fprintf(stderr, "Unknown texture format in frame 0 (expected RGB565+header)\n");
+        // Walk the ladder until a level fits; the last level is kept regardless
+        for (int level = 0; level < num_levels; ++level) {
+            int s = level / ladder_len;
+            int mode = ladder[level % ladder_len];
+            if (s != loaded) {
+                size_t original_size = read_frame_file(&sources[s], i);
+                if (!original_size || original_size - sources[s].skip != frame_size) {
+                    fprintf(stderr, "Frame %d of %s is missing or has the wrong size\n", i, sources[s].pattern);
                     return 1;
                 }
-            } else {
-                skip = 0;
+                loaded = s;
             }
 
-            frame_size = original_size - skip;  // store first frame's usable size
-        }
-
-        size_t src_len = original_size - skip;
-        uint8_t *src = raw_buf + skip;
+            int comp_size = compress_frame(sources[s].raw_buf + sources[s].skip, frame_size, mode, comp, bound);
+            if (comp_size <= 0) {
+                fprintf(stderr, "LZ4 compression failed on frame %d\n", i);
+                return 1;
+            }
 
-        int bound = LZ4_compressBound(src_len);
-        uint8_t *comp = malloc(bound);
-        if (!comp) {
-            perror("Failed to malloc comp");
-            return 1;
+            // Keep the first level that fits, else the smallest seen so far. A
+            // scene's first frame keeps a source's smallest mode if it fits the
+            // peak, rather than going to a smaller codebook for the target
+            int peak_only = cut && level % ladder_len == ladder_len - 1;
+            int fits = !rate_control || rate_ctl_fits(&rc, comp_size, peak_only);
+            if (fits || !best_size || comp_size < best_size) {
+                uint8_t *tmp = best; best = comp; comp = tmp;
+                best_size = comp_size;
+                chosen = s * PACK_MODE_COUNT + mode;
+            }
+            if (fits) break;
         }
+        if (rate_control)
+            rc.level_hist[chosen]++;
 
-        int comp_size = LZ4_compress_fast((const char *)src, (char *)comp, src_len, bound, 12);
-        if (comp_size <= 0) {
-            fprintf(stderr, "LZ4 compression failed on frame %d\n", i);
-            return 1;
-        }
+        fwrite(best, 1, best_size, out);
+        const frame_source_t *src = &sources[chosen / PACK_MODE_COUNT];
+        crcs[2 * i] = dcmv_crc32(0, best, best_size);
+        crcs[2 * i + 1] = dcmv_crc32(0, src->raw_buf + src->skip, frame_size);
 
-        fwrite(comp, 1, comp_size, out);
-        free(comp);
+        dcmv_lz4_cost_t fc;
+        dcmv_lz4_cost(best, best_size, &fc);
+        costs[i] = dcmv_lz4_cost_us(fc.cycles);
+        if (costs[i] > costs[cost_max_frame])
+            cost_max_frame = i;
+        cost_sum.sequences += fc.sequences;
+        cost_sum.short_matches += fc.short_matches;
+        cost_sum.overlaps += fc.overlaps;
+        cost_sum.far_matches += fc.far_matches;
+        cost_sum.cycles += fc.cycles;
+        if (rate_control)
+            rate_ctl_commit(&rc, i, best_size);
 
-        // fwrite(src, 1, src_len, out);
         // Set the offset for the *next* frame after writing this one
         offsets[i + 1] = ftell(out);
 
-        
-        // if (src_len > max_compressed_size)
-        //     max_compressed_size = src_len;
-        if (comp_size > max_compressed_size)
-            max_compressed_size = comp_size;
+        if (best_size > max_compressed_size)
+            max_compressed_size = best_size;
+        last_size = best_size;
     }
 
+    free(comp);
+    free(best);
+    free(last_stored);
+    int stored = frame_count - dup_frames, heavy = 0;
+    for (int i = 0; i < frame_count; ++i)
+        heavy += costs[i] * fps > 1e6;
+    printf("⚙️ Estimated SH-4 decode: %.2f ms mean, %.2f ms max (frame %d), %d frame(s) over one frame period; "
+           "%.0f sequences/frame, %u%% short matches, %u overlapping, %u far\n",
+           cost_sum.cycles / (DCMV_SH4_MHZ * 1000.0) / stored, costs[cost_max_frame] / 1000.0, cost_max_frame, heavy,
+           (double)cost_sum.sequences / stored,
+           (unsigned)(cost_sum.sequences ? 100ull * cost_sum.short_matches / cost_sum.sequences : 0),
+           cost_sum.overlaps, cost_sum.far_matches);
+    if (scenes.threshold > 0) {
+        uint32_t shortest = (uint32_t)frame_count;
+        for (uint32_t k = 0; k <= scenes.num_cuts; ++k) {
+            uint32_t start = k ? scenes.cuts[k - 1] : 0u, end = k < scenes.num_cuts ? scenes.cuts[k] : (uint32_t)frame_count;
+            if (end - start < shortest)
+                shortest = end - start;
+        }
+        printf("🎬 %u scene cut(s): %u scenes, %.1fs average, shortest %.1fs\n", scenes.num_cuts, scenes.num_cuts + 1,
+               frame_count / fps / (scenes.num_cuts + 1), shortest / fps);
+    }
+    if (dup_frames)
+        printf("🔁 %d repeated frame(s) stored as zero-length entries, ~%llu bytes saved (%.1f%% of frames)\n",
+               dup_frames, (unsigned long long)dup_bytes, dup_frames * 100.0 / frame_count);
+    for (int s = 0; s < num_sources; ++s)
+        free(sources[s].raw_buf);
 
-    free(raw_buf);
-         
-    // Patch max_compressed_size back into header
-    // fseek(out, 0x1A, SEEK_SET);
-    
-    // fwrite(&max_compressed_size, 4, 1, out);
     printf("📏 max_compressed_size written to header: %u\n", max_compressed_size);
 
     uint32_t audio_offset = ftell(out); // <- this is the real offset
@@ -241,19 +1418,120 @@ int main(int argc, char **argv) {
     fwrite(offsets, sizeof(uint32_t), frame_count + 1, out);
     
     fseek(out, 0, SEEK_END);
-    uint8_t abuf[4096];
-    size_t n;
-    while ((n = fread(abuf, 1, sizeof(abuf), audio_fp)) > 0)
-        fwrite(abuf, 1, n, out);
+    uint32_t ext_offset = 0;
+    if (pcm_input) {
+        adpcm_enc_t enc = {
+            .channels = channels, .block_size = audio_block_size, .threads = adpcm_threads,
+        };
+        long audio_bytes = adpcm_encode_stream(&enc, audio_fp, out);
+        if (audio_bytes < 0)
+            return 1;
+        printf("🔊 Encoded %llu samples/ch to ADPCM: %ld bytes in %u-byte blocks (%d thread(s), %llu resync samples, %u resplit(s))\n",
+               (unsigned long long)enc.samples, audio_bytes, audio_block_size, adpcm_threads,
+               (unsigned long long)enc.resync_samples, (unsigned)enc.rounds);
+
+        // Seek index goes in the first extension chunk, right after the audio
+        ext_offset = ftell(out);
+        uint32_t seek_hdr[2] = { audio_block_size * 2, enc.seek_count };
+        uint32_t seek_size = 8 + enc.seek_count * 16;
+        fwrite(DCMV_CHUNK_SEEK, 1, 4, out);
+        fwrite(&seek_size, 4, 1, out);
+        fwrite(seek_hdr, 4, 2, out);
+        for (uint32_t k = 0; k < enc.seek_count; ++k) {
+            const dcmv_seek_entry_t *e = &enc.seek[k];
+            fwrite(&e->sample, 4, 1, out);
+            fwrite(&e->byte_offset, 4, 1, out);
+            fwrite(e->signal, 2, 2, out);
+            fwrite(e->step, 2, 2, out);
+        }
+        printf("🧭 Seek index: %u entries (%u bytes)\n", enc.seek_count, seek_size);
+        free(enc.seek);
+    } else {
+        uint8_t abuf[4096];
+        size_t n;
+        while ((n = fread(abuf, 1, sizeof(abuf), audio_fp)) > 0)
+            fwrite(abuf, 1, n, out);
+        audio_block_size = 0;   // dcaconv layout
+        ext_offset = ftell(out);
+    }
+
+    uint32_t crc_size = 4 + frame_count * 8;
+    uint32_t crc_count = frame_count;
+    fwrite(DCMV_CHUNK_CRCS, 1, 4, out);
+    fwrite(&crc_size, 4, 1, out);
+    fwrite(&crc_count, 4, 1, out);
+    fwrite(crcs, sizeof(uint32_t), frame_count * 2, out);
+    free(crcs);
+
+    uint32_t cost_size = 4 + frame_count * 2;
+    uint32_t cost_count = frame_count;
+    fwrite(DCMV_CHUNK_COST, 1, 4, out);
+    fwrite(&cost_size, 4, 1, out);
+    fwrite(&cost_count, 4, 1, out);
+    fwrite(costs, sizeof(uint16_t), frame_count, out);
+    free(costs);
+
+    if (scenes.threshold > 0) {
+        uint32_t cuts_size = 4 + scenes.num_cuts * 4;
+        fwrite(DCMV_CHUNK_CUTS, 1, 4, out);
+        fwrite(&cuts_size, 4, 1, out);
+        fwrite(&scenes.num_cuts, 4, 1, out);
+        fwrite(scenes.cuts, 4, scenes.num_cuts, out);
+    }
+    free(scenes.cuts);
+
+    if (loop) {
+        if (!loop_end)
+            loop_end = frame_count;
+        if (loop_start >= loop_end || loop_end > (uint32_t)frame_count) {
+            fprintf(stderr, "Loop %u:%u doesn't fit the %d frames\n", loop_start, loop_end, frame_count);
+            return 1;
+        }
+        uint32_t loop_pts[2] = { loop_start, loop_end };
+        dcmv_write_chunk(out, DCMV_CHUNK_LOOP, loop_pts, sizeof(loop_pts));
+        printf("🔁 Loop: frames %u-%u\n", loop_start, loop_end - 1);
+    }
+
+    if (pts_path) {
+        uint32_t *pts = read_pts(pts_path, frame_count, fps);
+        if (!pts)
+            return 1;
+        uint32_t pts_hdr[2] = { PTS_TIMESCALE, frame_count + 1 };
+        uint32_t pts_size = sizeof(pts_hdr) + (frame_count + 1) * 4;
+        fwrite(DCMV_CHUNK_PTS, 1, 4, out);
+        fwrite(&pts_size, 4, 1, out);
+        fwrite(pts_hdr, 4, 2, out);
+        fwrite(pts, 4, frame_count + 1, out);
+        printf("⏱ Timestamps: %d frames over %.3fs (%.3f fps average)\n", frame_count,
+               (double)(pts[frame_count] - pts[0]) / PTS_TIMESCALE,
+               frame_count * (double)PTS_TIMESCALE / (pts[frame_count] - pts[0] ? pts[frame_count] - pts[0] : 1));
+        free(pts);
+    }
 
     // Finally patch header
     fseek(out, 0, SEEK_SET);
-    write_header(out, frame_type, width, height, fps, sample_rate, channels, frame_count,
-                frame_size, max_compressed_size, audio_offset);        
-    fclose(audio_fp);
+    dcmv_header_t hdr = {
+        .frame_type = frame_type, .width = width, .height = height,
+        .fps = (uint16_t)((fps_num + fps_den / 2) / fps_den), .fps_num = fps_num, .fps_den = fps_den,
+        .sample_rate = sample_rate, .channels = channels, .num_frames = frame_count,
+        .frame_size = frame_size, .max_compressed_size = max_compressed_size,
+        .audio_offset = audio_offset, .audio_block_size = audio_block_size,
+        .ext_offset = ext_offset,
+    };
+    dcmv_write_header(out, &hdr);
+    if (audio_fp != stdin)
+        fclose(audio_fp);
     fclose(out);
     free(offsets);
 
+    if (rate_control) {
+        rate_ctl_report(&rc, frame_count, fps, num_sources, sources);
+        free(rc.sizes);
+    }
+
+    if (check_seek && (!pcm_input || check_seek_index(output_path) < 0))
+        return 1;
+
     printf("✅ Packed %d LZ4-compressed frames + audio into %s\n", frame_count, output_path);
     return 0;
 }
@@ -0,0 +1,266 @@
+/*
+ * av_sync.h
+ * ---------------------
+ * Playback timing for fmv_play, kept free of KOS calls so dcmv_avsync can run
+ * the exact same logic on the host under simulated clocks.
+ *
+ * Everything is counted in per-channel samples of the stream rather than
+ * float seconds: the SH-4 FPU is run in single precision (a double is either
+ * a float or a slow mode switch, depending on -m4-single[-only]) and two
+ * hours of samples no longer fit a float's mantissa.
+ *
+ * Clocks:
+ *   - The AICA timer at AICA_MEM_CLOCK ticks AV_AICA_JIFFIES_PER_SEC times a
+ *     second off the same crystal that plays the audio, so it can't drift
+ *     against the sound the way the SH-4 clock does.
+ *   - The AICA can't play every rate exactly: the driver turns the requested
+ *     rate into an octave + 10-bit fraction (av_aica_pitch). 22050 and 44100
+ *     come out exact, 32000 plays at ~31998 Hz, which is ~0.44 s over two
+ *     hours if the timer is taken at face value.
+ *   - The sync clock is the timer converted at the real playback rate, held
+ *     back to the samples actually fed so video waits while audio is starved.
+ *
+ * A frame is due once the clock reaches its first sample minus the
+ * presentation lead, the typical time from deciding to draw to the frame
+ * actually flipping on screen. It is dropped without decoding once the next
+ * one is due as well. The frame rate is a fraction (30000/1001 for NTSC
+ * video), so frame * rate * fps_den / fps_num is exact and 29.97 fps material
+ * doesn't slide 3.6 s an hour against its audio as it would at 30. Times are
+ * kept in units of 1 / (sample_rate * scale) s, where scale is fps_num; files
+ * with a PTS table (variable frame rate) use its timescale instead and give
+ * each frame's start directly (av_pts_due, av_sync_next_at).
+ *
+ * In a playlist the next clip carries on in the same stream: its frames are
+ * counted from 0 again, at its own frame rate, from the stream position where
+ * the previous clip ended (av_sync_chain).
+ *
+ * The player asks once per vblank, so a frame presented goes up on the next
+ * one and the lead is one refresh. av_jitter_t measures the result: how far
+ * each interval between two frames going up is from the interval between
+ * their due times (a 24 fps film on a 59.94 Hz display alternates 3 and 2
+ * refreshes, ~8 ms either way; anything beyond that is the player's).
+ * When the frame rate matches the display, every frame's start lands near
+ * the same point between two vblanks, and a clock reading a fraction of a
+ * millisecond either way would drop one frame and repeat the next, over and
+ * over; a vblank-paced player sets a drop slack of half a refresh
+ * (av_sync_set_slack) so a frame is only dropped once it is clearly late.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define AV_AICA_JIFFIES_PER_SEC  4410
+#define AV_SYNC_MAX_SLEEP_MS     20         // re-check at least once per audio poll
+#define AV_SYNC_LEAD_MS          16         // one refresh: presented at a vblank, visible at the next
+#define AV_SYNC_VBLANK_SLACK_MS  8          // half a refresh
+
+enum {
+    AV_WAIT,            // too early, sleep *sleep_ms
+    AV_PRESENT,         // decode and draw this frame
+    AV_DROP,            // next frame is already due, skip this one
+};
+
+typedef struct {
+    uint32_t fps_num, fps_den;  // fps_num / fps_den frames per second
+    uint32_t scale;             // time unit is 1 / (sample_rate * scale) s
+    uint32_t sample_rate;       // nominal, as stored in the header
+    uint32_t pitch_base;        // AICA plays pitch_base * pitch_lo / 1024 samples/sec
+    uint32_t pitch_lo;
+    uint32_t start_jiffies;
+    uint32_t start_sample;      // per-channel sample the stream started at
+    uint64_t lead;              // presentation lead, samples * scale
+    uint32_t lead_ms;
+    uint64_t slack;             // drop a frame only this far past the next one's start, samples * scale
+    uint32_t slack_ms;
+    uint64_t clip_start;        // stream position (per-channel samples) frame 0 is due at
+} av_sync_t;
+
+/* Same conversion the KOS AICA driver does when it starts a channel */
+static inline void av_aica_pitch(uint32_t freq, uint32_t *base, uint32_t *lo) {
+    uint32_t freq_base = 5644800;   // 44100 << 7
+    int freq_hi = 7;
+    while (freq < freq_base && freq_hi > -8) {
+        freq_base >>= 1;
+        --freq_hi;
+    }
+    *base = freq_base;
+    *lo = (freq << 10) / freq_base;
+}
+
+static inline void av_sync_set_scale(av_sync_t *av, uint32_t scale) {
+    av->scale = scale;
+    av->lead = (uint64_t)av->lead_ms * av->sample_rate * scale / 1000;
+    av->slack = (uint64_t)av->slack_ms * av->sample_rate * scale / 1000;
+}
+
+static inline void av_sync_init(av_sync_t *av, uint32_t fps_num, uint32_t fps_den, uint32_t sample_rate,
+                                uint32_t start_sample, uint32_t jiffies, uint32_t lead_ms) {
+    av->fps_num = fps_num;
+    av->fps_den = fps_den;
+    av->sample_rate = sample_rate;
+    av_aica_pitch(sample_rate, &av->pitch_base, &av->pitch_lo);
+    av->start_jiffies = jiffies;
+    av->start_sample = start_sample;
+    av->lead_ms = lead_ms;
+    av->slack_ms = 0;
+    av->clip_start = 0;
+    av_sync_set_scale(av, fps_num);
+}
+
+static inline void av_sync_set_slack(av_sync_t *av, uint32_t slack_ms) {
+    av->slack_ms = slack_ms;
+    av_sync_set_scale(av, av->scale);
+}
+
+/* Schedule from a PTS table counting `timescale` ticks a second (av_pts_due) */
+static inline void av_sync_use_pts(av_sync_t *av, uint32_t timescale) {
+    av_sync_set_scale(av, timescale);
+}
+
+/* Next clip of a playlist on the same stream: frame 0 is due at stream position `at` */
+static inline void av_sync_chain(av_sync_t *av, uint32_t fps_num, uint32_t fps_den, uint64_t at) {
+    av->fps_num = fps_num;
+    av->fps_den = fps_den;
+    av->clip_start = at;
+    av_sync_set_scale(av, fps_num);
+}
+
+/* Per-channel samples in `bytes` of ADPCM returned across all channels */
+static inline uint32_t av_adpcm_samples(uint32_t bytes, int channels) {
+    return bytes * 2 / channels;
+}
+
+/* First sample of a frame */
+static inline uint64_t av_frame_sample(const av_sync_t *av, uint32_t frame) {
+    return (uint64_t)frame * av->sample_rate * av->fps_den / av->fps_num;
+}
+
+/* When a frame starts, in av time units (scale = fps_num, i.e. no PTS table) */
+static inline uint64_t av_frame_due(const av_sync_t *av, uint32_t frame) {
+    return av->clip_start * av->scale + (uint64_t)frame * av->sample_rate * av->fps_den;
+}
+
+/* When a frame with timestamp pts (in ticks of the av_sync_use_pts timescale) starts */
+static inline uint64_t av_pts_due(const av_sync_t *av, uint32_t pts) {
+    return av->clip_start * av->scale + (uint64_t)pts * av->sample_rate;
+}
+
+/*
+ * Looping clips: frame numbers and the stream keep counting up across
+ * passes, only the frame read from the file and the audio track position go
+ * back to the loop start. Each pass's audio is cut where that pass's video
+ * ends rather than after a fixed number of samples, so rounding the loop
+ * length to whole (even) samples doesn't add up over the passes.
+ */
+typedef struct {
+    uint32_t start, end;        // frames, end = 0: no loop
+} av_loop_t;
+
+/* Frame of the file shown as (ever increasing) frame t */
+static inline uint32_t av_loop_frame(const av_loop_t *lp, uint32_t t) {
+    if (!lp->end || t < lp->end)
+        return t;
+    return lp->start + (t - lp->end) % (lp->end - lp->start);
+}
+
+/* Pass frame t is in, 0 before the first wrap */
+static inline uint32_t av_loop_pass(const av_loop_t *lp, uint32_t t) {
+    if (!lp->end || t < lp->end)
+        return 0;
+    return (t - lp->end) / (lp->end - lp->start) + 1;
+}
+
+/* Stream sample at which the audio goes back to the loop start, ending `pass` */
+static inline uint64_t av_loop_wrap(const av_sync_t *av, const av_loop_t *lp, uint32_t pass) {
+    return av_frame_sample(av, lp->end + pass * (lp->end - lp->start)) & ~1ull;
+}
+
+/* Audio track sample heard at stream sample s, which is in `pass` */
+static inline uint64_t av_loop_sample(const av_sync_t *av, const av_loop_t *lp, uint32_t pass, uint64_t s) {
+    if (!pass)
+        return s;
+    return (av_frame_sample(av, lp->start) & ~1ull) + s - av_loop_wrap(av, lp, pass - 1);
+}
+
+/* Stream position (per-channel samples) to sync video against */
+static inline uint64_t av_sync_clock(const av_sync_t *av, uint32_t jiffies, uint32_t samples_fed) {
+    uint64_t played = (uint64_t)(uint32_t)(jiffies - av->start_jiffies) * av->pitch_base * av->pitch_lo /
+                      (1024ull * AV_AICA_JIFFIES_PER_SEC);
+    if (played > samples_fed)
+        played = samples_fed;
+    return av->start_sample + played;
+}
+
+/* How far the clock is past a frame's start (`due`), in microseconds (negative = early) */
+static inline int32_t av_sync_drift_at(const av_sync_t *av, uint64_t clock, uint64_t due) {
+    int64_t num = (int64_t)(clock * av->scale) - (int64_t)due;
+    return (int32_t)(num * 1000000 / ((int64_t)av->sample_rate * av->scale));
+}
+
+static inline int32_t av_sync_drift_us(const av_sync_t *av, uint64_t clock, uint32_t frame) {
+    return av_sync_drift_at(av, clock, av_frame_due(av, frame));
+}
+
+/* What to do about the frame starting at `due` when the one after it starts at `next` */
+static inline int av_sync_next_at(const av_sync_t *av, uint64_t clock, uint64_t due, uint64_t next,
+                                  uint32_t *sleep_ms) {
+    uint64_t now = clock * av->scale + av->lead;
+    if (now < due) {
+        uint64_t per_ms = (uint64_t)av->sample_rate * av->scale;
+        uint64_t ms = ((due - now) * 1000 + per_ms - 1) / per_ms;
+        *sleep_ms = ms > AV_SYNC_MAX_SLEEP_MS ? AV_SYNC_MAX_SLEEP_MS : (uint32_t)ms;
+        return AV_WAIT;
+    }
+    if (now >= next + av->slack)
+        return AV_DROP;
+    return AV_PRESENT;
+}
+
+static inline int av_sync_next(const av_sync_t *av, uint64_t clock, uint32_t frame, uint32_t *sleep_ms) {
+    return av_sync_next_at(av, clock, av_frame_due(av, frame), av_frame_due(av, frame + 1), sleep_ms);
+}
+
+/* A due time in microseconds of stream time */
+static inline uint64_t av_due_us(const av_sync_t *av, uint64_t due) {
+    uint64_t per_sec = (uint64_t)av->sample_rate * av->scale;
+    return due / per_sec * 1000000 + due % per_sec * 1000000 / per_sec;
+}
+
+typedef struct {
+    uint32_t frames;            // frames added
+    uint32_t count;             // intervals measured
+    uint64_t last_shown, last_due;
+    int64_t sum, sum_sq;        // of the interval errors, us and us^2
+    int32_t max;                // largest |error|, us
+    uint32_t refreshes[5];      // frames up for 1, 2, 3, 4 and 5+ refreshes
+} av_jitter_t;
+
+static inline void av_jitter_reset(av_jitter_t *j) {
+    *j = (av_jitter_t){ 0 };
+}
+
+/*
+ * Frame went up at shown_us (any clock) and was due at due_us (av_due_us).
+ * refresh_us sorts the interval into refreshes[]; the first call after a
+ * reset only sets the reference.
+ */
+static inline void av_jitter_add(av_jitter_t *j, uint64_t shown_us, uint64_t due_us, uint32_t refresh_us) {
+    if (j->frames++) {
+        int64_t err = (int64_t)(shown_us - j->last_shown) - (int64_t)(due_us - j->last_due);
+        uint32_t n = (uint32_t)((shown_us - j->last_shown + refresh_us / 2) / refresh_us);
+        j->count++;
+        j->sum += err;
+        j->sum_sq += err * err;
+        if (err < 0) err = -err;
+        if (err > j->max) j->max = (int32_t)err;
+        j->refreshes[n < 1 ? 0 : n > 5 ? 4 : n - 1]++;
+    }
+    j->last_shown = shown_us;
+    j->last_due = due_us;
+}
+
+/* Mean square interval error, us^2 (the caller takes the root) */
+static inline uint64_t av_jitter_mean_sq(const av_jitter_t *j) {
+    return j->count ? (uint64_t)(j->sum_sq / j->count) : 0;
+}
@@ -8,7 +8,13 @@ This script works in conjunction with a Dreamcast profiler that:
   - Delta-encodes performance counter and timestamp values
   - Writes records in a compact binary format (trace.bin)
 
-Each record is variable-length (typically 9–19 bytes), consisting of:
+profiler.c writes format v2 ("DCT2", see the comment at the top of profiler.c):
+8KB blocks per thread with function IDs instead of addresses, exits implied by
+the call stack and counter deltas in nibbles, ~2.5–3 bytes per record. v2
+blocks are translated into v1 records as they're read, so the rest of this
+script only deals with v1, which older traces are in.
+
+Each v1 record is variable-length (typically 7–19 bytes), consisting of:
   - uint32_t address:
       - Bits 31     = 1 for entry, 0 for exit
       - Bits 30–22  = thread ID
@@ -18,14 +24,37 @@ Each record is variable-length (typically 9–19 bytes), consisting of:
       - uint32_t delta_evt0 (e.g. operand cache misses)
       - uint32_t delta_evt1 (e.g. instruction cache misses)
 
+Marker records use compressed address 0 with the exit flag; their second and
+third fields are a kind and a value:
+  - MARK_DROPPED:  records the profiler had to drop because its flush thread fell behind
+  - MARK_SAMPLING: only 1 in N calls were recorded; counts and times are scaled by N
+  - MARK_OVERHEAD: what one instrumented call cost in the mode used, in ns
+  - MARK_PC:       a timer PC sample; these make up the whole trace in `mode pc`
+                   and are reported as a flat profile instead of a call graph
+  - MARK_FRAME:    PROF_FRAME(n), value = frame number
+  - MARK_REGION_BEGIN / MARK_REGION_END:
+                   PROF_REGION_*(name) / PROF_SCOPE(name), value = address of the
+                   name string in the ELF
+v2 region markers also carry counter deltas, which reach the v1 stream as a
+MARK_COUNTERS record just before the marker (this script's own, never written
+by profiler.c).
+
 This script performs:
-  ✓ LEB128 decoding of all deltas
-  ✓ Symbol resolution using addr2line
+  ✓ Streaming LEB128 decoding in fixed-size chunks, constant memory
+  ✓ v1 and v2 traces; --reencode converts to v2 and compares sizes
+  ✓ Per-thread clocks and call stacks, threads decoded in parallel (-j)
+  ✓ Batched symbol resolution from the ELF symbol table (addr2line for the
+    rest, in a single run), cached per ELF build ID
   ✓ Accurate wall-clock runtime reconstruction
+  ✓ Instrumentation overhead subtracted using the trace's calibration header
   ✓ Call graph reconstruction and self/inclusive time breakdown
   ✓ Parent → child contribution tracking
   ✓ Low-impact function detection and Makefile CFLAGS suggestions
+  ✓ Runtime deny list for profiler.cfg (--write-filter), no rebuild needed
+  ✓ Frame and region markers (profiler.h): slowest frames and what ran in them
   ✓ DOT file generation for Graphviz
+  ✓ Before/after diff of two traces with noise threshold and budgets (--diff)
+  ✓ Chrome trace JSON (--chrome) and flamegraph collapsed stacks (--collapsed)
 
 Output:
   - graph.dot: a visual call graph (render using `dot -Tpng graph.dot -o graph.png`)
@@ -34,15 +63,24 @@ Output:
 Example usage:
     python3 dctrace.py -t trace.bin -p 2 myprogram.elf
     dot -Tsvg graph.dot -o graph.svg
+    python3 dctrace.py --chrome trace.json --collapsed stacks.txt myprogram.elf
+    flamegraph.pl --countname=ns stacks.txt > flame.svg
+    python3 dctrace.py --diff old.bin old.elf -t trace.bin --budget load_frame=5 myprogram.elf
 """
 import argparse
+import hashlib
+import json
+import multiprocessing
+import random
+import re
 import struct
 import subprocess
 import sys
 import time
 import os
 import traceback
-from bisect import insort
+import heapq
+from bisect import bisect_right, insort
 from collections import defaultdict
 
 # Constants matching the C version
@@ -50,10 +88,39 @@ ENTRY_FLAG      = 0x80000000
 TID_MASK        = 0x1FF
 ADDR_MASK       = 0x003FFFFF
 BASE_ADDRESS    = 0x8C000000
+MARK_NONE       = 0         # v2 exit with nothing known to close; time only
+MARK_DROPPED    = 1
+MARK_SAMPLING   = 2
+MARK_OVERHEAD   = 3
+MARK_PC         = 4
+MARK_FRAME      = 5
+MARK_REGION_BEGIN = 6
+MARK_REGION_END = 7
+MARK_COUNTERS   = 63        # decoder only: value = ev0 | ev1 << 32, for the next marker
+PC_TOP          = 20
+
+# PRFC0/PRFC1 event modes (profiler.c counter_modes), for automatic -ev0/-ev1 labels
+COUNTER_MODES = {
+    0x01: 'operand-read', 0x02: 'operand-write', 0x03: 'utlb-miss', 0x04: 'oc-read-miss',
+    0x05: 'oc-write-miss', 0x06: 'ifetch', 0x07: 'itlb-miss', 0x08: 'ic-miss', 0x09: 'operand',
+    0x0a: 'ifetch-all', 0x0f: 'oc-miss', 0x10: 'branch', 0x11: 'branch-taken', 0x12: 'call',
+    0x13: 'instr', 0x14: 'dual-issue', 0x15: 'fpu-instr', 0x16: 'irq', 0x21: 'ic-fill',
+    0x22: 'oc-fill', 0x23: 'cycles', 0x24: 'stall-ic', 0x25: 'stall-oc', 0x27: 'stall-branch',
+    0x28: 'stall-reg', 0x29: 'stall-fpu',
+}
+SLOW_FRAMES     = 10
+FRAME_TOP_FUNCS = 5
+
+TRACE_MAGIC_V2  = b'DCT2'
+V2_BLOCK_HEADER = 4
+V2_BLOCK_SIZE   = 8192
+V2_ID_SLOTS     = 64
+V2_MAX_RECORD   = 22
 
 DEFAULT_TRACE   = 'trace.bin'
 DEFAULT_ADDR2LINE = os.environ.get('KOS_ADDR2LINE', '/opt/toolchains/dc/sh-elf/bin/sh-elf-addr2line')
 PQ_MAX_SIZE     = 5
+CHUNK_SIZE      = 1 << 20
 
 # --- Data structures ---
 class StackFrame:
@@ -271,17 +338,161 @@ class DotManager:
             fp.write("\n}\n")
 
 # ----------------------------------------------------------------------------
-# main: parse trace.bin and drive analysis
+# Symbols: every unique address is resolved in one batch once decoding is done
 # ----------------------------------------------------------------------------
-def addr2name(addr, addr2line, program):
+def elf_sections(data):
+    """(type, offset, size, link, addr) of every section in an ELF image, or None."""
+    if data[:4] != b'\x7fELF':
+        return None
+    is64 = data[4] == 2
+    endian = '<' if data[5] == 1 else '>'
+    if is64:
+        shoff, = struct.unpack_from(endian + 'Q', data, 0x28)
+        shentsize, shnum = struct.unpack_from(endian + 'HH', data, 0x3A)
+        fmt, fields = endian + 'IIQQQQII', (1, 4, 5, 6, 3)
+    else:
+        shoff, = struct.unpack_from(endian + 'I', data, 0x20)
+        shentsize, shnum = struct.unpack_from(endian + 'HH', data, 0x2E)
+        fmt, fields = endian + 'IIIIIIII', (1, 4, 5, 6, 3)
+    sections = []
+    for i in range(shnum):
+        sh = struct.unpack_from(fmt, data, shoff + i * shentsize)
+        sections.append(tuple(sh[k] for k in fields))
+    return is64, endian, sections
+
+def elf_build_id(data, sections):
+    """Hex GNU build ID, or a hash of the whole file when the link didn't add one."""
+    if sections:
+        _, endian, secs = sections
+        for sh_type, off, size, *_ in secs:
+            if sh_type != 7:                 # SHT_NOTE
+                continue
+            pos = off
+            while pos + 12 <= off + size:
+                namesz, descsz, ntype = struct.unpack_from(endian + 'III', data, pos)
+                name_end = pos + 12 + ((namesz + 3) & ~3)
+                if ntype == 3 and data[pos + 12:pos + 12 + namesz].rstrip(b'\0') == b'GNU':
+                    return data[name_end:name_end + descsz].hex()
+                pos = name_end + ((descsz + 3) & ~3)
+    return 'sha1-' + hashlib.sha1(data).hexdigest()
+
+def elf_functions(data, sections):
+    """Sorted (start, end, name) of the function symbols in .symtab."""
+    if not sections:
+        return []
+    is64, endian, secs = sections
+    funcs = []
+    for sh_type, off, size, link, _ in secs:
+        if sh_type != 2:                     # SHT_SYMTAB
+            continue
+        str_off = secs[link][1]
+        entsize = 24 if is64 else 16
+        for pos in range(off, off + size - entsize + 1, entsize):
+            if is64:
+                st_name, st_info, _, _, st_value, st_size = struct.unpack_from(endian + 'IBBHQQ', data, pos)
+            else:
+                st_name, st_value, st_size, st_info = struct.unpack_from(endian + 'IIIB', data, pos)
+            if st_info & 0xF != 2 or st_value == 0:     # STT_FUNC
+                continue
+            end = data.index(b'\0', str_off + st_name)
+            funcs.append((st_value, st_value + max(st_size, 1), data[str_off + st_name:end].decode(errors='replace')))
+    funcs.sort()
+    return funcs
+
+def elf_strings(data, sections, addrs):
+    """C strings at the given addresses, read from the ELF's loaded sections."""
+    out = {}
+    secs = sections[2] if sections else []
+    for a in addrs:
+        out[a] = f'region@{a:x}'
+        for sh_type, off, size, _, sh_addr in secs:
+            if sh_type != 8 and sh_addr and sh_addr <= a < sh_addr + size:     # not SHT_NOBITS
+                pos = off + a - sh_addr
+                end = data.find(b'\0', pos, off + size)
+                if end >= 0:
+                    out[a] = data[pos:end].decode(errors='replace')
+                break
+    return out
+
+def region_names(ptrs, program):
+    """PROF_REGION_*() names from the pointers the trace recorded."""
+    if not ptrs:
+        return {}
+    try:
+        with open(program, 'rb') as fp:
+            data = fp.read()
+    except OSError:
+        data = b''
+    return elf_strings(data, elf_sections(data), ptrs)
+
+def addr2line_batch(addrs, addr2line, program):
+    """Names for many addresses from a single addr2line run."""
+    if not addrs:
+        return {}
+    try:
+        out = subprocess.run([addr2line, '-e', program, '-f', '-s'],
+                             input='\n'.join(hex(a) for a in addrs) + '\n',
+                             stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                             text=True, check=False).stdout.splitlines()
+    except OSError:
+        return {}
+    names = {}
+    for a, name in zip(addrs, out[0::2]):
+        if name and name != '??':
+            names[a] = name
+    return names
+
+def resolve_symbols(addrs, addr2line, program, use_cache=True, verbose=False):
+    """
+    Map addresses to function names. The ELF symbol table covers function
+    entries and PC samples alike without running the toolchain; addr2line is
+    only asked about whatever that leaves (stripped ELFs, odd sections), and
+    all of it is cached under the ELF's build ID.
+    """
+    names = {}
     try:
-        p = subprocess.Popen([addr2line, '-e', program, '-f', '-s', hex(addr)],
-                             stdout=subprocess.PIPE,
-                             stderr=subprocess.DEVNULL)
-        name = p.stdout.readline().strip().decode()
-        return name or hex(addr)
-    except Exception:
-        return hex(addr)
+        with open(program, 'rb') as fp:
+            data = fp.read()
+    except OSError:
+        return {a: hex(a) for a in addrs}
+
+    sections = elf_sections(data)
+    cache_path = None
+    if use_cache:
+        cache_dir = os.path.join(os.environ.get('XDG_CACHE_HOME', os.path.expanduser('~/.cache')), 'dctrace')
+        cache_path = os.path.join(cache_dir, elf_build_id(data, sections) + '.json')
+        try:
+            with open(cache_path) as fp:
+                names = {int(k, 16): v for k, v in json.load(fp).items()}
+        except (OSError, ValueError):
+            names = {}
+
+    todo = sorted(a for a in addrs if a not in names)
+    if todo:
+        funcs = elf_functions(data, sections)
+        starts = [f[0] for f in funcs]
+        missing = []
+        for a in todo:
+            i = bisect_right(starts, a) - 1
+            if i >= 0 and a < funcs[i][1]:
+                names[a] = funcs[i][2]
+            else:
+                missing.append(a)
+        names.update(addr2line_batch(missing, addr2line, program))
+        if verbose:
+            print(f"Resolved {len(todo)} addresses ({len(todo) - len(missing)} from the symbol table)")
+
+        if cache_path:
+            try:
+                os.makedirs(os.path.dirname(cache_path), exist_ok=True)
+                tmp = cache_path + '.tmp'
+                with open(tmp, 'w') as fp:
+                    json.dump({f'{a:x}': n for a, n in names.items()}, fp)
+                os.replace(tmp, cache_path)
+            except OSError:
+                pass
+
+    return {a: names.get(a, hex(a)) for a in addrs}
 
 def print_progress_bar(progress, bar_length=50):
     """
@@ -313,6 +524,26 @@ def usage():
     print("                         (alias: --ex-time, default: 3.0)")
     print("  --xe <float>      Suggest exclude for functions using less than this % of")
     print("                         ev0 and ev1 (alias: --ex-ev, default: 1.0)")
+    print("  --write-filter <file>")
+    print("                    Also write the suggested functions as profiler.cfg deny lines")
+    print("  -j <n>            Decode threads in <n> processes (default: one per CPU)")
+    print("  --no-cache        Don't use the symbol cache (~/.cache/dctrace/<build id>.json)")
+    print("  --synthetic <MB>  Write a synthetic trace of <MB> megabytes to the trace file,")
+    print("                    then decode it if a program is given (decoder benchmark)")
+    print("  --chrome <file>   Export calls, regions and frames as Chrome trace JSON")
+    print("  --collapsed <file>")
+    print("                    Export collapsed stacks (ns of self time) for flamegraph.pl")
+    print("  --reencode <file> Write the trace as v2 to <file>, print bytes/record for both")
+    print("  --diff <trace> <elf>")
+    print("                    Compare with an earlier trace/ELF (-t and the program are the new")
+    print("                    run); per-function deltas, worst self-time regression first")
+    print("  --noise <pct>     Diff: ignore changes under <pct>% of the function (default: 2)")
+    print("  --min-share <pct> Diff: ignore changes under <pct>% of the run (default: 0.1)")
+    print("  --per-frame       Diff: compare per PROF_FRAME() instead of totals")
+    print("  --budget <name>=<pct>")
+    print("                    Diff: exit status 2 if <name>'s inclusive time grew more than <pct>%")
+    print("  --raw             Don't subtract the calibrated instrumentation overhead")
+    print("  --overhead-ns <n> Subtract <n> ns per record (v1 traces have no calibration)")
     print("  -v                Verbose output")
     sys.exit(1)
 
@@ -322,16 +553,46 @@ def parse_args():
     p.add_argument('-a', '--addr2line', default=DEFAULT_ADDR2LINE)
     p.add_argument('-p', '--percentage', type=float, default=0)
     p.add_argument('-v', '--verbose', action='store_true')
-    p.add_argument('-ev0', '--ev0-label', default='ev0', help='Custom label for ev0 (default: ev0)')
-    p.add_argument('-ev1', '--ev1-label', default='ev1', help='Custom label for ev1 (default: ev1)')
+    p.add_argument('-ev0', '--ev0-label', help='Custom label for ev0 (default: the event in the trace header)')
+    p.add_argument('-ev1', '--ev1-label', help='Custom label for ev1 (default: the event in the trace header)')
     p.add_argument('--xt', '--ex-time', dest='exclude_time_threshold', type=float, default=3.0,
                help='Suggest exclude for functions below this % of runtime (default: 3.0)')
     p.add_argument('--xe', '--ex-ev', dest='exclude_ev_threshold', type=float, default=1.0,
                help='Suggest exclude for functions below this % of ev0/ev1 usage (default: 1.0)')
-    p.add_argument('program', help='path to ELF executable')
+    p.add_argument('--write-filter', metavar='FILE',
+               help='Write the suggested functions to FILE as profiler.cfg deny lines')
+    p.add_argument('-j', '--jobs', type=int, default=0,
+               help='Decode threads in this many processes (default: one per CPU)')
+    p.add_argument('--no-cache', action='store_true',
+               help='Resolve symbols without reading or writing the per-build-ID cache')
+    p.add_argument('--synthetic', type=int, metavar='MB',
+               help='Write a synthetic trace of about MB megabytes to the trace file first')
+    p.add_argument('--chrome', metavar='FILE',
+               help='Export a Chrome trace (JSON) with calls, regions and frames')
+    p.add_argument('--collapsed', metavar='FILE',
+               help='Export collapsed stacks (self time in ns) for flamegraph.pl')
+    p.add_argument('--reencode', metavar='FILE',
+               help='Re-encode the trace as v2 into FILE and compare bytes per record')
+    p.add_argument('--diff', nargs=2, metavar=('BEFORE_TRACE', 'BEFORE_ELF'),
+               help='Compare against an earlier trace and ELF; -t and the program are "after"')
+    p.add_argument('--noise', type=float, default=2.0,
+               help='Diff: ignore changes under this %% of the function (default: 2)')
+    p.add_argument('--min-share', type=float, default=0.1,
+               help='Diff: ignore changes under this %% of the whole run (default: 0.1)')
+    p.add_argument('--top', type=int, default=30, help='Diff: rows to print (default: 30)')
+    p.add_argument('--per-frame', action='store_true',
+               help='Diff: divide by the number of PROF_FRAME()s, for runs of different length')
+    p.add_argument('--budget', action='append', default=[], metavar='NAME=PERCENT',
+               help='Diff: exit 2 if NAME\'s inclusive time grew by more than PERCENT')
+    p.add_argument('--raw', action='store_true',
+               help='Keep the profiler\'s own overhead in the numbers (no calibration subtraction)')
+    p.add_argument('--overhead-ns', type=float,
+               help='ns per record to subtract, for traces without a calibration header (v1)')
+    p.add_argument('program', nargs='?', help='path to ELF executable')
     return p.parse_args()
 
-def suggest_exclude_functions(total_time, total_ev0, total_ev1, percent_threshold, ev_percent_threshold):
+def suggest_exclude_functions(total_time, total_ev0, total_ev1, percent_threshold, ev_percent_threshold,
+                              filter_path=None):
     """
     Suggests low-impact functions to exclude from instrumentation.
 
@@ -343,7 +604,9 @@ def suggest_exclude_functions(total_time, total_ev0, total_ev1, percent_threshol
     This version includes functions with children, as long as the total impact remains small.
     That way, even small utility functions that call other tiny helpers can be excluded.
 
-    This helps reduce trace size and overhead on the Dreamcast.
+    This helps reduce trace size and overhead on the Dreamcast. With `filter_path`
+    the same list is written as profiler.cfg deny lines, which does the same
+    without a rebuild (the call still costs a range lookup).
     """
     candidates = []
 
@@ -361,14 +624,14 @@ def suggest_exclude_functions(total_time, total_ev0, total_ev1, percent_threshol
             ev0_pct < ev_percent_threshold and
             ev1_pct < ev_percent_threshold
         ):
-            candidates.append((inclusive_time_pct, name))
+            candidates.append((inclusive_time_pct, name, addr))
 
     if not candidates:
         return
 
     candidates.sort()
-    exclude_names = [name for _, name in candidates]
-    total_pct = sum(p for p, _ in candidates)
+    exclude_names = [name for _, name, _ in candidates]
+    total_pct = sum(p for p, _, _ in candidates)
 
     print("\n Suggested low-impact functions to exclude from instrumentation:")
     print(f"    (Collectively account for {total_pct:.2f}% of total runtime)\n")
@@ -384,141 +647,906 @@ def suggest_exclude_functions(total_time, total_ev0, total_ev1, percent_threshol
     print("    $(TARGET): $(OBJS)")
     print("        kos-cc $(CFLAGS) -o $(TARGET)\n")
 
-def read_uleb128(f):
-    result = 0
-    shift = 0
-    count = 0
-    while True:
-        byte = f.read(1)
-        if not byte:
-            raise EOFError("Unexpected EOF while reading ULEB128")
-        b = byte[0]
-        result |= (b & 0x7F) << shift
-        count += 1
-        if not (b & 0x80):
-            break
-        shift += 7
-    return result, count
-
-def main():
-    args = parse_args()
-
-    try:
-        with open(args.trace, 'rb') as f:
-            current_time = 0
-            current_e0 = 0
-            current_e1 = 0
-
-            total_size = os.path.getsize(args.trace)
-            read_size = 0
+    if filter_path:
+        with open(filter_path, 'w') as fp:
+            fp.write(f"# dctrace: {len(candidates)} low-impact functions, {total_pct:.2f}% of runtime\n")
+            for _, name, addr in candidates:
+                fp.write(f"deny {addr:08x}    # {name}\n")
+        print(f"  Wrote {len(candidates)} deny lines to {filter_path}; copy it to profiler.cfg next to")
+        print("  trace.bin (/pc/profiler.cfg) to filter them at runtime instead.\n")
+
+def scale_sampled(n):
+    """Turn 1-in-n sampled totals into estimates for every call."""
+    for fn in functions.values():
+        fn.times_called *= n
+        fn.total_time *= n
+        fn.ev0 *= n
+        fn.ev1 *= n
+    for callees in child_calls.values():
+        for cc in callees.values():
+            cc.times_called *= n
+            cc.total_cycles *= n
+            cc.ev0 *= n
+            cc.ev1 *= n
+
+def print_pc_profile(pc_hits, names):
+    """Flat profile of timer PC samples, by function."""
+    total = sum(pc_hits.values())
+    by_name = defaultdict(int)
+    for pc, hits in pc_hits.items():
+        by_name[names[pc]] += hits
+
+    print(f"\n PC samples: {total}\n")
+    print(f"  {'%':>6}  {'samples':>8}  function")
+    for name, hits in sorted(by_name.items(), key=lambda kv: -kv[1])[:PC_TOP]:
+        print(f"  {hits * 100 / total:6.2f}  {hits:8}  {name}")
+    if len(by_name) > PC_TOP:
+        print(f"  ... {len(by_name) - PC_TOP} more")
 
-            total_size = os.path.getsize(args.trace)
-            read_size = 0
-
-            while True:
-                header = f.read(4)
-                if not header or len(header) < 4:
+# ----------------------------------------------------------------------------
+# main: parse trace.bin and drive analysis
+# ----------------------------------------------------------------------------
+# ----------------------------------------------------------------------------
+# Decoding: the trace is read in CHUNK_SIZE pieces and never held in memory.
+# A record is 4 bytes then three ULEB128s, i.e. any 4 bytes followed by three
+# bytes < 0x80 with continuation bytes in between, so a regex can split a
+# whole chunk into records in C. At a chunk's end it stops cleanly: whatever
+# doesn't hold three terminators yet can't match from any later offset either.
+# ----------------------------------------------------------------------------
+RECORD_RE = re.compile(rb'.{4}(?:[\x80-\xff]*[\x00-\x7f]){3}', re.S)
+
+def uleb3(r):
+    """The three ULEB128 fields of a record that doesn't fit the 7-byte fast path."""
+    vals = []
+    val = shift = 0
+    for b in r[4:]:
+        val |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            vals.append(val)
+            val = shift = 0
+    return vals
+
+def record_tid(r):
+    return (r[2] >> 6) | ((r[3] & 0x7F) << 2)
+
+class ThreadState:
+    __slots__ = ('tid', 'stack', 'time', 'e0', 'e1', 'n', 'frame', 'frame_start', 'frame_funcs', 'regions')
+    def __init__(self, tid):
+        self.tid = tid
+        self.stack = []         # [compressed addr, start_time, start_e0, start_e1, start_n]
+        self.n = 0              # records so far, each one a hook's worth of overhead
+        self.time = 0
+        self.e0 = 0
+        self.e1 = 0
+        self.frame = None       # PROF_FRAME() number in progress
+        self.frame_start = 0
+        self.frame_funcs = None # addr -> inclusive time of calls finished in this frame
+        self.regions = []       # open PROF_REGION_BEGIN()s: (name pointer, start_time, start_e0, start_e1)
+
+class TraceStats:
+    """
+    Everything decoded from a trace, or from the threads one worker was given.
+    Times and counters are deltas since the same thread's previous record, so
+    each thread keeps its own clock and call stack. Plain dicts keyed by
+    compressed address, so memory grows with the program, not the trace.
+    """
+    def __init__(self):
+        self.funcs = {}         # addr -> [calls, time, ev0, ev1, records inside]
+        self.edges = {}         # (caller, callee) -> [calls, time, ev0, ev1, records inside]
+        self.threads = {}       # tid -> ThreadState
+        self.records = 0
+        self.dropped = 0
+        self.sample_every = 1
+        self.overhead_ns = None
+        self.pc_hits = defaultdict(int)
+        self.unmatched = 0
+        self.total_time = self.total_e0 = self.total_e1 = 0
+        self.total_n = 0
+        self.frames = 0
+        self.frame_time = 0
+        self.slow_frames = []   # min-heap of (duration, frame, tid, [(addr, time)])
+        self.regions = {}       # name pointer -> [count, total time, max time, ev0, ev1]
+
+    def marker(self, st, dt, kind, value):
+        if kind == MARK_PC:
+            # Written from the timer interrupt on its own clock; the thread ID
+            # is the interrupted thread, whose clock this isn't
+            self.pc_hits[value] += 1
+            return
+        if kind == MARK_COUNTERS:
+            st.e0 += value & 0xFFFFFFFF
+            st.e1 += value >> 32
+            self.records -= 1
+            return
+        st.time += dt * 80
+        st.n += 1
+        if kind == MARK_DROPPED:
+            self.dropped += value
+        elif kind == MARK_SAMPLING:
+            self.sample_every = value
+        elif kind == MARK_OVERHEAD:
+            self.overhead_ns = value
+        elif kind == MARK_FRAME:
+            if st.frame is not None:
+                self.end_frame(st)
+            st.frame = value
+            st.frame_start = st.time
+            st.frame_funcs = {}
+        elif kind == MARK_REGION_BEGIN:
+            st.regions.append((value, st.time, st.e0, st.e1))
+        elif kind == MARK_REGION_END:
+            # Close the innermost region of that name; an END without a BEGIN is ignored
+            for i in range(len(st.regions) - 1, -1, -1):
+                if st.regions[i][0] == value:
+                    _, t0, e0, e1 = st.regions[i]
+                    dur = st.time - t0
+                    del st.regions[i:]
+                    r = self.regions.get(value)
+                    if r is None:
+                        r = self.regions[value] = [0, 0, 0, 0, 0]
+                    r[0] += 1
+                    r[1] += dur
+                    r[2] = max(r[2], dur)
+                    r[3] += st.e0 - e0
+                    r[4] += st.e1 - e1
                     break
 
-                entry_tid_addr = struct.unpack('<I', header)[0]
-                read_size += 4
-
-                try:
-                    delta_time, t_bytes = read_uleb128(f)
-                    delta_evt0, e0_bytes = read_uleb128(f)
-                    delta_evt1, e1_bytes = read_uleb128(f)
-                    read_size += t_bytes + e0_bytes + e1_bytes
-                except EOFError:
-                    if args.verbose:
-                        print("Incomplete record at end of file; skipping.")
-                    break
+    def end_frame(self, st):
+        dur = st.time - st.frame_start
+        self.frames += 1
+        self.frame_time += dur
+        heap = self.slow_frames
+        if len(heap) < SLOW_FRAMES or dur > heap[0][0]:
+            top = sorted(st.frame_funcs.items(), key=lambda kv: -kv[1])[:FRAME_TOP_FUNCS]
+            item = (dur, st.frame, st.tid, top)
+            if len(heap) < SLOW_FRAMES:
+                heapq.heappush(heap, item)
+            else:
+                heapq.heapreplace(heap, item)
+
+    def feed(self, recs):
+        funcs, edges, threads = self.funcs, self.edges, self.threads
+        cur_tid = -1
+        st = None
+        self.records += len(recs)
+        for r in recs:
+            if len(r) == 7:
+                dt, d0, d1 = r[4], r[5], r[6]
+            else:
+                dt, d0, d1 = uleb3(r)
+            tid = (r[2] >> 6) | ((r[3] & 0x7F) << 2)
+            if tid != cur_tid:
+                st = threads.get(tid)
+                if st is None:
+                    st = threads[tid] = ThreadState(tid)
+                cur_tid = tid
+            addr = r[0] | (r[1] << 8) | ((r[2] & 0x3F) << 16)
+
+            if r[3] & 0x80:
+                # -- ENTRY logic --
+                t = st.time + dt * 80
+                e0 = st.e0 + d0
+                e1 = st.e1 + d1
+                st.time, st.e0, st.e1 = t, e0, e1
+                n = st.n = st.n + 1
+                f = funcs.get(addr)
+                if f is None:
+                    f = funcs[addr] = [0, 0, 0, 0, 0]
+                f[0] += 1
+                stack = st.stack
+                if stack:
+                    key = (stack[-1][0], addr)
+                    cc = edges.get(key)
+                    if cc is None:
+                        cc = edges[key] = [0, 0, 0, 0, 0]
+                    cc[0] += 1
+                stack.append((addr, t, e0, e1, n))
+            elif addr == 0:
+                # -- MARKER: d0 is the kind, d1 the value --
+                self.marker(st, dt, d0, d1)
+            else:
+                # -- EXIT logic --
+                t = st.time + dt * 80
+                e0 = st.e0 + d0
+                e1 = st.e1 + d1
+                st.time, st.e0, st.e1 = t, e0, e1
+                n = st.n = st.n + 1
+                stack = st.stack
+                if not stack:
+                    # unmatched exit, skip
+                    continue
+                fa, ft, f0, f1, fn = stack.pop()
+                dtime, de0, de1 = t - ft, e0 - f0, e1 - f1
+                f = funcs[fa]
+                f[1] += dtime
+                f[2] += de0
+                f[3] += de1
+                f[4] += n - fn
+                if stack:
+                    cc = edges[(stack[-1][0], fa)]
+                    cc[1] += dtime
+                    cc[2] += de0
+                    cc[3] += de1
+                    cc[4] += n - fn
+                ff = st.frame_funcs
+                if ff is not None:
+                    ff[fa] = ff.get(fa, 0) + dtime
+
+    def finish(self):
+        """Close calls still open at the end of the trace and total up the threads."""
+        for st in self.threads.values():
+            stack = st.stack
+            self.unmatched += len(stack)
+            for i, (fa, ft, f0, f1, fn) in enumerate(stack):
+                dtime, de0, de1 = st.time - ft, st.e0 - f0, st.e1 - f1
+                f = self.funcs[fa]
+                f[1] += dtime
+                f[2] += de0
+                f[3] += de1
+                f[4] += st.n - fn
+                if i > 0:
+                    cc = self.edges[(stack[i - 1][0], fa)]
+                    cc[1] += dtime
+                    cc[2] += de0
+                    cc[3] += de1
+                    cc[4] += st.n - fn
+            self.total_time += st.time
+            self.total_e0 += st.e0
+            self.total_e1 += st.e1
+            self.total_n += st.n
+        self.threads = {}
+
+    def subtract_overhead(self, calib):
+        """
+        Take the profiler's own cost out of every total. Each record's timestamp
+        gap holds one whole hook (the end of one, the start of the next), so a
+        call that saw r records from its entry to its exit, its own exit
+        included, carries r hooks of overhead; self time ends up charged for
+        1 + its direct children. Returns what was removed from the runtime.
+        """
+        ps, m0, m1 = calib
+        for table in (self.funcs, self.edges):
+            for v in table.values():
+                v[1] = max(0, v[1] - v[4] * ps // 1000)
+                v[2] = max(0, v[2] - v[4] * m0 // 1000)
+                v[3] = max(0, v[3] - v[4] * m1 // 1000)
+        removed = self.total_n * ps // 1000
+        self.total_time = max(0, self.total_time - removed)
+        self.total_e0 = max(0, self.total_e0 - self.total_n * m0 // 1000)
+        self.total_e1 = max(0, self.total_e1 - self.total_n * m1 // 1000)
+        return removed
+
+    def merge(self, other):
+        for table, theirs in ((self.funcs, other.funcs), (self.edges, other.edges)):
+            for key, v in theirs.items():
+                mine = table.get(key)
+                if mine is None:
+                    table[key] = v
+                else:
+                    for i in range(5):
+                        mine[i] += v[i]
+        for pc, hits in other.pc_hits.items():
+            self.pc_hits[pc] += hits
+        self.records += other.records
+        self.dropped += other.dropped
+        self.sample_every = max(self.sample_every, other.sample_every)
+        if other.overhead_ns is not None:
+            self.overhead_ns = other.overhead_ns
+        self.unmatched += other.unmatched
+        self.frames += other.frames
+        self.frame_time += other.frame_time
+        for item in other.slow_frames:
+            if len(self.slow_frames) < SLOW_FRAMES:
+                heapq.heappush(self.slow_frames, item)
+            elif item[0] > self.slow_frames[0][0]:
+                heapq.heapreplace(self.slow_frames, item)
+        for name, (count, total, longest, ev0, ev1) in other.regions.items():
+            r = self.regions.setdefault(name, [0, 0, 0, 0, 0])
+            r[0] += count
+            r[1] += total
+            r[2] = max(r[2], longest)
+            r[3] += ev0
+            r[4] += ev1
+        self.total_time += other.total_time
+        self.total_e0 += other.total_e0
+        self.total_e1 += other.total_e1
+        self.total_n += other.total_n
+
+def read_records(path, progress=False, part=0, jobs=1):
+    """
+    Yield the trace as lists of whole v1 records, CHUNK_SIZE bytes at a time,
+    keeping only threads with tid % jobs == part. v2 traces are translated
+    block by block (see V2Translator), so everything downstream reads one format.
+    """
+    total_size = os.path.getsize(path) or 1
+    read_size = 0
+    tail = b''
+    with open(path, 'rb') as f:
+        v2 = f.read(4) == TRACE_MAGIC_V2
+        if v2:
+            header_size = int.from_bytes(f.read(4), 'little')
+            f.seek(header_size, os.SEEK_CUR)
+            read_size = 8 + header_size
+            translator = V2Translator()
+        else:
+            f.seek(0)
+        while True:
+            chunk = f.read(CHUNK_SIZE)
+            if not chunk:
+                break
+            read_size += len(chunk)
+            buf = tail + chunk
+            if v2:
+                recs = []
+                pos = 0
+                while pos + V2_BLOCK_HEADER <= len(buf):
+                    header = int.from_bytes(buf[pos:pos + 4], 'little')
+                    end = pos + V2_BLOCK_HEADER + (header & 0xFFFF)
+                    if end > len(buf):
+                        break
+                    tid = (header >> 16) & TID_MASK
+                    if jobs == 1 or tid % jobs == part:
+                        translator.block(tid, buf, pos + V2_BLOCK_HEADER, end, recs)
+                    pos = end
+                tail = buf[pos:]
+            else:
+                recs = RECORD_RE.findall(buf)
+                tail = buf[sum(map(len, recs)):]
+                if jobs > 1:
+                    recs = [r for r in recs if record_tid(r) % jobs == part]
+            if progress:
+                print_progress_bar(int(read_size * 100 / total_size))
+            yield recs
+    if tail:
+        yield None      # incomplete record at end of file
+
+def read_header(path):
+    """The u32 fields of a v2 trace header, or an empty tuple for v1."""
+    with open(path, 'rb') as f:
+        if f.read(4) != TRACE_MAGIC_V2:
+            return ()
+        header = f.read(int.from_bytes(f.read(4), 'little'))
+    return struct.unpack_from(f'<{len(header) // 4}I', header, 0)
+
+def read_calibration(path):
+    """(ps, PRFC0 x1000, PRFC1 x1000) per record, or None."""
+    header = read_header(path)
+    return header[:3] if len(header) >= 3 else None
+
+def counter_labels(path):
+    """Names of the events PRFC0/PRFC1 counted, from the header; ev0/ev1 if it doesn't say."""
+    header = read_header(path)
+    if len(header) < 5:
+        return 'ev0', 'ev1'
+    return tuple(COUNTER_MODES.get(m, f'pmcr {m:#x}') for m in header[3:5])
+
+def apply_calibration(stats, path, args):
+    """Subtract instrumentation overhead unless --raw; returns (calibration, ns removed)."""
+    if args.raw:
+        return None, 0
+    calib = (int(args.overhead_ns * 1000), 0, 0) if args.overhead_ns is not None else read_calibration(path)
+    if not calib or not any(calib):
+        return None, 0
+    return calib, stats.subtract_overhead(calib)
+
+def v1_record(word, a, b, c):
+    if a < 0x80 and b < 0x80 and c < 0x80:
+        return bytes((word & 0xFF, (word >> 8) & 0xFF, (word >> 16) & 0xFF, word >> 24, a, b, c))
+    return word.to_bytes(4, 'little') + uleb_bytes(a) + uleb_bytes(b) + uleb_bytes(c)
+
+def uleb_bytes(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+def read_counters(buf, i):
+    """A v2 counter byte and its ULEB overflow: (ev0 delta, ev1 delta, next i)."""
+    c = buf[i]
+    i += 1
+    e0, e1 = c >> 4, c & 0xF
+    if e0 == 15:
+        v, i = read_uleb(buf, i)
+        e0 += v
+    if e1 == 15:
+        v, i = read_uleb(buf, i)
+        e1 += v
+    return e0, e1, i
+
+def read_uleb(buf, i):
+    val = shift = 0
+    while True:
+        b = buf[i]
+        i += 1
+        val |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return val, i
+        shift += 7
 
-                progress = int((read_size / total_size) * 100)
-                print_progress_bar(progress)
+class V2Translator:
+    """
+    Turns v2 blocks back into v1 records. Exits carry no address in v2, so this
+    keeps a shadow call stack per thread; a drop marker's depth trims it (or
+    pads it with unknown frames) so the exits after a gap still pair up.
+    """
+    def __init__(self):
+        self.stacks = {}        # tid -> [compressed addr or None]
+
+    def block(self, tid, buf, i, end, out):
+        stack = self.stacks.setdefault(tid, [])
+        ids = [None] * V2_ID_SLOTS
+        tidbits = tid << 22
+        while i < end:
+            op = buf[i]
+            i += 1
+            kind = op >> 6
+            if kind == 3:
+                # -- MARKER --
+                mark = op & 0x3F
+                dt, i = read_uleb(buf, i)
+                value, i = read_uleb(buf, i)
+                extra = 0
+                if mark in (MARK_DROPPED, MARK_PC):
+                    extra, i = read_uleb(buf, i)
+                elif mark in (MARK_REGION_BEGIN, MARK_REGION_END):
+                    e0, e1, i = read_counters(buf, i)
+                    if e0 or e1:
+                        out.append(v1_record(tidbits, 0, MARK_COUNTERS, e0 | e1 << 32))
+                word = ((extra & TID_MASK) << 22) if mark == MARK_PC else tidbits
+                out.append(v1_record(word, dt, mark, value))
+                if mark == MARK_DROPPED:
+                    while len(stack) > extra:
+                        a = stack.pop()
+                        if a is not None:
+                            out.append(v1_record(tidbits | a, 0, 0, 0))
+                    while len(stack) < extra:
+                        stack.append(None)
+                continue
 
-                is_entry = bool((entry_tid_addr >> 31) & 1)
-                thread_id = (entry_tid_addr >> 22) & TID_MASK
-                compressed_addr = entry_tid_addr & ADDR_MASK
-                address = (compressed_addr << 2) + BASE_ADDRESS
+            if kind == 0:
+                dt = op & 0x3F
+                if dt == 63:
+                    v, i = read_uleb(buf, i)
+                    dt += v
+            else:
+                if kind == 2:
+                    func, i = read_uleb(buf, i)
+                    ids[op & 0x3F] = func
+                else:
+                    func = ids[op & 0x3F]
+                dt, i = read_uleb(buf, i)
+            e0, e1, i = read_counters(buf, i)
+
+            if kind:
+                stack.append(func)
+                out.append(v1_record(ENTRY_FLAG | tidbits | func, dt, e0, e1))
+            else:
+                a = stack.pop() if stack else None
+                if a is None:
+                    # Nothing known to close: keep the time, lose the counters
+                    out.append(v1_record(tidbits, dt, MARK_NONE, 0))
+                else:
+                    out.append(v1_record(tidbits | a, dt, e0, e1))
 
-                current_time += delta_time * 80
-                current_e0 += delta_evt0
-                current_e1 += delta_evt1
+def reencode_v2(path, out_path):
+    """
+    Write any trace as v2 the way profiler.c would (8KB blocks per thread) and
+    report bytes per record for both, to measure the encoding on real traces.
+    """
+    limit = V2_BLOCK_SIZE - 2 * V2_MAX_RECORD
+    threads = {}            # tid -> [block bytearray, ids, depth, carried dt, pending region counters]
+    records = 0
+    written = 28
+
+    header = read_header(path)
+    header = (header + (0, 0, 0, 0x0F, 0x08)[len(header):])[:5]     # v1: no calibration, default counters
+    with open(out_path, 'wb') as out:
+        out.write(TRACE_MAGIC_V2 + struct.pack('<6I', 20, *header))
+
+        def flush(tid, th):
+            nonlocal written
+            if len(th[0]):
+                out.write(((tid << 16) | len(th[0])).to_bytes(4, 'little'))
+                out.write(th[0])
+                written += V2_BLOCK_HEADER + len(th[0])
+            th[0] = bytearray()
+            th[1] = [None] * V2_ID_SLOTS
+
+        def counters(blk, e0, e1):
+            blk.append((min(e0, 15) << 4) | min(e1, 15))
+            if e0 >= 15:
+                blk += uleb_bytes(e0 - 15)
+            if e1 >= 15:
+                blk += uleb_bytes(e1 - 15)
+
+        for recs in read_records(path):
+            if recs is None:
+                break
+            for r in recs:
+                dt, d0, d1 = (r[4], r[5], r[6]) if len(r) == 7 else uleb3(r)
+                tid = record_tid(r)
+                addr = r[0] | (r[1] << 8) | ((r[2] & 0x3F) << 16)
+                th = threads.get(tid)
+                if th is None:
+                    th = threads[tid] = [bytearray(), [None] * V2_ID_SLOTS, 0, 0, 0]
+                blk = th[0]
+                if addr == 0 and d0 == MARK_COUNTERS and not r[3] & 0x80:
+                    th[4] = d1
+                    continue
+                dt += th[3]
+                th[3] = 0
+                records += 1
+
+                if r[3] & 0x80:
+                    slot = (addr ^ (addr >> 6)) & (V2_ID_SLOTS - 1)
+                    if th[1][slot] == addr:
+                        blk.append(0x40 | slot)
+                    else:
+                        th[1][slot] = addr
+                        blk.append(0x80 | slot)
+                        blk += uleb_bytes(addr)
+                    blk += uleb_bytes(dt)
+                    counters(blk, d0, d1)
+                    th[2] += 1
+                elif addr:
+                    if th[2] == 0:
+                        th[3] = dt          # unmatched exit: v2 can't say it, keep its time
+                        continue
+                    if dt < 63:
+                        blk.append(dt)
+                    else:
+                        blk.append(63)
+                        blk += uleb_bytes(dt - 63)
+                    counters(blk, d0, d1)
+                    th[2] -= 1
+                elif d0 != MARK_NONE:
+                    blk.append(0xC0 | d0)
+                    blk += uleb_bytes(dt) + uleb_bytes(d1)
+                    if d0 == MARK_DROPPED:
+                        blk += uleb_bytes(th[2])
+                    elif d0 == MARK_PC:
+                        blk += uleb_bytes(tid)
+                    elif d0 in (MARK_REGION_BEGIN, MARK_REGION_END):
+                        counters(blk, th[4] & 0xFFFFFFFF, th[4] >> 32)
+                        th[4] = 0
+                else:
+                    th[3] = dt
+                    continue
+                if len(blk) >= limit:
+                    flush(tid, th)
+        for tid, th in threads.items():
+            flush(tid, th)
+
+    size = os.path.getsize(path)
+    print(f"{path}: {records:,} records, {size:,} bytes, {size / max(records, 1):.2f} bytes/record")
+    print(f"{out_path}: {written:,} bytes, {written / max(records, 1):.2f} bytes/record "
+          f"({written * 100 / max(size, 1):.1f}% of the input)")
+
+def decode_part(path, part, jobs):
+    """Decode the threads with tid % jobs == part (one worker's share)."""
+    stats = TraceStats()
+    for recs in read_records(path, progress=(part == 0), part=part, jobs=jobs):
+        if recs is None:
+            break
+        stats.feed(recs)
+    stats.finish()
+    return stats
 
-                if is_entry:
-                    # -- ENTRY logic --
-                    if address not in functions:
-                        func_name = addr2name(address, args.addr2line, args.program)
-                        functions[address] = FunctionRecord(func_name)
-                    func = functions[address]
-                    func.times_called += 1
+def decode_trace(path, jobs):
+    """
+    Decode a whole trace. With jobs > 1 each worker reads the file itself and
+    keeps the threads that hash to it; splitting records is cheap next to
+    replaying them, and nothing has to be spooled or shipped between processes.
+    """
+    if jobs <= 1:
+        return decode_part(path, 0, 1)
+    with multiprocessing.Pool(jobs) as pool:
+        parts = pool.starmap(decode_part, [(path, k, jobs) for k in range(jobs)])
+    stats = parts[0]
+    for p in parts[1:]:
+        stats.merge(p)
+    return stats
+
+def export_traces(path, names, strings, chrome_path=None, collapsed_path=None):
+    """
+    Replay the trace once more, now that names are known, into Chrome trace
+    JSON (chrome://tracing, Perfetto) and/or collapsed stacks for flamegraph.pl
+    (self time in ns per stack). Both are written as the records stream past;
+    the collapsed table grows with the number of distinct stacks only.
+    """
+    chrome = open(chrome_path, 'w') if chrome_path else None
+    collapsed = defaultdict(int)
+    threads = {}        # tid -> [time, stack of (name, start, child_time, stack_key), open frame]
+    sep = '\n'
+
+    def event(**ev):
+        nonlocal sep
+        chrome.write(sep + json.dumps(ev, separators=(',', ':')))
+        sep = ',\n'
+
+    if chrome:
+        chrome.write('{"traceEvents":[')
+        event(name='process_name', ph='M', pid=1, args={'name': 'calls'})
+        event(name='process_name', ph='M', pid=2, args={'name': 'frames'})
+
+    for recs in read_records(path):
+        if recs is None:
+            break
+        for r in recs:
+            dt, d0, d1 = (r[4], r[5], r[6]) if len(r) == 7 else uleb3(r)
+            tid = record_tid(r)
+            addr = r[0] | (r[1] << 8) | ((r[2] & 0x3F) << 16)
+            is_entry = r[3] & 0x80
+            if not is_entry and addr == 0 and d0 == MARK_PC:
+                continue
+            th = threads.get(tid)
+            if th is None:
+                th = threads[tid] = [0, [], None]
+            th[0] += dt * 80
+            now = th[0]
+            ts = now / 1000
+
+            if is_entry:
+                name = names[(addr << 2) + BASE_ADDRESS]
+                parent_key = th[1][-1][3] if th[1] else None
+                key = f'{parent_key};{name}' if parent_key else name
+                th[1].append([name, now, 0, key])
+                if chrome:
+                    event(name=name, ph='B', ts=ts, pid=1, tid=tid)
+            elif addr != 0:
+                if not th[1]:
+                    continue
+                name, start, child, key = th[1].pop()
+                dur = now - start
+                collapsed[key] += dur - child
+                if th[1]:
+                    th[1][-1][2] += dur
+                if chrome:
+                    event(name=name, ph='E', ts=ts, pid=1, tid=tid)
+            elif d0 == MARK_FRAME:
+                if th[2] is not None and chrome:
+                    event(name=f'frame {th[2][0]}', ph='X', ts=th[2][1] / 1000, dur=(now - th[2][1]) / 1000,
+                          pid=2, tid=tid)
+                th[2] = (d1, now)
+            elif d0 in (MARK_REGION_BEGIN, MARK_REGION_END) and chrome:
+                event(name=strings.get(d1, hex(d1)), cat='region', ph='B' if d0 == MARK_REGION_BEGIN else 'E',
+                      ts=ts, pid=1, tid=tid)
+
+    if chrome:
+        chrome.write('\n]}\n')
+        chrome.close()
+        print(f"Wrote Chrome trace to {chrome_path} (open in chrome://tracing or ui.perfetto.dev)")
+    if collapsed_path:
+        with open(collapsed_path, 'w') as fp:
+            for key, ns in collapsed.items():
+                if ns > 0:
+                    fp.write(f'{key} {ns}\n')
+        print(f"Wrote {len(collapsed)} collapsed stacks to {collapsed_path} (flamegraph.pl --countname=ns)")
+
+def print_frame_report(stats, names, strings, ev0_label, ev1_label):
+    if stats.frames:
+        print(f"\n Frames: {stats.frames}, mean {stats.frame_time / stats.frames / 1e6:.2f} ms; slowest:\n")
+        for dur, frame, tid, top in sorted(stats.slow_frames, reverse=True):
+            funcs = ', '.join(f"{names[(a << 2) + BASE_ADDRESS]} {t / 1e6:.2f}" for a, t in top)
+            print(f"  frame {frame:6} {dur / 1e6:8.2f} ms  (thread {tid}) {funcs}")
+    if stats.regions:
+        print(f"\n {'region':<20} {'count':>8} {'mean ms':>9} {'max ms':>9} {'total ms':>10} "
+              f"{ev0_label + '/call':>16} {ev1_label + '/call':>16}")
+        for ptr, (count, total, longest, ev0, ev1) in sorted(stats.regions.items(), key=lambda kv: -kv[1][1]):
+            print(f" {strings[ptr]:<20} {count:8} {total / count / 1e6:9.3f} {longest / 1e6:9.3f} {total / 1e6:10.1f} "
+                  f"{ev0 / count:16.1f} {ev1 / count:16.1f}")
 
-                    # record child call count
-                    if call_stack:
-                        parent = call_stack[-1].addr
-                        cc = child_calls[parent][address]
-                        cc.times_called += 1
+# ----------------------------------------------------------------------------
+# Diff mode: two traces (and the ELFs that made them) compared by function name
+# ----------------------------------------------------------------------------
+DIFF_FIELDS = ('calls', 'self', 'incl', 'ev0', 'ev1')
+
+def profile_by_name(trace, program, args, jobs):
+    """Per-function totals keyed by name, so different builds line up."""
+    stats = decode_trace(trace, jobs)
+    apply_calibration(stats, trace, args)
+    names = resolve_symbols({(a << 2) + BASE_ADDRESS for a in stats.funcs}, args.addr2line, program,
+                            not args.no_cache, args.verbose)
+    n = stats.sample_every
+    child_time = defaultdict(int)
+    for (caller, callee), cc in stats.edges.items():
+        if caller != callee:
+            child_time[caller] += cc[1]
+
+    prof = defaultdict(lambda: dict.fromkeys(DIFF_FIELDS, 0))
+    for a, (calls, total, ev0, ev1, _) in stats.funcs.items():
+        p = prof[names[(a << 2) + BASE_ADDRESS]]
+        p['calls'] += calls * n
+        p['incl'] += total * n
+        p['self'] += (total - child_time[a]) * n
+        p['ev0'] += ev0 * n
+        p['ev1'] += ev1 * n
+
+    if args.per_frame:
+        if not stats.frames:
+            raise ValueError(f"{trace} has no PROF_FRAME() markers, can't use --per-frame")
+        for p in prof.values():
+            for k in DIFF_FIELDS:
+                p[k] /= stats.frames
+    return prof, stats
+
+def pct_change(before, after):
+    if before == 0:
+        return float('inf') if after else 0.0
+    return (after - before) * 100 / before
+
+def diff_traces(args, jobs):
+    """
+    Print a per-function delta table, worst self-time regression first, and
+    check --budget limits. Returns the exit status: 0, or 2 if a budget was
+    exceeded (so a script or CI job can gate on it).
+    """
+    before_trace, before_elf = args.diff
+    before, bstats = profile_by_name(before_trace, before_elf, args, jobs)
+    after, astats = profile_by_name(args.trace, args.program, args, jobs)
+    unit = 'per frame' if args.per_frame else 'total'
+    runtime = max(bstats.total_time / (bstats.frames if args.per_frame else 1), 1)
+
+    rows = []
+    for name in set(before) | set(after):
+        b = before.get(name, dict.fromkeys(DIFF_FIELDS, 0))
+        a = after.get(name, dict.fromkeys(DIFF_FIELDS, 0))
+        d_self = a['self'] - b['self']
+        d_incl = a['incl'] - b['incl']
+        # Noise: ignore changes that are small relative to the function or the run
+        significant = any(abs(a[k] - b[k]) * 100 > args.noise * max(b[k], 1) and
+                          abs(a[k] - b[k]) * 100 > args.min_share * runtime
+                          for k in ('self', 'incl'))
+        if significant:
+            rows.append((d_self, d_incl, name, b, a))
+    rows.sort(key=lambda r: (-r[0], -r[1]))
+
+    print(f"\n {before_trace} ({before_elf}) -> {args.trace} ({args.program}), times in ms {unit}")
+    print(f" noise threshold: {args.noise:g}% of the function and {args.min_share:g}% of the run\n")
+    print(f" {'function':<32} {'calls':>15} {'self ms':>20} {'incl ms':>20} {args.ev0_label[:9]:>9} {args.ev1_label[:9]:>9}")
+    for d_self, d_incl, name, b, a in rows[:args.top]:
+        print(f" {name[:32]:<32} {b['calls']:>7.0f}>{a['calls']:<7.0f} "
+              f"{a['self'] / 1e6:9.3f} {pct_change(b['self'], a['self']):+8.1f}% "
+              f"{a['incl'] / 1e6:9.3f} {pct_change(b['incl'], a['incl']):+8.1f}% "
+              f"{pct_change(b['ev0'], a['ev0']):+8.1f}% {pct_change(b['ev1'], a['ev1']):+8.1f}%")
+    if len(rows) > args.top:
+        print(f"  ... {len(rows) - args.top} more above the noise threshold")
+    if not rows:
+        print("  no changes above the noise threshold")
+    print(f"\n runtime: {bstats.total_time / 1e6:.1f} ms -> {astats.total_time / 1e6:.1f} ms "
+          f"({pct_change(bstats.total_time, astats.total_time):+.1f}%)")
+
+    status = 0
+    for budget in args.budget:
+        name, _, limit = budget.partition('=')
+        try:
+            limit = float(limit)
+        except ValueError:
+            print(f"Error: --budget wants NAME=PERCENT, got '{budget}'")
+            return 1
+        if name not in before or name not in after:
+            print(f" budget {name}: not in both traces, skipped")
+            continue
+        change = pct_change(before[name]['incl'], after[name]['incl'])
+        verdict = 'FAIL' if change > limit else 'ok'
+        print(f" budget {name}: inclusive time {change:+.1f}% (limit +{limit:g}%) {verdict}")
+        if change > limit:
+            status = 2
+    return status
+
+def write_synthetic(path, size_mb, threads=4, seed=1):
+    """
+    A trace shaped like a real one, for timing the decoder: nested calls over a
+    few hundred functions, 8KB runs per thread as the profiler flushes them, a
+    few multi-byte deltas. One block is built and repeated.
+    """
+    rng = random.Random(seed)
+    funcs = [0x8C010000 + 0x40 * rng.randrange(1, 0x8000) for _ in range(300)]
+    runs = []
+    for tid in range(1, threads + 1):
+        out = bytearray()
+        while len(out) < 8192 - 64:
+            depth = rng.randrange(1, 7)
+            calls = [rng.choice(funcs) for _ in range(depth)]
+            for flag, seq in ((ENTRY_FLAG, calls), (0, reversed(calls))):
+                for a in seq:
+                    word = flag | (tid << 22) | (((a - BASE_ADDRESS) >> 2) & ADDR_MASK)
+                    out += word.to_bytes(4, 'little')
+                    for v in (rng.randrange(2, 400) if rng.random() < 0.1 else rng.randrange(1, 100),
+                              rng.randrange(0, 4), rng.randrange(0, 3)):
+                        while v >= 0x80:
+                            out.append((v & 0x7F) | 0x80)
+                            v >>= 7
+                        out.append(v)
+        runs.append(bytes(out))
+    block = b''.join(runs * 16)
+    with open(path, 'wb') as f:
+        for _ in range(max(1, size_mb * 1024 * 1024 // len(block))):
+            f.write(block)
 
-                    # push new frame
-                    frame = StackFrame(address, current_time, current_e0, current_e1)
-                    call_stack.append(frame)
+def main():
+    args = parse_args()
 
-                else:
-                    # -- EXIT logic --
-                    if not call_stack:
-                        # unmatched exit, skip
-                        continue
+    if args.synthetic:
+        write_synthetic(args.trace, args.synthetic)
+        print(f"Wrote {os.path.getsize(args.trace) / 1e6:.0f} MB synthetic trace to {args.trace}")
+        if not args.program:
+            return
+    if args.reencode:
+        reencode_v2(args.trace, args.reencode)
+        if not args.program:
+            return
+    if not args.program:
+        usage()
+    if os.path.exists(args.trace):
+        ev0, ev1 = counter_labels(args.trace)
+        args.ev0_label = args.ev0_label or ev0
+        args.ev1_label = args.ev1_label or ev1
+
+    if args.diff:
+        try:
+            sys.exit(diff_traces(args, args.jobs or os.cpu_count() or 1))
+        except (OSError, ValueError) as e:
+            print(f"Error: {e}")
+            sys.exit(1)
 
-                    frame = call_stack.pop()
-                    delta_time = current_time - frame.start_time
-                    delta_e0 = current_e0 - frame.start_e0
-                    delta_e1 = current_e1 - frame.start_e1
-
-                    # update function totals
-                    func = functions[frame.addr]
-                    func.total_time += delta_time
-                    func.ev0 += delta_e0
-                    func.ev1 += delta_e1
-
-                    # update child call accumulation
-                    if call_stack:
-                        parent = call_stack[-1]
-                        cc = child_calls[parent.addr][frame.addr]
-                        cc.total_cycles += delta_time
-                        cc.ev0 += delta_e0
-                        cc.ev1 += delta_e1
-
-            # Final cleanup for any unmatched function entries
-            if call_stack:
-                if args.verbose:
-                    print(f"Warning: {len(call_stack)} unmatched function entries detected. Processing them as incomplete frames.")
-
-                for i, frame in enumerate(call_stack):
-                    delta_time = current_time - frame.start_time
-                    delta_e0 = current_e0 - frame.start_e0
-                    delta_e1 = current_e1 - frame.start_e1
-
-                    func = functions[frame.addr]
-                    if args.verbose:
-                        print(f"  Function: {func.name} at depth {i}")
-                    func.total_time += delta_time
-                    func.ev0 += delta_e0
-                    func.ev1 += delta_e1
-
-                    if i > 0:
-                        parent = call_stack[i - 1].addr
-                        cc = child_calls[parent][frame.addr]
-                        cc.total_cycles += delta_time
-                        cc.ev0 += delta_e0
-                        cc.ev1 += delta_e1
-
-            # Suggest some functions the user can remove from intrumenstation after the first run
-            suggest_exclude_functions(current_time, current_e0, current_e1, args.exclude_time_threshold, args.exclude_ev_threshold)
-
-            dm = DotManager(args.program, args.addr2line, args.verbose, args.percentage, current_time, args.ev0_label, args.ev1_label)
-            dm.create_dot_file()
+    try:
+        jobs = args.jobs or os.cpu_count() or 1
+        start = time.perf_counter()
+        stats = decode_trace(args.trace, jobs)
+        elapsed = time.perf_counter() - start
+        print(f"Decoded {stats.records:,} records ({os.path.getsize(args.trace) / 1e6:.1f} MB) in "
+              f"{elapsed:.2f} s, {stats.records / max(elapsed, 1e-9):,.0f} records/s ({jobs} jobs)")
+
+        raw_time = stats.total_time
+        calib, removed = apply_calibration(stats, args.trace, args)
+        if calib:
+            print(f"Instrumentation overhead: {calib[0] / 1000:.1f} ns, {calib[1] / 1000:.2f} {args.ev0_label}, "
+                  f"{calib[2] / 1000:.2f} {args.ev1_label} per record; {removed / 1e6:.1f} ms of "
+                  f"{raw_time / 1e6:.1f} ms runtime ({removed * 100 / max(raw_time, 1):.1f}%) subtracted")
+
+        if stats.unmatched and args.verbose:
+            print(f"Warning: {stats.unmatched} unmatched function entries detected. Processing them as incomplete frames.")
+
+        # One batch for every address the trace mentions
+        addrs = {(a << 2) + BASE_ADDRESS for a in stats.funcs}
+        names = resolve_symbols(addrs | set(stats.pc_hits), args.addr2line, args.program,
+                                not args.no_cache, args.verbose)
+        strings = region_names(stats.regions, args.program)
+
+        for a, (calls, total, ev0, ev1, _) in stats.funcs.items():
+            fn = functions[(a << 2) + BASE_ADDRESS] = FunctionRecord(names[(a << 2) + BASE_ADDRESS])
+            fn.times_called, fn.total_time, fn.ev0, fn.ev1 = calls, total, ev0, ev1
+        for (caller, callee), (calls, total, ev0, ev1, _) in stats.edges.items():
+            cc = child_calls[(caller << 2) + BASE_ADDRESS][(callee << 2) + BASE_ADDRESS]
+            cc.times_called, cc.total_cycles, cc.ev0, cc.ev1 = calls, total, ev0, ev1
+
+        if stats.dropped:
+            print(f"Warning: the profiler dropped {stats.dropped} records (flush thread fell behind); "
+                  "call counts and times around the gaps are incomplete.")
+        if stats.overhead_ns is not None:
+            print(f"Profiler overhead: {stats.overhead_ns} ns per instrumented call")
+        if stats.pc_hits:
+            print_pc_profile(stats.pc_hits, names)
+        print_frame_report(stats, names, strings, args.ev0_label, args.ev1_label)
+        if args.chrome or args.collapsed:
+            export_traces(args.trace, names, strings, args.chrome, args.collapsed)
+        if stats.sample_every > 1:
+            print(f"Sampled 1 in {stats.sample_every} calls: counts, times and events are estimates.")
+            scale_sampled(stats.sample_every)
+
+        # Suggest some functions the user can remove from intrumenstation after the first run
+        suggest_exclude_functions(stats.total_time, stats.total_e0, stats.total_e1, args.exclude_time_threshold,
+                                  args.exclude_ev_threshold, args.write_filter)
+
+        dm = DotManager(args.program, args.addr2line, args.verbose, args.percentage, stats.total_time or 1,
+                        args.ev0_label, args.ev1_label)
+        dm.create_dot_file()
     except FileNotFoundError:
-        print(f"Error: file '{args.infile}' not found.\n\n")
+        print(f"Error: file '{args.trace}' not found.\n\n")
         usage()
     except Exception as e:
         print("An error occurred:")
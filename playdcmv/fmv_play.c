@@ -6,10 +6,26 @@
  * them to ADPCM audio streamed via the KOS sound API.
  *
  * Features:
- * - Parses custom DCMV v3 container format (video+audio in one file)
+ * - Parses custom DCMV v3/v4 container format (video+audio in one file)
  * - Uses LZ4 decompression for each video frame (compressed with LZ4-HC)
  * - Leverages PVR DMA and VQ textures for efficient rendering
  * - Streams audio using snd_stream with optional stereo/mono handling
+ *   (v4 stereo is stored as [L block][R block] pairs, one read per request)
+ * - Click-free mid-stream starts: with a SEEK index the ADPCM decoder state is
+ *   restored in software and the stream runs as 16-bit PCM
+ * - Audio-clocked A/V sync (av_sync.h), simulated on the host by dcmv_avsync,
+ *   at the header's exact frame rate (30000/1001 for NTSC) or, for variable
+ *   frame rate files, from the PTS chunk's per-frame timestamps
+ * - Paced by the display: the main loop wakes on every vblank, presents the
+ *   frame due by the next one and decodes the one after it while it waits;
+ *   frame-to-frame presentation jitter is measured and reported, and decodes
+ *   that overrun a refresh are told apart by the COST chunk's estimates
+ * - Repeated frames (zero-length offset table entries) skip read, decode and upload
+ * - Short clips (up to RAM_CLIP_MAX) play from RAM with no I/O after startup,
+ *   looping gaplessly between the points in a LOOP chunk
+ * - Gapless playlists (PLAYLIST_FILE): the next clip is opened and its start
+ *   preloaded while the current one plays, and its audio follows in the same
+ *   stream, reusing the buffers
  * - Uses profiler integration for performance tuning
  *
  * Author: Troy Davis (GPF) — https://github.com/GPF
@@ -17,6 +33,7 @@
  *
  * Controls:
  * - Press A: Take screenshot (/pc/screenshot#.ppm)
+ * - D-pad right / left: next scene / back to the start of this one (CUTS chunk)
  * - Press any other button: Exit cleanly
  *
  * Dependencies:
@@ -37,28 +54,115 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <lz4/lz4.h>
+#include "../dcmv_format.h"
+#include "../dcmv_adpcm.h"
+#include "av_sync.h"
+#include "tex_slots.h"
 // #include "kosinski_lz4.h"
-// #include "profiler.h"
+#include "profiler.h"
 
 
-#define DCMV_MAGIC "DCMV"
 #define VIDEO_FILE "/pc/movie.dcmv"
+#define PLAYLIST_FILE "/pc/playlist.txt"       // one .dcmv per line, VIDEO_FILE if missing
+#define PLAYLIST_MAX 16
+#ifndef RAM_CLIP_MAX
+#define RAM_CLIP_MAX (4 * 1024 * 1024)          // files up to this size play from RAM
+#endif
+#define PRELOAD_VIDEO (256 * 1024)              // next clip: frame data read ahead
+#define PRELOAD_AUDIO (64 * 1024)               // next clip: audio read ahead
+#define PRELOAD_CHUNK (32 * 1024)               // preload read size, lets the playing clip's reads in
+#ifndef START_FRAME
+#define START_FRAME 0                           // first clip's starting frame (-DSTART_FRAME=n to debug mid-movie)
+#endif
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Part of a clip's file held in RAM
+typedef struct {
+    const uint8_t *mem;
+    uint32_t pos, len;                          // file range, len = 0: none
+    uint8_t *alloc;                             // kept for the next clip in the slot
+    uint32_t cap;
+} clip_region_t;
+
+/*
+ * One playlist entry. Two slots: the playing clip and the next one, opened
+ * and preloaded on a thread while this one plays. Buffers stay with the slot
+ * and are only grown, so the third clip reuses the first one's.
+ */
+typedef struct {
+    const char *path;
+    FILE *fp, *audio_fp;
+    dcmv_header_t hdr;
+    uint32_t size;
+    dcmv_index_t idx;                           // paged offset table when streaming
+    clip_region_t file;                         // whole file in RAM, len = 0 when streaming
+    clip_region_t vhead, ahead;                 // streaming: first frames / audio, preloaded
+    const uint32_t *offsets;                    // RAM clips: offset table, 4-byte aligned
+    uint8_t *table_alloc;
+    uint32_t table_cap;
+    long seek_index;                            // SEEK chunk payload, -1 if absent
+    uint32_t seek_interval, seek_count;
+    av_loop_t loop;                             // from the LOOP chunk, last RAM clip only
+    av_sync_t tb;                               // fps / rate for the av_frame_sample calls
+    long pts;                                   // PTS chunk: pts[0], 0 = frames at a fixed rate
+    uint32_t pts_scale;                         // its ticks per second
+    long cost;                                  // COST chunk: cost[0], 0 = no decode estimates
+    long cuts;                                  // CUTS chunk: cuts[0], 0 = no scene cuts
+    uint32_t num_cuts;
+    uint32_t loop_pass;                         // pass the audio is in
+    uint64_t loop_wrap;                         // clip sample that pass ends at
+    dcmv_adpcm_state_t loop_state[2];           // decoder state at the loop start
+    uint32_t audio_pos, audio_end;              // audio read position / end of the audio stream
+    uint32_t audio_fp_pos;                      // where audio_fp is, UINT32_MAX = unknown
+    dcmv_adpcm_state_t audio_state[2];
+    int restored;                               // audio_seek_sample restored the decoder state
+    uint8_t *adpcm;                             // PCM mode: ADPCM staging, one request per channel
+    uint8_t *block;                             // one staged [L][R] block pair
+    uint32_t adpcm_cap, block_cap;
+    uint32_t block_pos, block_len;              // per-channel read cursor / bytes valid in the pair
+    uint64_t start;                             // stream sample frame 0 is due at
+    uint64_t end_rel;                           // clip sample its video ends at
+    volatile int ready;                         // preload: 1 done, -1 failed
+} dcmv_clip_t;
 
-static FILE *fp = NULL, *audio_fp = NULL;
+static char playlist[PLAYLIST_MAX][256];
+static int playlist_len, playlist_pos;
+static dcmv_clip_t clips[2];
+static dcmv_clip_t *vclip;                      // clip on screen
+static dcmv_clip_t *volatile aclip;             // clip the audio callback is feeding
+static dcmv_clip_t *volatile anext;             // clip the audio carries on with, if any
+static kthread_t *preload_thread;
 static uint8_t *compressed_buffer = NULL;
-static uint32_t *frame_offsets = NULL;
-static int frame_index =18282 ;
-static int frame_type, video_width, video_height, fps, sample_rate, num_frames, video_frame_size, audio_channels, max_compressed_size, audio_offset;
-static int audio_bytes_fed = 0;
+static uint32_t compressed_cap, frame_buffer_cap, txr_cap;
+static uint64_t audio_start_sample;             // stream sample the stream started at
+static int frame_index = START_FRAME;
+static uint32_t fps_num, fps_den;
+static int frame_type, video_width, video_height, sample_rate, num_frames, video_frame_size, audio_channels, max_compressed_size;
+static volatile uint32_t audio_samples_fed = 0;    // per channel
+static int audio_pcm_mode = 0;                  // decode ADPCM on the SH-4, stream PCM
 snd_stream_hnd_t stream;
+static mutex_t stream_lock = MUTEX_INITIALIZER; // poll thread vs. restart_stream
 static kthread_t *audio_thread;
-pvr_ptr_t pvr_txr;
-pvr_poly_hdr_t hdr;
+static volatile int audio_thread_stop;         // set at exit: audio_poll_thread returns
+pvr_ptr_t pvr_txr[TEX_SLOTS];
+pvr_poly_hdr_t hdr[TEX_SLOTS];
 pvr_vertex_t vert[4];
 char screenshotfilename[256];
 
-static uint8_t *frame_buffer;
+static uint8_t *frame_buffer[TEX_SLOTS];       // DMA source for the matching pvr_txr
+static tex_slots_t slots;
+static semaphore_t dma_done;
+static semaphore_t vblank_sem;                  // signalled every vblank
+static int vblank_handle = -1;
+static volatile uint32_t vblank_count;
+static volatile uint64_t vblank_us;             // timer at the last vblank
+static volatile uint32_t refresh_us = 16683;    // time between the last two
+static volatile int flip_pending;               // a scene was submitted: it goes up at the next vblank
+static volatile uint64_t flip_us;               // when the last one did
+static int dma_pending = 0;                     // started, not waited for yet
+static uint32_t yuv_cfg;
 static volatile int ready_buffer = -1;
 static volatile int audio_started = 0;
 int soundbufferalloc = 8192;
@@ -66,8 +170,8 @@ static volatile float current_audio_frame = 0;
 
 // static LZ4_DC_Stream lz4_ctx; 
 
-double
-psTimer(void)
+static uint32_t
+aica_jiffies(void)
 {
 	// Clock off AICA
 	//
@@ -76,11 +180,10 @@ psTimer(void)
 	//
 	// This solves the sound drift issue in the part 2 of the intro
 	//
-	// N.B. This depends on the jiffies per second from AICA
+	// N.B. Ticks AV_AICA_JIFFIES_PER_SEC times a second (see av_sync.h)
 	//      and only works after AICA has been initialized
 	#define AICA_MEM_CLOCK      0x021000    /* 4 bytes */
-	uint32_t jiffies = g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_CLOCK);
-	return jiffies / 4.410f;
+	return g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_CLOCK);
 }
 
 // int load_frame(int frame_num) {
@@ -134,33 +237,283 @@ psTimer(void)
 //     return 0;
 // }
 
-static int load_frame(int frame_num) {
-    uint32_t offset = frame_offsets[frame_num];
-    uint32_t next_offset = frame_offsets[frame_num + 1];
-    uint32_t compressed_size = next_offset - offset;
+// Make *buf hold at least size bytes; buffers only grow, so clips reuse them
+static int grow(uint8_t **buf, uint32_t *cap, uint32_t size) {
+    if (size <= *cap)
+        return 0;
+    free(*buf);
+    *buf = memalign(32, size);
+    *cap = *buf ? size : 0;
+    return *buf ? 0 : -1;
+}
+
+// RAM copy of file byte pos, with *avail bytes after it; NULL if it isn't loaded
+static const uint8_t *clip_map(const dcmv_clip_t *c, uint32_t pos, uint32_t *avail) {
+    const clip_region_t *r[3] = { &c->file, &c->vhead, &c->ahead };
+    for (int i = 0; i < 3; ++i) {
+        if (pos >= r[i]->pos && pos - r[i]->pos < r[i]->len) {
+            *avail = r[i]->len - (pos - r[i]->pos);
+            return r[i]->mem + (pos - r[i]->pos);
+        }
+    }
+    return NULL;
+}
+
+// Read len bytes from pos into a region, pad bytes into its buffer
+static int region_read(clip_region_t *r, FILE *fp, uint32_t pos, uint32_t len, uint32_t pad) {
+    r->len = 0;
+    if (grow(&r->alloc, &r->cap, len + pad) < 0)
+        return -1;
+    fseek(fp, pos, SEEK_SET);
+    for (uint32_t done = 0; done < len;) {
+        uint32_t n = MIN(len - done, PRELOAD_CHUNK);
+        if (fread(r->alloc + pad + done, 1, n, fp) != n)
+            return -1;
+        done += n;
+        thd_pass();
+    }
+    r->mem = r->alloc + pad;
+    r->pos = pos;
+    r->len = len;
+    return 0;
+}
+
+// Decode a stored frame into a slot's RAM buffer, 0 or -1 on error
+static int decode_frame(dcmv_clip_t *c, const dcmv_frame_ref_t *ref, int slot) {
+    int frame_num = ref->source;
+    uint32_t offset = ref->offset;
+    uint32_t compressed_size = ref->size;
+    PROF_SCOPE("decode");
+    if (tex_slots_fill(&slots, slot, -1) < 0) {
+        printf("Frame %d: slot %d is still being uploaded\n", frame_num, slot);
+        return -1;
+    }
+
+    // LZ4_decompress_fast trusts its input, so at least keep it inside the buffer
+    // and catch short reads; dcmv_verify checks the CRCS table before burning
+    if (compressed_size > (uint32_t)max_compressed_size) {
+        printf("Frame %d: bad offset table entry (%u bytes)\n", frame_num, (unsigned)compressed_size);
+        return -1;
+    }
 
-    fseek(fp, offset, SEEK_SET);
-    fread(compressed_buffer, 1, compressed_size, fp);
-    printf("Frame %d , compressed = %ld\n", frame_num,compressed_size );
+    // A frame in RAM (clip or preloaded head) is decoded in place; clip_load checked the table
+    uint32_t avail;
+    const uint8_t *src = clip_map(c, offset, &avail);
+    if (!src || avail < compressed_size) {
+        src = compressed_buffer;
+        PROF_REGION_BEGIN("read");
+        fseek(c->fp, offset, SEEK_SET);
+        size_t got = fread(compressed_buffer, 1, compressed_size, c->fp);
+        PROF_REGION_END("read");
+        if (got != compressed_size) {
+            printf("Frame %d: short read (%u of %u bytes)\n", frame_num, (unsigned)got, (unsigned)compressed_size);
+            return -1;
+        }
+    }
     // fread(frame_buffer, 1, compressed_size, fp);
-    LZ4_decompress_fast(
-        (const char *)compressed_buffer,
-        (char *)frame_buffer,
+    PROF_REGION_BEGIN("lz4");
+    int used = LZ4_decompress_fast(
+        (const char *)src,
+        (char *)frame_buffer[slot],
         video_frame_size);
+    PROF_REGION_END("lz4");
+    if (used != (int)compressed_size) {
+        printf("Frame %d: LZ4 decode used %d of %u bytes\n", frame_num, used, (unsigned)compressed_size);
+        return -1;
+    }
 
-    return 0;
+    return tex_slots_fill(&slots, slot, frame_num);
 }
 
 
+// fread from the audio handle (or copy from RAM) without running into the
+// extension chunks
+static size_t audio_read(dcmv_clip_t *c, void *dst, size_t n) {
+    if (c->audio_pos + n > c->audio_end)
+        n = c->audio_end > c->audio_pos ? c->audio_end - c->audio_pos : 0;
+    size_t got = 0;
+    while (got < n) {
+        uint32_t avail;
+        const uint8_t *mem = clip_map(c, c->audio_pos, &avail);
+        size_t k;
+        if (mem) {
+            k = MIN(n - got, avail);
+            memcpy((uint8_t *)dst + got, mem, k);
+        } else {
+            if (c->audio_fp_pos != c->audio_pos)
+                fseek(c->audio_fp, c->audio_pos, SEEK_SET);
+            k = fread((uint8_t *)dst + got, 1, n - got, c->audio_fp);
+            c->audio_fp_pos = c->audio_pos + k;
+            if (!k) break;
+        }
+        c->audio_pos += k;
+        got += k;
+    }
+    return got;
+}
+
+// Position at a per-channel byte of the track
+static void audio_seek_byte(dcmv_clip_t *c, uint32_t bytes) {
+    uint32_t bs = c->hdr.audio_block_size;
+    if (c->hdr.channels == 2 && bs) {
+        // Land on the containing block pair and start partway into it
+        uint32_t block = bytes / bs;
+        c->audio_pos = c->hdr.audio_offset + block * bs * 2;
+        c->block_len = audio_read(c, c->block, bs * 2) / 2;
+        c->block_pos = MIN(bytes - block * bs, c->block_len);
+    } else {
+        c->audio_pos = c->hdr.audio_offset + bytes;
+    }
+}
+
+// Whether the SH-4 can decode the track (dcaconv's stereo layout isn't documented)
+static int audio_decodable(const dcmv_clip_t *c) {
+    return c->hdr.channels == 1 || c->hdr.audio_block_size;
+}
+
+// Whether the stream can carry on into clip n without restarting
+static int audio_chains(const dcmv_clip_t *n) {
+    return audio_pcm_mode && audio_decodable(n) && (int)n->hdr.sample_rate == sample_rate &&
+           (int)n->hdr.channels == audio_channels;
+}
+
+// Fill both channels from [L block][R block] pairs: a request that lines up
+// with the block size is a single fread and one memcpy per channel
+static size_t audio_fill_blocks(dcmv_clip_t *c, uintptr_t l, uintptr_t r, size_t per_channel) {
+    uint32_t bs = c->hdr.audio_block_size;
+    size_t done = 0;
+    while (done < per_channel) {
+        if (c->block_pos == c->block_len) {
+            size_t got = audio_read(c, c->block, bs * 2);
+            c->block_len = got / 2;
+            c->block_pos = 0;
+            if (!c->block_len) break;
+        }
+        size_t n = MIN(per_channel - done, c->block_len - c->block_pos);
+        memcpy((uint8_t *)l + done, c->block + c->block_pos, n);
+        memcpy((uint8_t *)r + done, c->block + bs + c->block_pos, n);
+        c->block_pos += n;
+        done += n;
+    }
+    return done * 2;
+}
+
+// Pull ADPCM for both channels into the staging buffer; returns bytes per channel
+static size_t audio_fetch_adpcm(dcmv_clip_t *c, size_t per_channel) {
+    if (c->hdr.channels == 2)
+        return audio_fill_blocks(c, (uintptr_t)c->adpcm, (uintptr_t)(c->adpcm + soundbufferalloc / 2),
+                                 per_channel) / 2;
+    return audio_read(c, c->adpcm, per_channel);
+}
+
+// Decode n ADPCM samples per channel into l / r; returns the samples decoded
+static size_t audio_decode(dcmv_clip_t *c, int16_t *l, int16_t *r, size_t n) {
+    size_t got = audio_fetch_adpcm(c, n / 2) * 2;
+    dcmv_adpcm_decode(&c->audio_state[0], c->adpcm, got, l);
+    if (c->hdr.channels == 2)
+        dcmv_adpcm_decode(&c->audio_state[1], c->adpcm + soundbufferalloc / 2, got, r);
+    return got;
+}
+
+// Back to the first sample of the track with a reset decoder
+static void audio_rewind(dcmv_clip_t *c) {
+    dcmv_adpcm_init(&c->audio_state[0]);
+    dcmv_adpcm_init(&c->audio_state[1]);
+    c->audio_pos = c->hdr.audio_offset;
+    c->block_pos = c->block_len = 0;
+}
+
+// End of a loop pass: back to the loop start, with the decoder state it had
+// there, so the next pass decodes exactly like the first
+static void audio_loop_wrap(dcmv_clip_t *c) {
+    c->audio_state[0] = c->loop_state[0];
+    c->audio_state[1] = c->loop_state[1];
+    audio_seek_byte(c, (uint32_t)(av_frame_sample(&c->tb, c->loop.start) / 2));
+    c->loop_wrap = av_loop_wrap(&c->tb, &c->loop, ++c->loop_pass);
+}
+
+/*
+ * PCM mode: decode ADPCM with the restored state straight into the stream.
+ * In a playlist the clip's audio is cut (or padded with silence) where its
+ * video ends, and the next clip's audio follows in the same request, so the
+ * stream never stops between clips. If the next clip isn't loaded yet, the
+ * stream plays silence until it is and the video waits for it.
+ */
+static size_t audio_cb_pcm(uintptr_t l, uintptr_t r, size_t req) {
+    size_t samples = req / 2 / audio_channels;
+    size_t done = 0;
+    int wrapped = 0;
+    while (done < samples) {
+        dcmv_clip_t *c = aclip, *next = anext;
+        int16_t *lp = (int16_t *)l + done, *rp = (int16_t *)r + done;
+
+        // Stop at the end of the pass or of the clip
+        uint64_t at = audio_start_sample + audio_samples_fed - c->start;
+        uint64_t stop = c->loop.end ? c->loop_wrap : next ? c->end_rel : UINT64_MAX;
+        if (at >= stop && !c->loop.end) {
+            if (next->ready > 0 && audio_chains(next)) {
+                next->start = audio_start_sample + audio_samples_fed;
+                aclip = next;
+                anext = NULL;
+                continue;
+            }
+            size_t n = samples - done;
+            memset(lp, 0, n * 2);
+            if (audio_channels == 2)
+                memset(rp, 0, n * 2);
+            audio_samples_fed += n;
+            done += n;
+            break;
+        }
+        size_t n = samples - done;
+        if (at + n > stop)
+            n = (size_t)(stop - at);
+
+        size_t got = audio_decode(c, lp, rp, n);
+        audio_samples_fed += got;
+        done += got;
+
+        // A track shorter than the video ends the pass early
+        if (c->loop.end && (got < n || at + got == c->loop_wrap) && (got || !wrapped)) {
+            audio_loop_wrap(c);
+            wrapped = 1;
+        } else if (got < n) {
+            if (!next)
+                break;
+            // ... or is padded out to the next clip
+            size_t pad = n - got;
+            memset(lp + got, 0, pad * 2);
+            if (audio_channels == 2)
+                memset(rp + got, 0, pad * 2);
+            audio_samples_fed += pad;
+            done += pad;
+        }
+    }
+    if (done < samples) {
+        printf("Warning: Audio underflow, requested=%zu, provided=%zu\n", req, done * 2 * audio_channels);
+    }
+    return done * 2 * audio_channels;
+}
+
 static size_t audio_cb(snd_stream_hnd_t hnd, uintptr_t l, uintptr_t r, size_t req) {
-    if (audio_channels == 2) {
-        size_t lbytes = fread((void *)l, 1, req / 2, audio_fp);
-        size_t rbytes = fread((void *)r, 1, req / 2, audio_fp);
-        audio_bytes_fed += lbytes + rbytes;
+    dcmv_clip_t *c = aclip;
+    if (audio_pcm_mode) {
+        return audio_cb_pcm(l, r, req);
+    } else if (audio_channels == 2 && c->hdr.audio_block_size) {
+        size_t bytes = audio_fill_blocks(c, l, r, req / 2);
+        audio_samples_fed += av_adpcm_samples(bytes, 2);
+        if (bytes < req) {
+            printf("Warning: Audio underflow, requested=%zu, provided=%zu\n", req, bytes);
+        }
+        return bytes;
+    } else if (audio_channels == 2) {
+        size_t lbytes = audio_read(c, (void *)l, req / 2);
+        size_t rbytes = audio_read(c, (void *)r, req / 2);
+        audio_samples_fed += av_adpcm_samples(lbytes + rbytes, 2);
         return lbytes + rbytes;
     } else {
-        size_t bytes = fread((void *)l, 1, req, audio_fp);
-        audio_bytes_fed += bytes;
+        size_t bytes = audio_read(c, (void *)l, req);
+        audio_samples_fed += av_adpcm_samples(bytes, 1);
         if (bytes < req) {
             printf("Warning: Audio underflow, requested=%zu, provided=%zu\n", req, bytes);
         }
@@ -168,61 +521,407 @@ static size_t audio_cb(snd_stream_hnd_t hnd, uintptr_t l, uintptr_t r, size_t re
     }
 }
 
-static int load_header(void) {
-    char magic[4];
-    fread(magic, 1, 4, fp);
-    if (memcmp(magic, DCMV_MAGIC, 4)) return -1;
-    uint32_t version;
-    fread(&version, 4, 1, fp);
-    fread(&frame_type, 1, 1, fp);
-    fread(&video_width, 2, 1, fp);
-    fread(&video_height, 2, 1, fp);
-    fread(&fps, 2, 1, fp);
-    fread(&sample_rate, 2, 1, fp);
-    fread(&audio_channels, 2, 1, fp);
-    fread(&num_frames, 4, 1, fp);
-    fread(&video_frame_size, 4, 1, fp);
-    fread(&max_compressed_size, 4, 1, fp);
-    fread(&audio_offset, 4, 1, fp);
+// SEEK entry k, from RAM or the audio handle
+static int read_seek_entry(dcmv_clip_t *c, uint32_t k, dcmv_seek_entry_t *e) {
+    uint32_t pos = (uint32_t)c->seek_index + 8 + k * 16, avail;
+    const uint8_t *mem = clip_map(c, pos, &avail);
+    if (!mem || avail < 16) {
+        c->audio_fp_pos = UINT32_MAX;
+        return dcmv_read_seek_entry(c->audio_fp, c->seek_index, k, e);
+    }
+    memcpy(&e->sample, mem, 4);
+    memcpy(&e->byte_offset, mem + 4, 4);
+    memcpy(e->signal, mem + 8, 4);
+    memcpy(e->step, mem + 12, 4);
+    return 0;
+}
 
-    printf("📦 Header: %s %dx%d @ %dfps, %dHz, %dch, %d frames, frame_size=%d, max_compressed_size=%d, audio_offset=0x%X\n",
-           frame_type == 1 ? "YUV420P" : "RGB565", video_width, video_height, fps, sample_rate, audio_channels, num_frames, video_frame_size, max_compressed_size, audio_offset);
+/*
+ * Position the audio at a per-channel sample. With a SEEK index the decoder
+ * state is restored from the nearest entry and the remaining samples are
+ * decoded and dropped, so playback continues exactly as a full decode would;
+ * the stream then has to run in PCM mode (c->restored) because the AICA
+ * always starts ADPCM from a reset state. A clip in RAM without an index is
+ * decoded from the start instead. Returns the sample actually reached.
+ */
+static uint32_t audio_seek_sample(dcmv_clip_t *c, uint32_t target) {
+    target &= ~1u;
+    dcmv_seek_entry_t e;
+    int have_entry = 0;
+    if (c->seek_index >= 0) {
+        have_entry = read_seek_entry(c, MIN(target / c->seek_interval, c->seek_count - 1), &e) == 0 &&
+                     e.sample <= target;
+    } else if (c->file.len && audio_decodable(c)) {
+        // No index, but the track is in RAM: decode it from the start
+        e = (dcmv_seek_entry_t){ .step = { DCMV_ADPCM_STEP_MIN, DCMV_ADPCM_STEP_MIN } };
+        have_entry = 1;
+    }
+    if (have_entry) {
+        for (int ch = 0; ch < 2; ++ch) {
+            c->audio_state[ch].signal = e.signal[ch];
+            c->audio_state[ch].step = e.step[ch];
+        }
+        c->audio_pos = c->hdr.audio_offset + e.byte_offset;
+        c->block_pos = c->block_len = 0;
+
+        int16_t scratch[256];
+        uint32_t skip = target - e.sample;
+        while (skip) {
+            uint32_t n = MIN(skip, 256);
+            if (audio_decode(c, scratch, scratch, n) < n) break;
+            skip -= n;
+        }
+        c->restored = 1;
+        return target - skip;
+    }
+
+    // No index: jump to the byte and let the AICA start from a reset state
+    uint32_t bytes_to_skip = target / 2;
+    bytes_to_skip = (bytes_to_skip + 15) & ~0xF;  // Round up to nearest 16-byte boundary
+    audio_seek_byte(c, bytes_to_skip);
+    return bytes_to_skip * 2;
+}
+
+static int load_header(dcmv_clip_t *c) {
+    const dcmv_header_t *h = &c->hdr;
+    if (dcmv_read_header(c->fp, &c->hdr) < 0) return -1;
+    printf("📦 Header: %s %dx%d @ %.3ffps, %dHz, %dch, %d frames, frame_size=%d, max_compressed_size=%d, audio_offset=0x%X\n",
+           h->frame_type == 1 ? "YUV420P" : "RGB565", (int)h->width, (int)h->height, (double)h->fps_num / h->fps_den, (int)h->sample_rate,
+           (int)h->channels, (int)h->num_frames, (int)h->frame_size, (int)h->max_compressed_size, (unsigned)h->audio_offset);
 
     return 0;
 }
 
-static int init_pvr(int frame_type) {
-    // LZ4_DC_init(&lz4_ctx);
-        pvr_init_defaults();
-    if (frame_type == 1) {
-        pvr_txr = pvr_mem_malloc(video_width * video_height * 2);
+/*
+ * Short clips (menu backgrounds, attract loops) are kept whole in RAM so
+ * playback doesn't touch the file again: romdisk files are used where they
+ * are, anything else is read once. 0 if the clip is in RAM, -1 to stream it.
+ */
+static int clip_load(dcmv_clip_t *c) {
+    uint32_t size = c->size;
+    if (!size || size > RAM_CLIP_MAX)
+        return -1;
+
+    uint32_t table = c->hdr.header_size, frames = c->hdr.num_frames;
+    const uint8_t *mem = fs_mmap(fileno(c->fp));
+    if (mem) {
+        c->offsets = (const uint32_t *)(mem + table);
+        if ((uintptr_t)c->offsets & 3) {
+            if (grow(&c->table_alloc, &c->table_cap, (frames + 1) * 4) < 0) return -1;
+            memcpy(c->table_alloc, mem + table, (frames + 1) * 4);
+            c->offsets = (const uint32_t *)c->table_alloc;
+        }
+        c->file.mem = mem;
+        c->file.pos = 0;
+        c->file.len = size;
     } else {
-        pvr_txr = pvr_mem_malloc(video_frame_size);
+        // Read in so that the offset table lands 4-byte aligned
+        if (region_read(&c->file, c->fp, 0, size, (4 - table % 4) % 4) < 0)
+            return -1;
+        c->offsets = (const uint32_t *)(c->file.mem + table);
     }
-    if (!pvr_txr) return -1;
 
-    pvr_poly_cxt_t cxt;
-    if (frame_type == 1) {
-        // YUV422 texture setup
-        PVR_SET(PVR_YUV_ADDR, ((unsigned int)pvr_txr) & 0xffffff);
-        PVR_SET(PVR_YUV_CFG, (0x00 << 24) |
-                             (((video_height / 16) - 1) << 8) |
-                             ((video_width / 16) - 1));
-        PVR_GET(PVR_YUV_CFG);
+    // Frames are decoded straight from here, so check the table once
+    for (uint32_t i = 0; i < frames; ++i) {
+        if (c->offsets[i] > c->offsets[i + 1] || c->offsets[i + 1] > size) {
+            printf("Frame %u: bad offset table entry, streaming instead\n", (unsigned)i);
+            c->file.len = 0;
+            return -1;
+        }
+    }
+    printf("🎬 Playing from RAM: %u bytes (%s)\n", (unsigned)size, c->file.mem == mem ? "mapped" : "loaded");
+    return 0;
+}
+
+/*
+ * Variable frame rate clips carry a PTS table: frames are scheduled from it
+ * instead of the frame rate. A RAM clip's table is checked here, a streamed
+ * one a page at a time by dcmv_index_t.
+ */
+static void clip_use_pts(dcmv_clip_t *c) {
+    long pos = dcmv_find_pts(c->fp, &c->hdr, &c->pts_scale);
+    if (pos < 0)
+        return;
+    if (c->file.len) {
+        if (pos + (c->hdr.num_frames + 1) * 4ull > c->size)
+            return;
+        uint32_t prev = 0, pts;
+        for (uint32_t i = 0; i <= c->hdr.num_frames; ++i, prev = pts) {
+            memcpy(&pts, c->file.mem + pos + i * 4, 4);
+            if (pts < prev) {
+                printf("Frame %u: timestamps go backwards, ignoring the PTS table\n", (unsigned)i);
+                return;
+            }
+        }
+    } else {
+        dcmv_index_use_pts(&c->idx, pos);
+    }
+    c->pts = pos;
+    printf("⏱ Per-frame timestamps, %u ticks/s\n", (unsigned)c->pts_scale);
+}
+
+// Decode estimates (dcmv_lz4cost.h), checked like the PTS table
+static void clip_use_cost(dcmv_clip_t *c) {
+    long pos = dcmv_find_cost(c->fp, &c->hdr);
+    if (pos < 0 || (c->file.len && pos + c->hdr.num_frames * 2ull > c->size))
+        return;
+    if (!c->file.len)
+        dcmv_index_use_cost(&c->idx, pos);
+    c->cost = pos;
+    printf("⚙️ Per-frame decode estimates\n");
+}
+
+// Estimated decode time of stored frame i in microseconds, -1 if unknown
+static int32_t clip_cost_us(dcmv_clip_t *c, uint32_t i) {
+    if (!c->cost)
+        return -1;
+    if (!c->file.len)
+        return dcmv_index_cost(&c->idx, i);
+    uint16_t us;
+    memcpy(&us, c->file.mem + c->cost + i * 2, 2);
+    return us;
+}
 
-        pvr_poly_cxt_txr(&cxt, PVR_LIST_OP_POLY,
-                         PVR_TXRFMT_YUV422 | PVR_TXRFMT_NONTWIDDLED,
-                         video_width, video_height, pvr_txr, PVR_FILTER_BILINEAR);
-        pvr_poly_compile(&hdr, &cxt);
-        hdr.mode3 |= PVR_TXRFMT_STRIDE;
+// Scene cuts, the chapters of the clip
+static void clip_use_cuts(dcmv_clip_t *c) {
+    long pos = dcmv_find_cuts(c->fp, &c->hdr, &c->num_cuts);
+    if (pos < 0 || !c->num_cuts || (c->file.len && pos + c->num_cuts * 4ull > c->size))
+        return;
+    c->cuts = pos;
+    printf("🎬 %u scene cuts\n", (unsigned)c->num_cuts);
+}
+
+// First frame of scene k (0 = the clip's start), -1 if it can't be read
+static int clip_scene(dcmv_clip_t *c, uint32_t k) {
+    uint32_t f;
+    if (!k)
+        return 0;
+    if (c->file.len)
+        memcpy(&f, c->file.mem + c->cuts + (k - 1) * 4, 4);
+    else if (fseek(c->fp, c->cuts + (k - 1) * 4, SEEK_SET) != 0 || fread(&f, 4, 1, c->fp) != 1)
+        return -1;
+    return f < c->hdr.num_frames ? (int)f : -1;
+}
+
+// The scene frame i is in
+static uint32_t clip_scene_of(dcmv_clip_t *c, int i) {
+    uint32_t lo = 0, hi = c->num_cuts;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        int f = clip_scene(c, mid + 1);
+        if (f >= 0 && f <= i)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Start and end of frame i in PTS ticks, 0 or -1
+static int clip_pts(dcmv_clip_t *c, uint32_t i, uint32_t pts[2]) {
+    if (c->file.len) {
+        if (i >= c->hdr.num_frames)
+            return -1;
+        memcpy(pts, c->file.mem + c->pts + i * 4, 8);
+        return 0;
+    }
+    return dcmv_index_pts(&c->idx, i, pts);
+}
+
+// Clip sample frame i starts at
+static uint64_t clip_frame_sample(dcmv_clip_t *c, uint32_t i) {
+    uint32_t pts[2];
+    if (c->pts && clip_pts(c, i ? i - 1 : 0, pts) == 0)
+        return (uint64_t)pts[i ? 1 : 0] * c->hdr.sample_rate / c->pts_scale;
+    return av_frame_sample(&c->tb, i);
+}
+
+/*
+ * Open a playlist entry: header, SEEK index, and either the whole file in
+ * RAM or the paged offset table and a handle for the audio. Loop points only
+ * count on the last entry. Leaves the audio at the first sample.
+ */
+static int clip_open(dcmv_clip_t *c, const char *path, int last) {
+    c->path = path;
+    c->fp = fopen(path, "rb");
+    if (!c->fp || load_header(c) < 0) return -1;
+    c->file.len = c->vhead.len = c->ahead.len = 0;
+    c->loop.end = 0;
+    c->restored = 0;
+    fseek(c->fp, 0, SEEK_END);
+    long size = ftell(c->fp);
+    c->size = size > 0 ? (uint32_t)size : 0;
+    c->audio_end = dcmv_audio_end(&c->hdr, c->size);
+    c->audio_fp_pos = UINT32_MAX;
+    c->tb = (av_sync_t){ .fps_num = c->hdr.fps_num, .fps_den = c->hdr.fps_den, .sample_rate = c->hdr.sample_rate };
+    c->pts = 0;
+    c->cost = 0;
+    c->cuts = 0;
+
+    c->seek_index = dcmv_find_seek(c->fp, &c->hdr, &c->seek_interval, &c->seek_count);
+    if (c->hdr.audio_block_size && grow(&c->block, &c->block_cap, c->hdr.audio_block_size * 2) < 0)
+        return -1;
+    if (audio_decodable(c) && grow(&c->adpcm, &c->adpcm_cap, soundbufferalloc) < 0)
+        return -1;
+
+    if (clip_load(c) == 0) {
+        // Loop points only apply in RAM, and the audio has to be decoded on the
+        // SH-4 to carry the decoder state across the wrap
+        if (last && dcmv_read_loop(c->fp, &c->hdr, &c->loop.start, &c->loop.end) == 0 && !audio_decodable(c)) {
+            printf("Loop points ignored: the stereo audio isn't in [L block][R block] pairs\n");
+            c->loop.end = 0;
+        }
+        if (!c->loop.end)
+            clip_use_pts(c);
+        clip_use_cost(c);
+        clip_use_cuts(c);
     } else {
-        // RGB565 + VQ
-        pvr_poly_cxt_txr(&cxt, PVR_LIST_OP_POLY,
-                         PVR_TXRFMT_RGB565 | PVR_TXRFMT_TWIDDLED | PVR_TXRFMT_VQ_ENABLE,
-                         video_width, video_height, pvr_txr, PVR_FILTER_BILINEAR);
-        pvr_poly_compile(&hdr, &cxt);
+        // Frame offsets are paged in as playback reaches them
+        dcmv_index_open(&c->idx, c->fp, &c->hdr);
+        clip_use_pts(c);
+        clip_use_cost(c);
+        clip_use_cuts(c);
+        printf("🗂 Frame index: %u bytes resident (%d pages of %d frames), whole table %u bytes\n",
+               (unsigned)sizeof(c->idx), DCMV_INDEX_PAGES, DCMV_INDEX_PAGE_FRAMES, (unsigned)(c->hdr.num_frames + 1) * 4);
+        c->audio_fp = fopen(path, "rb"); // Point to the same file as video
+        if (!c->audio_fp) return -1;
     }
 
+    c->end_rel = clip_frame_sample(c, c->hdr.num_frames) & ~1ull;
+    if (c->loop.end) {
+        // Decoder state at the loop start, put back at the end of every pass
+        audio_seek_sample(c, (uint32_t)av_frame_sample(&c->tb, c->loop.start));
+        memcpy(c->loop_state, c->audio_state, sizeof(c->loop_state));
+        c->loop_pass = 0;
+        c->loop_wrap = av_loop_wrap(&c->tb, &c->loop, 0);
+    }
+    audio_rewind(c);
+    return 0;
+}
+
+// Preload thread: open the next clip and read its first frames and audio
+static void *clip_preload(void *p) {
+    dcmv_clip_t *c = p;
+    int ok = clip_open(c, c->path, playlist_pos + 2 == playlist_len) == 0;
+    if (ok && !c->file.len) {
+        dcmv_frame_ref_t first;
+        ok = dcmv_index_lookup(&c->idx, 0, &first) == 0;
+        if (ok && first.offset < c->hdr.audio_offset)
+            ok = region_read(&c->vhead, c->fp, first.offset,
+                             MIN(PRELOAD_VIDEO, c->hdr.audio_offset - first.offset), 0) == 0;
+        if (ok && c->hdr.audio_offset < c->audio_end)
+            ok = region_read(&c->ahead, c->fp, c->hdr.audio_offset,
+                             MIN(PRELOAD_AUDIO, c->audio_end - c->hdr.audio_offset), 0) == 0;
+    }
+    c->ready = ok ? 1 : -1;
+    return NULL;
+}
+
+// Close the files, keep the buffers for the next clip in the slot
+static void clip_close(dcmv_clip_t *c) {
+    if (c->fp)
+        fclose(c->fp);
+    if (c->audio_fp)
+        fclose(c->audio_fp);
+    c->fp = c->audio_fp = NULL;
+    c->file.len = c->vhead.len = c->ahead.len = 0;
+}
+
+static void clip_free(dcmv_clip_t *c) {
+    clip_close(c);
+    free(c->file.alloc);
+    free(c->vhead.alloc);
+    free(c->ahead.alloc);
+    free(c->table_alloc);
+    free(c->adpcm);
+    free(c->block);
+}
+
+// Where frame i (counting up through the loop passes) is stored, 0 or -1
+static int frame_lookup(dcmv_clip_t *c, int frame_num, dcmv_frame_ref_t *ref) {
+    uint32_t i = av_loop_frame(&c->loop, frame_num);
+    if (!c->file.len)
+        return dcmv_index_lookup(&c->idx, i, ref);
+    uint32_t source = dcmv_source_frame(c->offsets, i);
+    *ref = (dcmv_frame_ref_t){ source, c->offsets[source], c->offsets[source + 1] - c->offsets[source] };
+    return 0;
+}
+
+static void playlist_add(const char *path) {
+    if (playlist_len < PLAYLIST_MAX)
+        snprintf(playlist[playlist_len++], sizeof(playlist[0]), "%s", path);
+}
+
+// One .dcmv path per line; blank lines and # comments are skipped
+static void playlist_load(void) {
+    FILE *f = fopen(PLAYLIST_FILE, "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0] && line[0] != '#')
+                playlist_add(line);
+        }
+        fclose(f);
+    }
+    if (!playlist_len)
+        playlist_add(VIDEO_FILE);
+}
+
+// Start opening the entry after the playing one in the other slot
+static void preload_next(void) {
+    if (playlist_pos + 1 >= playlist_len)
+        return;
+    dcmv_clip_t *n = &clips[vclip == &clips[0]];
+    n->path = playlist[playlist_pos + 1];
+    n->ready = 0;
+    anext = n;
+    preload_thread = thd_create(0, clip_preload, n);
+}
+
+// Interrupt context: a new field / frame started, and the last scene submitted is now up
+static void vblank_isr(uint32_t code, void *data) {
+    (void)code;
+    (void)data;
+    uint64_t now = timer_us_gettime64();
+    if (vblank_us)
+        refresh_us = (uint32_t)(now - vblank_us);
+    vblank_us = now;
+    vblank_count++;
+    if (flip_pending) {
+        flip_us = now;
+        flip_pending = 0;
+    }
+    sem_signal(&vblank_sem);
+}
+
+// Block until the next vblank (or sleep_ms without a vblank handler); returns
+// at once if one went by since the last call, so an overrun loses no refresh.
+// Returns the vblanks since the last call, more than 1 after an overrun (0 without a handler)
+static uint32_t wait_vblank(uint32_t sleep_ms) {
+    static uint32_t seen;
+    if (vblank_handle < 0) {
+        if (sleep_ms)
+            thd_sleep(sleep_ms);
+        return 0;
+    }
+    while (vblank_count == seen)
+        sem_wait(&vblank_sem);
+    uint32_t passed = vblank_count - seen;
+    seen += passed;
+    return passed;
+}
+
+static int init_pvr(void) {
+    // LZ4_DC_init(&lz4_ctx);
+        pvr_init_defaults();
+    tex_slots_init(&slots);
+    sem_init(&dma_done, 0);
+    sem_init(&vblank_sem, 0);
+    vblank_handle = vblank_handler_add(vblank_isr, NULL);
+    if (vblank_handle < 0)
+        printf("No vblank handler, pacing frames with thd_sleep\n");
+
     vert[0] = (pvr_vertex_t){.flags = PVR_CMD_VERTEX, .x=0, .y=0, .z=1, .u=0, .v=0, .argb=0xffffffff};
     vert[1] = (pvr_vertex_t){.flags = PVR_CMD_VERTEX, .x=640, .y=0, .z=1, .u=1, .v=0, .argb=0xffffffff};
     vert[2] = (pvr_vertex_t){.flags = PVR_CMD_VERTEX, .x=0, .y=480, .z=1, .u=0, .v=1, .argb=0xffffffff};
@@ -230,18 +929,115 @@ static int init_pvr(int frame_type) {
     return 0;
 }
 
-void draw_frame() {
+// Textures and frame buffers for the clip on screen; only reallocated when
+// a clip needs more than the ones before it
+static int init_textures(void) {
+    yuv_cfg = (0x00 << 24) | (((video_height / 16) - 1) << 8) | ((video_width / 16) - 1);
+    uint32_t txr_size = frame_type == 1 ? video_width * video_height * 2 : video_frame_size;
+    if (txr_size > txr_cap) {
+        pvr_wait_ready();   // the last scene may still be drawing from them
+        for (int i = 0; i < TEX_SLOTS; ++i) {
+            if (pvr_txr[i]) pvr_mem_free(pvr_txr[i]);
+            pvr_txr[i] = pvr_mem_malloc(txr_size);
+            if (!pvr_txr[i]) return -1;
+        }
+        txr_cap = txr_size;
+    }
+    if ((uint32_t)video_frame_size > frame_buffer_cap) {
+        for (int i = 0; i < TEX_SLOTS; ++i) {
+            uint32_t cap = frame_buffer_cap;
+            if (grow(&frame_buffer[i], &cap, video_frame_size) < 0) return -1;
+        }
+        frame_buffer_cap = video_frame_size;
+    }
+
+    for (int i = 0; i < TEX_SLOTS; ++i) {
+        pvr_poly_cxt_t cxt;
+        if (frame_type == 1) {
+            // YUV422 texture setup; PVR_YUV_ADDR is pointed at the slot per upload
+            pvr_poly_cxt_txr(&cxt, PVR_LIST_OP_POLY,
+                             PVR_TXRFMT_YUV422 | PVR_TXRFMT_NONTWIDDLED,
+                             video_width, video_height, pvr_txr[i], PVR_FILTER_BILINEAR);
+            pvr_poly_compile(&hdr[i], &cxt);
+            hdr[i].mode3 |= PVR_TXRFMT_STRIDE;
+        } else {
+            // RGB565 + VQ
+            pvr_poly_cxt_txr(&cxt, PVR_LIST_OP_POLY,
+                             PVR_TXRFMT_RGB565 | PVR_TXRFMT_TWIDDLED | PVR_TXRFMT_VQ_ENABLE,
+                             video_width, video_height, pvr_txr[i], PVR_FILTER_BILINEAR);
+            pvr_poly_compile(&hdr[i], &cxt);
+        }
+    }
+    return 0;
+}
+
+// Put a clip on screen: the globals the decode / upload path uses, and
+// textures for its format
+static int use_clip_video(dcmv_clip_t *c) {
+    const dcmv_header_t *h = &c->hdr;
+    frame_type = h->frame_type;
+    video_width = h->width;
+    video_height = h->height;
+    fps_num = h->fps_num;
+    fps_den = h->fps_den;
+    num_frames = h->num_frames;
+    video_frame_size = h->frame_size;
+    max_compressed_size = h->max_compressed_size;
+    vclip = c;
+    if (!c->file.len && grow(&compressed_buffer, &compressed_cap, max_compressed_size) < 0)
+        return -1;
+    tex_slots_forget(&slots);
+    return init_textures();
+}
+
+// Interrupt context: the texture is complete
+static void dma_complete(void *data) {
+    (void)data;
+    tex_slots_dma_done(&slots);
+    sem_signal(&dma_done);
+}
+
+// Kick off the DMA from a slot's buffer into its texture and return straight away
+static int start_upload(int slot) {
+    PROF_REGION_BEGIN("upload");
+    // The back texture was last drawn by the scene before the one on screen, which
+    // draw_frame's pvr_wait_ready() saw rendered, so the DMA can't hit it mid-render
+    if (tex_slots_dma_start(&slots, slot) < 0) {
+        PROF_REGION_END("upload");
+        return -1;
+    }
+    dcache_flush_range((uintptr_t)frame_buffer[slot], video_frame_size);
+    int rv;
     if (frame_type == 1) {
-        // dcache_flush_range((uintptr_t)frame_buffer, (uintptr_t)(frame_buffer + video_frame_size));
-        // pvr_dma_transfer(frame_buffer, PVR_TA_YUV_CONV, video_frame_size, PVR_DMA_YUV, true, NULL, NULL);
-        // sq_cpy((void *)0x10800000, (void *)frame_buffer, video_frame_size);
-        pvr_sq_load(NULL, frame_buffer, video_frame_size, PVR_DMA_YUV);
-        
+        // The converter writes wherever PVR_YUV_ADDR points; setting it again restarts it there
+        PVR_SET(PVR_YUV_ADDR, ((unsigned int)pvr_txr[slot]) & 0xffffff);
+        PVR_SET(PVR_YUV_CFG, yuv_cfg);
+        PVR_GET(PVR_YUV_CFG);
+        rv = pvr_dma_transfer(frame_buffer[slot], PVR_TA_YUV_CONV, video_frame_size, PVR_DMA_YUV, 0,
+                              dma_complete, NULL);
     } else {
-        // dcache_flush_range((uintptr_t)pvr_txr, (uintptr_t)(frame_buffer + video_frame_size));
-        pvr_txr_load(frame_buffer, pvr_txr, video_frame_size);
+        rv = pvr_txr_load_dma(frame_buffer[slot], pvr_txr[slot], video_frame_size, 0, dma_complete, NULL);
+    }
+    PROF_REGION_END("upload");
+    if (rv < 0) {
+        slots.dma_slot = -1;
+        printf("Slot %d: texture DMA failed to start\n", slot);
+        return -1;
     }
+    dma_pending = 1;
+    return 0;
+}
+
+static void finish_upload(void) {
+    if (!dma_pending) return;
+    PROF_REGION_BEGIN("dma-wait");
+    sem_wait(&dma_done);
+    PROF_REGION_END("dma-wait");
+    dma_pending = 0;
+}
 
+void draw_frame(int slot) {
+    pvr_wait_ready();
     pvr_scene_begin();
     pvr_list_begin(PVR_LIST_OP_POLY);
     pvr_dr_state_t dr;
@@ -251,179 +1047,424 @@ void draw_frame() {
     uintptr_t sq_dest_addr = (uintptr_t)SQ_MASK_DEST(PVR_TA_INPUT);
     
     // Submit polygon header
-    sq_fast_cpy((void *)sq_dest_addr, &hdr, 1);
+    sq_fast_cpy((void *)sq_dest_addr, &hdr[slot], 1);
     // Submit 4 vertices
     sq_fast_cpy((void *)sq_dest_addr, vert, 4);
 
     pvr_dr_finish();
     pvr_list_finish();
     pvr_scene_finish();
+    flip_pending = 1;   // one quad renders well within a refresh
+}
+
+// Timing for the clip on screen: its frame rate, or its PTS timescale
+static void clip_timebase(av_sync_t *av, const dcmv_clip_t *c) {
+    if (c->pts)
+        av_sync_use_pts(av, c->pts_scale);
+    if (vblank_handle >= 0)
+        av_sync_set_slack(av, AV_SYNC_VBLANK_SLACK_MS);
+}
+
+// When a frame of the clip on screen and the one after it are due, from its timestamps if it has them
+static void frame_due(const av_sync_t *av, int frame_num, uint64_t due[2]) {
+    uint32_t pts[2];
+    if (vclip->pts && clip_pts(vclip, frame_num, pts) == 0) {
+        due[0] = av_pts_due(av, pts[0]);
+        due[1] = av_pts_due(av, pts[1]);
+    } else {
+        due[0] = av_frame_due(av, frame_num);
+        due[1] = av_frame_due(av, frame_num + 1);
+    }
+}
+
+static int frame_next(const av_sync_t *av, uint64_t clock, int frame_num, uint32_t *sleep_ms) {
+    uint64_t due[2];
+    frame_due(av, frame_num, due);
+    return av_sync_next_at(av, clock, due[0], due[1], sleep_ms);
+}
+
+static int32_t frame_drift_us(const av_sync_t *av, uint64_t clock, int frame_num) {
+    uint64_t due[2];
+    frame_due(av, frame_num, due);
+    return av_sync_drift_at(av, clock, due[0]);
 }
 
-static void wait_exit(void) {
+// Decode (unless decoded ahead) and upload a frame, decoding the next one while
+// the DMA runs (see tex_slots.h), then draw it. 0 or -1 on error.
+static int present_frame(const av_sync_t *av, int frame_num) {
+    // Zero-length entries repeat the last stored frame; only decode that one
+    // if a drop skipped it
+    dcmv_frame_ref_t ref;
+    if (frame_lookup(vclip, frame_num, &ref) < 0) {
+        printf("Frame %d: can't read the offset table\n", frame_num);
+        return -1;
+    }
+    int slot;
+    int action = tex_slots_present(&slots, ref.source, &slot);
+    if (action == TS_DECODE && decode_frame(vclip, &ref, slot) < 0)
+        return -1;
+    if (action != TS_REDRAW && start_upload(slot) < 0)
+        return -1;
+
+    // Only while on time: once the next frame is due as well, av_sync may drop it.
+    // Paced by vblank the main loop decodes it once the scene is out instead,
+    // so the draw doesn't wait for it
+    uint32_t sleep_ms;
+    uint64_t clock = av_sync_clock(av, aica_jiffies(), audio_samples_fed);
+    if (vblank_handle < 0 && (vclip->loop.end || frame_num + 1 < num_frames) &&
+        frame_next(av, clock, frame_num + 1, &sleep_ms) == AV_WAIT) {
+        dcmv_frame_ref_t ahead;
+        int target = -1;
+        if (frame_lookup(vclip, frame_num + 1, &ahead) == 0)
+            target = tex_slots_ahead(&slots, slot, ahead.source);
+        if (target >= 0 && decode_frame(vclip, &ahead, target) < 0) {
+            finish_upload();
+            return -1;
+        }
+    }
+
+    finish_upload();
+    if (tex_slots_flip(&slots, slot) < 0)
+        return -1;
+    draw_frame(slot);
+    return 0;
+}
+
+// Before waiting for a vblank: get the next frame into the back buffer if it
+// isn't there yet. 1 if it decoded one (its estimate in *est_us, -1 if the
+// clip has none), 0 if not, -1 on error.
+static int decode_ahead(int frame_num, int32_t *est_us) {
+    dcmv_frame_ref_t ref;
+    if (slots.front < 0 || (!vclip->loop.end && frame_num >= num_frames) || frame_lookup(vclip, frame_num, &ref) < 0)
+        return 0;
+    int target = tex_slots_ahead(&slots, slots.front, ref.source);
+    if (target < 0)
+        return 0;
+    *est_us = clip_cost_us(vclip, ref.source);
+    return decode_frame(vclip, &ref, target) < 0 ? -1 : 1;
+}
+
+// A: screenshot, d-pad left / right: scene back / forward (returns -1 / 1), anything else exits
+static int poll_input(void) {
     static uint16_t prev_buttons = 0;
 
     maple_device_t *dev = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
-    if (!dev) return;
+    if (!dev) return 0;
 
     cont_state_t *state = (cont_state_t *)maple_dev_status(dev);
-    if (!state || !dev->status_valid) return;
+    if (!state || !dev->status_valid) return 0;
 
     // Avoid repeated work if button state hasn't changed
-    if (state->buttons == prev_buttons) return;
+    if (state->buttons == prev_buttons) return 0;
     prev_buttons = state->buttons;
 
     if (state->buttons & CONT_A) {
         sprintf(screenshotfilename, "/pc/screenshot%d.ppm", frame_index);
         vid_screen_shot(screenshotfilename);
+    } else if (state->buttons & CONT_DPAD_LEFT) {
+        return -1;
+    } else if (state->buttons & CONT_DPAD_RIGHT) {
+        return 1;
     } else if (state->buttons) {
         arch_exit();  // Graceful exit
     }
+    return 0;
 }
 
 
+
 void *audio_poll_thread(void *p) {
-    while (1) {
+    while (!audio_thread_stop) {
         // printf("snd_stream_poll\n");
+        mutex_lock(&stream_lock);
         snd_stream_poll(stream);
-        thd_sleep(20);  
-        wait_exit();
-
+        mutex_unlock(&stream_lock);
+        thd_sleep(20);
     }
     return NULL;
 }
-float start_time;
+
+static void stream_start(void) {
+    if (audio_pcm_mode)
+        snd_stream_start(stream, sample_rate, audio_channels == 2 ? 1 : 0);
+    else
+        snd_stream_start_adpcm(stream, sample_rate, audio_channels == 2 ? 1 : 0);
+}
+
+// Start the stream again on clip n, whose audio can't follow in the running one
+static void restart_stream(av_sync_t *av, dcmv_clip_t *n) {
+    mutex_lock(&stream_lock);
+    snd_stream_stop(stream);
+    anext = NULL;
+    aclip = n;
+    n->start = 0;
+    audio_start_sample = 0;
+    audio_samples_fed = 0;
+    sample_rate = n->hdr.sample_rate;
+    audio_channels = n->hdr.channels;
+    audio_pcm_mode = audio_decodable(n);
+    stream_start();
+    av_sync_init(av, n->hdr.fps_num, n->hdr.fps_den, sample_rate, 0, aica_jiffies(), AV_SYNC_LEAD_MS);
+    clip_timebase(av, n);
+    mutex_unlock(&stream_lock);
+}
+
+/*
+ * Scene (chapter) seeking: restart the clip on screen at the next scene cut,
+ * or back at the start of the current scene (the one before it within the
+ * first second). The stream restarts at the cut's exact sample, as at
+ * startup; a cut is always a stored frame, so it decodes with no search for
+ * its source. Not in a loop, or once the audio has moved on to the next clip.
+ * 0, or -1 if there's nowhere to go.
+ */
+static int seek_scene(av_sync_t *av, int step) {
+    dcmv_clip_t *c = vclip;
+    int shown = frame_index - 1;
+    if (!c->cuts || c->loop.end || aclip != c || shown < 0)
+        return -1;
+    uint32_t k = clip_scene_of(c, shown);
+    int target = clip_scene(c, k);
+    if (step > 0)
+        target = k < c->num_cuts ? clip_scene(c, k + 1) : -1;
+    else if (target >= 0 && shown - target < (int)(fps_num / fps_den) && k > 0)
+        target = clip_scene(c, k - 1);
+    if (target < 0)
+        return -1;
+
+    finish_upload();
+    mutex_lock(&stream_lock);
+    snd_stream_stop(stream);
+    c->restored = 0;
+    uint32_t start = audio_seek_sample(c, (uint32_t)clip_frame_sample(c, target));
+    c->start = 0;
+    audio_start_sample = start;
+    audio_samples_fed = 0;
+    audio_pcm_mode = c->restored || (playlist_len > 1 && audio_decodable(c));
+    stream_start();
+    av_sync_init(av, fps_num, fps_den, sample_rate, start, aica_jiffies(), AV_SYNC_LEAD_MS);
+    clip_timebase(av, c);
+    mutex_unlock(&stream_lock);
+    printf("⏩ Scene %u of %u: frame %d\n", (unsigned)clip_scene_of(c, target) + 1, (unsigned)c->num_cuts + 1, target);
+    frame_index = target;
+    return 0;
+}
+
+/*
+ * The clip on screen has shown its last frame: carry on with the preloaded
+ * one. Normally the audio callback has already moved on to it, and its
+ * frame 0 is due where its audio starts in the stream. A clip whose audio
+ * can't follow in the same stream (another rate or channel count, or ADPCM
+ * the SH-4 can't decode) restarts the stream once the last clip has played.
+ * -1 at the end of the playlist.
+ */
+static int next_clip(av_sync_t *av) {
+    if (playlist_pos + 1 >= playlist_len)
+        return -1;
+    dcmv_clip_t *c = vclip, *n = &clips[c == &clips[0]];
+    thd_join(preload_thread, NULL);
+    preload_thread = NULL;
+    if (n->ready < 0) {
+        printf("%s: can't be played, stopping\n", n->path);
+        return -1;
+    }
+    finish_upload();
+
+    if (audio_chains(n)) {
+        while (aclip != n)
+            thd_sleep(1);
+        av_sync_chain(av, n->hdr.fps_num, n->hdr.fps_den, n->start);
+        clip_timebase(av, n);
+    } else {
+        uint64_t end = c->start + c->end_rel;
+        for (;;) {
+            uint64_t fed = audio_start_sample + audio_samples_fed;
+            if (av_sync_clock(av, aica_jiffies(), audio_samples_fed) >= MIN(end, fed))
+                break;
+            thd_sleep(5);
+        }
+        restart_stream(av, n);
+        printf("Restarted the audio stream for %s\n", n->path);
+    }
+
+    if (use_clip_video(n) < 0)
+        return -1;
+    clip_close(c);
+    playlist_pos++;
+    frame_index = 0;
+    preload_next();
+    return 0;
+}
+
 int main(int argc, char **argv) {
-    // profiler_init("/pc/gmon.out");
-    // profiler_start();
-    fp = fopen(VIDEO_FILE, "rb");
-    if (!fp || load_header() < 0) return -1;
-
-    // Read frame offsets
-    frame_offsets = malloc((num_frames + 1) * sizeof(uint32_t));
-    fread(frame_offsets, sizeof(uint32_t), num_frames + 1, fp);
-
-    // Allocate buffer for compressed frames
-    compressed_buffer = memalign(32, max_compressed_size);
-    if (!compressed_buffer) return -1;
-    
-    // int target_frame = (int)(current_time / frame_time) + frame_index;
-    // Open the audio file and seek to the audio offset
-    audio_fp = fopen(VIDEO_FILE, "rb"); // Point to the same file as video
-    // int samples_per_frame = sample_rate / fps;
-    // int total_samples_to_skip = frame_index * samples_per_frame;
-
-    // // ADPCM is 4 bits per sample, so bytes = samples / 2
-    // // Plus we need block alignment (16 bytes per ADPCM block)
-    // int bytes_to_skip = (total_samples_to_skip / 2) & ~0xF;  // Align to 16-byte blocks
-    // bytes_to_skip += audio_offset;
-
-    // // Seek to the calculated position
-    // fseek(audio_fp, bytes_to_skip, SEEK_SET);
-    // Allocate frame buffer
-    frame_buffer = memalign(32, video_frame_size);
-    if (!frame_buffer) return -1;
+    uint64_t start_ms = timer_ms_gettime64();
+    playlist_load();
+    dcmv_clip_t *c = &clips[0];
+    if (clip_open(c, playlist[0], playlist_len == 1) < 0) return -1;
+    if (frame_index >= (int)c->hdr.num_frames)
+        frame_index = 0;
 
     // Initialize the PVR for rendering
-    if (init_pvr(frame_type) < 0) return -1;
+    if (init_pvr() < 0 || use_clip_video(c) < 0) return -1;
 
-    // Initialize audio stream
-    // Initialize audio stream
+    // Initialize audio stream; a playlist keeps the one stream going from
+    // clip to clip, so it gets stereo buffers even if the first clip is mono
     // snd_stream_init();
-    snd_stream_init_ex(audio_channels, soundbufferalloc);
+    sample_rate = c->hdr.sample_rate;
+    audio_channels = c->hdr.channels;
+    snd_stream_init_ex(playlist_len > 1 ? 2 : audio_channels, soundbufferalloc);
     stream = snd_stream_alloc(NULL, soundbufferalloc);
     snd_stream_set_callback_direct(stream, audio_cb);
-    
-    // Calculate exact audio position for frame 140
-    float frames_per_second = (float)fps;
-    float samples_per_second = (float)sample_rate;
-    int samples_per_frame = (int)(samples_per_second / frames_per_second);
-    int total_samples_to_skip = frame_index * samples_per_frame;
-    
-    // ADPCM is 4 bits per sample, so bytes = samples / 2
-    // Plus we need block alignment (16 bytes per ADPCM block)
-    int bytes_to_skip = (total_samples_to_skip / 2);
-    bytes_to_skip = (bytes_to_skip + 15) & ~0xF;  // Round up to nearest 16-byte boundary
-    bytes_to_skip += audio_offset;
-    
-    printf("Seeking to audio position: 0x%X bytes (frame %d)\n", bytes_to_skip, frame_index);
-    
-    // Seek audio and reset stream
-    fseek(audio_fp, bytes_to_skip, SEEK_SET);
-    int initial_audio_skip = bytes_to_skip - audio_offset;
-// audio_bytes_fed = 0;
-        snd_stream_start_adpcm(stream, sample_rate, audio_channels == 2 ? 1 : 0);
+    aclip = c;
+
+    // Exact audio position for the starting frame
+    uint32_t start_sample = 0;
+    if (c->loop.end) {
+        // The stream counts on through the passes, the track goes round
+        start_sample = (uint32_t)av_frame_sample(&c->tb, frame_index) & ~1u;
+        c->loop_pass = av_loop_pass(&c->loop, frame_index);
+        c->loop_wrap = av_loop_wrap(&c->tb, &c->loop, c->loop_pass);
+        audio_seek_sample(c, (uint32_t)av_loop_sample(&c->tb, &c->loop, c->loop_pass, start_sample));
+        printf("🔁 Looping frames %u-%u\n", c->loop.start, c->loop.end - 1);
+    } else if (frame_index > 0) {
+        start_sample = audio_seek_sample(c, (uint32_t)clip_frame_sample(c, frame_index));
+    }
+    audio_start_sample = start_sample;
+    // Clips are chained by decoding on the SH-4, which starts each one from
+    // its own decoder state
+    audio_pcm_mode = c->restored || (playlist_len > 1 && audio_decodable(c));
+    printf("Seeking to audio position: sample %u, 0x%X bytes (frame %d)%s\n", start_sample, (unsigned)c->audio_pos,
+           frame_index, c->restored ? " [PCM resume]" : "");
+
+    stream_start();
     // Create audio polling thread
     audio_thread = thd_create(0, audio_poll_thread, NULL);
 
-    int initial_frame_index=frame_index;
-    float audio_time_offset = (float)(initial_audio_skip * 2) / (float)sample_rate;
-    #define FRAME_DURATION (1.0f / frames_per_second)
-    #define VIDEO_START_FRAME 0
     // // Load and display FIRST FRAME immediately
     // if (load_frame(frame_index)) {
     //     printf("Failed to load initial frame %d\n", frame_index);
     //     return -1;
     // }
     // draw_frame();
-    // Set up timing - account for the fact we're starting at frame 140
-    start_time = psTimer() - ((float)(frame_index) * FRAME_DURATION);
-    float video_time_offset = (float)frame_index * FRAME_DURATION;
-    frame_index++; // Next frame to process
-
-#define MIN(a,b) ((a) < (b) ? (a) : (b))
-// Main rendering loop
-#define FRAME_DURATION (1.0f / frames_per_second)
-
-while (frame_index < num_frames) {
-    float now = psTimer() - start_time;
-
-    float audio_time = audio_time_offset + ((float)audio_bytes_fed * 2 / (float)(sample_rate * audio_channels));
+    // Clock starts at the sample the stream started from
+    av_sync_t av;
+    av_sync_init(&av, fps_num, fps_den, sample_rate, start_sample, aica_jiffies(), AV_SYNC_LEAD_MS);
+    clip_timebase(&av, c);
+    if (playlist_len > 1)
+        printf("⏭ Playlist: %d clips\n", playlist_len);
+    preload_next();
+    int frames_dropped = 0;
+    uint64_t last_present_ms = 0, switch_ms = 0;
+    uint32_t switch_frame_ms = 0;
+    av_jitter_t jitter;
+    av_jitter_reset(&jitter);
+    uint64_t shown_due = 0;                     // due time (us) of the frame waiting to go up
+    int shown_pending = 0;
+    uint32_t sleep_ms = 0;
+    int action = AV_WAIT;
+    // Decodes that ran past the next vblank, and how many of those (and of
+    // all decodes) the COST estimates said would take over a refresh
+    int decoded = 0;
+    int32_t decoded_us = -1;
+    uint32_t overruns = 0, overruns_heavy = 0, heavy = 0;
 
+    // Main rendering loop: once per vblank, present the frame due by the
+    // next one; drops are skipped without waiting
+    for (;;) {
+        if (!vclip->loop.end && frame_index >= num_frames) {
+            switch_frame_ms = 1000 * fps_den / fps_num;
+            if (next_clip(&av) < 0) break;
+            switch_ms = last_present_ms;
+            jitter.frames = 0;      // the next interval spans the switch
+            continue;
+        }
+        if (action != AV_DROP) {
+            if (wait_vblank(action == AV_WAIT ? sleep_ms : 0) > 1 && decoded) {
+                overruns++;
+                overruns_heavy += decoded_us > (int32_t)refresh_us;
+            }
+            decoded = 0;
+            int step = poll_input();
+            if (step && seek_scene(&av, step) == 0) {
+                jitter.frames = 0;
+                shown_pending = 0;
+                action = AV_WAIT;
+                continue;
+            }
+        }
+        if (shown_pending && !flip_pending) {
+            av_jitter_add(&jitter, flip_us, shown_due, refresh_us);
+            shown_pending = 0;
+        }
 
-    float effective_time = MIN(now, audio_time);
-    float expected_time = (float)(frame_index - VIDEO_START_FRAME) * FRAME_DURATION;
-    float drift = effective_time - expected_time;
+        uint64_t clock = av_sync_clock(&av, aica_jiffies(), audio_samples_fed);
+        uint64_t due[2];
+        frame_due(&av, frame_index, due);
+        action = av_sync_next_at(&av, clock, due[0], due[1], &sleep_ms);
 
-    if (frame_index %100 == 0) {
-        printf("Frame %d (logical frame %d) | ⏱ now=%.3f 🎧 audio=%.3f 🎞 drift=%.3f\n",
-       frame_index, frame_index - VIDEO_START_FRAME, now, audio_time, drift);
-    }
+        if (action != AV_WAIT && frame_index % 100 == 0) {
+            printf("Frame %d | 🎧 audio=%.3f 🎞 drift=%.1fms dropped=%d jitter=%.1fms rms\n", frame_index,
+                   (float)clock / sample_rate, frame_drift_us(&av, clock, frame_index) / 1000.0f, frames_dropped,
+                   sqrtf((float)av_jitter_mean_sq(&jitter)) / 1000.0f);
+        }
 
-if (effective_time >= expected_time) {
-    if (load_frame(frame_index)) break;
-    draw_frame();
-    frame_index++;
+        if (action == AV_PRESENT) {
+            PROF_FRAME(frame_index);
+            if (present_frame(&av, frame_index) < 0) break;
+            shown_due = av_due_us(&av, due[0]);
+            shown_pending = 1;
+            last_present_ms = timer_ms_gettime64();
+            if (start_ms) {
+                printf("First frame on screen %u ms after start\n", (unsigned)(last_present_ms - start_ms));
+                start_ms = 0;
+            }
+            if (switch_ms) {
+                // A gapless switch shows the first frame one frame period after the last
+                int gap = (int)(last_present_ms - switch_ms) - (int)switch_frame_ms;
+                printf("⏭ %s: frame %d on screen %d ms later than a gapless switch\n", vclip->path, frame_index, gap);
+                switch_ms = 0;
+            }
+            frame_index++;
+        } else if (action == AV_DROP) {
+            // Frames are independent, so a late one can be skipped outright
+            frames_dropped++;
+            frame_index++;
+            continue;
+        }
 
-    float drift = effective_time - expected_time;
-    int sleep_ms = (int)((FRAME_DURATION - drift) * 1000);
-    if (sleep_ms > 0 && sleep_ms < 100) {
-        thd_sleep(sleep_ms);  // smooth adjustment
-        // printf("video sleep\n");
-    } else {
-        thd_pass();  // avoid busy wait
-        // printf("video pass\n");
+        // The PVR renders (or the frame isn't due yet): decode the next one meanwhile
+        decoded = decode_ahead(frame_index, &decoded_us);
+        if (decoded < 0)
+            break;
+        heavy += decoded && decoded_us > (int32_t)refresh_us;
     }
-} else {
-    int sleep_ms = (int)((expected_time - effective_time) * 1000);
-    if (sleep_ms > 0) thd_sleep(sleep_ms);
-    else thd_sleep(1);
-}
 
-        wait_exit();
+    if (jitter.count) {
+        const uint32_t *n = jitter.refreshes;
+        printf("🎞 Presentation: %u intervals, error %.1f ms rms, %.1f ms max; up for 1/2/3/4/5+ refreshes: %u/%u/%u/%u/%u\n",
+               (unsigned)jitter.count, sqrtf((float)av_jitter_mean_sq(&jitter)) / 1000.0f, jitter.max / 1000.0f,
+               (unsigned)n[0], (unsigned)n[1], (unsigned)n[2], (unsigned)n[3], (unsigned)n[4]);
     }
+    if (vblank_handle >= 0 && vclip->cost)
+        printf("🐢 %u decode(s) ran past the next vblank, %u of them on frames estimated over a refresh (%u such decodes)\n",
+               (unsigned)overruns, (unsigned)overruns_heavy, (unsigned)heavy);
+    else if (vblank_handle >= 0)
+        printf("🐢 %u decode(s) ran past the next vblank (no COST chunk to tell the heavy frames)\n", (unsigned)overruns);
 
-    // profiler_stop();
-    // profiler_clean_up();
     // Clean up
+    if (vblank_handle >= 0)
+        vblank_handler_remove(vblank_handle);
+    audio_thread_stop = 1;
     thd_join(audio_thread, NULL);
+    if (preload_thread)
+        thd_join(preload_thread, NULL);
     snd_stream_stop(stream);
     snd_stream_destroy(stream);
-    fclose(fp);
-    fclose(audio_fp);
-    free(frame_buffer);
+    finish_upload();
+    for (int i = 0; i < 2; ++i)
+        clip_free(&clips[i]);
+    for (int i = 0; i < TEX_SLOTS; ++i)
+        free(frame_buffer[i]);
     free(compressed_buffer);
-    free(frame_offsets);
 
     return 0;
 }
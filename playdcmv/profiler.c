@@ -1,11 +1,23 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
+#include <unistd.h>
+
+#include "profiler.h"
+
+#ifdef _arch_dreamcast
 #include <kos/thread.h>
-#include <kos/mutex.h>
 #include <arch/timer.h>
+#include <arch/irq.h>
 
 #include <dc/perf_monitor.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
 
 /*
  * Dreamcast Function Profiler – Low-overhead instrumentation for function entry/exit
@@ -14,73 +26,301 @@
  * This profiler:
  *   ✓ Captures timestamps and performance counters (PRFC0 / PRFC1)
  *   ✓ Computes deltas since the last call per-thread
- *   ✓ Compresses data using unsigned LEB128 encoding
+ *   ✓ Compresses data: per-buffer function IDs, implicit exits, nibble-packed
+ *     counter deltas and unsigned LEB128 for anything bigger
  *   ✓ Divides time deltas by 80 (to match 80ns tick resolution)
- *   ✓ Writes compact variable-length records to /pc/trace.bin via dcload
+ *   ✓ Hands full buffers to a background thread that writes /pc/trace.bin via dcload
+ *
+ * Trace format v2 (trace.bin):
+ *   "DCT2"
+ *   uint32_t header size (bytes that follow, before the first block; readers
+ *            skip what they don't know)
+ *   uint32_t calibration: ps per record        } what one record costs the
+ *   uint32_t calibration: PRFC0 per 1000 records } timeline it lands in, so
+ *   uint32_t calibration: PRFC1 per 1000 records } dctrace can subtract it
+ *   uint32_t PRFC0 event (PMCR mode, see counter_modes)
+ *   uint32_t PRFC1 event
+ *   then one block per flushed buffer:
+ *     uint32_t header:  bits 24–16 thread ID, bits 15–0 payload length
+ *     payload:          that thread's records, in order
+ *
+ *   Every record starts with an op byte (ULEB = unsigned LEB128, 1–5 bytes):
+ *     00tttttt               exit of the innermost open call; t = scaled time,
+ *                            63 means ULEB (time - 63) follows
+ *     01iiiiii ULEB(time)    entry, function already in ID slot i of this block
+ *     10iiiiii ULEB(func) ULEB(time)
+ *                            entry, and func (address >> 2 from 0x8C000000)
+ *                            goes into slot i (slot = (func ^ func >> 6) & 63)
+ *     11kkkkkk ULEB(time) ULEB(value) [ULEB(extra)] [counter byte]
+ *                            marker of kind k (MARK_*); only region markers
+ *                            have a counter byte
+ *   Entries, exits and region markers end in a counter byte: high nibble the
+ *   PRFC0 delta (operand cache misses by default), low nibble PRFC1
+ *   (instruction cache misses); a nibble of 15 means ULEB (delta - 15)
+ *   follows, PRFC0's first.
+ *   Slots start empty in every block, so blocks decode on their own.
+ *   scaled_time is the delta since this thread's previous record / 80ns.
  *
- * Binary Record Format (per function entry or exit):
- *   uint32_t address
- *     - Bit 31: 1 for entry, 0 for exit
- *     - Bits 30–22: thread ID
- *     - Bits 21–0: compressed function address (>>2 from 0x8C000000)
+ *   A typical exit is 2 bytes and a repeated entry 3, against 7+ for the v1
+ *   records (a 4-byte address word then three ULEBs) dctrace still reads.
  *
- *   LEB128 encoded values (1–5 bytes each):
- *     - scaled_time:   delta time / 80ns
- *     - delta_evt0:    delta of PRFC0 (e.g., operand cache misses)
- *     - delta_evt1:    delta of PRFC1 (e.g., instruction cache misses)
+ * Marker kinds and values:
+ *         MARK_DROPPED   records lost on this thread just before the marker;
+ *                        extra = call depth, so exits stay matched after a gap
+ *         MARK_SAMPLING  1-in-N call sampling is on, value = N
+ *         MARK_OVERHEAD  measured cost of one instrumented call in this mode, ns
+ *         MARK_PC        PC sampling: interrupted PC; extra = interrupted thread ID
+ *         MARK_FRAME     PROF_FRAME(): frame number
+ *         MARK_REGION_BEGIN / MARK_REGION_END
+ *                        PROF_REGION_*() / PROF_SCOPE(): address of the name
+ *                        string, plus the counters, so a region's events are
+ *                        known even when nothing inside it is instrumented
+ *
+ * Modes and filtering (/pc/profiler.cfg, read at startup, all optional):
+ *     mode trace|sample|pc     every call (default), 1-in-N calls, or timer PC samples
+ *     sample_every <n>         mean N for mode sample (default 64), randomised so
+ *                              loops calling a fixed pattern don't alias
+ *     pc_hz <hz>               PC sample rate (default 1000); uses TMU1, so
+ *                              timer_spin_sleep() is off limits while it runs
+ *     allow <lo> [<hi>]        only record functions in [lo, hi) (hex)
+ *     deny <lo> [<hi>]         never record functions in [lo, hi); <hi> defaults
+ *                              to lo + 1, i.e. one function entry point
+ *     counters <ev0> <ev1>     what PRFC0 / PRFC1 count: a name from
+ *                              counter_modes (oc-miss, ic-miss, stall-oc,
+ *                              instr, ...) or a raw PMCR mode in hex; default
+ *                              oc-miss ic-miss. PROFILER_COUNTERS=ev0,ev1 in
+ *                              the environment overrides the file.
+ *   `dctrace.py --write-filter` writes deny lines for the low-impact functions
+ *   it finds, so a rerun drops them without rebuilding. Filtered and unsampled
+ *   calls cost a range lookup (and a bit on a per-thread stack) and nothing else.
+ *   At startup each mode's cost per call is measured and printed, and the one in
+ *   use goes into the trace as MARK_OVERHEAD.
  *
  * Memory & Performance:
- *   - Each thread maintains its own 8KB TLS buffer, flushed when full
+ *   - Each thread gets PROFILER_BUFFERS 8KB buffers from a static pool
+ *   - The hot path only fills the current buffer; when it's full the buffer
+ *     goes on a lock-free queue and the thread moves on to its next free one
+ *   - A flush thread drains the queue and does the dcload write(), so the
+ *     instrumented code never waits on the transfer
+ *   - If all of a thread's buffers are still queued, records are dropped and
+ *     counted; the count is written as a marker once a buffer frees up, and
+ *     per-thread totals are printed at exit
  *   - All instrumentation functions are marked __no_instrument_function to avoid recursion
  *   - No dynamic allocations; aligned buffers for safe unaligned writes
  *
  * Initialization:
- *   - File opened at startup via constructor (main_constructor)
- *   - Counters started and cleared
+ *   - Config read, file opened and flush thread started via constructor (main_constructor)
+ *   - Counters cleared and started in the configured modes, overhead measured
  *   - Cleanup handler registered with atexit()
  *
  * Cleanup:
- *   - Flushes remaining buffer contents
+ *   - Stops PC sampling
+ *   - Queues every thread's partial buffer, waits for the flush thread to drain
  *   - Stops and clears hardware counters
  *   - Closes trace file
  *
+ * Outside KOS the thread/timer calls fall back to a small pthreads shim, so the
+ * buffer hand-off and flush thread can be built and exercised on the host
+ * (PC sampling is Dreamcast only):
+ *   gcc -O2 -finstrument-functions test.c profiler.c -pthread
+ *
  * Paired with `dctrace.py` to decode, resolve symbols, and generate call graphs.
  */
 
-/* Use TLS to keep things separate */ 
-#define thread_local _Thread_local
+#define NO_INSTR __attribute__ ((no_instrument_function))
+
+#ifndef PROFILER_BUFFERS
+#define PROFILER_BUFFERS     3           /* per thread, at least 2 */
+#endif
+#ifndef PROFILER_MAX_THREADS
+#define PROFILER_MAX_THREADS 8
+#endif
 
 #define BUFFER_SIZE    (1024 * 8)
+#define TRACE_MAGIC    "DCT2"
+#define BLOCK_HEADER   4
+#define ID_SLOTS       64
+#define NO_ID          0xFFFFFFFF
+#define QUEUE_SIZE     64                /* power of two, >= every buffer in the pool */
+#define NO_BUFFER      0xFF
 
-#define ENTRY_FLAG     0x80000000
-#define EXIT_FLAG      0x00000000
+#define ENTRY_FLAG     1
+#define EXIT_FLAG      0
 
 #define BASE_ADDRESS   0x8C000000
 #define TID_MASK       0x1FF       /* 9 bits */
 #define ADDR_MASK      0x003FFFFF  /* 22 bits (compressed address) */
 
-#define MAX_ENTRY_SIZE 19
+#define MARK_DROPPED   1
+#define MARK_SAMPLING  2
+#define MARK_OVERHEAD  3
+#define MARK_PC        4
+#define MARK_FRAME     5
+#define MARK_REGION_BEGIN  6
+#define MARK_REGION_END    7
+
+#define MODE_TRACE     0
+#define MODE_SAMPLE    1
+#define MODE_PC        2
+
+#define MAX_FILTER_RANGES  32
+#define SAMPLE_STACK       256           /* call depth tracked by sample mode */
+#define MEASURE_CALLS      512
+#define CALIBRATE_CALLS    4096
+
+#define OP_EXIT        0x00
+#define OP_ENTRY       0x40
+#define OP_DEFINE      0x80
+#define OP_MARKER      0xC0
+
+#define MAX_ENTRY_SIZE 22                /* region marker: op + four 5-byte ULEBs + counter byte */
+
+#define COMPRESS_ADDRESS(full_addr) \
+     ((((uint32_t)(uintptr_t)(full_addr)) - BASE_ADDRESS) >> 2 & ADDR_MASK)
 
-#define MAKE_ADDRESS(entry, tid, full_addr) \
-     (((entry) ? ENTRY_FLAG : 0) | \
-     (((tid) & TID_MASK) << 22) | \
-     (((((uint32_t)(full_addr)) - BASE_ADDRESS) >> 2) & ADDR_MASK))
+#if (PROFILER_MAX_THREADS + 1) * PROFILER_BUFFERS > QUEUE_SIZE
+#error "QUEUE_SIZE must hold every buffer in the pool"
+#endif
+
+/*
+ * SH7750 performance counter events (the PMCR_*_MODE values of KOS
+ * dc/perf_monitor.h); dctrace.py has the same names for its labels.
+ */
+typedef struct {
+    const char *name;
+    uint32_t mode;
+} counter_mode_t;
+
+static const counter_mode_t counter_modes[] = {
+    { "operand-read",  0x01 },
+    { "operand-write", 0x02 },
+    { "utlb-miss",     0x03 },
+    { "oc-read-miss",  0x04 },
+    { "oc-write-miss", 0x05 },
+    { "ifetch",        0x06 },
+    { "itlb-miss",     0x07 },
+    { "ic-miss",       0x08 },
+    { "operand",       0x09 },
+    { "ifetch-all",    0x0a },
+    { "oc-miss",       0x0f },
+    { "branch",        0x10 },
+    { "branch-taken",  0x11 },
+    { "call",          0x12 },
+    { "instr",         0x13 },
+    { "dual-issue",    0x14 },
+    { "fpu-instr",     0x15 },
+    { "irq",           0x16 },
+    { "ic-fill",       0x21 },
+    { "oc-fill",       0x22 },
+    { "cycles",        0x23 },
+    { "stall-ic",      0x24 },
+    { "stall-oc",      0x25 },
+    { "stall-branch",  0x27 },
+    { "stall-reg",     0x28 },
+    { "stall-fpu",     0x29 },
+};
+
+/* --- Platform layer: KOS, or pthreads on the host --- */
+#ifdef _arch_dreamcast
+#define TRACE_PATH  "/pc/trace.bin"
+#define CONFIG_PATH "/pc/profiler.cfg"
+
+static kthread_t *flush_thread;
+
+static inline uint64_t NO_INSTR prof_time_ns(void) { return timer_ns_gettime64(); }
+static inline uint64_t NO_INSTR prof_counter(int n) { return perf_cntr_count(n ? PRFC1 : PRFC0); }
+static inline uint32_t NO_INSTR prof_thread_id(void) { return thd_get_current()->tid; }
+static inline void NO_INSTR prof_sleep_ms(int ms) { thd_sleep(ms); }
+static void NO_INSTR prof_thread_start(void *(*fn)(void *)) { flush_thread = thd_create(0, fn, NULL); }
+static void NO_INSTR prof_thread_join(void) { if(flush_thread) thd_join(flush_thread, NULL); }
+#else
+#define TRACE_PATH  "trace.bin"
+#define CONFIG_PATH "profiler.cfg"
+#define __unlikely(x) __builtin_expect(!!(x), 0)
+
+static pthread_t flush_thread;
+static bool flush_started;
+static uint32_t host_next_tid = 1;
+
+static inline uint64_t NO_INSTR prof_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+static inline uint64_t NO_INSTR prof_counter(int n) { (void)n; return 0; }
+static inline uint32_t NO_INSTR prof_thread_id(void) { return __atomic_fetch_add(&host_next_tid, 1, __ATOMIC_RELAXED); }
+static inline void NO_INSTR prof_sleep_ms(int ms) { usleep(ms * 1000); }
+static void NO_INSTR prof_thread_start(void *(*fn)(void *)) { flush_started = pthread_create(&flush_thread, NULL, fn, NULL) == 0; }
+static void NO_INSTR prof_thread_join(void) { if(flush_started) pthread_join(flush_thread, NULL); }
+#endif
+
+/* Use TLS to keep things separate */
+#define thread_local _Thread_local
+
+typedef struct {
+    uint8_t  data[BUFFER_SIZE] __attribute__((aligned(32)));
+    uint32_t len;
+    uint32_t busy;              /* set while queued / being written */
+} trace_buffer_t;
+
+typedef struct {
+    trace_buffer_t buf[PROFILER_BUFFERS];
+    uint8_t *ptr;               /* write cursor, NULL while starved */
+    uint8_t *end;               /* switch buffers once ptr passes this */
+    uint32_t tid;
+    uint32_t current;           /* buffer being filled, NO_BUFFER while starved */
+    uint32_t dropped;           /* lost since the last marker */
+    uint32_t dropped_total;
+    uint64_t last_time;
+    uint64_t last_event0;
+    uint64_t last_event1;
+    int32_t  depth;             /* open calls, counting dropped records too */
+    uint32_t ids[ID_SLOTS];     /* function ID slots of the current block */
+    bool     discard;           /* overhead measurement: never reaches the file */
+} thread_trace_t;
+
+typedef struct {
+    uint32_t seq;
+    trace_buffer_t *buf;
+} queue_cell_t;
+
+typedef struct {
+    uint32_t lo, hi;
+} addr_range_t;
 
 static int fd;
 static FILE *fp;
-static mutex_t io_lock = MUTEX_INITIALIZER;
 
-/* TLS buffer management */
-static thread_local uint8_t *tls_ptr;
-static thread_local size_t   tls_buffer_idx;
-static thread_local uint8_t  tls_buffer[BUFFER_SIZE] __attribute__((aligned(32)));
+/* Buffer pool, one slot per instrumented thread */
+static thread_trace_t pool[PROFILER_MAX_THREADS];
+static uint32_t pool_used;
+static uint32_t pool_overflow;  /* records from threads that didn't get a slot */
+
+/* Full buffers waiting for the flush thread (bounded MPMC ring) */
+static queue_cell_t queue[QUEUE_SIZE];
+static uint32_t queue_head;
+static uint32_t queue_tail;
+static volatile bool flush_running;
+
+/* Mode and filter, fixed after startup */
+static int      prof_mode = MODE_TRACE;
+static uint32_t sample_every = 64;
+static uint32_t pc_hz = 1000;
+static uint32_t mode_overhead_ns;
+static uint32_t calib_record_ps, calib_ev0_milli, calib_ev1_milli;
+static uint32_t counter_mode[2] = { 0x0f, 0x08 };   /* oc-miss, ic-miss */
+static addr_range_t allow_ranges[MAX_FILTER_RANGES], deny_ranges[MAX_FILTER_RANGES];
+static int n_allow, n_deny;
 
-/* TLS stats management */
+/* TLS buffer management (the cursor lives in the pool so cleanup can see it) */
+static thread_local thread_trace_t *tls_trace;
 static thread_local bool     tls_inited;
-static thread_local uint32_t tls_thread_id;
-static thread_local uint64_t tls_last_time;
-static thread_local uint64_t tls_last_event0;
-static thread_local uint64_t tls_last_event1;
+
+/* TLS sample mode state: one bit per open call, set if it was recorded */
+static thread_local uint32_t tls_depth;
+static thread_local uint32_t tls_sample_left;
+static thread_local uint32_t tls_rng;
+static thread_local uint32_t tls_sampled[SAMPLE_STACK / 32];
 
 static inline void  __attribute__ ((no_instrument_function)) write_u32_unaligned(uint8_t *dst, uint32_t value) {
     dst[0] = (uint8_t)(value & 0xFF);
@@ -109,14 +349,223 @@ static size_t __attribute__ ((no_instrument_function)) encode_uleb128(uint32_t v
     return count;
 }
 
+static bool NO_INSTR queue_push(trace_buffer_t *b) {
+    uint32_t pos = __atomic_load_n(&queue_head, __ATOMIC_RELAXED);
+    for(;;) {
+        queue_cell_t *cell = &queue[pos & (QUEUE_SIZE - 1)];
+        int32_t dif = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if(dif == 0) {
+            if(__atomic_compare_exchange_n(&queue_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->buf = b;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        else if(dif < 0) {
+            return false;
+        }
+        else {
+            pos = __atomic_load_n(&queue_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Single consumer: only the flush thread (or cleanup, once it has stopped) pops */
+static trace_buffer_t * NO_INSTR queue_pop(void) {
+    queue_cell_t *cell = &queue[queue_tail & (QUEUE_SIZE - 1)];
+    if((int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (queue_tail + 1)) < 0)
+        return NULL;
+    trace_buffer_t *b = cell->buf;
+    __atomic_store_n(&cell->seq, queue_tail + QUEUE_SIZE, __ATOMIC_RELEASE);
+    queue_tail++;
+    return b;
+}
+
+static void * NO_INSTR flush_main(void *arg) {
+    (void)arg;
+    for(;;) {
+        trace_buffer_t *b = queue_pop();
+        if(b == NULL) {
+            if(!flush_running)
+                break;
+            prof_sleep_ms(1);
+            continue;
+        }
+        write(fd, b->data, b->len);
+        __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* Point the cursor at a free buffer of this thread, if there is one */
+static bool NO_INSTR take_buffer(thread_trace_t *t) {
+    for(uint32_t i = 0; i < PROFILER_BUFFERS; ++i) {
+        trace_buffer_t *b = &t->buf[i];
+        if(__atomic_load_n(&b->busy, __ATOMIC_ACQUIRE) == 0) {
+            t->current = i;
+            t->ptr = b->data + BLOCK_HEADER;
+            t->end = b->data + BUFFER_SIZE - 2 * MAX_ENTRY_SIZE;   /* room for a marker + record */
+            memset(t->ids, 0xFF, sizeof(t->ids));
+            return true;
+        }
+    }
+    t->current = NO_BUFFER;
+    t->ptr = NULL;
+    return false;
+}
+
+/* Hand the current buffer to the flush thread */
+static void NO_INSTR submit_buffer(thread_trace_t *t) {
+    trace_buffer_t *b = &t->buf[t->current];
+    b->len = t->ptr - b->data;
+    write_u32_unaligned(b->data, t->tid << 16 | (b->len - BLOCK_HEADER));
+    if(t->discard)
+        return;
+    __atomic_store_n(&b->busy, 1, __ATOMIC_RELAXED);
+    if(!queue_push(b))
+        b->busy = 0;    /* can't happen with QUEUE_SIZE >= the pool, but don't leak it */
+}
+
+/* Anything in the current buffer besides the block header? */
+static inline bool NO_INSTR has_records(const thread_trace_t *t) {
+    return t->ptr != NULL && t->ptr != t->buf[t->current].data + BLOCK_HEADER;
+}
+
+static void NO_INSTR reset_trace(thread_trace_t *t, uint32_t tid) {
+    t->tid = tid & TID_MASK;
+    t->last_time = prof_time_ns();
+    t->last_event0 = prof_counter(0);
+    t->last_event1 = prof_counter(1);
+    take_buffer(t);
+}
+
+static inline uint8_t * NO_INSTR put_counters(uint8_t *p, uint32_t e0, uint32_t e1) {
+    uint32_t hi = e0 < 15 ? e0 : 15;
+    uint32_t lo = e1 < 15 ? e1 : 15;
+    *p++ = (uint8_t)(hi << 4 | lo);
+    if(hi == 15)
+        p += encode_uleb128(e0 - 15, p);
+    if(lo == 15)
+        p += encode_uleb128(e1 - 15, p);
+    return p;
+}
+
+static inline uint8_t * NO_INSTR put_exit(uint8_t *p, uint32_t time, uint32_t e0, uint32_t e1) {
+    if(time < 63) {
+        *p++ = OP_EXIT | time;
+    }
+    else {
+        *p++ = OP_EXIT | 63;
+        p += encode_uleb128(time - 63, p);
+    }
+    return put_counters(p, e0, e1);
+}
+
+static inline uint8_t * NO_INSTR put_entry(thread_trace_t *t, uint8_t *p, uint32_t func, uint32_t time,
+                                          uint32_t e0, uint32_t e1) {
+    uint32_t slot = (func ^ (func >> 6)) & (ID_SLOTS - 1);
+    if(t->ids[slot] == func) {
+        *p++ = OP_ENTRY | slot;
+    }
+    else {
+        t->ids[slot] = func;
+        *p++ = OP_DEFINE | slot;
+        p += encode_uleb128(func, p);
+    }
+    p += encode_uleb128(time, p);
+    return put_counters(p, e0, e1);
+}
+
+static inline uint8_t * NO_INSTR put_marker(uint8_t *p, uint32_t kind, uint32_t time, uint32_t value, uint32_t extra) {
+    *p++ = OP_MARKER | kind;
+    p += encode_uleb128(time, p);
+    p += encode_uleb128(value, p);
+    if(kind == MARK_DROPPED || kind == MARK_PC)
+        p += encode_uleb128(extra, p);
+    return p;
+}
+
+/* Counter deltas since the thread's previous record, which becomes this one */
+static inline void NO_INSTR take_counters(thread_trace_t *t, uint32_t *d0, uint32_t *d1) {
+    uint64_t e0 = prof_counter(0);
+    uint64_t e1 = prof_counter(1);
+    *d0 = (uint32_t)(e0 - t->last_event0);
+    *d1 = (uint32_t)(e1 - t->last_event1);
+    t->last_event0 = e0;
+    t->last_event1 = e1;
+}
+
+/* Make sure there's room for a record; counts it as dropped if there isn't */
+static inline bool NO_INSTR reserve(thread_trace_t *t) {
+    /* All buffers still queued: count the record and leave the last_* values
+     * alone so the next written delta covers the gap */
+    if(__unlikely(t->ptr == NULL)) {
+        if(!take_buffer(t)) {
+            t->dropped++;
+            t->dropped_total++;
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Advance the time base; writes the pending drop marker first if there is one */
+static inline uint32_t NO_INSTR take_time(thread_trace_t *t, uint64_t now) {
+    uint32_t delta_time = (uint32_t)(now - t->last_time);
+    t->last_time = now;
+
+    /* Scale delta_time down to 80ns units (the resolution of timer_ns_gettime64()) */
+    uint32_t scaled_time = delta_time / 80;
+
+    if(__unlikely(t->dropped)) {
+        /* The marker takes the time delta; the counter deltas stay on the record */
+        t->ptr = put_marker(t->ptr, MARK_DROPPED, scaled_time, t->dropped, (uint32_t)t->depth);
+        t->dropped = 0;
+        scaled_time = 0;
+    }
+    return scaled_time;
+}
+
+static inline void NO_INSTR finish_record(thread_trace_t *t) {
+    /* When this thread’s buffer is full, pass it on and switch */
+    if(__unlikely(t->ptr >= t->end)) {
+        submit_buffer(t);
+        take_buffer(t);
+    }
+}
+
+static void NO_INSTR record_marker(thread_trace_t *t, uint32_t kind, uint32_t value, uint32_t extra) {
+    if(!reserve(t))
+        return;
+    uint32_t scaled_time = take_time(t, prof_time_ns());
+    t->ptr = put_marker(t->ptr, kind, scaled_time, value, extra);
+    finish_record(t);
+}
+
+static void NO_INSTR record_region(thread_trace_t *t, uint32_t kind, uint32_t name) {
+    if(!reserve(t))
+        return;
+    uint64_t now = prof_time_ns();
+    uint32_t d0, d1;
+    take_counters(t, &d0, &d1);
+    uint32_t scaled_time = take_time(t, now);
+    t->ptr = put_marker(t->ptr, kind, scaled_time, name, 0);
+    t->ptr = put_counters(t->ptr, d0, d1);
+    finish_record(t);
+}
+
 static void __attribute__ ((no_instrument_function)) init_tls(void) {
-    kthread_t *th = thd_get_current();
-    tls_thread_id = th->tid & TID_MASK; /* Reserve bit 31 for entry/exit */
-    tls_buffer_idx = 0;
-    tls_ptr = tls_buffer;
-    tls_last_time = timer_ns_gettime64();
-    tls_last_event0 = perf_cntr_count(PRFC0);
-    tls_last_event1 = perf_cntr_count(PRFC1);
+    uint32_t tid = prof_thread_id();
+    tls_rng = 0x9E3779B9u ^ (tid * 0x85EBCA6Bu);
+
+    uint32_t slot = __atomic_fetch_add(&pool_used, 1, __ATOMIC_RELAXED);
+    if(slot < PROFILER_MAX_THREADS) {
+        tls_trace = &pool[slot];
+        reset_trace(tls_trace, tid);
+        if(prof_mode == MODE_SAMPLE)
+            record_marker(tls_trace, MARK_SAMPLING, sample_every, 0);
+        record_marker(tls_trace, MARK_OVERHEAD, mode_overhead_ns, 0);
+    }
 
     tls_inited = true;
 }
@@ -124,56 +573,391 @@ static void __attribute__ ((no_instrument_function)) init_tls(void) {
 static void __attribute__ ((no_instrument_function, hot)) create_entry(void *this, uint32_t flag) {
     if(__unlikely(!tls_inited))
         init_tls();
-    
-    uint64_t now = timer_ns_gettime64();
-    uint64_t e0  = perf_cntr_count(PRFC0);
-    uint64_t e1  = perf_cntr_count(PRFC1);
 
-    uint32_t diff_evt0 = (uint32_t)(e0 - tls_last_event0);
-    uint32_t diff_evt1 = (uint32_t)(e1 - tls_last_event1);
-    uint32_t delta_time = (uint32_t)(now - tls_last_time);
+    thread_trace_t *t = tls_trace;
+    if(__unlikely(t == NULL)) {
+        __atomic_fetch_add(&pool_overflow, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if(!reserve(t)) {
+        t->depth += flag ? 1 : -1;
+        return;
+    }
 
-    /* Scale delta_time down to 80ns units (the resolution of timer_ns_gettime64()) */
-    uint32_t scaled_time = delta_time / 80;
+    uint64_t now = prof_time_ns();
+    uint32_t diff_evt0, diff_evt1;
+    take_counters(t, &diff_evt0, &diff_evt1);
+    uint32_t scaled_time = take_time(t, now);
 
     /* Write record byte by byte */
-    uint32_t addr = MAKE_ADDRESS(flag, tls_thread_id, this);
-    write_u32_unaligned(tls_ptr, addr);
-    tls_ptr += 4;
-    tls_ptr += encode_uleb128(scaled_time, tls_ptr);
-    tls_ptr += encode_uleb128(diff_evt0, tls_ptr);
-    tls_ptr += encode_uleb128(diff_evt1, tls_ptr);
+    if(flag) {
+        t->ptr = put_entry(t, t->ptr, COMPRESS_ADDRESS(this), scaled_time, diff_evt0, diff_evt1);
+        t->depth++;
+    }
+    else {
+        t->ptr = put_exit(t->ptr, scaled_time, diff_evt0, diff_evt1);
+        t->depth--;
+    }
+
+    finish_record(t);
+}
+
+/* --- Filtering and sampling --- */
+
+static inline bool NO_INSTR in_ranges(const addr_range_t *r, int n, uint32_t addr) {
+    int lo = 0, hi = n;
+    while(lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if(addr < r[mid].lo)
+            hi = mid;
+        else if(addr >= r[mid].hi)
+            lo = mid + 1;
+        else
+            return true;
+    }
+    return false;
+}
 
-    /* Advance this thread’s buffer */
-    tls_buffer_idx = tls_ptr - tls_buffer;
+static inline bool NO_INSTR filter_pass(void *this) {
+    uint32_t addr = (uint32_t)(uintptr_t)this;
+    if(n_allow && !in_ranges(allow_ranges, n_allow, addr))
+        return false;
+    return !(n_deny && in_ranges(deny_ranges, n_deny, addr));
+}
 
-    /* Update for next delta */
-    tls_last_time = now;
-    tls_last_event0 = e0;
-    tls_last_event1 = e1;
+static inline bool NO_INSTR sample_enter(void) {
+    uint32_t d = tls_depth++;
+    bool take;
+    if(tls_sample_left <= 1) {
+        /* Next gap is uniform in [1, 2N - 1], mean N */
+        uint32_t x = tls_rng;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        tls_rng = x;
+        tls_sample_left = 1 + x % (2 * sample_every - 1);
+        take = true;
+    }
+    else {
+        tls_sample_left--;
+        take = false;
+    }
+    if(d >= SAMPLE_STACK)
+        return false;
+    if(take)
+        tls_sampled[d >> 5] |= 1u << (d & 31);
+    else
+        tls_sampled[d >> 5] &= ~(1u << (d & 31));
+    return take;
+}
+
+static inline bool NO_INSTR sample_exit(void) {
+    if(tls_depth == 0)
+        return false;
+    uint32_t d = --tls_depth;
+    return d < SAMPLE_STACK && (tls_sampled[d >> 5] & (1u << (d & 31)));
+}
 
-    /* When this thread’s buffer is full, flush under lock */
-    if(__unlikely(tls_buffer_idx >= BUFFER_SIZE - MAX_ENTRY_SIZE)) {
-        mutex_lock(&io_lock);
-        write(fd, tls_buffer, tls_buffer_idx);
-        mutex_unlock(&io_lock);
-        tls_ptr = tls_buffer;
-        tls_buffer_idx = 0;
+/* --- PC sampling (TMU1 interrupt) --- */
+#ifdef _arch_dreamcast
+static thread_trace_t pc_trace;     /* only ever written from the interrupt */
+
+static void NO_INSTR pc_sample_irq(irq_t source, irq_context_t *context, void *data) {
+    (void)source;
+    (void)data;
+    record_marker(&pc_trace, MARK_PC, context->pc, thd_get_current()->tid);
+}
+
+static void NO_INSTR pc_sampling_start(void) {
+    reset_trace(&pc_trace, 0);
+    irq_set_handler(EXC_TMU1_TUNI1, pc_sample_irq, NULL);
+    timer_prime(TMU1, pc_hz, 1);
+    timer_start(TMU1);
+}
+
+static void NO_INSTR pc_sampling_stop(void) {
+    timer_stop(TMU1);
+    timer_disable_ints(TMU1);
+    irq_set_handler(EXC_TMU1_TUNI1, NULL, NULL);
+    if(has_records(&pc_trace))
+        submit_buffer(&pc_trace);
+    pc_trace.ptr = NULL;
+}
+#endif
+
+/* --- Startup --- */
+
+static int NO_INSTR range_cmp(const void *a, const void *b) {
+    const addr_range_t *x = a, *y = b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+/* Sort and merge so in_ranges() can bisect */
+static int NO_INSTR normalize_ranges(addr_range_t *r, int n) {
+    if(n == 0)
+        return 0;
+    qsort(r, n, sizeof(*r), range_cmp);
+    int out = 0;
+    for(int i = 1; i < n; ++i) {
+        if(r[i].lo <= r[out].hi) {
+            if(r[i].hi > r[out].hi)
+                r[out].hi = r[i].hi;
+        }
+        else {
+            r[++out] = r[i];
+        }
+    }
+    return out + 1;
+}
+
+static const char * NO_INSTR counter_name(uint32_t mode) {
+    for(size_t i = 0; i < sizeof(counter_modes) / sizeof(counter_modes[0]); ++i)
+        if(counter_modes[i].mode == mode)
+            return counter_modes[i].name;
+    return "?";
+}
+
+/* A counter_modes name or a raw mode in hex; false (and the mode unchanged) if neither */
+static bool NO_INSTR parse_counter_mode(const char *s, uint32_t *mode) {
+    for(size_t i = 0; i < sizeof(counter_modes) / sizeof(counter_modes[0]); ++i) {
+        if(!strcmp(s, counter_modes[i].name)) {
+            *mode = counter_modes[i].mode;
+            return true;
+        }
     }
+    char *end;
+    unsigned long v = strtoul(s, &end, 16);
+    if(end == s || *end || v == 0 || v > 0x3f) {
+        fprintf(stderr, "profiler: unknown counter '%s', keeping %#x\n", s, (unsigned)*mode);
+        return false;
+    }
+    *mode = (uint32_t)v;
+    return true;
+}
+
+static void NO_INSTR load_counters_env(void) {
+    const char *env = getenv("PROFILER_COUNTERS");
+    if(env == NULL || !*env)
+        return;
+    char a[32], b[32];
+    if(sscanf(env, "%31[^,],%31s", a, b) == 2) {
+        parse_counter_mode(a, &counter_mode[0]);
+        parse_counter_mode(b, &counter_mode[1]);
+    }
+    else {
+        fprintf(stderr, "profiler: PROFILER_COUNTERS should be <ev0>,<ev1>, ignoring '%s'\n", env);
+    }
+}
+
+static void NO_INSTR load_config(void) {
+    FILE *cfg = fopen(CONFIG_PATH, "r");
+    if(cfg == NULL) {
+        load_counters_env();
+        return;
+    }
+
+    char line[128];
+    while(fgets(line, sizeof(line), cfg)) {
+        char key[16], a[32], b[32];
+        int n = sscanf(line, "%15s %31s %31s", key, a, b);
+        if(n < 2 || key[0] == '#')
+            continue;
+        if(!strcmp(key, "mode")) {
+            if(!strcmp(a, "sample")) prof_mode = MODE_SAMPLE;
+            else if(!strcmp(a, "pc")) prof_mode = MODE_PC;
+            else prof_mode = MODE_TRACE;
+        }
+        else if(!strcmp(key, "sample_every")) {
+            sample_every = strtoul(a, NULL, 0);
+            if(sample_every < 1) sample_every = 1;
+        }
+        else if(!strcmp(key, "pc_hz")) {
+            pc_hz = strtoul(a, NULL, 0);
+            if(pc_hz < 1) pc_hz = 1;
+        }
+        else if(!strcmp(key, "allow") || !strcmp(key, "deny")) {
+            bool allow = key[0] == 'a';
+            int *count = allow ? &n_allow : &n_deny;
+            if(*count == MAX_FILTER_RANGES) {
+                fprintf(stderr, "profiler: more than %d %s ranges, ignoring %s", MAX_FILTER_RANGES, key, line);
+                continue;
+            }
+            addr_range_t *r = &(allow ? allow_ranges : deny_ranges)[(*count)++];
+            r->lo = strtoul(a, NULL, 16);
+            r->hi = n > 2 ? strtoul(b, NULL, 16) : r->lo + 1;
+        }
+        else if(!strcmp(key, "counters")) {
+            parse_counter_mode(a, &counter_mode[0]);
+            if(n > 2)
+                parse_counter_mode(b, &counter_mode[1]);
+        }
+    }
+    fclose(cfg);
+    load_counters_env();
+
+    n_allow = normalize_ranges(allow_ranges, n_allow);
+    n_deny = normalize_ranges(deny_ranges, n_deny);
+
+#ifndef _arch_dreamcast
+    if(prof_mode == MODE_PC) {
+        fprintf(stderr, "profiler: PC sampling needs the Dreamcast timer, tracing instead\n");
+        prof_mode = MODE_TRACE;
+    }
+#endif
+}
+
+void __cyg_profile_func_enter(void *this, void *callsite);
+void __cyg_profile_func_exit(void *this, void *callsite);
+
+/* ns per call (enter + exit count as one call) for the hooks as configured */
+static uint32_t NO_INSTR time_calls(void *fn) {
+    uint64_t start = prof_time_ns();
+    for(int i = 0; i < MEASURE_CALLS; ++i) {
+        __cyg_profile_func_enter(fn, NULL);
+        __cyg_profile_func_exit(fn, NULL);
+    }
+    return (uint32_t)((prof_time_ns() - start) / MEASURE_CALLS);
+}
+
+/*
+ * The gap between two records' timestamps always contains the end of one
+ * hook and the start of the next, i.e. one whole hook, on top of whatever
+ * the program did. Back to back calls with nothing in between measure just
+ * that, in time and in the cache misses the hook itself causes.
+ */
+static void NO_INSTR calibrate(void *fn) {
+    uint64_t e0 = prof_counter(0);
+    uint64_t e1 = prof_counter(1);
+    uint64_t start = prof_time_ns();
+    for(int i = 0; i < CALIBRATE_CALLS; ++i) {
+        __cyg_profile_func_enter(fn, NULL);
+        __cyg_profile_func_exit(fn, NULL);
+    }
+    uint64_t records = 2 * CALIBRATE_CALLS;
+    calib_record_ps = (uint32_t)((prof_time_ns() - start) * 1000 / records);
+    calib_ev0_milli = (uint32_t)((prof_counter(0) - e0) * 1000 / records);
+    calib_ev1_milli = (uint32_t)((prof_counter(1) - e1) * 1000 / records);
+}
+
+/*
+ * Run the real hooks against a scratch buffer that never reaches the file, once
+ * per mode, so the trace says what the instrumentation itself cost.
+ */
+static void NO_INSTR measure_overhead(void) {
+    static thread_trace_t scratch;
+    void *fn = (void *)(uintptr_t)measure_overhead;
+
+    int mode = prof_mode;
+    int saved_allow = n_allow, saved_deny = n_deny;
+    addr_range_t saved_range = deny_ranges[0];
+
+    scratch.discard = true;
+    reset_trace(&scratch, 0);
+    tls_trace = &scratch;
+    tls_inited = true;
+    tls_rng = 0x9E3779B9u;      /* init_tls() reseeds it per thread later */
+
+    prof_mode = MODE_TRACE;
+    n_allow = n_deny = 0;
+    time_calls(fn);             /* warm up: first touch of the scratch buffers */
+    calibrate(fn);
+    uint32_t trace_ns = time_calls(fn);
+
+    n_deny = 1;
+    deny_ranges[0].lo = (uint32_t)(uintptr_t)fn;
+    deny_ranges[0].hi = deny_ranges[0].lo + 1;
+    uint32_t filtered_ns = time_calls(fn);
+    deny_ranges[0] = saved_range;
+
+    prof_mode = MODE_SAMPLE;
+    n_deny = 0;
+    uint32_t sample_ns = time_calls(fn);
+
+    prof_mode = mode;
+    n_allow = saved_allow;
+    n_deny = saved_deny;
+    tls_depth = 0;
+    tls_sample_left = 0;
+
+#ifdef _arch_dreamcast
+    uint64_t start = prof_time_ns();
+    for(int i = 0; i < MEASURE_CALLS; ++i)
+        record_marker(&scratch, MARK_PC, (uint32_t)(uintptr_t)fn, 0);
+    uint32_t pc_ns = (uint32_t)((prof_time_ns() - start) / MEASURE_CALLS);
+#else
+    uint32_t pc_ns = 0;
+#endif
+
+    tls_trace = NULL;
+    tls_inited = false;
+
+    mode_overhead_ns = prof_mode == MODE_SAMPLE ? sample_ns : prof_mode == MODE_PC ? pc_ns : trace_ns;
+
+    fprintf(stderr, "profiler: per call: trace %u ns, filtered out %u ns, sample 1/%u %u ns",
+            (unsigned)trace_ns, (unsigned)filtered_ns, (unsigned)sample_every, (unsigned)sample_ns);
+    if(pc_ns)
+        fprintf(stderr, "; per PC sample %u ns (%u.%02u%% CPU at %u Hz)", (unsigned)pc_ns,
+                (unsigned)(pc_ns * pc_hz / 10000000), (unsigned)(pc_ns * pc_hz / 100000 % 100), (unsigned)pc_hz);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "profiler: calibration per record %u ps, PRFC0 %s %u.%03u, PRFC1 %s %u.%03u\n",
+            (unsigned)calib_record_ps,
+            counter_name(counter_mode[0]), (unsigned)(calib_ev0_milli / 1000), (unsigned)(calib_ev0_milli % 1000),
+            counter_name(counter_mode[1]), (unsigned)(calib_ev1_milli / 1000), (unsigned)(calib_ev1_milli % 1000));
+}
+
+static void NO_INSTR write_header(void) {
+    uint8_t header[28];
+    memcpy(header, TRACE_MAGIC, 4);
+    write_u32_unaligned(header + 4, sizeof(header) - 8);
+    write_u32_unaligned(header + 8, calib_record_ps);
+    write_u32_unaligned(header + 12, calib_ev0_milli);
+    write_u32_unaligned(header + 16, calib_ev1_milli);
+    write_u32_unaligned(header + 20, counter_mode[0]);
+    write_u32_unaligned(header + 24, counter_mode[1]);
+    write(fd, header, sizeof(header));
 }
 
 static void __attribute__ ((no_instrument_function)) cleanup(void) {
-    if(tls_buffer_idx > 0) {
-        mutex_lock(&io_lock);
-        write(fd, tls_buffer, tls_buffer_idx);
-        mutex_unlock(&io_lock);
+#ifdef _arch_dreamcast
+    if(prof_mode == MODE_PC)
+        pc_sampling_stop();
+#endif
+
+    /* Queue what's left in every thread's current buffer. Other threads
+     * should be idle by now; anything they record after this is lost. */
+    for(uint32_t i = 0; i < pool_used && i < PROFILER_MAX_THREADS; ++i) {
+        thread_trace_t *t = &pool[i];
+        if(has_records(t))
+            submit_buffer(t);
+        t->current = NO_BUFFER;
+        t->ptr = NULL;
+    }
+
+    flush_running = false;
+    prof_thread_join();
+
+    for(uint32_t i = 0; i < pool_used && i < PROFILER_MAX_THREADS; ++i) {
+        thread_trace_t *t = &pool[i];
+        if(t->dropped_total)
+            fprintf(stderr, "profiler: thread %u dropped %u records (flush thread fell behind)\n",
+                    (unsigned)t->tid, (unsigned)t->dropped_total);
     }
-    
+#ifdef _arch_dreamcast
+    if(pc_trace.dropped_total)
+        fprintf(stderr, "profiler: dropped %u PC samples (flush thread fell behind)\n",
+                (unsigned)pc_trace.dropped_total);
+#endif
+    if(pool_overflow)
+        fprintf(stderr, "profiler: %u records from threads past PROFILER_MAX_THREADS (%d)\n",
+                (unsigned)pool_overflow, PROFILER_MAX_THREADS);
+
+#ifdef _arch_dreamcast
     perf_cntr_stop(PRFC0);
     perf_cntr_stop(PRFC1);
 
     perf_cntr_clear(PRFC0);
     perf_cntr_clear(PRFC1);
+#endif
 
     if(fp != NULL) {
         fclose(fp);
@@ -181,10 +965,45 @@ static void __attribute__ ((no_instrument_function)) cleanup(void) {
     }
 }
 
+/* --- Markers (profiler.h); never filtered or sampled --- */
+
+static void NO_INSTR mark(uint32_t kind, uint32_t value) {
+    if(fp == NULL)
+        return;
+    if(__unlikely(!tls_inited))
+        init_tls();
+    if(tls_trace == NULL)
+        return;
+    if(kind == MARK_REGION_BEGIN || kind == MARK_REGION_END)
+        record_region(tls_trace, kind, value);
+    else
+        record_marker(tls_trace, kind, value, 0);
+}
+
+void NO_INSTR profiler_frame(uint32_t frame) {
+    mark(MARK_FRAME, frame);
+}
+
+void NO_INSTR profiler_region_begin(const char *name) {
+    mark(MARK_REGION_BEGIN, (uint32_t)(uintptr_t)name);
+}
+
+void NO_INSTR profiler_region_end(const char *name) {
+    mark(MARK_REGION_END, (uint32_t)(uintptr_t)name);
+}
+
+void NO_INSTR profiler_scope_end(const char **name) {
+    mark(MARK_REGION_END, (uint32_t)(uintptr_t)*name);
+}
+
 void __attribute__ ((no_instrument_function, hot)) __cyg_profile_func_enter(void *this, void *callsite) {
     (void)callsite;
 
-    if(__unlikely(fp == NULL))
+    if(__unlikely(fp == NULL) || prof_mode == MODE_PC)
+        return;
+    if(!filter_pass(this))
+        return;
+    if(prof_mode == MODE_SAMPLE && !sample_enter())
         return;
 
     create_entry(this, ENTRY_FLAG);
@@ -193,14 +1012,23 @@ void __attribute__ ((no_instrument_function, hot)) __cyg_profile_func_enter(void
 void __attribute__ ((no_instrument_function, hot)) __cyg_profile_func_exit(void *this, void *callsite) {
     (void)callsite;
 
-    if(__unlikely(fp == NULL))
+    if(__unlikely(fp == NULL) || prof_mode == MODE_PC)
+        return;
+    if(!filter_pass(this))
+        return;
+    if(prof_mode == MODE_SAMPLE && !sample_exit())
         return;
 
     create_entry(this, EXIT_FLAG);
 }
 
 void __attribute__ ((no_instrument_function, constructor)) main_constructor(void) {
-    fp = fopen("/pc/trace.bin", "wb");
+    for(uint32_t i = 0; i < QUEUE_SIZE; ++i)
+        queue[i].seq = i;
+
+    load_config();
+
+    fp = fopen(TRACE_PATH, "wb");
     if(fp == NULL) {
         fprintf(stderr, "trace.bin file not opened\n");
         return;
@@ -208,13 +1036,26 @@ void __attribute__ ((no_instrument_function, constructor)) main_constructor(void
 
     fd = fileno(fp);
 
-    /* Cleanup at exit */
-    atexit(cleanup);
-
+#ifdef _arch_dreamcast
     /* Start performance counters */
     perf_cntr_timer_disable();
     perf_cntr_clear(PRFC0);
     perf_cntr_clear(PRFC1);
-    perf_cntr_start(PRFC0, PMCR_OPERAND_CACHE_MISS_MODE, PMCR_COUNT_CPU_CYCLES);
-    perf_cntr_start(PRFC1, PMCR_INSTRUCTION_CACHE_MISS_MODE, PMCR_COUNT_CPU_CYCLES);
+    perf_cntr_start(PRFC0, counter_mode[0], PMCR_COUNT_CPU_CYCLES);
+    perf_cntr_start(PRFC1, counter_mode[1], PMCR_COUNT_CPU_CYCLES);
+#endif
+
+    measure_overhead();
+    write_header();
+
+    flush_running = true;
+    prof_thread_start(flush_main);
+
+    /* Cleanup at exit */
+    atexit(cleanup);
+
+#ifdef _arch_dreamcast
+    if(prof_mode == MODE_PC)
+        pc_sampling_start();
+#endif
 }
@@ -1,18 +1,50 @@
 #pragma once
 
 /*
- * The Dreamcast doesn't have any kind of profiling support from GCC
- * so this is a cumbersome sampling profiler that runs in a background thread
+ * Markers for the -finstrument-functions profiler (profiler.c). They go into
+ * trace.bin next to the entry/exit records, on the calling thread's clock, so
+ * dctrace can cut a trace into video frames and named regions:
+ *
+ *   PROF_FRAME(n)               frame n starts here (and the previous one ends)
+ *   PROF_REGION_BEGIN("name")   open / close a named region; regions nest, and
+ *   PROF_REGION_END("name")     can cover code that isn't a function of its own
+ *   PROF_SCOPE("name")          a region from here to the end of the enclosing
+ *                               block, however the block is left
+ *
+ * Region names must be string literals: only the pointer is recorded and
+ * dctrace reads the string back out of the ELF. Region markers carry the
+ * PRFC0/PRFC1 counters as well, so building only the files of interest with
+ * -finstrument-functions (or none) still gives per-region event counts.
+ *
+ * The macros compile to nothing unless PROFILER is defined (-DPROFILER with
+ * profiler.o linked in, see readmeprofile.txt), so they can stay in the code.
  */
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void profiler_init(const char* output);
-void profiler_start();
-void profiler_stop();
-void profiler_clean_up();
+void profiler_frame(uint32_t frame);
+void profiler_region_begin(const char *name);
+void profiler_region_end(const char *name);
+void profiler_scope_end(const char **name);
 
 #ifdef __cplusplus
 }
 #endif
+
+#ifdef PROFILER
+#define PROF_FRAME(n)               profiler_frame(n)
+#define PROF_REGION_BEGIN(name)     profiler_region_begin(name)
+#define PROF_REGION_END(name)       profiler_region_end(name)
+#define PROF_SCOPE(name)            PROF_SCOPE_AT(name, __LINE__)
+#define PROF_SCOPE_AT(name, line)   PROF_SCOPE_VAR(name, line)     /* expands __LINE__ first */
+#define PROF_SCOPE_VAR(name, line) \
+    const char *prof_scope_##line __attribute__((cleanup(profiler_scope_end))) = (profiler_region_begin(name), name)
+#else
+#define PROF_FRAME(n)               ((void)0)
+#define PROF_REGION_BEGIN(name)     ((void)0)
+#define PROF_REGION_END(name)       ((void)0)
+#define PROF_SCOPE(name)            ((void)0)
+#endif
@@ -0,0 +1,115 @@
+/*
+ * tex_slots.h
+ * ---------------------
+ * Double-buffered frame upload for fmv_play, kept free of KOS calls so
+ * dcmv_uploadsim can run the same bookkeeping against a model of the DMA
+ * and the PVR.
+ *
+ * A slot is a RAM frame buffer plus the VRAM texture it gets uploaded to.
+ * The last scene drew the front slot; the other one is the back slot. Once
+ * the front texture holds its frame, the front buffer is free again.
+ *
+ * To present frame N the player
+ *   1. decodes it into the back buffer, unless it was decoded ahead,
+ *   2. starts an asynchronous DMA from the back buffer into the back texture
+ *      (last drawn by a scene before the front one, so already rendered),
+ *   3. decodes frame N+1 into the front buffer while the DMA runs,
+ *   4. waits for the DMA and draws the back slot, which becomes the front,
+ *      so N+1 is now in the back buffer.
+ * Decoding overlaps the upload, and a decoded-ahead frame is on screen
+ * max(upload, next decode) after it's due instead of decode + upload.
+ *
+ * Decoding never writes a buffer the DMA is reading and the DMA never writes
+ * a texture a scene is drawing, so there is no tearing. The tex_slots_*
+ * calls that would break either rule refuse with -1.
+ *
+ * Repeated frames (zero-length offset entries) redraw the front texture and
+ * skip steps 1-4. A frame decoded ahead that av_sync then drops is simply
+ * overwritten.
+ */
+
+#pragma once
+
+#define TEX_SLOTS 2
+
+enum {
+    TS_REDRAW,          // the front texture already holds the frame
+    TS_UPLOAD,          // the back buffer holds it (decoded ahead), upload it
+    TS_DECODE,          // decode into the back buffer, then upload
+};
+
+typedef struct {
+    int buf_frame[TEX_SLOTS];       // frame in each RAM buffer, -1 = none
+    int txr_frame[TEX_SLOTS];       // frame in each texture, -1 = none / being written
+    int front;                      // slot the last scene drew, -1 before the first
+    volatile int dma_slot;          // slot with a DMA in flight, -1 = none
+} tex_slots_t;
+
+static inline void tex_slots_init(tex_slots_t *ts) {
+    for (int i = 0; i < TEX_SLOTS; ++i)
+        ts->buf_frame[i] = ts->txr_frame[i] = -1;
+    ts->front = -1;
+    ts->dma_slot = -1;
+}
+
+static inline int tex_slots_back(const tex_slots_t *ts) {
+    return ts->front < 0 ? 0 : (ts->front + 1) % TEX_SLOTS;
+}
+
+/* A new clip numbers its frames from 0 again: forget what the slots hold, keep which one is on screen */
+static inline void tex_slots_forget(tex_slots_t *ts) {
+    for (int i = 0; i < TEX_SLOTS; ++i)
+        ts->buf_frame[i] = ts->txr_frame[i] = -1;
+}
+
+/* What presenting stored frame `frame` takes; *slot is the slot to decode into, upload and draw */
+static inline int tex_slots_present(const tex_slots_t *ts, int frame, int *slot) {
+    if (ts->front >= 0 && ts->txr_frame[ts->front] == frame) {
+        *slot = ts->front;
+        return TS_REDRAW;
+    }
+    *slot = tex_slots_back(ts);
+    return ts->buf_frame[*slot] == frame ? TS_UPLOAD : TS_DECODE;
+}
+
+/* Slot to decode the stored frame after the one about to be drawn from `slot` into, -1 if nothing to do */
+static inline int tex_slots_ahead(const tex_slots_t *ts, int slot, int frame) {
+    int target = (slot + 1) % TEX_SLOTS;
+    if (frame < 0 || ts->buf_frame[slot] == frame || ts->buf_frame[target] == frame)
+        return -1;
+    return target;
+}
+
+/* Record what a RAM buffer holds (-1 before decoding into it); -1 if the DMA is reading it */
+static inline int tex_slots_fill(tex_slots_t *ts, int slot, int frame) {
+    if (slot == ts->dma_slot)
+        return -1;
+    ts->buf_frame[slot] = frame;
+    return 0;
+}
+
+/* Before starting the DMA into a texture; -1 if it is on screen, a DMA is in flight or there's nothing to send */
+static inline int tex_slots_dma_start(tex_slots_t *ts, int slot) {
+    if (slot == ts->front || ts->dma_slot >= 0 || ts->buf_frame[slot] < 0)
+        return -1;
+    ts->txr_frame[slot] = -1;
+    ts->dma_slot = slot;
+    return 0;
+}
+
+/* From the DMA completion callback (interrupt context) */
+static inline void tex_slots_dma_done(tex_slots_t *ts) {
+    int slot = ts->dma_slot;
+    if (slot < 0)
+        return;
+    ts->txr_frame[slot] = ts->buf_frame[slot];
+    ts->dma_slot = -1;
+}
+
+/* The next scene draws `slot`; -1 if its texture isn't complete */
+static inline int tex_slots_flip(tex_slots_t *ts, int slot) {
+    if (slot == ts->dma_slot || ts->txr_frame[slot] < 0)
+        return -1;
+    ts->front = slot;
+    return 0;
+}